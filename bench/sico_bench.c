@@ -0,0 +1,653 @@
+#include <sico.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+// Measures the overhead SICO itself adds (compiles, transfers, dispatch) and writes one JSON object per line so
+// results can be collected and compared between releases. Usage: sico_bench [output.jsonl] [iteration scale]
+
+#define BENCH_KERNELS "bench/sico_bench.cl"
+#define BENCH_ADD_KERNEL "tests/add_values.cl"
+#define BENCH_MANDELBROT_KERNEL "examples/advanced/mandelbrot_fractal/mandelbrot_fractal.cl"
+#define BENCH_CACHE_DIR "sico_bench_cache"
+
+#define MANDELBROT_WIDTH 1280
+#define MANDELBROT_HEIGHT 720
+
+typedef struct BenchTiming
+{
+    int count;
+    double total;
+    double min;
+    double max;
+} BenchTiming;
+
+static FILE* s_output;
+static int s_scale = 1;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static double getTime()
+{
+#if defined(_WIN32)
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void timingAdd(BenchTiming* timing, double time)
+{
+    if (timing->count == 0 || time < timing->min)
+        timing->min = time;
+
+    if (timing->count == 0 || time > timing->max)
+        timing->max = time;
+
+    timing->total += time;
+    timing->count++;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// For batches where only the total time is known (min/max becomes the average)
+
+static void timingAddBatch(BenchTiming* timing, double time, int count)
+{
+    timing->min = timing->max = time / count;
+    timing->total += time;
+    timing->count += count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// bytes is the amount of data moved per iteration (0 if not a transfer)
+
+static void report(const char* name, size_t size, const BenchTiming* timing, size_t bytes)
+{
+    double mean;
+
+    if (timing->count == 0)
+        return;
+
+    mean = timing->total / timing->count;
+
+    fprintf(s_output, "{\"bench\": \"%s\", \"size\": %llu, \"iterations\": %d, \"mean_us\": %.3f, \"min_us\": %.3f, \"max_us\": %.3f",
+            name, (unsigned long long)size, timing->count, mean * 1e6, timing->min * 1e6, timing->max * 1e6);
+
+    if (bytes && mean > 0.0)
+        fprintf(s_output, ", \"gb_per_s\": %.3f", ((double)bytes / 1e9) / mean);
+
+    fprintf(s_output, "}\n");
+    fflush(s_output);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Cold compiles have the program cache disabled (the driver may still cache internally), warm ones hit the SICO
+// binary cache and registry compiles are scGetKernel lookups of an already built kernel
+
+static void benchCompile(SICODevice device)
+{
+    BenchTiming cold = { 0 }, warm = { 0 }, registry = { 0 };
+    SICOKernel kernel;
+    int i, count = 5 * s_scale;
+
+    scSetProgramCacheDir(0);
+
+    for (i = 0; i < count; ++i)
+    {
+        double startTime = getTime();
+
+        if (!(kernel = scCompileKernelFromSourceFile(device, BENCH_MANDELBROT_KERNEL, "kern", "")))
+            return;
+
+        timingAdd(&cold, getTime() - startTime);
+        scReleaseKernel(kernel);
+    }
+
+    scSetProgramCacheDir(BENCH_CACHE_DIR);
+
+    // populate the cache
+
+    if ((kernel = scCompileKernelFromSourceFile(device, BENCH_MANDELBROT_KERNEL, "kern", "")))
+        scReleaseKernel(kernel);
+
+    for (i = 0; i < count; ++i)
+    {
+        double startTime = getTime();
+
+        if (!(kernel = scCompileKernelFromSourceFile(device, BENCH_MANDELBROT_KERNEL, "kern", "")))
+            break;
+
+        timingAdd(&warm, getTime() - startTime);
+        scReleaseKernel(kernel);
+    }
+
+    scSetProgramCacheDir(0);
+
+    scGetKernel(device, BENCH_MANDELBROT_KERNEL, "kern", "");
+
+    for (i = 0; i < count * 100; ++i)
+    {
+        double startTime = getTime();
+        scGetKernel(device, BENCH_MANDELBROT_KERNEL, "kern", "");
+        timingAdd(&registry, getTime() - startTime);
+    }
+
+    report("compile_cold", 0, &cold, 0);
+    report("compile_warm", 0, &warm, 0);
+    report("compile_registry", 0, &registry, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// A batch of different specializations built one by one on this thread vs with the async compile pool. Every build
+// uses new defines so neither the registry nor the driver cache can be hit.
+
+#define BENCH_COMPILE_BATCH 8
+
+static void benchCompileBatch(SICODevice device)
+{
+    BenchTiming serial = { 0 }, async = { 0 };
+    SICOCompileJob jobs[BENCH_COMPILE_BATCH];
+    SICOKernel kernels[BENCH_COMPILE_BATCH];
+    char options[64];
+    int i, j, width = 100, count = 2 * s_scale;
+
+    for (i = 0; i < count; ++i)
+    {
+        double startTime = getTime();
+
+        for (j = 0; j < BENCH_COMPILE_BATCH; ++j)
+        {
+            snprintf(options, sizeof(options), "-D WIDTH=%d", width++);
+            kernels[j] = scGetKernel(device, BENCH_MANDELBROT_KERNEL, "kern", options);
+        }
+
+        timingAdd(&serial, getTime() - startTime);
+
+        for (j = 0; j < BENCH_COMPILE_BATCH; ++j)
+        {
+            if (kernels[j])
+                scEvictKernel(kernels[j]);
+        }
+
+        startTime = getTime();
+
+        for (j = 0; j < BENCH_COMPILE_BATCH; ++j)
+        {
+            snprintf(options, sizeof(options), "-D WIDTH=%d", width++);
+            jobs[j] = scCompileKernelAsync(device, BENCH_MANDELBROT_KERNEL, "kern", options);
+        }
+
+        for (j = 0; j < BENCH_COMPILE_BATCH; ++j)
+        {
+            kernels[j] = scCompileJobWait(jobs[j]);
+            scReleaseCompileJob(jobs[j]);
+        }
+
+        timingAdd(&async, getTime() - startTime);
+
+        for (j = 0; j < BENCH_COMPILE_BATCH; ++j)
+        {
+            if (kernels[j])
+                scEvictKernel(kernels[j]);
+        }
+    }
+
+    report("compile_batch_serial", BENCH_COMPILE_BATCH, &serial, 0);
+    report("compile_batch_async", BENCH_COMPILE_BATCH, &async, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Upload with scSetupParameters and read back with scWriteMemoryParams
+
+static void benchTransfer(SICODevice device, SICOCommanQueue queue)
+{
+    SICOKernel kernel;
+    size_t size;
+
+    if (!(kernel = scGetKernel(device, BENCH_KERNELS, "touch", "")))
+        return;
+
+    for (size = 4 * 1024; size <= 64 * 1024 * 1024; size *= 4)
+    {
+        BenchTiming timing = { 0 };
+        float* data = (float*)scAllocHostAligned(size);
+        int i, count = (size >= 16 * 1024 * 1024 ? 5 : 20) * s_scale;
+
+        memset(data, 0, size);
+
+        for (i = 0; i < count + 1; ++i)
+        {
+            SICOParam params[] =
+            {
+                { (uintptr_t)data, SICO_MEM_READ_WRITE, SICO_AutoAllocate, size, 0 },
+            };
+
+            double startTime = getTime();
+
+            scSetupParameters(device, kernel, queue, params, SICO_SIZEOF_ARRAY(params));
+            scWriteMemoryParams(device, queue, params, SICO_SIZEOF_ARRAY(params));
+            scCommandQueueFinish(queue);
+
+            // first iteration warms up the buffer pool
+
+            if (i != 0)
+                timingAdd(&timing, getTime() - startTime);
+
+            scFreeParams(params, SICO_SIZEOF_ARRAY(params));
+        }
+
+        report("transfer_roundtrip", size, &timing, size * 2);
+
+        scFreeHostAligned(data);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Measures both the cost of queuing a launch (many launches, one finish) and the full round trip of a launch
+
+static void benchDispatch(SICODevice device, SICOCommanQueue queue)
+{
+    BenchTiming enqueue1D = { 0 }, roundTrip1D = { 0 }, enqueue2D = { 0 }, enqueueLaunch = { 0 };
+    SICOKernel kernel;
+    SICOLaunch launch;
+    size_t launchSize = 64;
+    float value = 1.0f;
+    int i, count = 1000 * s_scale;
+    double startTime;
+
+    SICOParam params[] =
+    {
+        { (uintptr_t)&value, SICO_PARAMETER, 0, sizeof(float), 0 },
+    };
+
+    if (!(kernel = scGetKernel(device, BENCH_KERNELS, "empty", "")))
+        return;
+
+    scSetupParameters(device, kernel, queue, params, SICO_SIZEOF_ARRAY(params));
+
+    startTime = getTime();
+
+    for (i = 0; i < count; ++i)
+        scAddKernel1D(queue, kernel, 64);
+
+    scCommandQueueFinish(queue);
+    timingAddBatch(&enqueue1D, getTime() - startTime, count);
+
+    for (i = 0; i < count; ++i)
+    {
+        startTime = getTime();
+        scAddKernel1D(queue, kernel, 64);
+        scCommandQueueFinish(queue);
+        timingAdd(&roundTrip1D, getTime() - startTime);
+    }
+
+    startTime = getTime();
+
+    for (i = 0; i < count; ++i)
+        scAddKernel2D(queue, device, kernel, 8, 8, params, SICO_SIZEOF_ARRAY(params));
+
+    scCommandQueueFinish(queue);
+    timingAddBatch(&enqueue2D, getTime() - startTime, count);
+
+    // launch object where the scalar changes every dispatch
+
+    if ((launch = scCreateLaunch(device, kernel, params, SICO_SIZEOF_ARRAY(params))))
+    {
+        startTime = getTime();
+
+        for (i = 0; i < count; ++i)
+        {
+            value = (float)i;
+            scLaunchDispatch(launch, queue, 1, &launchSize, 0);
+        }
+
+        scCommandQueueFinish(queue);
+        timingAddBatch(&enqueueLaunch, getTime() - startTime, count);
+
+        scDestroyLaunch(launch);
+    }
+
+    report("dispatch_1d", 64, &enqueue1D, 0);
+    report("dispatch_1d_roundtrip", 64, &roundTrip1D, 0);
+    report("dispatch_2d", 64, &enqueue2D, 0);
+    report("dispatch_launch", 64, &enqueueLaunch, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void benchRunSimple()
+{
+    // includes awkward sizes next to power of two ones to compare per-element throughput
+
+    static const size_t counts[] = { 1024, 16 * 1024, 256 * 1024, 1000003, 1024 * 1024, 4 * 1024 * 1024 };
+
+    for (int c = 0; c < SICO_SIZEOF_ARRAY(counts); ++c)
+    {
+        size_t count = counts[c];
+        BenchTiming timing = { 0 };
+        size_t dataSize = sizeof(float) * count;
+        float* inputData = (float*)malloc(dataSize);
+        float* inputData2 = (float*)malloc(dataSize);
+        float* dataRes = (float*)malloc(dataSize);
+        size_t i;
+        int run;
+
+        for (i = 0; i < count; ++i)
+        {
+            inputData[i] = (float)i;
+            inputData2[i] = 1.0f;
+        }
+
+        for (run = 0; run < 10 * s_scale + 1; ++run)
+        {
+            double startTime = getTime();
+
+            if (scRunKernel1DArraySimple(dataRes, inputData, inputData2, BENCH_ADD_KERNEL, count, dataSize) != SICO_Ok)
+                break;
+
+            // first run includes the compile
+
+            if (run != 0)
+                timingAdd(&timing, getTime() - startTime);
+        }
+
+        report("run_simple_1d", count, &timing, dataSize * 3);
+
+        free(inputData);
+        free(inputData2);
+        free(dataRes);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void benchMandelbrot(SICODevice device, SICOCommanQueue queue)
+{
+    BenchTiming timing = { 0 };
+    SICOKernel kernel;
+    float time = 0.0f;
+    int frame, count = 20 * s_scale;
+    size_t size = MANDELBROT_WIDTH * MANDELBROT_HEIGHT * sizeof(unsigned int);
+    unsigned int* buffer = (unsigned int*)malloc(size);
+
+    if (!(kernel = scGetKernel(device, BENCH_MANDELBROT_KERNEL, "kern", "")))
+    {
+        free(buffer);
+        return;
+    }
+
+    for (frame = 0; frame < count; ++frame)
+    {
+        SICOParam params[] =
+        {
+            { (uintptr_t)buffer, SICO_MEM_READ_WRITE, SICO_AutoAllocate, size, 0 },
+            { (uintptr_t)&time, SICO_PARAMETER, 0, sizeof(float), 0 },
+        };
+
+        double startTime = getTime();
+
+        scAddKernel2D(queue, device, kernel, MANDELBROT_WIDTH, MANDELBROT_HEIGHT, params, SICO_SIZEOF_ARRAY(params));
+        scWriteMemoryParams(device, queue, params, SICO_SIZEOF_ARRAY(params));
+        scCommandQueueFinish(queue);
+        scFreeParams(params, SICO_SIZEOF_ARRAY(params));
+
+        timingAdd(&timing, getTime() - startTime);
+
+        time += 0.01f;
+    }
+
+    report("mandelbrot_frame", MANDELBROT_WIDTH * MANDELBROT_HEIGHT, &timing, size);
+
+    free(buffer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Built-in primitives on device buffers. The first run of each includes building the primitives so it's skipped.
+
+static void benchPrimitives(SICODevice device, SICOCommanQueue queue)
+{
+    static const size_t counts[] = { 1024 * 1024, 16 * 1024 * 1024 };
+
+    for (int c = 0; c < SICO_SIZEOF_ARRAY(counts); ++c)
+    {
+        BenchTiming reduce = { 0 }, scan = { 0 }, sort = { 0 }, histogram = { 0 };
+        size_t count = counts[c];
+        size_t dataSize = count * sizeof(unsigned int);
+        unsigned int* data = (unsigned int*)malloc(dataSize);
+        unsigned int seed = 1;
+        SICOHandle input, output, bins;
+        SICOEvent event;
+        int i, runs = 5 * s_scale;
+
+        for (size_t e = 0; e < count; ++e)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            data[e] = seed;
+        }
+
+        input = scAllocSyncCopy(device, data, dataSize);
+        output = scAlloc(device, SICO_MEM_READ_WRITE, dataSize, 0);
+        bins = scAlloc(device, SICO_MEM_READ_WRITE, 256 * sizeof(unsigned int), 0);
+
+        for (i = 0; i < runs + 1 && input && output && bins; ++i)
+        {
+            double startTime = getTime();
+            scReduce(queue, SICO_UInt32, SICO_ReduceSum, input, count, output);
+            scCommandQueueFinish(queue);
+
+            if (i > 0)
+                timingAdd(&reduce, getTime() - startTime);
+
+            startTime = getTime();
+            scScan(queue, SICO_UInt32, input, output, count, 0);
+            scCommandQueueFinish(queue);
+
+            if (i > 0)
+                timingAdd(&scan, getTime() - startTime);
+
+            // sort a copy so every run sorts the same unsorted data
+
+            event = scAsyncCopyToDevice(queue, output, 0, data, dataSize, 0, 0);
+            scWaitEvents(&event, 1);
+            scReleaseEvent(event);
+
+            startTime = getTime();
+            scSortKeys(queue, output, count);
+            scCommandQueueFinish(queue);
+
+            if (i > 0)
+                timingAdd(&sort, getTime() - startTime);
+
+            startTime = getTime();
+            scHistogram(queue, output, count, bins, 256);
+            scCommandQueueFinish(queue);
+
+            if (i > 0)
+                timingAdd(&histogram, getTime() - startTime);
+        }
+
+        report("primitive_reduce", count, &reduce, dataSize);
+        report("primitive_scan", count, &scan, dataSize * 2);
+        report("primitive_sort_keys", count, &sort, dataSize);
+        report("primitive_histogram", count, &histogram, dataSize);
+
+        if (input)
+            scFree(input);
+
+        if (output)
+            scFree(output);
+
+        if (bins)
+            scFree(bins);
+
+        free(data);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// sqrt(a * 2 + b) as one fused kernel compared to one kernel per operation with temporaries in between
+
+static void benchExpr(SICODevice device, SICOCommanQueue queue)
+{
+    size_t count = 16 * 1024 * 1024;
+    size_t dataSize = count * sizeof(float);
+    BenchTiming fused = { 0 }, separate = { 0 };
+    SICOHandle a, b, temp, output;
+    SICOExprGraph graph = scExprCreate();
+    SICOExpr x, y, result, mul, add, root;
+    int i, runs = 5 * s_scale;
+
+    a = scAlloc(device, SICO_MEM_READ_WRITE, dataSize, 0);
+    b = scAlloc(device, SICO_MEM_READ_WRITE, dataSize, 0);
+    temp = scAlloc(device, SICO_MEM_READ_WRITE, dataSize, 0);
+    output = scAlloc(device, SICO_MEM_READ_WRITE, dataSize, 0);
+
+    if (!a || !b || !temp || !output)
+        runs = -1;
+
+    x = scExprInput(graph, a);
+    y = scExprInput(graph, b);
+    result = scExprUnary(graph, SICO_ExprSqrt, scExprFma(graph, x, scExprConst(graph, 2.0f), y));
+
+    // unfused version, one operation per run
+
+    mul = scExprBinary(graph, SICO_ExprMul, x, scExprConst(graph, 2.0f));
+    add = scExprBinary(graph, SICO_ExprAdd, scExprInput(graph, temp), y);
+    root = scExprUnary(graph, SICO_ExprSqrt, scExprInput(graph, output));
+
+    for (i = 0; i < runs + 1; ++i)
+    {
+        double startTime = getTime();
+        scExprRun(queue, graph, result, output, count);
+        scCommandQueueFinish(queue);
+
+        if (i > 0)
+            timingAdd(&fused, getTime() - startTime);
+
+        startTime = getTime();
+        scExprRun(queue, graph, mul, temp, count);
+        scExprRun(queue, graph, add, output, count);
+        scExprRun(queue, graph, root, temp, count);
+        scCommandQueueFinish(queue);
+
+        if (i > 0)
+            timingAdd(&separate, getTime() - startTime);
+    }
+
+    report("expr_fused", count, &fused, dataSize * 3);
+    report("expr_separate", count, &separate, dataSize * 9);
+
+    scExprDestroy(graph);
+
+    if (a)
+        scFree(a);
+
+    if (b)
+        scFree(b);
+
+    if (temp)
+        scFree(temp);
+
+    if (output)
+        scFree(output);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Many small per-request arrays, allocated with clCreateBuffer each vs from a bump arena that is reset per frame
+
+#define BENCH_ALLOC_COUNT 1000
+#define BENCH_ALLOC_SIZE 4096
+
+static void benchAlloc(SICODevice device)
+{
+    BenchTiming buffers = { 0 }, arenaTiming = { 0 };
+    SICOHandle handles[BENCH_ALLOC_COUNT];
+    SICOArena arena;
+    int i, j, count = 10 * s_scale;
+
+    if (!(arena = scCreateArena(device, SICO_MEM_READ_WRITE, 2 * BENCH_ALLOC_COUNT * BENCH_ALLOC_SIZE, SICO_ArenaBump)))
+        return;
+
+    for (i = 0; i < count; ++i)
+    {
+        double startTime = getTime();
+
+        for (j = 0; j < BENCH_ALLOC_COUNT; ++j)
+            handles[j] = scAlloc(device, SICO_MEM_READ_WRITE, BENCH_ALLOC_SIZE, 0);
+
+        for (j = 0; j < BENCH_ALLOC_COUNT; ++j)
+            scFree(handles[j]);
+
+        timingAddBatch(&buffers, getTime() - startTime, BENCH_ALLOC_COUNT);
+
+        startTime = getTime();
+
+        for (j = 0; j < BENCH_ALLOC_COUNT; ++j)
+            handles[j] = scArenaAlloc(arena, BENCH_ALLOC_SIZE);
+
+        scArenaReset(arena);
+
+        timingAddBatch(&arenaTiming, getTime() - startTime, BENCH_ALLOC_COUNT);
+    }
+
+    scDestroyArena(arena);
+
+    report("alloc_buffer", BENCH_ALLOC_SIZE, &buffers, 0);
+    report("alloc_arena", BENCH_ALLOC_SIZE, &arenaTiming, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    SICODevice device;
+    SICOCommanQueue queue;
+
+    s_output = stdout;
+
+    if (argc > 1 && !(s_output = fopen(argv[1], "w")))
+    {
+        printf("Unable to open %s for writing\n", argv[1]);
+        return 1;
+    }
+
+    if (argc > 2 && (s_scale = atoi(argv[2])) < 1)
+        s_scale = 1;
+
+    if (!scInitialize() || !(device = scGetBestDevice()))
+    {
+        printf("Unable to get OpenCL device\n");
+        return 1;
+    }
+
+    queue = scGetDeviceQueue(device);
+
+    benchCompile(device);
+    benchCompileBatch(device);
+    benchTransfer(device, queue);
+    benchDispatch(device, queue);
+    benchRunSimple();
+    benchMandelbrot(device, queue);
+    benchPrimitives(device, queue);
+    benchExpr(device, queue);
+    benchAlloc(device);
+
+    scClose();
+
+    if (s_output != stdout)
+        fclose(s_output);
+
+    return 0;
+}
@@ -0,0 +1,12 @@
+// Kernels used by sico_bench to measure SICO overhead. They intentionally do (almost) no work.
+
+__kernel void touch(global float* data)
+{
+    size_t i = get_global_id(0);
+    data[i] = data[i] + 1.0f;
+}
+
+__kernel void empty(float value)
+{
+    (void)value;
+}
@@ -2,6 +2,8 @@
 
 #include <sico.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -11,53 +13,239 @@ static void printHeader()
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Joins all arguments after input/output into one string that is passed as build options
 
-static void writeOutput(const char* filename)
+static void getBuildOptions(char* output, size_t size, int first, int argc, const char** argv)
 {
+    output[0] = 0;
+
+    for (int i = first; i < argc; ++i)
+    {
+        if (strlen(output) + strlen(argv[i]) + 2 >= size)
+            break;
+
+        if (output[0])
+            strcat(output, " ");
+
+        strcat(output, argv[i]);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Symbol name for embedded data, "examples/foo/my-kernel.cl" gives "my_kernel_cl"
+
+static void getSymbolName(char* output, size_t size, const char* filename)
+{
+    const char* name = filename;
+    size_t len = 0;
+
+    for (const char* c = filename; *c; ++c)
+    {
+        if (*c == '/' || *c == '\\')
+            name = c + 1;
+    }
+
+    if (*name >= '0' && *name <= '9' && len < size - 1)
+        output[len++] = '_';
+
+    for (; *name && len < size - 1; ++name)
+    {
+        char c = *name;
+        int valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+        output[len++] = valid ? c : '_';
+    }
+
+    output[len] = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static unsigned char* readFile(const char* filename, size_t* size)
+{
+    unsigned char* data;
+    long fileSize;
     FILE* f;
 
-    if (filename[0] == 0)
-        return;
+    if (!(f = fopen(filename, "rb")))
+    {
+        printf("SICOC: Unable to open %s\n", filename);
+        return 0;
+    }
+
+    fseek(f, 0, SEEK_END);
+    fileSize = ftell(f);
+    fseek(f, 0, SEEK_SET);
 
-    remove(filename);
+    data = malloc((size_t)fileSize + 1);
 
-    f = fopen(filename, "w");
-    if (f)
+    if (fileSize < 0 || fread(data, 1, (size_t)fileSize, f) != (size_t)fileSize)
+    {
+        printf("SICOC: Unable to read %s\n", filename);
+        free(data);
         fclose(f);
-    else
-        printf("SICOC: Unable to open %s for write\n", filename);
+        return 0;
+    }
+
+    fclose(f);
+
+    *size = (size_t)fileSize;
+
+    return data;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Writes data as a C array so it can be compiled into the executable. Data is null terminated (not included in the
+// size) so embedded source can be used as a regular string.
 
-int main(int argc, const char** argv)
+static int writeEmbedded(const char* filename, const char* inputName, const unsigned char* data, size_t size)
 {
-    struct SICODevice* device;
+    char symbol[256];
+    FILE* f;
+    int ok;
 
-    if (!scInitialize())
+    getSymbolName(symbol, sizeof(symbol), inputName);
+
+    if (!(f = fopen(filename, "w")))
     {
-        printf("Unable to init OpenCL\n");
+        printf("SICOC: Unable to open %s for write\n", filename);
         return 0;
     }
 
-    printHeader();
+    fprintf(f, "// Generated by sicoc from %s, do not edit\n\n", inputName);
+    fprintf(f, "#include <stddef.h>\n\n");
+    fprintf(f, "const size_t %s_size = %lu;\n\n", symbol, (unsigned long)size);
+    fprintf(f, "const unsigned char %s[] =\n{", symbol);
 
-    if (argc < 3)
+    for (size_t i = 0; i <= size; ++i)
     {
-        printf("Usage: sicoc <input.cl> output\n");
-        return 0;
+        if ((i & 15) == 0)
+            fprintf(f, "\n    ");
+
+        fprintf(f, "0x%02x,", i < size ? data[i] : 0);
     }
 
-    if (!(device = scGetBestDevice()))
+    fprintf(f, "\n};\n");
+
+    ok = !ferror(f);
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok)
+    {
+        printf("SICOC: Unable to write %s\n", filename);
+        remove(filename);
+    }
+
+    return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Builds the binary container to a temporary file and embeds that
+
+static int embedBinary(SICODevice* devices, int deviceCount, const char* input, const char* output, const char* buildOpts)
+{
+    char tempName[1024];
+    unsigned char* data;
+    size_t size = 0;
+    int ok;
+
+    snprintf(tempName, sizeof(tempName), "%s.scb", output);
+
+    if (scCompileToBinaryFile(devices, deviceCount, input, tempName, buildOpts) != SICO_Ok)
         return 0;
 
-    if (!scCompileFromFile(device, argv[1], 0))
+    if (!(data = readFile(tempName, &size)))
         return 0;
 
-    writeOutput(argv[2]);
+    remove(tempName);
+
+    ok = writeEmbedded(output, input, data, size);
+
+    free(data);
+
+    return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, const char** argv)
+{
+    enum { ModeBinary, ModeEmbedSource, ModeEmbedBinary } mode = ModeBinary;
+    char buildOpts[2048];
+    SICODevice* devices;
+    int deviceCount = 0;
+    int first = 1;
+
+    if (argc > 1 && !strcmp(argv[1], "--embed-source"))
+    {
+        mode = ModeEmbedSource;
+        first++;
+    }
+    else if (argc > 1 && !strcmp(argv[1], "--embed-binary"))
+    {
+        mode = ModeEmbedBinary;
+        first++;
+    }
+
+    printHeader();
+
+    if (argc < first + 2)
+    {
+        printf("Usage: sicoc [--embed-source | --embed-binary] <input.cl> output [build options]\n");
+        printf("  --embed-source  Write the source as a C array (no OpenCL needed)\n");
+        printf("  --embed-binary  Write the program binary container as a C array\n");
+        return 1;
+    }
+
+    // Embedding source doesn't compile anything so it works on machines without OpenCL devices
+
+    if (mode == ModeEmbedSource)
+    {
+        unsigned char* data;
+        size_t size = 0;
+        int ok;
+
+        if (!(data = readFile(argv[first], &size)))
+            return 1;
+
+        ok = writeEmbedded(argv[first + 1], argv[first], data, size);
+        free(data);
+
+        return ok ? 0 : 1;
+    }
+
+    if (!scInitialize())
+    {
+        printf("Unable to init OpenCL\n");
+        return 1;
+    }
+
+    // Build a binary for every device in the system so the output can be loaded on any of them
+
+    if (!(devices = scGetAllDevices(&deviceCount)) || deviceCount == 0)
+    {
+        printf("SICOC: No OpenCL devices found\n");
+        return 1;
+    }
+
+    getBuildOptions(buildOpts, sizeof(buildOpts), first + 2, argc, argv);
+
+    if (mode == ModeEmbedBinary)
+    {
+        if (!embedBinary(devices, deviceCount, argv[first], argv[first + 1], buildOpts))
+        {
+            printf("SICOC: Unable to embed %s to %s\n", argv[first], argv[first + 1]);
+            scClose();
+            return 1;
+        }
+    }
+    else if (scCompileToBinaryFile(devices, deviceCount, argv[first], argv[first + 1], buildOpts) != SICO_Ok)
+    {
+        printf("SICOC: Unable to compile %s to %s\n", argv[first], argv[first + 1]);
+        scClose();
+        return 1;
+    }
 
     scClose();
 
     return 0;
 }
-
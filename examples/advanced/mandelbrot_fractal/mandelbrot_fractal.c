@@ -5,8 +5,15 @@
 
 #define WIDTH 1280
 #define HEIGHT 720
+#define STR2(x) #x
+#define STR(x) STR2(x)
 static unsigned int s_buffer[WIDTH * HEIGHT];
 
+// Kernel source embedded by the OpenCLEmbedSource build rule
+
+extern const unsigned char mandelbrot_fractal_cl[];
+extern const size_t mandelbrot_fractal_cl_size;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 int main()
@@ -14,6 +21,16 @@ int main()
     SICODevice device;
     SICOKernel kernel;
     SICOCommanQueue queue;
+    SICOLaunch launch;
+    char buildOpts[256];
+
+    // The kernel is specialized for the window size so it's constant folded
+
+    static const SICODefine defines[] =
+    {
+        { "WIDTH", STR(WIDTH) },
+        { "HEIGHT", STR(HEIGHT) },
+    };
 
     scInitialize();
 
@@ -23,7 +40,10 @@ int main()
         return 0;
     }
 
-    if (!(kernel = scCompileKernelFromSourceFile(device, "examples/advanced/mandelbrot_fractal/mandelbrot_fractal.cl", "kern", "")))
+    if (scSpecializeOptions(buildOpts, sizeof(buildOpts), "-cl-fast-relaxed-math", defines, 2) != SICO_Ok)
+        return 0;
+
+    if (!(kernel = scCompileKernelFromSource(device, (const char*)mandelbrot_fractal_cl, mandelbrot_fractal_cl_size, "kern", buildOpts)))
         return 0;
 
     if (!mfb_open("SICO - OpenCL - Mandelbrot Fractal - Press ESC to Exit", WIDTH, HEIGHT))
@@ -32,18 +52,23 @@ int main()
     queue = scCreateCommandQueue(device);
 
     float time = 0.0f;
+    size_t sizes[] = { WIDTH, HEIGHT };
 
-    for (;;)
+    SICOParam params[] =
     {
-        SICOParam params[] =
-        {
-            { (uintptr_t)s_buffer, SICO_MEM_READ_WRITE, SICO_AutoAllocate, WIDTH * HEIGHT * sizeof(unsigned int), 0 },
-            { (uintptr_t)&time, SICO_PARAMETER, 0, sizeof(float), 0 },
-        };
+        { (uintptr_t)s_buffer, SICO_MEM_READ_WRITE, SICO_AutoAllocate, WIDTH * HEIGHT * sizeof(unsigned int), 0 },
+        { (uintptr_t)&time, SICO_PARAMETER, 0, sizeof(float), 0 },
+    };
+
+    // The launch keeps the output buffer between frames and only updates the time argument when it changes
+
+    if (!(launch = scCreateLaunch(device, kernel, params, SICO_SIZEOF_ARRAY(params))))
+        return 0;
 
-        scAddKernel2D(queue, device, kernel, WIDTH, HEIGHT, params, SICO_SIZEOF_ARRAY(params));
-        scCommandQueueFinish(queue);
-        scFreeParams(params, SICO_SIZEOF_ARRAY(params)); // TODO: Get rid of this call.. a bit tricky though (only needed with autoallocate)
+    for (;;)
+    {
+        scLaunchDispatch(launch, queue, 2, sizes, 0);
+        scLaunchReadBack(launch, queue);
 
         int state = mfb_update(s_buffer);
 
@@ -53,6 +78,7 @@ int main()
             break;
     }
 
+    scDestroyLaunch(launch);
     scDestroyCommandQueue(queue);
     scClose();
 
@@ -16,15 +16,25 @@
 //
 // More info here: http://www.iquilezles.org/www/articles/distancefractals/distancefractals.htm
 
+// Output size, normally given as build options (-D WIDTH=... -D HEIGHT=...) so the kernel is specialized per size
+
+#ifndef WIDTH
+#define WIDTH 1280
+#endif
+
+#ifndef HEIGHT
+#define HEIGHT 720
+#endif
+
 __kernel void kern(global int* output, float time)
 {
     int x = get_global_id(0);
     int y = get_global_id(1);
 
     float2 p;
-    p.x = -1.0f + 2.0f * (x / 1280.0f);
-    p.y = -1.0f + 2.0f * (y / 720.0f);
-    p.x *= 1280.0f/720.0f;
+    p.x = -1.0f + 2.0f * (x / (float)WIDTH);
+    p.y = -1.0f + 2.0f * (y / (float)HEIGHT);
+    p.x *= (float)WIDTH / (float)HEIGHT;
 
     // animation	
     float tz = 0.5f - 0.5f * cos(0.225f * time);
@@ -60,5 +70,5 @@ __kernel void kern(global int* output, float time)
 
     int t = clamp(d, 0.0f, 1.0f) * 255.0f;
 
-    output[(y * 1280) + x] = (t << 16) | (t << 8) | t;
+    output[(y * WIDTH) + x] = (t << 16) | (t << 8) | t;
 }
@@ -1,10 +1,22 @@
 
 #include "sico.h"
+#include "sico_primitives.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <direct.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -39,10 +51,287 @@ static void sico_log_internal(const char* format, ...)
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+#if defined(_WIN32)
+typedef SRWLOCK SICOMutex;
+#define SICO_MUTEX_INIT SRWLOCK_INIT
+#else
+typedef pthread_mutex_t SICOMutex;
+#define SICO_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void mutexInit(SICOMutex* mutex)
+{
+#if defined(_WIN32)
+    InitializeSRWLock(mutex);
+#else
+    pthread_mutex_init(mutex, 0);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void mutexDestroy(SICOMutex* mutex)
+{
+#if defined(_WIN32)
+    (void)mutex;
+#else
+    pthread_mutex_destroy(mutex);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void mutexLock(SICOMutex* mutex)
+{
+#if defined(_WIN32)
+    AcquireSRWLockExclusive(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void mutexUnlock(SICOMutex* mutex)
+{
+#if defined(_WIN32)
+    ReleaseSRWLockExclusive(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined(_WIN32)
+typedef CONDITION_VARIABLE SICOCondition;
+#define SICO_CONDITION_INIT CONDITION_VARIABLE_INIT
+#else
+typedef pthread_cond_t SICOCondition;
+#define SICO_CONDITION_INIT PTHREAD_COND_INITIALIZER
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void conditionWait(SICOCondition* condition, SICOMutex* mutex)
+{
+#if defined(_WIN32)
+    SleepConditionVariableSRW(condition, mutex, INFINITE, 0);
+#else
+    pthread_cond_wait(condition, mutex);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void conditionBroadcast(SICOCondition* condition)
+{
+#if defined(_WIN32)
+    WakeAllConditionVariable(condition);
+#else
+    pthread_cond_broadcast(condition);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Flags used to publish state that is written once (under a lock) and then read without locking
+
+static int loadAcquire(volatile int* value)
+{
+#if defined(_WIN32)
+    int result = *value;
+    MemoryBarrier();
+    return result;
+#else
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void storeRelease(volatile int* value, int newValue)
+{
+#if defined(_WIN32)
+    MemoryBarrier();
+    *value = newValue;
+#else
+    __atomic_store_n(value, newValue, __ATOMIC_RELEASE);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Thread local storage, the key is created once in scInitialize and kept for the lifetime of the process. Fiber local
+// storage is used on Windows as it's the only way to get a callback when a thread exits. threadExit is called with
+// the value of a thread that exits while it still has one set.
+
+#if defined(_WIN32)
+static DWORD s_threadKey = FLS_OUT_OF_INDEXES;
+#else
+static pthread_key_t s_threadKey;
+#endif
+static int s_threadKeyValid = 0;
+
+static void threadExit(void* value);
+
+#if defined(_WIN32)
+static VOID WINAPI threadExitCallback(PVOID value)
+{
+    if (value)
+        threadExit(value);
+}
+#endif
+
+static void createThreadKey()
+{
+    if (s_threadKeyValid)
+        return;
+
+#if defined(_WIN32)
+    s_threadKeyValid = (s_threadKey = FlsAlloc(threadExitCallback)) != FLS_OUT_OF_INDEXES;
+#else
+    s_threadKeyValid = pthread_key_create(&s_threadKey, threadExit) == 0;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void* getThreadValue()
+{
+#if defined(_WIN32)
+    return FlsGetValue(s_threadKey);
+#else
+    return pthread_getspecific(s_threadKey);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void setThreadValue(void* value)
+{
+#if defined(_WIN32)
+    FlsSetValue(s_threadKey, value);
+#else
+    pthread_setspecific(s_threadKey, value);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Monotonic time in seconds
+
+static double getTime()
+{
+#if defined(_WIN32)
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int getCpuCount()
+{
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void threadYield()
+{
+#if defined(_WIN32)
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Initialization and device enumeration happens once under s_initMutex. After that the device list is
+// read only so lookups don't need to lock (s_initialized and s_devicesReady are used to publish it)
+
+static SICOMutex s_initMutex = SICO_MUTEX_INIT;
+static volatile int s_initialized = 0;
+static volatile int s_devicesReady = 0;
 static cl_platform_id s_platformId = 0;
 static struct SICODevice** s_devices = 0;
 static int s_deviceCount = 0;
 
+// devices split up by type (see SICODeviceCategory) and the best category, setup when the devices are fetched
+
+enum SICODeviceCategory
+{
+    SICO_CategoryCPU,
+    SICO_CategoryGPU,
+    SICO_CategoryOther,
+    SICO_CategoryCount,
+};
+
+static struct SICODevice** s_categoryDevices[SICO_CategoryCount];
+static int s_categoryDeviceCounts[SICO_CategoryCount];
+static int s_bestCategory = 0;
+
+static char s_programCacheDir[1024];
+static SICOProgramCacheStats s_programCacheStats;
+static SICOMutex s_programCacheStatsMutex = SICO_MUTEX_INIT; // programs can be built on several threads at once
+static SICODevicePolicy s_devicePolicy = SICO_DevicePolicyDefault; // see scSetDevicePolicy
+static int s_devicePolicyIndex = 0;
+static int s_deviceBenchmark = 0; // see scSetDeviceBenchmark
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Buffers are pooled in size classes with 4 classes per power of two (so at most 25% waste) starting at 256 bytes
+
+#define SICO_POOL_MIN_SHIFT 8
+#define SICO_POOL_CLASS_COUNT (4 * (64 - SICO_POOL_MIN_SHIFT))
+#define SICO_POOL_DEFAULT_LIMIT (256 * 1024 * 1024)
+
+typedef struct SICOBufferList
+{
+    cl_mem* buffers;
+    int count;
+    int capacity;
+} SICOBufferList;
+
+typedef struct SICOPooledBuffer
+{
+    cl_mem mem;
+    cl_command_queue queue; // last queue the buffer was used on (retained), 0 if not used since it was acquired
+} SICOPooledBuffer;
+
+typedef struct SICOPendingBuffer
+{
+    cl_mem mem;
+    cl_event marker;        // completes when the commands queued before the buffer was released are done
+} SICOPendingBuffer;
+
+typedef struct SICOBufferPool
+{
+    SICOMutex lock;
+    SICOBufferList classes[SICO_POOL_CLASS_COUNT];
+    SICOPooledBuffer* owned;        // every buffer created by the pool, sorted by handle
+    int ownedCount;
+    int ownedCapacity;
+    SICOPendingBuffer* pending;     // released buffers that may still be in use by queued commands
+    int pendingCount;
+    int pendingCapacity;
+    SICOBufferPoolStats stats;
+} SICOBufferPool;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 struct SICODevice
@@ -50,6 +339,20 @@ struct SICODevice
     cl_device_id deviceId;
     cl_device_type deviceType;
     cl_context context;
+    cl_command_queue queue; // shared queue returned by scGetDeviceQueue
+    cl_bool unifiedMemory;  // device shares memory with the host (CPU, integrated GPU)
+    cl_uint memBaseAlign;   // required alignment in bytes for CL_MEM_USE_HOST_PTR to be zero-copy
+    cl_uint computeUnits;
+    cl_uint clockFrequency; // MHz
+    cl_uint vectorWidth;    // native float vector width
+    cl_ulong globalMemSize;
+    cl_ulong localMemSize;
+    cl_bool doubleSupport;
+    volatile int measured;  // bandwidth/compute below has been measured (see measureDevice)
+    double bandwidth;       // GB/s
+    double compute;         // GFLOP/s
+    SICOBufferPool pool;
+    struct SICOPrimitives* primitives[SICO_DataTypeCount]; // built on first use (see scReduce etc)
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -58,8 +361,46 @@ struct SICOKernel
 {
     cl_program program;
     cl_kernel kern;
+    char name[64];     // function name, used for profiling
+    cl_device_id deviceId; // device the program was built for
+    uint64_t programHash; // source and build options (or the binary) the kernel was built from, see getProgramHash
+    uint64_t tuneKey;  // key into the autotune table (0 until first used)
+    size_t defaultLocalSize; // local size for 1D launches without a tuned size (0 until first used)
+    const void* argOwner; // launch that last set all arguments (see SICOLaunch), 0 if set by someone else
+    SICOMutex argLock; // kernel args are shared state so setup + enqueue has to be serialized between threads
 };
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Registry of kernels that has been built with scGetKernel
+
+#define SICO_KERNEL_REGISTRY_SIZE 256
+
+// What a kernel was built from. The key is only a hash so the strings are compared as well when an entry is found.
+// Kernels from files also include the modification time and size so an edited file is rebuilt.
+
+typedef struct SICOKernelId
+{
+    const char* filename;   // 0 for kernels built from memory
+    const char* source;     // 0 for kernels built from files
+    size_t sourceSize;
+    const char* kernelName;
+    const char* buildOpts;
+    int64_t modified;
+    int64_t fileSize;
+} SICOKernelId;
+
+typedef struct SICOKernelEntry
+{
+    uint64_t key;
+    SICODevice device;
+    SICOKernel kernel;
+    SICOKernelId id;        // strings are owned by the entry
+    struct SICOKernelEntry* next;
+} SICOKernelEntry;
+
+static SICOKernelEntry* s_kernelRegistry[SICO_KERNEL_REGISTRY_SIZE];
+static SICOMutex s_registryMutex = SICO_MUTEX_INIT;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 /*
@@ -72,6 +413,10 @@ struct SICOCommanQueue
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+cl_context createSingleContext(cl_device_id deviceId);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 static void* mallocZero(size_t size)
 {
     void* t = malloc(size);
@@ -213,8 +558,11 @@ static void* readFileFromDisk(const char* file, size_t* size)
         free(data);
         fclose(f);
         sico_log("SICO: Unable to read the whole file %s to memory\n", file);
+        return 0;
     }
 
+    fclose(f);
+
     *size = fileSize;
 
     return data;
@@ -222,231 +570,7058 @@ static void* readFileFromDisk(const char* file, size_t* size)
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static void printOrAppendString(char* output, cl_device_id dev, cl_device_info param, int id, int index, const char* fmt, size_t* len)
+static SICOKernel createKernelObject(cl_program program, cl_kernel kern)
 {
-    char tempBuffer[2048];
+    SICOKernel kernel = mallocZero(sizeof(struct SICOKernel));
+    kernel->program = program;
+    kernel->kern = kern;
+    clGetKernelInfo(kern, CL_KERNEL_FUNCTION_NAME, sizeof(kernel->name) - 1, kernel->name, 0);
+    clGetProgramInfo(program, CL_PROGRAM_DEVICES, sizeof(cl_device_id), &kernel->deviceId, 0);
+    mutexInit(&kernel->argLock);
+    return kernel;
+}
 
-    size_t valueSize;
-    char* value;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// All argument setting goes through here so launch objects know when they have to set all of their arguments again
 
-    clGetDeviceInfo(dev, param, 0, 0, &valueSize);
-    value = (char*)malloc(valueSize);
-    clGetDeviceInfo(dev, param, valueSize, value, 0);
+static cl_int setKernelArg(SICOKernel kernel, cl_uint index, size_t size, const void* value)
+{
+    kernel->argOwner = 0;
+    return clSetKernelArg(kernel->kern, index, size, value);
+}
 
-    if (output && (*len > 0))
-    {
-        size_t tempLen;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Profiling. When enabled queues are created with CL_QUEUE_PROFILING_ENABLE and every kernel launch and transfer
+// done through SICO gets an event with a completion callback that stores the timestamps. Compiles are timed
+// on the host.
 
-        sprintf(tempBuffer, fmt, id, index, value);
-        tempLen = strlen(tempBuffer);
+#define SICO_PROFILE_MAX_RECORDS (1024 * 1024)
 
-        if (tempLen < *len)
-        {
-            strcat(output, tempBuffer);
-            *len -= tempLen;
-        }
-    }
-    else
-    {
-        printf(fmt, id, index, value);
-    }
+typedef struct SICOProfileRecord
+{
+    char name[64];
+    SICOProfileType type;
+    size_t bytes;
+    cl_ulong queued;
+    cl_ulong submit;
+    cl_ulong start;
+    cl_ulong end;
+} SICOProfileRecord;
+
+static int s_profiling = 0;
+static SICOMutex s_profileMutex = SICO_MUTEX_INIT;
+static SICOProfileRecord* s_profileRecords = 0;
+static int s_profileRecordCount = 0;
+static int s_profileRecordCapacity = 0;
+static int s_profileDropped = 0;
+static int s_profilePending = 0;
 
-    free(value);
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scSetProfiling(int enable)
+{
+    s_profiling = enable;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-static void printOrAppendInt(char* output, cl_device_id dev, cl_device_info param, int id, int index, const char* fmt, size_t* len)
+void scProfilingReset()
 {
-    char tempBuffer[2048];
-    size_t value;
-
-    clGetDeviceInfo(dev, param, sizeof(value), &value, 0);
+    mutexLock(&s_profileMutex);
+    free(s_profileRecords);
+    s_profileRecords = 0;
+    s_profileRecordCount = 0;
+    s_profileRecordCapacity = 0;
+    s_profileDropped = 0;
+    mutexUnlock(&s_profileMutex);
+}
 
-    if (output && (*len > 0))
-    {
-        size_t tempLen;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-        sprintf(tempBuffer, fmt, id, index, value);
-        tempLen = strlen(tempBuffer);
+static void addProfileRecord(const SICOProfileRecord* record)
+{
+    mutexLock(&s_profileMutex);
 
-        if (tempLen < *len)
-        {
-            strcat(output, tempBuffer);
-            *len -= tempLen;
-        }
+    if (s_profileRecordCount >= SICO_PROFILE_MAX_RECORDS)
+    {
+        s_profileDropped++;
     }
     else
     {
-        printf(fmt, id, index, value);
+        if (s_profileRecordCount == s_profileRecordCapacity)
+        {
+            s_profileRecordCapacity = s_profileRecordCapacity ? s_profileRecordCapacity * 2 : 1024;
+            s_profileRecords = realloc(s_profileRecords, sizeof(SICOProfileRecord) * (size_t)s_profileRecordCapacity);
+        }
+
+        s_profileRecords[s_profileRecordCount++] = *record;
     }
+
+    mutexUnlock(&s_profileMutex);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-cl_context createSingleContext(cl_device_id deviceId)
+static void CL_CALLBACK profileCallback(cl_event event, cl_int status, void* userData)
 {
-    cl_context context;
-    cl_int err;
-
-    if ((context = clCreateContext(0, 1, &deviceId, NULL, NULL, &err)))
-        return context;
+    SICOProfileRecord* record = (SICOProfileRecord*)userData;
 
-    // TODO: Include more detailed error messages
+    if (status == CL_COMPLETE &&
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &record->queued, 0) == CL_SUCCESS &&
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &record->submit, 0) == CL_SUCCESS &&
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &record->start, 0) == CL_SUCCESS &&
+        clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &record->end, 0) == CL_SUCCESS)
+    {
+        addProfileRecord(record);
+    }
 
-    sico_log("Unable to create context. Error %s\n", getErrorString(err));
+    free(record);
+    clReleaseEvent(event);
 
-    return 0;
+    mutexLock(&s_profileMutex);
+    s_profilePending--;
+    mutexUnlock(&s_profileMutex);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Returns the event pointer that should be passed to an enqueue call. If the caller didn't ask for an event we
+// still need one when profiling.
 
-SICODevice* scGetAllDevices(int* count)
+static cl_event* getProfileEvent(cl_event* userEvent, cl_event* temp)
 {
-    cl_uint i, j, deviceIter = 0;
-    cl_uint platformCount;
-    cl_uint deviceCount;
-    cl_platform_id* platforms;
-    cl_device_id* devices;
-    int totalDeviceCount = 0;
+    *temp = 0;
 
-    if (s_platformId == 0)
-        return 0;
+    if (userEvent || !s_profiling)
+        return userEvent;
 
-    // Check if we have already fetched all devices then we just return them here
+    return temp;
+}
 
-    if (s_deviceCount > 0)
-    {
-        *count = s_deviceCount;
-        return s_devices;
-    }
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Called after a successful enqueue. Takes ownership of the event if the caller didn't ask for it.
+
+static void profileEvent(const char* name, SICOProfileType type, size_t bytes, cl_event* event, cl_event* userEvent)
+{
+    SICOProfileRecord* record;
+
+    if (!event || !*event)
+        return;
+
+    if (!s_profiling)
+    {
+        if (event != userEvent)
+            clReleaseEvent(*event);
+
+        return;
+    }
+
+    // the callback releases the event so keep it alive if the caller also has it
+
+    if (event == userEvent)
+        clRetainEvent(*event);
+
+    record = mallocZero(sizeof(SICOProfileRecord));
+    strncpy(record->name, name, sizeof(record->name) - 1);
+    record->type = type;
+    record->bytes = bytes;
+
+    mutexLock(&s_profileMutex);
+    s_profilePending++;
+    mutexUnlock(&s_profileMutex);
+
+    if (clSetEventCallback(*event, CL_COMPLETE, profileCallback, record) != CL_SUCCESS)
+        profileCallback(*event, CL_INVALID_EVENT, record);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void profileHostTime(const char* name, SICOProfileType type, double startTime, double endTime)
+{
+    SICOProfileRecord record;
+
+    if (!s_profiling)
+        return;
+
+    memset(&record, 0, sizeof(record));
+    strncpy(record.name, name, sizeof(record.name) - 1);
+    record.type = type;
+    record.queued = record.submit = record.start = (cl_ulong)(startTime * 1e9);
+    record.end = (cl_ulong)(endTime * 1e9);
+
+    addProfileRecord(&record);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Wrappers for all enqueues SICO does so they get profiled
+
+static cl_int enqueueWrite(cl_command_queue queue, cl_mem mem, cl_bool blocking, size_t offset, size_t size, const void* ptr,
+                           cl_uint waitCount, const cl_event* waitList, cl_event* userEvent)
+{
+    cl_event temp;
+    cl_event* event = getProfileEvent(userEvent, &temp);
+    cl_int error = clEnqueueWriteBuffer(queue, mem, blocking, offset, size, ptr, waitCount, waitList, event);
+
+    if (error == CL_SUCCESS)
+        profileEvent("write", SICO_ProfileWrite, size, event, userEvent);
+
+    return error;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static cl_int enqueueRead(cl_command_queue queue, cl_mem mem, cl_bool blocking, size_t offset, size_t size, void* ptr,
+                          cl_uint waitCount, const cl_event* waitList, cl_event* userEvent)
+{
+    cl_event temp;
+    cl_event* event = getProfileEvent(userEvent, &temp);
+    cl_int error = clEnqueueReadBuffer(queue, mem, blocking, offset, size, ptr, waitCount, waitList, event);
+
+    if (error == CL_SUCCESS)
+        profileEvent("read", SICO_ProfileRead, size, event, userEvent);
+
+    return error;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static cl_int enqueueKernel(cl_command_queue queue, SICOKernel kernel, cl_uint workDim, const size_t* offset,
+                            const size_t* globalSize, const size_t* localSize, cl_uint waitCount, const cl_event* waitList,
+                            cl_event* userEvent)
+{
+    cl_event temp;
+    cl_event* event = getProfileEvent(userEvent, &temp);
+    cl_int error = clEnqueueNDRangeKernel(queue, kernel->kern, workDim, offset, globalSize, localSize, waitCount, waitList, event);
+
+    if (error == CL_SUCCESS)
+        profileEvent(kernel->name, SICO_ProfileKernel, 0, event, userEvent);
+
+    return error;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// FNV-1a
+
+static uint64_t hashData(uint64_t hash, const void* data, size_t size)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint64_t hashString(uint64_t hash, const char* str)
+{
+    // include the terminator so "ab" + "c" and "a" + "bc" ends up with different hashes
+
+    if (!str)
+        str = "";
+
+    return hashData(hash, str, strlen(str) + 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define SICO_HASH_INIT 0xcbf29ce484222325ull
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void getDeviceString(cl_device_id dev, cl_device_info param, char* output, size_t size)
+{
+    size_t len = 0;
+
+    output[0] = 0;
+
+    if (clGetDeviceInfo(dev, param, size - 1, output, &len) != CL_SUCCESS)
+        output[0] = 0;
+    else
+        output[len < size ? len : size - 1] = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Program binary cache. Entries are stored as <dir>/<key>.clbin where the key is a hash of the source, build options
+// and the device/driver identity. When the driver is upgraded the identity changes so the old entries are simply never
+// looked up again. The identity is also stored in the file and verified on load to guard against hash collisions.
+
+#define SICO_CACHE_MAGIC 0x43434953 // 'SICC'
+#define SICO_CACHE_VERSION 1
+#define SICO_CACHE_FILENAME_SIZE (sizeof(s_programCacheDir) + 64)
+
+typedef struct SICOCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t identitySize;
+    uint32_t binarySize;
+} SICOCacheHeader;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scSetProgramCacheDir(const char* path)
+{
+    size_t len;
+
+    if (!path || path[0] == 0)
+    {
+        s_programCacheDir[0] = 0;
+        return;
+    }
+
+    len = strlen(path);
+
+    if (len >= sizeof(s_programCacheDir) - 64)
+    {
+        sico_log("Program cache path %s is too long, cache disabled\n", path);
+        s_programCacheDir[0] = 0;
+        return;
+    }
+
+    strcpy(s_programCacheDir, path);
+
+    // strip trailing separator so we can always append one
+
+    if (len > 1 && (s_programCacheDir[len - 1] == '/' || s_programCacheDir[len - 1] == '\\'))
+        s_programCacheDir[len - 1] = 0;
+
+#if defined(_WIN32)
+    _mkdir(s_programCacheDir);
+#else
+    mkdir(s_programCacheDir, 0755);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scGetProgramCacheStats(SICOProgramCacheStats* stats)
+{
+    mutexLock(&s_programCacheStatsMutex);
+    *stats = s_programCacheStats;
+    mutexUnlock(&s_programCacheStatsMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void countCacheStat(uint32_t* counter)
+{
+    mutexLock(&s_programCacheStatsMutex);
+    (*counter)++;
+    mutexUnlock(&s_programCacheStatsMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static size_t getDeviceIdentity(cl_device_id dev, char* output, size_t size)
+{
+    char name[256];
+    char driver[256];
+    char version[256];
+
+    getDeviceString(dev, CL_DEVICE_NAME, name, sizeof(name));
+    getDeviceString(dev, CL_DRIVER_VERSION, driver, sizeof(driver));
+    getDeviceString(dev, CL_DEVICE_VERSION, version, sizeof(version));
+
+    snprintf(output, size, "%s|%s|%s", name, driver, version);
+
+    return strlen(output);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Return non-zero if the whole name fit in output
+
+static int getCacheFilename(char* output, size_t size, uint64_t key)
+{
+    int len = snprintf(output, size, "%s/%08x%08x.clbin", s_programCacheDir, (uint32_t)(key >> 32), (uint32_t)key);
+
+    return len > 0 && (size_t)len < size;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint64_t getCacheKey(const char* identity, const char* source, size_t size, const char* buildOpts)
+{
+    uint64_t key = SICO_HASH_INIT;
+
+    key = hashString(key, identity);
+    key = hashString(key, buildOpts);
+    key = hashData(key, source, size);
+
+    return key;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Identifies what a kernel was built from. Programs loaded from the cache or from binaries have no source to query so
+// this is stored on the kernel when it's created (used for the autotune key)
+
+static uint64_t getProgramHash(const void* data, size_t size, const char* buildOpts)
+{
+    return hashString(hashData(SICO_HASH_INIT, data, size), buildOpts);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static unsigned char* readCacheFile(const char* filename, uint64_t key, const char* identity, size_t* binarySize)
+{
+    SICOCacheHeader header;
+    unsigned char* binary;
+    char* storedIdentity;
+    int ok;
+    FILE* f;
+
+    if (!(f = fopen(filename, "rb")))
+        return 0;
+
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        header.magic != SICO_CACHE_MAGIC || header.version != SICO_CACHE_VERSION ||
+        header.key != key || header.binarySize == 0)
+    {
+        fclose(f);
+        return 0;
+    }
+
+    storedIdentity = mallocZero(header.identitySize + 1);
+    binary = malloc(header.binarySize);
+
+    ok = fread(storedIdentity, 1, header.identitySize, f) == header.identitySize &&
+         fread(binary, 1, header.binarySize, f) == header.binarySize &&
+         strcmp(storedIdentity, identity) == 0;
+
+    fclose(f);
+    free(storedIdentity);
+
+    if (!ok)
+    {
+        free(binary);
+        return 0;
+    }
+
+    *binarySize = header.binarySize;
+
+    return binary;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static cl_program loadCachedProgram(SICODevice device, uint64_t key, const char* identity, const char* buildOpts)
+{
+    char filename[SICO_CACHE_FILENAME_SIZE];
+    struct stat st;
+    unsigned char* binary;
+    cl_program program;
+    cl_int binaryStatus, error;
+    size_t binarySize;
+
+    if (!getCacheFilename(filename, sizeof(filename), key) || stat(filename, &st) != 0)
+        return 0;
+
+    if ((binary = readCacheFile(filename, key, identity, &binarySize)))
+    {
+        program = clCreateProgramWithBinary(device->context, 1, &device->deviceId, &binarySize,
+                                            (const unsigned char**)&binary, &binaryStatus, &error);
+        free(binary);
+
+        if (program && error == CL_SUCCESS && binaryStatus == CL_SUCCESS)
+        {
+            if (clBuildProgram(program, 1, &device->deviceId, buildOpts, 0, 0) == CL_SUCCESS)
+            {
+                countCacheStat(&s_programCacheStats.hits);
+                return program;
+            }
+        }
+
+        if (program)
+            clReleaseProgram(program);
+    }
+
+    // Something is wrong with the entry (old driver, truncated write, etc) so get rid of it. It will be replaced
+    // by a fresh binary after the program has been built from source
+
+    remove(filename);
+
+    countCacheStat(&s_programCacheStats.invalidations);
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void storeCachedProgram(SICODevice device, cl_program program, uint64_t key, const char* identity)
+{
+    char filename[SICO_CACHE_FILENAME_SIZE];
+    char tempFilename[SICO_CACHE_FILENAME_SIZE + 32];
+    SICOCacheHeader header;
+    unsigned char* binary;
+    size_t binarySize = 0;
+    int ok;
+    FILE* f;
+
+    (void)device;
+
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &binarySize, 0) != CL_SUCCESS ||
+        binarySize == 0)
+    {
+        return;
+    }
+
+    binary = malloc(binarySize);
+
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char*), &binary, 0) != CL_SUCCESS)
+    {
+        free(binary);
+        return;
+    }
+
+    header.magic = SICO_CACHE_MAGIC;
+    header.version = SICO_CACHE_VERSION;
+    header.key = key;
+    header.identitySize = (uint32_t)strlen(identity);
+    header.binarySize = (uint32_t)binarySize;
+
+    // Write to a temporary file first and then rename it in place so other processes never sees a partial entry
+
+    if (!getCacheFilename(filename, sizeof(filename), key))
+    {
+        free(binary);
+        return;
+    }
+
+    snprintf(tempFilename, sizeof(tempFilename), "%s.%x.tmp", filename, (uint32_t)time(0) ^ (uint32_t)(uintptr_t)&header);
+
+    if (!(f = fopen(tempFilename, "wb")))
+    {
+        free(binary);
+        return;
+    }
+
+    ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+         fwrite(identity, 1, header.identitySize, f) == header.identitySize &&
+         fwrite(binary, 1, binarySize, f) == binarySize;
+
+    ok = (fclose(f) == 0) && ok;
+
+    free(binary);
+
+    if (ok)
+    {
+#if defined(_WIN32)
+        remove(filename);
+#endif
+        ok = rename(tempFilename, filename) == 0;
+    }
+
+    if (!ok)
+    {
+        remove(tempFilename);
+        return;
+    }
+
+    countCacheStat(&s_programCacheStats.stores);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void logBuildError(SICODevice device, cl_program program, const char* name, cl_int error)
+{
+    char* errorBuffer;
+    size_t size;
+
+    clGetProgramBuildInfo(program, device->deviceId, CL_PROGRAM_BUILD_LOG, 0, 0, &size);
+    errorBuffer = malloc(size + 1);
+    clGetProgramBuildInfo(program, device->deviceId, CL_PROGRAM_BUILD_LOG, size, errorBuffer, 0);
+    errorBuffer[size] = 0;
+
+    // TODO: Support writing the error log to a buffer
+
+    sico_log("unable to build %s (error %s)\n\n%s\n", name, getErrorString(error), errorBuffer);
+    free(errorBuffer);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Creates and builds a program from source, going through the binary cache if it's enabled.
+// name is only used for error reporting
+
+static cl_program buildProgram(SICODevice device, const char* name, const char* source, size_t size, const char* buildOpts);
+
+static cl_program buildProgramFromSource(SICODevice device, const char* name, const char* source, size_t size, const char* buildOpts)
+{
+    double startTime = getTime();
+    cl_program program = buildProgram(device, name, source, size, buildOpts);
+
+    profileHostTime(name, SICO_ProfileCompile, startTime, getTime());
+
+    return program;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Devices without a context get a single device one the first time a program is built for them. Programs are built
+// from several compile threads at once so this is serialized.
+
+static SICOMutex s_contextMutex = SICO_MUTEX_INIT;
+
+static int createDeviceContext(SICODevice device)
+{
+    int result = 1;
+
+    mutexLock(&s_contextMutex);
+
+    if (!device->context)
+        result = (device->context = createSingleContext(device->deviceId)) != 0;
+
+    mutexUnlock(&s_contextMutex);
+
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static cl_program buildProgram(SICODevice device, const char* name, const char* source, size_t size, const char* buildOpts)
+{
+    char identity[1024];
+    uint64_t key = 0;
+    cl_program program;
+    cl_int error;
+    int useCache = s_programCacheDir[0] != 0;
+
+    // First create a single context if we have none
+
+    if (!createDeviceContext(device))
+        return 0;
+
+    if (useCache)
+    {
+        getDeviceIdentity(device->deviceId, identity, sizeof(identity));
+        key = getCacheKey(identity, source, size, buildOpts);
+
+        if ((program = loadCachedProgram(device, key, identity, buildOpts)))
+            return program;
+
+        countCacheStat(&s_programCacheStats.misses);
+    }
+
+    if (!(program = clCreateProgramWithSource(device->context, 1, &source, &size, &error)))
+    {
+        sico_log("clCreateProgramWithSource failed, error: %s\n", getErrorString(error));
+        return 0;
+    }
+
+    if ((error = clBuildProgram(program, 1, &device->deviceId, buildOpts, 0, 0)) != CL_SUCCESS)
+    {
+        logBuildError(device, program, name, error);
+        clReleaseProgram(program);
+        return 0;
+    }
+
+    if (useCache)
+        storeCachedProgram(device, program, key, identity);
+
+    return program;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void printOrAppendString(char* output, cl_device_id dev, cl_device_info param, int id, int index, const char* fmt, size_t* len)
+{
+    char tempBuffer[2048];
+
+    size_t valueSize;
+    char* value;
+
+    clGetDeviceInfo(dev, param, 0, 0, &valueSize);
+    value = (char*)malloc(valueSize);
+    clGetDeviceInfo(dev, param, valueSize, value, 0);
+
+    if (output && (*len > 0))
+    {
+        size_t tempLen;
+
+        sprintf(tempBuffer, fmt, id, index, value);
+        tempLen = strlen(tempBuffer);
+
+        if (tempLen < *len)
+        {
+            strcat(output, tempBuffer);
+            *len -= tempLen;
+        }
+    }
+    else
+    {
+        printf(fmt, id, index, value);
+    }
+
+    free(value);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void printOrAppendInt(char* output, cl_device_id dev, cl_device_info param, int id, int index, const char* fmt, size_t* len)
+{
+    char tempBuffer[2048];
+    size_t value;
+
+    clGetDeviceInfo(dev, param, sizeof(value), &value, 0);
+
+    if (output && (*len > 0))
+    {
+        size_t tempLen;
+
+        sprintf(tempBuffer, fmt, id, index, value);
+        tempLen = strlen(tempBuffer);
+
+        if (tempLen < *len)
+        {
+            strcat(output, tempBuffer);
+            *len -= tempLen;
+        }
+    }
+    else
+    {
+        printf(fmt, id, index, value);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+cl_context createSingleContext(cl_device_id deviceId)
+{
+    cl_context context;
+    cl_int err;
+
+    if ((context = clCreateContext(0, 1, &deviceId, NULL, NULL, &err)))
+        return context;
+
+    // TODO: Include more detailed error messages
+
+    sico_log("Unable to create context. Error %s\n", getErrorString(err));
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Rough estimate of how much work a device can do. Used for picking the best device category and for the
+// initial split in multi-device runs
+
+static double getDeviceThroughputEstimate(SICODevice device)
+{
+    double clock = device->clockFrequency ? (double)device->clockFrequency : 1000.0;
+    double units = device->computeUnits ? (double)device->computeUnits : 1.0;
+    return units * clock;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int getDeviceCategory(SICODevice device)
+{
+    if (device->deviceType & CL_DEVICE_TYPE_GPU)
+        return SICO_CategoryGPU;
+
+    if (device->deviceType & CL_DEVICE_TYPE_CPU)
+        return SICO_CategoryCPU;
+
+    return SICO_CategoryOther;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void setupDeviceCategories(SICODevice* devices, int count)
+{
+    double categoryScore[SICO_CategoryCount] = { 0.0 };
+
+    for (int c = 0; c < SICO_CategoryCount; ++c)
+    {
+        s_categoryDevices[c] = malloc(sizeof(SICODevice) * (size_t)(count > 0 ? count : 1));
+        s_categoryDeviceCounts[c] = 0;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        int c = getDeviceCategory(devices[i]);
+        s_categoryDevices[c][s_categoryDeviceCounts[c]++] = devices[i];
+        categoryScore[c] += getDeviceThroughputEstimate(devices[i]);
+    }
+
+    s_bestCategory = 0;
+
+    for (int c = 1; c < SICO_CategoryCount; ++c)
+    {
+        if (categoryScore[c] > categoryScore[s_bestCategory])
+            s_bestCategory = c;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void setupDevices()
+{
+    cl_uint i, j, deviceIter = 0;
+    cl_uint platformCount;
+    cl_uint deviceCount;
+    cl_platform_id* platforms;
+    cl_device_id* devices;
+    int totalDeviceCount = 0;
+
+    clGetPlatformIDs(0, 0, &platformCount);
+    platforms = (cl_platform_id*)malloc(sizeof(cl_platform_id) * platformCount);
+    clGetPlatformIDs(platformCount, platforms, 0);
+
+    for (i = 0; i < platformCount; ++i)
+    {
+        clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, 0, 0, &deviceCount);
+        totalDeviceCount += deviceCount;
+    }
+
+    // Allocate space for the devices and then set them up
+
+    s_devices = malloc((sizeof(SICODevice*) * (size_t)totalDeviceCount));
+
+    // setup the device ids
+
+    for (i = 0; i < platformCount; ++i)
+    {
+        clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, 0, 0, &deviceCount);
+        devices = (cl_device_id*)malloc(sizeof(cl_device_id) * deviceCount);
+        clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, deviceCount, devices, 0);
+
+        for (j = 0; j < deviceCount; ++j, ++deviceIter)
+        {
+            s_devices[deviceIter] = mallocZero(sizeof(struct SICODevice));
+            s_devices[deviceIter]->deviceId = devices[j];
+            s_devices[deviceIter]->pool.stats.limit = SICO_POOL_DEFAULT_LIMIT;
+            mutexInit(&s_devices[deviceIter]->pool.lock);
+            s_devices[deviceIter]->context = createSingleContext(devices[j]);
+            clGetDeviceInfo(devices[j], CL_DEVICE_TYPE, sizeof(cl_device_type), &s_devices[deviceIter]->deviceType, 0);
+            clGetDeviceInfo(devices[j], CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &s_devices[deviceIter]->unifiedMemory, 0);
+            clGetDeviceInfo(devices[j], CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(cl_uint), &s_devices[deviceIter]->memBaseAlign, 0);
+
+            clGetDeviceInfo(devices[j], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &s_devices[deviceIter]->computeUnits, 0);
+            clGetDeviceInfo(devices[j], CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(cl_uint), &s_devices[deviceIter]->clockFrequency, 0);
+            clGetDeviceInfo(devices[j], CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT, sizeof(cl_uint), &s_devices[deviceIter]->vectorWidth, 0);
+            clGetDeviceInfo(devices[j], CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &s_devices[deviceIter]->globalMemSize, 0);
+            clGetDeviceInfo(devices[j], CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &s_devices[deviceIter]->localMemSize, 0);
+
+            {
+                cl_device_fp_config doubleConfig = 0;
+                clGetDeviceInfo(devices[j], CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(doubleConfig), &doubleConfig, 0);
+                s_devices[deviceIter]->doubleSupport = doubleConfig != 0;
+            }
+
+            // reported in bits
+
+            s_devices[deviceIter]->memBaseAlign /= 8;
+        }
+
+        free(devices);
+    }
+
+    free(platforms);
+
+    setupDeviceCategories(s_devices, totalDeviceCount);
+
+    s_deviceCount = totalDeviceCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICODevice* scGetAllDevices(int* count)
+{
+    if (!loadAcquire(&s_initialized))
+        return 0;
+
+    // Check if we have already fetched all devices then we just return them here (without locking)
+
+    if (!loadAcquire(&s_devicesReady))
+    {
+        mutexLock(&s_initMutex);
+
+        if (!s_devicesReady)
+        {
+            setupDevices();
+            storeRelease(&s_devicesReady, 1);
+        }
+
+        mutexUnlock(&s_initMutex);
+    }
+
+    *count = s_deviceCount;
+
+    return s_devices;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static SICODevice* getCategoryDevices(int category, int* count)
+{
+    int deviceCount;
+
+    if (!scGetAllDevices(&deviceCount))
+    {
+        *count = 0;
+        return 0;
+    }
+
+    *count = s_categoryDeviceCounts[category];
+
+    return s_categoryDevices[category];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICODevice* scGetCPUDevices(int* count)
+{
+    return getCategoryDevices(SICO_CategoryCPU, count);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICODevice* scGetGPUDevices(int* count)
+{
+    return getCategoryDevices(SICO_CategoryGPU, count);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICODevice* scGetOtherDevices(int* count)
+{
+    return getCategoryDevices(SICO_CategoryOther, count);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICODevice* scGetBestDevices(int* count)
+{
+    int deviceCount;
+
+    if (!scGetAllDevices(&deviceCount))
+    {
+        *count = 0;
+        return 0;
+    }
+
+    return getCategoryDevices(s_bestCategory, count);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int getPoolClass(size_t size, size_t* classSize)
+{
+    int shift = SICO_POOL_MIN_SHIFT;
+    size_t step;
+
+    if (size < ((size_t)1 << SICO_POOL_MIN_SHIFT))
+        size = (size_t)1 << SICO_POOL_MIN_SHIFT;
+
+    while (shift < 63 && ((size_t)1 << (shift + 1)) < size)
+        shift++;
+
+    // size is now in (2^shift, 2^(shift + 1)] so pick the first quarter step that fits
+
+    step = ((size_t)1 << shift) / 4;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        size_t s = ((size_t)1 << shift) + step * (size_t)(i + 1);
+
+        if (size <= s)
+        {
+            *classSize = s;
+            return (shift - SICO_POOL_MIN_SHIFT) * 4 + i;
+        }
+    }
+
+    *classSize = size;
+    return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Pooled buffers are only recognized by being in the owned list (a buffer with the same size and flags that was
+// created somewhere else is not ours to keep). Return index or -1, insertPos is where it would be inserted.
+
+static int findPooled(SICOBufferPool* pool, cl_mem mem, int* insertPos)
+{
+    int low = 0, high = pool->ownedCount;
+
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+
+        if ((uintptr_t)pool->owned[mid].mem < (uintptr_t)mem)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if (insertPos)
+        *insertPos = low;
+
+    return low < pool->ownedCount && pool->owned[low].mem == mem ? low : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void addPooled(SICOBufferPool* pool, cl_mem mem)
+{
+    int index;
+
+    findPooled(pool, mem, &index);
+
+    if (pool->ownedCount == pool->ownedCapacity)
+    {
+        pool->ownedCapacity = pool->ownedCapacity ? pool->ownedCapacity * 2 : 16;
+        pool->owned = realloc(pool->owned, sizeof(SICOPooledBuffer) * (size_t)pool->ownedCapacity);
+    }
+
+    memmove(&pool->owned[index + 1], &pool->owned[index], sizeof(SICOPooledBuffer) * (size_t)(pool->ownedCount - index));
+
+    pool->owned[index].mem = mem;
+    pool->owned[index].queue = 0;
+    pool->ownedCount++;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Forgets about a buffer and releases it
+
+static void releasePooled(SICOBufferPool* pool, cl_mem mem)
+{
+    int index = findPooled(pool, mem, 0);
+
+    if (index >= 0)
+    {
+        if (pool->owned[index].queue)
+            clReleaseCommandQueue(pool->owned[index].queue);
+
+        memmove(&pool->owned[index], &pool->owned[index + 1], sizeof(SICOPooledBuffer) * (size_t)(pool->ownedCount - index - 1));
+        pool->ownedCount--;
+    }
+
+    clReleaseMemObject(mem);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Puts an idle buffer in its size class (or releases it if the pool is at the limit). Called with the lock held
+
+static void poolStore(SICOBufferPool* pool, cl_mem mem)
+{
+    size_t size = 0, classSize;
+    int index;
+
+    clGetMemObjectInfo(mem, CL_MEM_SIZE, sizeof(size), &size, 0);
+
+    if ((index = getPoolClass(size, &classSize)) < 0 || pool->stats.bytesResident + classSize > pool->stats.limit)
+    {
+        releasePooled(pool, mem);
+        return;
+    }
+
+    {
+        SICOBufferList* list = &pool->classes[index];
+
+        if (list->count == list->capacity)
+        {
+            list->capacity = list->capacity ? list->capacity * 2 : 4;
+            list->buffers = realloc(list->buffers, sizeof(cl_mem) * (size_t)list->capacity);
+        }
+
+        list->buffers[list->count++] = mem;
+    }
+
+    pool->stats.bytesResident += classSize;
+
+    if (pool->stats.bytesResident > pool->stats.peakResident)
+        pool->stats.peakResident = pool->stats.bytesResident;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Moves released buffers whose commands has finished back to the pool. Called with the lock held
+
+static void poolCollect(SICOBufferPool* pool)
+{
+    for (int i = 0; i < pool->pendingCount;)
+    {
+        SICOPendingBuffer* pending = &pool->pending[i];
+        cl_int status = CL_QUEUED;
+        size_t size = 0;
+
+        clGetEventInfo(pending->marker, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, 0);
+
+        // errors are negative, the buffer isn't used by anything after that either
+
+        if (status > CL_COMPLETE)
+        {
+            ++i;
+            continue;
+        }
+
+        clGetMemObjectInfo(pending->mem, CL_MEM_SIZE, sizeof(size), &size, 0);
+        clReleaseEvent(pending->marker);
+
+        pool->stats.bytesPending -= size;
+        poolStore(pool, pending->mem);
+
+        *pending = pool->pending[--pool->pendingCount];
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Get a CL_MEM_READ_WRITE buffer of at least size bytes from the device pool, creating it if needed
+
+static cl_mem poolAcquire(SICODevice device, size_t size, cl_int* error)
+{
+    SICOBufferPool* pool = &device->pool;
+    size_t classSize;
+    cl_mem mem = 0;
+    int index = getPoolClass(size, &classSize);
+
+    *error = CL_SUCCESS;
+
+    mutexLock(&pool->lock);
+
+    poolCollect(pool);
+
+    if (index >= 0 && pool->classes[index].count > 0)
+    {
+        mem = pool->classes[index].buffers[--pool->classes[index].count];
+        pool->stats.bytesResident -= classSize;
+        pool->stats.hits++;
+    }
+    else
+    {
+        pool->stats.misses++;
+    }
+
+    pool->stats.bytesInUse += classSize;
+
+    mutexUnlock(&pool->lock);
+
+    if (mem)
+        return mem;
+
+    mem = clCreateBuffer(device->context, CL_MEM_READ_WRITE, classSize, NULL, error);
+
+    mutexLock(&pool->lock);
+
+    if (mem)
+        addPooled(pool, mem);
+    else
+        pool->stats.bytesInUse -= classSize;
+
+    mutexUnlock(&pool->lock);
+
+    return mem;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Records the queue a pooled buffer has commands on, so releasing it can wait for them (does nothing for buffers
+// that aren't from the pool)
+
+static void poolUse(SICODevice device, cl_mem mem, cl_command_queue queue)
+{
+    SICOBufferPool* pool;
+    int index;
+
+    if (!device || !mem || !queue)
+        return;
+
+    pool = &device->pool;
+
+    mutexLock(&pool->lock);
+
+    if ((index = findPooled(pool, mem, 0)) >= 0 && pool->owned[index].queue != queue)
+    {
+        clRetainCommandQueue(queue);
+
+        if (pool->owned[index].queue)
+            clReleaseCommandQueue(pool->owned[index].queue);
+
+        pool->owned[index].queue = queue;
+    }
+
+    mutexUnlock(&pool->lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static SICODevice getDeviceFromContext(cl_context context)
+{
+    for (int i = 0; i < s_deviceCount; ++i)
+    {
+        if (s_devices[i]->context == context)
+            return s_devices[i];
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Gives a buffer back to the pool of the device it was created on. Buffers that didn't come from the pool
+// (such as CL_MEM_USE_HOST_PTR buffers) are released, OpenCL keeps them alive until queued commands are done.
+// Pooled buffers that has been used on a queue are only reused once a marker enqueued after those commands has
+// completed, otherwise the next user could overwrite data that is still being uploaded or read back.
+
+static void poolRelease(cl_mem mem)
+{
+    SICOBufferPool* pool;
+    SICODevice device;
+    cl_context context = 0;
+    cl_command_queue queue;
+    cl_event marker = 0;
+    size_t size = 0;
+    int index;
+
+    clGetMemObjectInfo(mem, CL_MEM_CONTEXT, sizeof(context), &context, 0);
+
+    if (!(device = getDeviceFromContext(context)))
+    {
+        clReleaseMemObject(mem);
+        return;
+    }
+
+    pool = &device->pool;
+
+    mutexLock(&pool->lock);
+
+    if ((index = findPooled(pool, mem, 0)) < 0)
+    {
+        mutexUnlock(&pool->lock);
+        clReleaseMemObject(mem);
+        return;
+    }
+
+    clGetMemObjectInfo(mem, CL_MEM_SIZE, sizeof(size), &size, 0);
+
+    pool->stats.bytesInUse -= size;
+
+    queue = pool->owned[index].queue;
+    pool->owned[index].queue = 0;
+
+    if (queue)
+    {
+        if (clEnqueueMarkerWithWaitList(queue, 0, 0, &marker) == CL_SUCCESS)
+            clFlush(queue);
+        else
+            clFinish(queue);
+
+        clReleaseCommandQueue(queue);
+    }
+
+    if (!marker)
+    {
+        poolStore(pool, mem);
+        mutexUnlock(&pool->lock);
+        return;
+    }
+
+    if (pool->pendingCount == pool->pendingCapacity)
+    {
+        pool->pendingCapacity = pool->pendingCapacity ? pool->pendingCapacity * 2 : 16;
+        pool->pending = realloc(pool->pending, sizeof(SICOPendingBuffer) * (size_t)pool->pendingCapacity);
+    }
+
+    pool->pending[pool->pendingCount].mem = mem;
+    pool->pending[pool->pendingCount].marker = marker;
+    pool->pendingCount++;
+    pool->stats.bytesPending += size;
+
+    mutexUnlock(&pool->lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scSetBufferPoolLimit(struct SICODevice* device, size_t maxResidentBytes)
+{
+    mutexLock(&device->pool.lock);
+    device->pool.stats.limit = maxResidentBytes;
+    mutexUnlock(&device->pool.lock);
+
+    scTrimBufferPool(device, maxResidentBytes);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scTrimBufferPool(struct SICODevice* device, size_t maxResidentBytes)
+{
+    SICOBufferPool* pool = &device->pool;
+
+    mutexLock(&pool->lock);
+
+    poolCollect(pool);
+
+    // Release the largest buffers first as they are the most costly to keep around
+
+    for (int i = SICO_POOL_CLASS_COUNT - 1; i >= 0 && pool->stats.bytesResident > maxResidentBytes; --i)
+    {
+        SICOBufferList* list = &pool->classes[i];
+        size_t classSize = ((size_t)1 << (SICO_POOL_MIN_SHIFT + i / 4)) / 4 * (size_t)(4 + (i & 3) + 1);
+
+        while (list->count > 0 && pool->stats.bytesResident > maxResidentBytes)
+        {
+            releasePooled(pool, list->buffers[--list->count]);
+            pool->stats.bytesResident -= classSize;
+        }
+
+        if (list->count == 0)
+        {
+            free(list->buffers);
+            list->buffers = 0;
+            list->capacity = 0;
+        }
+    }
+
+    mutexUnlock(&pool->lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Called from scClose. Buffers still handed out are left to their users
+
+static void destroyBufferPool(SICODevice device)
+{
+    SICOBufferPool* pool = &device->pool;
+
+    mutexLock(&pool->lock);
+
+    for (int i = 0; i < pool->pendingCount; ++i)
+    {
+        clWaitForEvents(1, &pool->pending[i].marker);
+        clReleaseEvent(pool->pending[i].marker);
+        poolStore(pool, pool->pending[i].mem);
+    }
+
+    pool->pendingCount = 0;
+    pool->stats.bytesPending = 0;
+
+    mutexUnlock(&pool->lock);
+
+    scTrimBufferPool(device, 0);
+
+    for (int i = 0; i < pool->ownedCount; ++i)
+    {
+        if (pool->owned[i].queue)
+            clReleaseCommandQueue(pool->owned[i].queue);
+    }
+
+    free(pool->owned);
+    free(pool->pending);
+    mutexDestroy(&pool->lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scGetBufferPoolStats(struct SICODevice* device, SICOBufferPoolStats* stats)
+{
+    mutexLock(&device->pool.lock);
+    poolCollect(&device->pool);
+    *stats = device->pool.stats;
+    mutexUnlock(&device->pool.lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Arenas. One big buffer that sub-buffers are carved out of, so an allocation is only some offset math and a
+// clCreateSubBuffer instead of a device allocation.
+
+typedef struct SICOArenaBlock
+{
+    size_t offset;
+    size_t size;
+    cl_mem mem;     // sub-buffer (0 for free ranges)
+} SICOArenaBlock;
+
+typedef struct SICOArenaList
+{
+    SICOArenaBlock* blocks;
+    int count;
+    int capacity;
+} SICOArenaList;
+
+struct SICOArena
+{
+    SICODevice device;
+    cl_mem mem;
+    SICOArenaMode mode;
+    size_t capacity;
+    size_t align;               // sub-buffer origins has to be aligned to CL_DEVICE_MEM_BASE_ADDR_ALIGN
+    size_t top;                 // bump mode: end of the last allocation
+    size_t used;
+    size_t peak;
+    uint32_t failures;
+    SICOArenaList live;         // sub-buffers handed out
+    SICOArenaList freeRanges;   // free list mode: free ranges sorted by offset
+    SICOMutex lock;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void arenaInsert(SICOArenaList* list, int index, size_t offset, size_t size, cl_mem mem)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->blocks = realloc(list->blocks, sizeof(SICOArenaBlock) * (size_t)list->capacity);
+    }
+
+    memmove(&list->blocks[index + 1], &list->blocks[index], sizeof(SICOArenaBlock) * (size_t)(list->count - index));
+
+    list->blocks[index].offset = offset;
+    list->blocks[index].size = size;
+    list->blocks[index].mem = mem;
+    list->count++;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void arenaRemove(SICOArenaList* list, int index)
+{
+    memmove(&list->blocks[index], &list->blocks[index + 1], sizeof(SICOArenaBlock) * (size_t)(list->count - index - 1));
+    list->count--;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Gives a range back to the free list, merging it with the neighbours
+
+static void arenaFreeRange(struct SICOArena* arena, size_t offset, size_t size)
+{
+    SICOArenaList* list = &arena->freeRanges;
+    int i = 0;
+
+    while (i < list->count && list->blocks[i].offset < offset)
+        ++i;
+
+    if (i > 0 && list->blocks[i - 1].offset + list->blocks[i - 1].size == offset)
+    {
+        list->blocks[i - 1].size += size;
+
+        if (i < list->count && offset + size == list->blocks[i].offset)
+        {
+            list->blocks[i - 1].size += list->blocks[i].size;
+            arenaRemove(list, i);
+        }
+    }
+    else if (i < list->count && offset + size == list->blocks[i].offset)
+    {
+        list->blocks[i].offset = offset;
+        list->blocks[i].size += size;
+    }
+    else
+    {
+        arenaInsert(list, i, offset, size, 0);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOArena scCreateArena(SICODevice device, int flags, size_t size, SICOArenaMode mode)
+{
+    struct SICOArena* arena;
+    cl_int error;
+
+    if (!device || !device->context || size == 0)
+        return 0;
+
+    arena = mallocZero(sizeof(struct SICOArena));
+    arena->device = device;
+    arena->mode = mode;
+    arena->align = device->memBaseAlign ? device->memBaseAlign : 128;
+    arena->capacity = size - size % arena->align;
+
+    if (arena->capacity == 0)
+    {
+        sico_log("Arena size %d is below the device alignment %d\n", (int)size, (int)arena->align);
+        free(arena);
+        return 0;
+    }
+
+    if (!(arena->mem = clCreateBuffer(device->context, (cl_mem_flags)flags, arena->capacity, 0, &error)))
+    {
+        sico_log("Unable to create arena of %d bytes, error %s\n", (int)size, getErrorString(error));
+        free(arena);
+        return 0;
+    }
+
+    mutexInit(&arena->lock);
+
+    if (mode == SICO_ArenaFreeList)
+        arenaInsert(&arena->freeRanges, 0, 0, arena->capacity, 0);
+
+    return arena;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOHandle scArenaAlloc(SICOArena arena, size_t size)
+{
+    cl_buffer_region region;
+    size_t offset = 0;
+    cl_int error;
+    cl_mem mem;
+    int found = 0;
+
+    if (!arena || size == 0)
+        return 0;
+
+    size = (size + arena->align - 1) / arena->align * arena->align;
+
+    mutexLock(&arena->lock);
+
+    if (arena->mode == SICO_ArenaBump)
+    {
+        if (size <= arena->capacity - arena->top)
+        {
+            offset = arena->top;
+            arena->top += size;
+            found = 1;
+        }
+    }
+    else
+    {
+        // first fit, the range is taken from the start of the free block
+
+        for (int i = 0; i < arena->freeRanges.count; ++i)
+        {
+            SICOArenaBlock* block = &arena->freeRanges.blocks[i];
+
+            if (block->size < size)
+                continue;
+
+            offset = block->offset;
+            block->offset += size;
+            block->size -= size;
+
+            if (block->size == 0)
+                arenaRemove(&arena->freeRanges, i);
+
+            found = 1;
+            break;
+        }
+    }
+
+    if (!found)
+    {
+        arena->failures++;
+        mutexUnlock(&arena->lock);
+        return 0;
+    }
+
+    region.origin = offset;
+    region.size = size;
+
+    if (!(mem = clCreateSubBuffer(arena->mem, 0, CL_BUFFER_CREATE_TYPE_REGION, &region, &error)))
+    {
+        sico_log("clCreateSubBuffer failed, error %s\n", getErrorString(error));
+
+        if (arena->mode == SICO_ArenaBump)
+            arena->top = offset;
+        else
+            arenaFreeRange(arena, offset, size);
+
+        arena->failures++;
+        mutexUnlock(&arena->lock);
+        return 0;
+    }
+
+    arenaInsert(&arena->live, arena->live.count, offset, size, mem);
+
+    arena->used += size;
+
+    if (arena->used > arena->peak)
+        arena->peak = arena->used;
+
+    mutexUnlock(&arena->lock);
+
+    return (SICOHandle)mem;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scArenaFree(SICOArena arena, SICOHandle handle)
+{
+    SICOArenaBlock block;
+    int i;
+
+    if (!arena || !handle)
+        return;
+
+    mutexLock(&arena->lock);
+
+    // recent allocations are the most likely to be freed
+
+    for (i = arena->live.count - 1; i >= 0; --i)
+    {
+        if (arena->live.blocks[i].mem == (cl_mem)handle)
+            break;
+    }
+
+    if (i < 0)
+    {
+        mutexUnlock(&arena->lock);
+        sico_log("%s", "Handle doesn't belong to the arena\n");
+        return;
+    }
+
+    block = arena->live.blocks[i];
+    arenaRemove(&arena->live, i);
+    clReleaseMemObject(block.mem);
+
+    arena->used -= block.size;
+
+    // bump arenas can only reuse the space at the top, holes are given back at scArenaReset
+
+    if (arena->mode == SICO_ArenaBump)
+    {
+        arena->top = 0;
+
+        for (i = 0; i < arena->live.count; ++i)
+        {
+            size_t end = arena->live.blocks[i].offset + arena->live.blocks[i].size;
+
+            if (end > arena->top)
+                arena->top = end;
+        }
+    }
+    else
+    {
+        arenaFreeRange(arena, block.offset, block.size);
+    }
+
+    mutexUnlock(&arena->lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scArenaReset(SICOArena arena)
+{
+    if (!arena)
+        return;
+
+    mutexLock(&arena->lock);
+
+    for (int i = 0; i < arena->live.count; ++i)
+        clReleaseMemObject(arena->live.blocks[i].mem);
+
+    arena->live.count = 0;
+    arena->freeRanges.count = 0;
+    arena->top = 0;
+    arena->used = 0;
+
+    if (arena->mode == SICO_ArenaFreeList)
+        arenaInsert(&arena->freeRanges, 0, 0, arena->capacity, 0);
+
+    mutexUnlock(&arena->lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scGetArenaStats(SICOArena arena, SICOArenaStats* stats)
+{
+    size_t freeBytes;
+
+    memset(stats, 0, sizeof(SICOArenaStats));
+
+    if (!arena)
+        return;
+
+    mutexLock(&arena->lock);
+
+    stats->capacity = arena->capacity;
+    stats->used = arena->used;
+    stats->peak = arena->peak;
+    stats->allocations = (uint32_t)arena->live.count;
+    stats->failures = arena->failures;
+
+    if (arena->mode == SICO_ArenaBump)
+    {
+        stats->largestFree = arena->capacity - arena->top;
+    }
+    else
+    {
+        for (int i = 0; i < arena->freeRanges.count; ++i)
+        {
+            if (arena->freeRanges.blocks[i].size > stats->largestFree)
+                stats->largestFree = arena->freeRanges.blocks[i].size;
+        }
+    }
+
+    // free space that can't be used for one allocation of the same total size
+
+    freeBytes = arena->capacity - arena->used;
+
+    if (freeBytes > 0)
+        stats->fragmentation = 1.0f - (float)((double)stats->largestFree / (double)freeBytes);
+
+    mutexUnlock(&arena->lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scDestroyArena(SICOArena arena)
+{
+    if (!arena)
+        return;
+
+    scArenaReset(arena);
+    clReleaseMemObject(arena->mem);
+    mutexDestroy(&arena->lock);
+
+    free(arena->live.blocks);
+    free(arena->freeRanges.blocks);
+    free(arena);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Parameters are used directly from host memory on CPU devices, and on unified memory devices if the host memory
+// is aligned well enough for the driver to not do a copy behind our back.
+
+static int useHostPtr(SICODevice device, const SICOParam* param)
+{
+    size_t align = device->memBaseAlign ? device->memBaseAlign : 128;
+
+    if (device->deviceType == CL_DEVICE_TYPE_CPU)
+        return 1;
+
+    if (!device->unifiedMemory)
+        return 0;
+
+    return (param->data % align) == 0 && (param->size % 64) == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int isHostPtrBuffer(cl_mem mem)
+{
+    cl_mem_flags flags = 0;
+    clGetMemObjectInfo(mem, CL_MEM_FLAGS, sizeof(flags), &flags, 0);
+    return (flags & CL_MEM_USE_HOST_PTR) != 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void* scAllocHostAligned(size_t size)
+{
+    void* ptr = 0;
+
+    // round up to a full cache line as some drivers requires that for zero-copy
+
+    size = (size + 63) & ~(size_t)63;
+
+#if defined(_WIN32)
+    ptr = _aligned_malloc(size, SICO_HOST_ALIGNMENT);
+#else
+    if (posix_memalign(&ptr, SICO_HOST_ALIGNMENT, size) != 0)
+        ptr = 0;
+#endif
+
+    return ptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scFreeHostAligned(void* ptr)
+{
+#if defined(_WIN32)
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int scIsUnifiedMemory(struct SICODevice* device)
+{
+    return device->deviceType == CL_DEVICE_TYPE_CPU || device->unifiedMemory;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOHandle scAllocHostMapped(struct SICODevice* device, int flags, size_t size)
+{
+    return scAlloc(device, flags | CL_MEM_ALLOC_HOST_PTR, size, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void* scMapBuffer(SICOCommanQueue queue, SICOHandle handle, int mapFlags, size_t offset, size_t size)
+{
+    cl_int error;
+    void* ptr = clEnqueueMapBuffer((cl_command_queue)queue, (cl_mem)handle, CL_TRUE, (cl_map_flags)mapFlags, offset, size, 0, 0, 0, &error);
+
+    if (error == CL_SUCCESS)
+        return ptr;
+
+    sico_log("clEnqueueMapBuffer failed, error %s\n", getErrorString(error));
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scUnmapBuffer(SICOCommanQueue queue, SICOHandle handle, void* ptr)
+{
+    cl_int error = clEnqueueUnmapMemObject((cl_command_queue)queue, (cl_mem)handle, ptr, 0, 0, 0);
+
+    if (error == CL_SUCCESS)
+        return SICO_Ok;
+
+    sico_log("clEnqueueUnmapMemObject failed, error %s\n", getErrorString(error));
+
+    return SICO_GeneralFail;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Creates the device memory for a parameter. Zero-copy buffers wraps the host memory directly, others comes from
+// the buffer pool and needs to be uploaded
+
+static cl_mem createParamBuffer(SICODevice device, SICOParam* param, int index, int* needsUpload)
+{
+    cl_int error;
+    cl_mem mem;
+
+    *needsUpload = 0;
+
+    // outputs left on the device are meant to feed other kernels so they always get a real device buffer
+
+    if (param->policy != SICO_LeaveOnDevice && useHostPtr(device, param))
+    {
+        if (!(mem = clCreateBuffer(device->context, param->type | CL_MEM_USE_HOST_PTR, param->size, (void*)param->data, &error)))
+            sico_log("Zero-copy clCreateBuffer failed (param %d), error %s\n", index, getErrorString(error));
+
+        return mem;
+    }
+
+    if (!(mem = poolAcquire(device, param->size, &error)))
+    {
+        sico_log("GPU clCreateBuffer failed (param %d), error %s\n", index, getErrorString(error));
+        return 0;
+    }
+
+    *needsUpload = 1;
+
+    return mem;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Resident data. The device copy is kept between launches and only the parts that has changed since the last sync
+// are uploaded. Changes are either marked by the user (scResidentMarkDirty) or found by hashing the host data in
+// blocks. Zero-copy buffers never needs any uploads.
+
+#define SICO_RESIDENT_MAX_RANGES 8
+#define SICO_RESIDENT_BLOCK_SIZE (64 * 1024)
+
+struct SICOResident
+{
+    SICODevice device;
+    cl_mem mem;
+    int zeroCopy;
+    void* host;
+    size_t size;
+    int flags;
+    uint64_t* blockHashes;  // only used with content hashing, 0 otherwise
+    size_t ranges[SICO_RESIDENT_MAX_RANGES][2]; // dirty byte ranges (start, end)
+    int rangeCount;
+    SICOResidentStats stats;
+    SICOMutex lock;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOResident scCreateResident(SICODevice device, int flags, void* data, size_t size, int hashContents)
+{
+    struct SICOResident* resident;
+    SICOParam param = { 0 };
+    int upload;
+
+    if (!device || !device->context || !data || size == 0)
+        return 0;
+
+    param.data = (uintptr_t)data;
+    param.type = (unsigned int)flags;
+    param.size = size;
+
+    resident = mallocZero(sizeof(struct SICOResident));
+    resident->device = device;
+    resident->host = data;
+    resident->size = size;
+    resident->flags = flags;
+    mutexInit(&resident->lock);
+
+    if (!(resident->mem = createParamBuffer(device, &param, 0, &upload)))
+    {
+        mutexDestroy(&resident->lock);
+        free(resident);
+        return 0;
+    }
+
+    resident->zeroCopy = !upload;
+
+    if (hashContents && upload)
+        resident->blockHashes = mallocZero(sizeof(uint64_t) * ((size + SICO_RESIDENT_BLOCK_SIZE - 1) / SICO_RESIDENT_BLOCK_SIZE));
+
+    // everything is dirty until the first sync
+
+    scResidentMarkDirty(resident, 0, size);
+
+    return resident;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scResidentMarkDirty(SICOResident resident, size_t offset, size_t size)
+{
+    size_t start, end;
+
+    if (!resident || offset >= resident->size)
+        return;
+
+    start = offset;
+    end = (size == 0 || size > resident->size - offset) ? resident->size : offset + size;
+
+    mutexLock(&resident->lock);
+
+    resident->stats.version++;
+
+    if (resident->zeroCopy)
+    {
+        mutexUnlock(&resident->lock);
+        return;
+    }
+
+    // merge with an overlapping (or touching) range, otherwise add a new one. If we run out of ranges everything is
+    // collapsed into one range covering all of them
+
+    for (int i = 0; i < resident->rangeCount; ++i)
+    {
+        if (start <= resident->ranges[i][1] && end >= resident->ranges[i][0])
+        {
+            start = start < resident->ranges[i][0] ? start : resident->ranges[i][0];
+            end = end > resident->ranges[i][1] ? end : resident->ranges[i][1];
+            resident->ranges[i][0] = resident->ranges[--resident->rangeCount][0];
+            resident->ranges[i][1] = resident->ranges[resident->rangeCount][1];
+            i = -1;
+        }
+    }
+
+    if (resident->rangeCount == SICO_RESIDENT_MAX_RANGES)
+    {
+        for (int i = 0; i < resident->rangeCount; ++i)
+        {
+            start = start < resident->ranges[i][0] ? start : resident->ranges[i][0];
+            end = end > resident->ranges[i][1] ? end : resident->ranges[i][1];
+        }
+
+        resident->rangeCount = 0;
+    }
+
+    resident->ranges[resident->rangeCount][0] = start;
+    resident->ranges[resident->rangeCount][1] = end;
+    resident->rangeCount++;
+
+    mutexUnlock(&resident->lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static cl_int uploadResidentRange(cl_command_queue queue, struct SICOResident* resident, size_t start, size_t end, cl_bool blocking)
+{
+    cl_int error = enqueueWrite(queue, resident->mem, blocking, start, end - start, (uint8_t*)resident->host + start, 0, 0, 0);
+
+    if (error == CL_SUCCESS)
+    {
+        resident->stats.uploads++;
+        resident->stats.uploadedBytes += end - start;
+    }
+
+    return error;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Has to be called with the resident lock held. Rehashes all blocks and uploads the runs of blocks that changed
+
+static cl_int syncResidentHashed(cl_command_queue queue, struct SICOResident* resident, cl_bool blocking)
+{
+    size_t blockCount = (resident->size + SICO_RESIDENT_BLOCK_SIZE - 1) / SICO_RESIDENT_BLOCK_SIZE;
+    size_t runStart = 0;
+    int inRun = 0;
+    cl_int error = CL_SUCCESS;
+
+    for (size_t i = 0; i <= blockCount && error == CL_SUCCESS; ++i)
+    {
+        int changed = 0;
+
+        if (i < blockCount)
+        {
+            size_t offset = i * SICO_RESIDENT_BLOCK_SIZE;
+            size_t size = resident->size - offset < SICO_RESIDENT_BLOCK_SIZE ? resident->size - offset : SICO_RESIDENT_BLOCK_SIZE;
+            uint64_t hash = hashData(SICO_HASH_INIT, (uint8_t*)resident->host + offset, size);
+
+            // marked ranges are always uploaded (the first sync marks everything)
+
+            for (int r = 0; r < resident->rangeCount && !changed; ++r)
+                changed = offset < resident->ranges[r][1] && offset + size > resident->ranges[r][0];
+
+            changed |= hash != resident->blockHashes[i];
+            resident->blockHashes[i] = hash;
+        }
+
+        if (changed && !inRun)
+        {
+            runStart = i;
+            inRun = 1;
+        }
+        else if (!changed && inRun)
+        {
+            size_t end = i * SICO_RESIDENT_BLOCK_SIZE;
+            error = uploadResidentRange(queue, resident, runStart * SICO_RESIDENT_BLOCK_SIZE, end < resident->size ? end : resident->size, blocking);
+            inRun = 0;
+        }
+    }
+
+    return error;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static SICOState syncResident(SICOCommanQueue queue, SICOResident resident, cl_bool blocking)
+{
+    cl_int error = CL_SUCCESS;
+
+    if (!queue || !resident)
+        return SICO_GeneralFail;
+
+    if (resident->zeroCopy)
+        return SICO_Ok;
+
+    poolUse(resident->device, resident->mem, (cl_command_queue)queue);
+
+    mutexLock(&resident->lock);
+
+    if (resident->blockHashes)
+    {
+        error = syncResidentHashed((cl_command_queue)queue, resident, blocking);
+    }
+    else
+    {
+        for (int i = 0; i < resident->rangeCount && error == CL_SUCCESS; ++i)
+            error = uploadResidentRange((cl_command_queue)queue, resident, resident->ranges[i][0], resident->ranges[i][1], blocking);
+    }
+
+    if (error == CL_SUCCESS)
+        resident->rangeCount = 0;
+
+    mutexUnlock(&resident->lock);
+
+    if (error != CL_SUCCESS)
+    {
+        sico_log("Unable to upload resident data, error %s\n", getErrorString(error));
+        return SICO_GeneralFail;
+    }
+
+    return SICO_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scResidentSync(SICOCommanQueue queue, SICOResident resident)
+{
+    return syncResident(queue, resident, CL_FALSE);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Marked ranges that overlaps the read are uploaded first so the read doesn't overwrite host changes the device
+// hasn't seen. The hashes of blocks that are entirely read are updated so the next sync doesn't upload them again,
+// partly read blocks keeps their old hash as the rest of the block may have unmarked host changes.
+
+SICOState scResidentReadBack(SICOCommanQueue queue, SICOResident resident, size_t offset, size_t size)
+{
+    size_t firstBlock, endBlock;
+    int overlapsDirty = 0;
+    cl_int error;
+
+    if (!queue || !resident || offset >= resident->size)
+        return SICO_GeneralFail;
+
+    if (size == 0 || size > resident->size - offset)
+        size = resident->size - offset;
+
+    mutexLock(&resident->lock);
+
+    for (int i = 0; i < resident->rangeCount && !overlapsDirty; ++i)
+        overlapsDirty = offset < resident->ranges[i][1] && offset + size > resident->ranges[i][0];
+
+    mutexUnlock(&resident->lock);
+
+    if (overlapsDirty && syncResident(queue, resident, CL_TRUE) != SICO_Ok)
+        return SICO_GeneralFail;
+
+    if (resident->zeroCopy)
+    {
+        void* ptr = clEnqueueMapBuffer((cl_command_queue)queue, resident->mem, CL_TRUE, CL_MAP_READ, offset, size, 0, 0, 0, &error);
+
+        if (error == CL_SUCCESS)
+            error = clEnqueueUnmapMemObject((cl_command_queue)queue, resident->mem, ptr, 0, 0, 0);
+    }
+    else
+    {
+        poolUse(resident->device, resident->mem, (cl_command_queue)queue);
+        error = enqueueRead((cl_command_queue)queue, resident->mem, CL_TRUE, offset, size, (uint8_t*)resident->host + offset, 0, 0, 0);
+    }
+
+    if (error != CL_SUCCESS)
+    {
+        sico_log("Unable to read back resident data, error %s\n", getErrorString(error));
+        return SICO_GeneralFail;
+    }
+
+    // the last block is shorter so it's entirely read if the range goes to the end
+
+    firstBlock = (offset + SICO_RESIDENT_BLOCK_SIZE - 1) / SICO_RESIDENT_BLOCK_SIZE;
+    endBlock = offset + size == resident->size ? (resident->size + SICO_RESIDENT_BLOCK_SIZE - 1) / SICO_RESIDENT_BLOCK_SIZE
+                                               : (offset + size) / SICO_RESIDENT_BLOCK_SIZE;
+
+    mutexLock(&resident->lock);
+
+    if (resident->blockHashes)
+    {
+        for (size_t i = firstBlock; i < endBlock; ++i)
+        {
+            size_t blockOffset = i * SICO_RESIDENT_BLOCK_SIZE;
+            size_t blockSize = resident->size - blockOffset < SICO_RESIDENT_BLOCK_SIZE ? resident->size - blockOffset : SICO_RESIDENT_BLOCK_SIZE;
+            resident->blockHashes[i] = hashData(SICO_HASH_INIT, (uint8_t*)resident->host + blockOffset, blockSize);
+        }
+    }
+
+    mutexUnlock(&resident->lock);
+
+    return SICO_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOHandle scResidentHandle(SICOResident resident)
+{
+    return resident ? (SICOHandle)resident->mem : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scGetResidentStats(SICOResident resident, SICOResidentStats* stats)
+{
+    if (!resident || !stats)
+        return;
+
+    mutexLock(&resident->lock);
+    *stats = resident->stats;
+    mutexUnlock(&resident->lock);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scDestroyResident(SICOResident resident)
+{
+    if (!resident)
+        return;
+
+    poolRelease(resident->mem);
+    mutexDestroy(&resident->lock);
+    free(resident->blockHashes);
+    free(resident);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Lazy outputs. Kernels write to the device buffer and the host only gets the data when it asks for it with
+// scAcquireHost. On unified memory devices the buffer is mapped instead of copied, it's unmapped again before the
+// next kernel uses it.
+
+struct SICOOutput
+{
+    SICODevice device;
+    cl_mem mem;
+    size_t size;
+    void* host;         // host copy (user supplied or allocated on first acquire), 0 when mapping
+    int ownsHost;
+    int useMap;
+    void* mapped;       // mapped pointer while the host has access (useMap only)
+    int stale;          // device has data the host hasn't seen yet
+    SICOMutex lock;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOOutput scCreateOutput(SICODevice device, int flags, size_t size, void* hostPtr)
+{
+    struct SICOOutput* output;
+    cl_int error;
+
+    if (!device || !device->context || size == 0)
+        return 0;
+
+    output = mallocZero(sizeof(struct SICOOutput));
+    output->device = device;
+    output->size = size;
+    output->host = hostPtr;
+    output->useMap = !hostPtr && device->unifiedMemory;
+    mutexInit(&output->lock);
+
+    // Pooled buffers are always read-write so any other flags get a buffer of their own (poolRelease frees it)
+
+    if (output->useMap)
+        output->mem = clCreateBuffer(device->context, (cl_mem_flags)flags | CL_MEM_ALLOC_HOST_PTR, size, 0, &error);
+    else if (flags != 0 && flags != SICO_MEM_READ_WRITE)
+        output->mem = clCreateBuffer(device->context, (cl_mem_flags)flags, size, 0, &error);
+    else
+        output->mem = poolAcquire(device, size, &error);
+
+    if (!output->mem)
+    {
+        sico_log("Unable to create output buffer, error %s\n", getErrorString(error));
+        mutexDestroy(&output->lock);
+        free(output);
+        return 0;
+    }
+
+    return output;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOHandle scOutputHandle(SICOOutput output)
+{
+    return output ? (SICOHandle)output->mem : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Called before a kernel uses the buffer. The host mapping has to go away and if the kernel can write to it the
+// host data is out of date
+
+static SICOState prepareOutput(cl_command_queue queue, SICOOutput output, int written)
+{
+    cl_int error = CL_SUCCESS;
+
+    poolUse(output->device, output->mem, queue);
+
+    mutexLock(&output->lock);
+
+    if (output->mapped)
+    {
+        error = clEnqueueUnmapMemObject(queue, output->mem, output->mapped, 0, 0, 0);
+        output->mapped = 0;
+    }
+
+    if (written)
+        output->stale = 1;
+
+    mutexUnlock(&output->lock);
+
+    if (error != CL_SUCCESS)
+    {
+        sico_log("clEnqueueUnmapMemObject failed, error %s\n", getErrorString(error));
+        return SICO_GeneralFail;
+    }
+
+    return SICO_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scOutputInvalidate(SICOCommanQueue queue, SICOOutput output)
+{
+    if (output && queue)
+        prepareOutput((cl_command_queue)queue, output, 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int scOutputIsStale(SICOOutput output)
+{
+    int stale;
+
+    if (!output)
+        return 0;
+
+    mutexLock(&output->lock);
+    stale = output->stale;
+    mutexUnlock(&output->lock);
+
+    return stale;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void* scAcquireHost(SICOCommanQueue queue, SICOOutput output)
+{
+    cl_int error = CL_SUCCESS;
+    void* result;
+
+    if (!queue || !output)
+        return 0;
+
+    mutexLock(&output->lock);
+
+    if (output->useMap)
+    {
+        // mapping again after the kernel has run makes sure the host sees the latest data
+
+        if (!output->mapped)
+        {
+            output->mapped = clEnqueueMapBuffer((cl_command_queue)queue, output->mem, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+                                                0, output->size, 0, 0, 0, &error);
+        }
+
+        result = output->mapped;
+    }
+    else
+    {
+        if (!output->host)
+        {
+            output->host = malloc(output->size);
+            output->ownsHost = 1;
+        }
+
+        if (output->stale)
+            error = enqueueRead((cl_command_queue)queue, output->mem, CL_TRUE, 0, output->size, output->host, 0, NULL, NULL);
+
+        result = output->host;
+    }
+
+    if (error == CL_SUCCESS)
+        output->stale = 0;
+
+    mutexUnlock(&output->lock);
+
+    if (error != CL_SUCCESS)
+    {
+        sico_log("Unable to get output to the host, error %s\n", getErrorString(error));
+        return 0;
+    }
+
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scDestroyOutput(SICOCommanQueue queue, SICOOutput output)
+{
+    if (!output)
+        return;
+
+    if (output->mapped && queue)
+    {
+        clEnqueueUnmapMemObject((cl_command_queue)queue, output->mem, output->mapped, 0, 0, 0);
+        clFinish((cl_command_queue)queue);
+    }
+
+    poolRelease(output->mem);
+    mutexDestroy(&output->lock);
+
+    if (output->ownsHost)
+        free(output->host);
+
+    free(output);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Images. The host pixels are kept with the image so params can upload and read them back like buffers
+
+struct SICOImage
+{
+    SICODevice device;
+    cl_mem mem;
+    void* host;
+    size_t size[3];         // width, height, depth (1 for 2D images)
+    size_t rowPitch;        // host pitches
+    size_t slicePitch;
+    size_t pixelSize;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int scHasImageSupport(SICODevice device)
+{
+    cl_bool support = CL_FALSE;
+
+    if (!device)
+        return 0;
+
+    clGetDeviceInfo(device->deviceId, CL_DEVICE_IMAGE_SUPPORT, sizeof(support), &support, 0);
+
+    return support == CL_TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static SICOImage createImage(SICODevice device, int flags, int channelOrder, int channelType, const size_t* size,
+                             size_t rowPitch, size_t slicePitch, void* hostPtr)
+{
+    struct SICOImage* image;
+    cl_image_format format;
+    cl_image_desc desc;
+    cl_int error;
+
+    if (!device || !device->context || size[0] == 0 || size[1] == 0 || size[2] == 0)
+        return 0;
+
+    if (!scHasImageSupport(device))
+    {
+        sico_log("%s", "Device doesn't support images\n");
+        return 0;
+    }
+
+    format.image_channel_order = (cl_channel_order)channelOrder;
+    format.image_channel_data_type = (cl_channel_type)channelType;
+
+    memset(&desc, 0, sizeof(desc));
+    desc.image_type = size[2] > 1 ? CL_MEM_OBJECT_IMAGE3D : CL_MEM_OBJECT_IMAGE2D;
+    desc.image_width = size[0];
+    desc.image_height = size[1];
+    desc.image_depth = size[2];
+
+    image = mallocZero(sizeof(struct SICOImage));
+    image->device = device;
+    image->host = hostPtr;
+
+    if (!(image->mem = clCreateImage(device->context, (cl_mem_flags)flags, &format, &desc, 0, &error)))
+    {
+        sico_log("Unable to create image, error %s\n", getErrorString(error));
+        free(image);
+        return 0;
+    }
+
+    clGetImageInfo(image->mem, CL_IMAGE_ELEMENT_SIZE, sizeof(size_t), &image->pixelSize, 0);
+
+    for (int i = 0; i < 3; ++i)
+        image->size[i] = size[i];
+
+    image->rowPitch = rowPitch ? rowPitch : size[0] * image->pixelSize;
+    image->slicePitch = slicePitch ? slicePitch : image->rowPitch * size[1];
+
+    return image;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOImage scCreateImage2D(SICODevice device, int flags, int channelOrder, int channelType, size_t width, size_t height,
+                          size_t rowPitch, void* hostPtr)
+{
+    size_t size[] = { width, height, 1 };
+
+    return createImage(device, flags, channelOrder, channelType, size, rowPitch, 0, hostPtr);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOImage scCreateImage3D(SICODevice device, int flags, int channelOrder, int channelType, size_t width, size_t height,
+                          size_t depth, size_t rowPitch, size_t slicePitch, void* hostPtr)
+{
+    size_t size[] = { width, height, depth };
+
+    // a 3D image with depth 1 would be created as a 2D image
+
+    if (depth < 2)
+        return 0;
+
+    return createImage(device, flags, channelOrder, channelType, size, rowPitch, slicePitch, hostPtr);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOHandle scGetImageHandle(SICOImage image)
+{
+    return image ? (SICOHandle)image->mem : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Transfers a region between the host pixels and the image. The host data has the same layout as the image so the
+// region starts at the same pixel on both sides
+
+static SICOState copyImage(SICOCommanQueue queue, SICOImage image, const SICORegion* region, int blocking, int read)
+{
+    size_t origin[3] = { 0, 0, 0 };
+    size_t size[3];
+    cl_event temp;
+    cl_event* event;
+    cl_int error;
+    uint8_t* host;
+
+    if (!queue || !image || !image->host)
+        return SICO_GeneralFail;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        if (region)
+        {
+            origin[i] = region->origin[i];
+            size[i] = region->size[i] ? region->size[i] : 1;
+        }
+        else
+        {
+            size[i] = image->size[i];
+        }
+
+        if (origin[i] + size[i] > image->size[i])
+            return SICO_GeneralFail;
+    }
+
+    host = (uint8_t*)image->host + origin[2] * image->slicePitch + origin[1] * image->rowPitch + origin[0] * image->pixelSize;
+    event = getProfileEvent(0, &temp);
+
+    // 2D images requires a slice pitch of 0
+
+    if (read)
+    {
+        error = clEnqueueReadImage((cl_command_queue)queue, image->mem, blocking ? CL_TRUE : CL_FALSE, origin, size,
+                                   image->rowPitch, image->size[2] > 1 ? image->slicePitch : 0, host, 0, NULL, event);
+    }
+    else
+    {
+        error = clEnqueueWriteImage((cl_command_queue)queue, image->mem, blocking ? CL_TRUE : CL_FALSE, origin, size,
+                                    image->rowPitch, image->size[2] > 1 ? image->slicePitch : 0, host, 0, NULL, event);
+    }
+
+    if (error != CL_SUCCESS)
+    {
+        sico_log("Unable to %s image, error %s\n", read ? "read" : "write", getErrorString(error));
+        return SICO_GeneralFail;
+    }
+
+    if (read)
+        profileEvent("read_image", SICO_ProfileRead, size[0] * size[1] * size[2] * image->pixelSize, event, 0);
+    else
+        profileEvent("write_image", SICO_ProfileWrite, size[0] * size[1] * size[2] * image->pixelSize, event, 0);
+
+    return SICO_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scWriteImage(SICOCommanQueue queue, SICOImage image, const SICORegion* region, int blocking)
+{
+    return copyImage(queue, image, region, blocking, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scReadImage(SICOCommanQueue queue, SICOImage image, const SICORegion* region, int blocking)
+{
+    return copyImage(queue, image, region, blocking, 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scDestroyImage(SICOImage image)
+{
+    if (!image)
+        return;
+
+    clReleaseMemObject(image->mem);
+    free(image);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOSampler scCreateSampler(SICODevice device, int normalizedCoords, int addressMode, int filterMode)
+{
+    cl_sampler sampler;
+    cl_int error;
+
+    if (!device || !device->context)
+        return 0;
+
+    if (!(sampler = clCreateSampler(device->context, normalizedCoords ? CL_TRUE : CL_FALSE, (cl_addressing_mode)addressMode,
+                                    (cl_filter_mode)filterMode, &error)))
+    {
+        sico_log("Unable to create sampler, error %s\n", getErrorString(error));
+        return 0;
+    }
+
+    return (SICOSampler)sampler;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scReleaseSampler(SICOSampler sampler)
+{
+    if (sampler)
+        clReleaseSampler((cl_sampler)sampler);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Buffers that are owned by something else than the params (and thus not created, uploaded or freed by them)
+
+static int isExternalParam(const SICOParam* param)
+{
+    return param->policy == SICO_UserSuppliedData || param->policy == SICO_Resident || param->policy == SICO_Output ||
+           param->policy == SICO_Image || param->policy == SICO_Sampler;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Buffers come from the pool and can hold data of an earlier user, so the host data is uploaded even for write-only
+// params unless SICO_Uninitialized says the kernel writes all of it
+
+static int skipsUpload(const SICOParam* param)
+{
+    return param->type == SICO_MEM_WRITE_ONLY && param->policy == SICO_Uninitialized;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Uploads are only non-blocking for scSetupParametersAsync as the host data then has to stay unchanged until the
+// kernel has run
+
+static int setupParameters(SICODevice device, SICOKernel kernel, SICOCommanQueue queue, SICOParam* params, int paramCount,
+                           cl_bool blocking)
+{
+    uint8_t needsUpload[256] = { 0 };
+    cl_int error;
+    cl_mem mem;
+    int upload;
+
+    if (!device)
+        return SICO_NoDevice;
+
+    if (!kernel || !queue || !params || params == 0)
+        return SICO_GeneralFail;
+
+    if (!device->context)
+        return SICO_GeneralFail;
+
+    assert(paramCount < (int)sizeof(needsUpload));
+
+    // Create memory objects
+
+    for (int i = 0; i < paramCount; ++i)
+    {
+        SICOParam* param = &params[i];
+
+        if (param->type == SICO_PARAMETER)
+        {
+            param->privData = 0;
+            continue;
+        }
+
+        // buffers supplied by the user (such as the output of an earlier kernel) are bound as is
+
+        if (param->policy == SICO_UserSuppliedData)
+        {
+            param->privData = (void*)param->data;
+            continue;
+        }
+
+        if (param->policy == SICO_Resident)
+        {
+            if (syncResident(queue, (SICOResident)param->data, blocking) != SICO_Ok)
+                return SICO_GeneralFail;
+
+            param->privData = (void*)((SICOResident)param->data)->mem;
+            continue;
+        }
+
+        if (param->policy == SICO_Output)
+        {
+            if (prepareOutput((cl_command_queue)queue, (SICOOutput)param->data, param->type != SICO_MEM_READ_ONLY) != SICO_Ok)
+                return SICO_GeneralFail;
+
+            param->privData = (void*)((SICOOutput)param->data)->mem;
+            continue;
+        }
+
+        // samplers are bound the same way as buffers (both are pointer sized handles)
+
+        if (param->policy == SICO_Sampler)
+        {
+            param->privData = (void*)param->data;
+            continue;
+        }
+
+        if (param->policy == SICO_Image)
+        {
+            SICOImage image = (SICOImage)param->data;
+
+            if (param->type != SICO_MEM_WRITE_ONLY && scWriteImage(queue, image, 0, (int)blocking) != SICO_Ok)
+                return SICO_GeneralFail;
+
+            param->privData = (void*)image->mem;
+            continue;
+        }
+
+        if (!(mem = createParamBuffer(device, param, i, &upload)))
+            return SICO_GeneralFail;
+
+        needsUpload[i] = (uint8_t)(upload && !skipsUpload(param));
+        param->privData = (void*)mem;
+
+        poolUse(device, mem, (cl_command_queue)queue);
+    }
+
+    // Setup the memory objects that needs to be transfered
+
+    for (int i = 0; i < paramCount; ++i)
+    {
+        SICOParam* param = &params[i];
+
+        if (needsUpload[i] == 0)
+            continue;
+
+        if ((error = enqueueWrite((cl_command_queue)queue, (cl_mem)param->privData, blocking, 0, param->size, (void*)param->data, 0, NULL, NULL)) != CL_SUCCESS)
+        {
+            sico_log("clEnqueueWriteBuffer failed (param %d), error %s\n", i, getErrorString(error));
+            return SICO_GeneralFail;
+        }
+    }
+
+    // Setup kernel parameters
+
+    for (int i = 0; i < paramCount; ++i)
+    {
+        SICOParam* param = &params[i];
+
+        if (param->type == SICO_PARAMETER)
+            error = setKernelArg(kernel, (cl_uint)i, param->size, (void*)param->data);
+        else
+            error = setKernelArg(kernel, (cl_uint)i, sizeof(cl_mem), (cl_mem) & param->privData);
+
+        if (error != CL_SUCCESS)
+        {
+            sico_log("Unable to clSetKernelArg (param %d), error %s\n", i, getErrorString(error));
+            return SICO_GeneralFail;
+        }
+    }
+
+    return SICO_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int scSetupParameters(SICODevice device, SICOKernel kernel, SICOCommanQueue queue, SICOParam* params, int paramCount)
+{
+    return setupParameters(device, kernel, queue, params, paramCount, CL_TRUE);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int scSetupParametersAsync(SICODevice device, SICOKernel kernel, SICOCommanQueue queue, SICOParam* params, int paramCount)
+{
+    return setupParameters(device, kernel, queue, params, paramCount, CL_FALSE);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static SICOState writeMemoryParams(SICODevice device, SICOCommanQueue queue, SICOParam* params, uint32_t paramCount, cl_bool blocking)
+{
+    uint32_t i;
+    cl_int error;
+
+    for (i = 0; i < paramCount; ++i)
+    {
+        SICOParam* param = &params[i];
+
+        if (param->type == SICO_MEM_READ_ONLY || param->type == SICO_PARAMETER || !param->privData ||
+            param->policy == SICO_UserSuppliedData || param->policy == SICO_LeaveOnDevice || param->policy == SICO_Output ||
+            param->policy == SICO_Sampler)
+        {
+            continue;
+        }
+
+        if (param->policy == SICO_Image)
+        {
+            if (scReadImage(queue, (SICOImage)param->data, 0, blocking) != SICO_Ok)
+                return SICO_GeneralFail;
+
+            continue;
+        }
+
+        // the device copy of resident data is authoritative, the parts the host needs are read with
+        // scResidentReadBack (zero-copy data is still mapped below so the host sees the results)
+
+        if (param->policy == SICO_Resident && !((SICOResident)param->data)->zeroCopy)
+            continue;
+
+        // Zero-copy buffers already lives in host memory, map/unmap is only done to make sure the host sees the
+        // results (on unified memory devices this doesn't copy anything)
+
+        if (isHostPtrBuffer((cl_mem)param->privData))
+        {
+            void* ptr = clEnqueueMapBuffer((cl_command_queue)queue, (cl_mem)param->privData, blocking, CL_MAP_READ, 0, param->size, 0, 0, 0, &error);
+
+            if (error == CL_SUCCESS)
+                error = clEnqueueUnmapMemObject((cl_command_queue)queue, (cl_mem)param->privData, ptr, 0, 0, 0);
+
+            if (error != CL_SUCCESS)
+            {
+                sico_log("Unable to map zero-copy buffer (param %d), error %s\n", i, getErrorString(error));
+                return SICO_GeneralFail;
+            }
+
+            continue;
+        }
+
+        poolUse(device, (cl_mem)param->privData, (cl_command_queue)queue);
+
+        if ((error = enqueueRead((cl_command_queue)queue, (cl_mem)param->privData, blocking, 0, param->size, (void*)param->data, 0, NULL, NULL)) != CL_SUCCESS)
+        {
+            sico_log("clEnqueueReadBuffer failed (param %d), error %s\n", i, getErrorString(error));
+            return SICO_GeneralFail;
+        }
+    }
+
+    return SICO_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scWriteMemoryParams(SICODevice device, SICOCommanQueue queue, SICOParam* params, uint32_t paramCount)
+{
+    return writeMemoryParams(device, queue, params, paramCount, CL_TRUE);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scWriteMemoryParamsAsync(SICODevice device, SICOCommanQueue queue, SICOParam* params, uint32_t paramCount, SICOEvent* event)
+{
+    cl_int error;
+
+    if (writeMemoryParams(device, queue, params, paramCount, CL_FALSE) != SICO_Ok)
+        return SICO_GeneralFail;
+
+    // The queue is in-order so a marker after the reads completes when all of them are done
+
+    if ((error = clEnqueueMarkerWithWaitList((cl_command_queue)queue, 0, 0, (cl_event*)event)) != CL_SUCCESS)
+    {
+        sico_log("clEnqueueMarkerWithWaitList failed, error %s\n", getErrorString(error));
+        return SICO_GeneralFail;
+    }
+
+    return SICO_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void parseDevicePolicy(const char* text);
+
+int scInitialize()
+{
+    const char* cacheDir;
+    const char* policy;
+    int result;
+
+    if (loadAcquire(&s_initialized))
+        return 1;
+
+    mutexLock(&s_initMutex);
+
+    if (!s_initialized)
+    {
+        if (clGetPlatformIDs(1, &s_platformId, 0) != CL_SUCCESS)
+        {
+            s_platformId = 0;
+        }
+        else
+        {
+            if (s_programCacheDir[0] == 0 && (cacheDir = getenv("SICO_PROGRAM_CACHE_DIR")))
+                scSetProgramCacheDir(cacheDir);
+
+            if (getenv("SICO_PROFILE"))
+                s_profiling = 1;
+
+            if ((policy = getenv("SICO_DEVICE")))
+                parseDevicePolicy(policy);
+
+            if (getenv("SICO_DEVICE_BENCHMARK"))
+                s_deviceBenchmark = 1;
+
+            createThreadKey();
+
+            storeRelease(&s_initialized, 1);
+        }
+    }
+
+    result = s_initialized;
+
+    mutexUnlock(&s_initMutex);
+
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void stopCompileThreads();
+static void releaseAllThreadQueues();
+static void releasePrimitives(SICODevice device);
+
+void scClose()
+{
+    stopCompileThreads();
+    scReleaseKernels();
+    releaseAllThreadQueues();
+
+    for (int i = 0; i < s_deviceCount; ++i)
+    {
+        SICODevice device = s_devices[i];
+
+        destroyBufferPool(device);
+        releasePrimitives(device);
+
+        if (device->queue)
+            clReleaseCommandQueue(device->queue);
+
+        if (device->context)
+        {
+            int error = clReleaseContext(device->context);
+
+            if (error != CL_SUCCESS)
+                sico_log("%s ", getErrorString(error));
+        }
+
+        free(device);
+    }
+
+    free(s_devices);
+
+    for (int c = 0; c < SICO_CategoryCount; ++c)
+    {
+        free(s_categoryDevices[c]);
+        s_categoryDevices[c] = 0;
+        s_categoryDeviceCounts[c] = 0;
+    }
+
+    s_devices = 0;
+    s_deviceCount = 0;
+    s_platformId = 0;
+
+    storeRelease(&s_devicesReady, 0);
+    storeRelease(&s_initialized, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int scListDevices(char* output, size_t size)
+{
+    int i, count;
+    SICODevice* devices;
+
+    if (!(devices = scGetAllDevices(&count)))
+        return 0;
+
+    for (i = 0; i < count; ++i)
+    {
+        cl_device_id id = 0;
+
+        if (!devices[i])
+            continue;
+
+        id = devices[i]->deviceId;
+
+        printOrAppendString(output, id, CL_DEVICE_NAME, i + 1, 0, "%d.%d Device: %s\n", &size);
+        printOrAppendString(output, id, CL_DEVICE_VERSION, i + 1, 1, " %d.%d Hardware version: %s\n", &size);
+        printOrAppendString(output, id, CL_DEVICE_VERSION, i + 1, 2, " %d.%d Software version: %s\n", &size);
+        printOrAppendString(output, id, CL_DEVICE_OPENCL_C_VERSION, i + 1, 3, " %d.%d OpenCL C version: %s\n", &size);
+        printOrAppendInt(output, id, CL_DEVICE_MAX_COMPUTE_UNITS, i + 1, 4, " %d.%d Parallel compute units: %d\n", &size);
+    }
+
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Device selection. Devices are scored from what they report (compute units * clock * lanes, memory sizes, double
+// support) or, when benchmarking is enabled, from a small measured bandwidth/compute run that is done once per
+// device and stored in the program cache directory.
+
+static void parseDevicePolicy(const char* text)
+{
+    if (!strcmp(text, "cpu"))
+        scSetDevicePolicy(SICO_DevicePolicyPreferCPU, 0);
+    else if (!strcmp(text, "gpu"))
+        scSetDevicePolicy(SICO_DevicePolicyPreferGPU, 0);
+    else if (!strcmp(text, "bandwidth"))
+        scSetDevicePolicy(SICO_DevicePolicyBandwidth, 0);
+    else if (text[0] >= '0' && text[0] <= '9')
+        scSetDevicePolicy(SICO_DevicePolicyIndex, atoi(text));
+    else if (strcmp(text, "default"))
+        sico_log("Unknown device policy %s (use default, cpu, gpu, bandwidth or a device index)\n", text);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scSetDevicePolicy(SICODevicePolicy policy, int index)
+{
+    s_devicePolicy = policy;
+    s_devicePolicyIndex = index;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scSetDeviceBenchmark(int enable)
+{
+    s_deviceBenchmark = enable;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static SICOMutex s_measureMutex = SICO_MUTEX_INIT;
+
+static SICOKernel getKernelFromSource(SICODevice device, const char* name, const char* source, size_t size,
+                                      const char* kernelName, const char* buildOpts);
+
+static const char* s_measureSource =
+    "__kernel void sico_measure_copy(global const float4* input, global float4* output)\n"
+    "{\n"
+    "    size_t i = get_global_id(0);\n"
+    "    output[i] = input[i];\n"
+    "}\n"
+    "\n"
+    "__kernel void sico_measure_fma(global float* output, float a, float b)\n"
+    "{\n"
+    "    float x = (float)get_global_id(0);\n"
+    "    float y = x * 0.5f;\n"
+    "\n"
+    "    for (int i = 0; i < 256; ++i)\n"
+    "    {\n"
+    "        x = fma(x, a, b);\n"
+    "        y = fma(y, a, b);\n"
+    "    }\n"
+    "\n"
+    "    output[get_global_id(0)] = x + y;\n"
+    "}\n";
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Best time (in seconds) of a few runs of a kernel, 0 on failure
+
+static double timeMeasureKernel(cl_command_queue queue, SICOKernel kernel, size_t globalSize)
+{
+    double best = 0.0;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        double startTime = getTime();
+
+        if (clEnqueueNDRangeKernel(queue, kernel->kern, 1, 0, &globalSize, 0, 0, 0, 0) != CL_SUCCESS ||
+            clFinish(queue) != CL_SUCCESS)
+        {
+            return 0.0;
+        }
+
+        // first run is warmup
+
+        if (i > 0 && (best == 0.0 || getTime() - startTime < best))
+            best = getTime() - startTime;
+    }
+
+    return best;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint64_t getMeasureKey(SICODevice device)
+{
+    char identity[1024];
+    getDeviceIdentity(device->deviceId, identity, sizeof(identity));
+    return hashString(SICO_HASH_INIT, identity);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int loadDeviceMeasurement(SICODevice device, uint64_t key)
+{
+    char filename[1100];
+    unsigned long long fileKey;
+    double bandwidth, compute;
+    int found = 0;
+    FILE* f;
+
+    if (!s_programCacheDir[0])
+        return 0;
+
+    snprintf(filename, sizeof(filename), "%s/devices.txt", s_programCacheDir);
+
+    if (!(f = fopen(filename, "r")))
+        return 0;
+
+    while (fscanf(f, "%llx %lf %lf", &fileKey, &bandwidth, &compute) == 3)
+    {
+        if ((uint64_t)fileKey == key)
+        {
+            device->bandwidth = bandwidth;
+            device->compute = compute;
+            found = 1;
+        }
+    }
+
+    fclose(f);
+
+    return found;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void storeDeviceMeasurement(SICODevice device, uint64_t key)
+{
+    char filename[1100];
+    FILE* f;
+
+    if (!s_programCacheDir[0])
+        return;
+
+    snprintf(filename, sizeof(filename), "%s/devices.txt", s_programCacheDir);
+
+    if (!(f = fopen(filename, "a")))
+        return;
+
+    fprintf(f, "%016llx %f %f\n", (unsigned long long)key, device->bandwidth, device->compute);
+    fclose(f);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Measures copy bandwidth and fma throughput once per device (0 is stored if the device fails to run the kernels)
+
+static void measureDevice(SICODevice device)
+{
+    size_t count = 8 * 1024 * 1024;
+    size_t fmaCount = 1024 * 1024;
+    cl_command_queue queue = 0;
+    SICOKernel copyKernel, fmaKernel;
+    cl_mem input = 0, output = 0;
+    float a = 0.999f, b = 0.001f;
+    uint64_t key;
+    double time;
+
+    if (loadAcquire(&device->measured))
+        return;
+
+    mutexLock(&s_measureMutex);
+
+    if (device->measured)
+    {
+        mutexUnlock(&s_measureMutex);
+        return;
+    }
+
+    key = getMeasureKey(device);
+
+    if (loadDeviceMeasurement(device, key))
+    {
+        storeRelease(&device->measured, 1);
+        mutexUnlock(&s_measureMutex);
+        return;
+    }
+
+    while (count > 1024 && (cl_ulong)count * sizeof(float) * 4 > device->globalMemSize / 4)
+        count /= 2;
+
+    copyKernel = getKernelFromSource(device, "sico_measure", s_measureSource, strlen(s_measureSource), "sico_measure_copy", "");
+    fmaKernel = getKernelFromSource(device, "sico_measure", s_measureSource, strlen(s_measureSource), "sico_measure_fma", "");
+
+    // timed on a queue of our own so the finishes doesn't wait for (or get slowed down by) work of the user
+
+    if (copyKernel && fmaKernel)
+        queue = clCreateCommandQueue(device->context, device->deviceId, 0, 0);
+
+    if (queue)
+    {
+        input = clCreateBuffer(device->context, CL_MEM_READ_WRITE, count * sizeof(float) * 4, 0, 0);
+        output = clCreateBuffer(device->context, CL_MEM_READ_WRITE, count * sizeof(float) * 4, 0, 0);
+    }
+
+    if (input && output)
+    {
+        // the kernels are in the registry so anyone can get them with scGetKernelFromSource and the same source
+
+        mutexLock(&copyKernel->argLock);
+
+        setKernelArg(copyKernel, 0, sizeof(cl_mem), &input);
+        setKernelArg(copyKernel, 1, sizeof(cl_mem), &output);
+
+        if ((time = timeMeasureKernel(queue, copyKernel, count)) > 0.0)
+            device->bandwidth = (double)(count * sizeof(float) * 4 * 2) / time * 1e-9;
+
+        mutexUnlock(&copyKernel->argLock);
+        mutexLock(&fmaKernel->argLock);
+
+        setKernelArg(fmaKernel, 0, sizeof(cl_mem), &output);
+        setKernelArg(fmaKernel, 1, sizeof(float), &a);
+        setKernelArg(fmaKernel, 2, sizeof(float), &b);
+
+        if ((time = timeMeasureKernel(queue, fmaKernel, fmaCount)) > 0.0)
+            device->compute = (double)fmaCount * 256.0 * 2.0 * 2.0 / time * 1e-9;
+
+        mutexUnlock(&fmaKernel->argLock);
+
+        storeDeviceMeasurement(device, key);
+    }
+
+    if (input)
+        clReleaseMemObject(input);
+
+    if (output)
+        clReleaseMemObject(output);
+
+    if (queue)
+        clReleaseCommandQueue(queue);
+
+    storeRelease(&device->measured, 1);
+
+    mutexUnlock(&s_measureMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Estimated GFLOP/s from what the device reports. GPU compute units are SIMD cores so they get a number of lanes each,
+// CPU cores get their vector width.
+
+static double getEstimatedCompute(SICODevice device)
+{
+    double clock = device->clockFrequency ? (double)device->clockFrequency : 1000.0;
+    double units = device->computeUnits ? (double)device->computeUnits : 1.0;
+    double lanes = device->vectorWidth ? (double)device->vectorWidth : 1.0;
+
+    if (device->deviceType & CL_DEVICE_TYPE_GPU)
+        lanes = device->unifiedMemory ? 16.0 : 64.0;
+
+    return units * clock * lanes * 2.0 * 1e-3;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+double scGetDeviceScore(struct SICODevice* device, SICODevicePolicy policy)
+{
+    double score;
+
+    if (!device || !device->context)
+        return 0.0;
+
+    if (policy == SICO_DevicePolicyBandwidth)
+    {
+        measureDevice(device);
+        return device->bandwidth;
+    }
+
+    if (s_deviceBenchmark)
+    {
+        measureDevice(device);
+        score = device->compute;
+    }
+    else
+    {
+        score = getEstimatedCompute(device);
+    }
+
+    // devices with very little memory or local memory are unlikely to run real workloads well
+
+    if (device->globalMemSize && device->globalMemSize < 256 * 1024 * 1024)
+        score *= 0.5;
+
+    if (device->localMemSize && device->localMemSize < 16 * 1024)
+        score *= 0.5;
+
+    if (device->doubleSupport)
+        score *= 1.05;
+
+    return score;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct SICODevice* scGetBestDevice()
+{
+    SICODevicePolicy policy = s_devicePolicy;
+    cl_device_type preferType = 0;
+    SICODevice best = 0;
+    double bestScore = -1.0;
+    SICODevice* devices;
+    int i, count;
+
+    if (!(devices = scGetAllDevices(&count)) || count == 0)
+    {
+        sico_log("%s", "Unable to find any OpenCL devices in the system\n");
+        return 0;
+    }
+
+    if (policy == SICO_DevicePolicyIndex)
+    {
+        if (s_devicePolicyIndex >= 0 && s_devicePolicyIndex < count && devices[s_devicePolicyIndex]->context)
+            return devices[s_devicePolicyIndex];
+
+        sico_log("Device index %d is not valid (%d devices), using the default policy\n", s_devicePolicyIndex, count);
+        policy = SICO_DevicePolicyDefault;
+    }
+
+    if (policy == SICO_DevicePolicyPreferCPU)
+        preferType = CL_DEVICE_TYPE_CPU;
+    else if (policy == SICO_DevicePolicyPreferGPU)
+        preferType = CL_DEVICE_TYPE_GPU;
+
+    // preferred device type first, if there are none of that type all devices are considered
+
+    for (int pass = 0; pass < 2 && !best; ++pass)
+    {
+        for (i = 0; i < count; ++i)
+        {
+            double score;
+
+            if (!devices[i] || !devices[i]->context)
+                continue;
+
+            if (pass == 0 && preferType && !(devices[i]->deviceType & preferType))
+                continue;
+
+            if ((score = scGetDeviceScore(devices[i], policy)) > bestScore)
+            {
+                best = devices[i];
+                bestScore = score;
+            }
+        }
+    }
+
+    if (!best)
+        sico_log("%s", "No usable OpenCL device found\n");
+
+    return best;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// name is only used for logging and profiling
+
+static SICOKernel compileKernelFromSource(SICODevice device, const char* name, const char* source, size_t size,
+                                          const char* kernelName, const char* buildOpts)
+{
+    SICOKernel kernel;
+    cl_program program;
+    cl_kernel kern;
+    cl_int error;
+
+    if (!(program = buildProgramFromSource(device, name, source, size, buildOpts)))
+        return 0;
+
+    if (!(kern = clCreateKernel(program, kernelName, &error)))
+    {
+        sico_log("Unable to create kernel for %s (%s), error %s\n", name, kernelName, getErrorString(error));
+        clReleaseProgram(program);
+        return 0;
+    }
+
+    kernel = createKernelObject(program, kern);
+    kernel->programHash = getProgramHash(source, size, buildOpts);
+
+    return kernel;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct SICOKernel* scCompileKernelFromSourceFile(struct SICODevice* device, const char* filename, const char* kernelName, const char* buildOpts)
+{
+    const char* data;
+    size_t fileSize;
+    SICOKernel kernel;
+
+    if (!(data = readFileFromDisk(filename, &fileSize)))
+        return 0;
+
+    kernel = compileKernelFromSource(device, filename, data, fileSize, kernelName, buildOpts);
+
+    free((void*)data);
+
+    return kernel;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct SICOKernel* scCompileKernelFromSource(struct SICODevice* device, const char* source, size_t size, const char* kernelName, const char* buildOpts)
+{
+    if (!device || !source)
+        return 0;
+
+    return compileKernelFromSource(device, kernelName, source, size ? size : strlen(source), kernelName, buildOpts);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int scCompileFromFile(struct SICODevice* device, const char* filename, const char* buildOpts)
+{
+    const char* data;
+    size_t fileSize;
+    cl_program program;
+
+    if (!(data = readFileFromDisk(filename, &fileSize)))
+        return 0;
+
+    program = buildProgramFromSource(device, filename, data, fileSize, buildOpts);
+
+    free((void*)data);
+
+    if (!program)
+        return 0;
+
+    clReleaseProgram(program);
+
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Program binary container (sicoc output). All values are little endian u32s and strings are stored as size + data.
+//
+// u32 magic, u32 version, string buildOpts
+// u32 deviceCount, deviceCount * { string identity, string binary }
+// u32 kernelCount, kernelCount * { string name, u32 argCount, argCount * { u32 addressQualifier, u32 accessQualifier, string type, string name } }
+
+#define SICO_CONTAINER_MAGIC 0x50434953 // 'SICP'
+#define SICO_CONTAINER_VERSION 1
+
+typedef struct SICOWriteBuffer
+{
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+} SICOWriteBuffer;
+
+typedef struct SICOReadBuffer
+{
+    const uint8_t* data;
+    size_t size;
+    size_t offset;
+    int error;
+} SICOReadBuffer;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void writeData(SICOWriteBuffer* buffer, const void* data, size_t size)
+{
+    if (buffer->size + size > buffer->capacity)
+    {
+        size_t capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+
+        while (capacity < buffer->size + size)
+            capacity *= 2;
+
+        buffer->data = realloc(buffer->data, capacity);
+        buffer->capacity = capacity;
+    }
+
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void writeU32(SICOWriteBuffer* buffer, uint32_t value)
+{
+    uint8_t bytes[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+    writeData(buffer, bytes, 4);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void writeBlob(SICOWriteBuffer* buffer, const void* data, size_t size)
+{
+    writeU32(buffer, (uint32_t)size);
+    writeData(buffer, data, size);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void writeString(SICOWriteBuffer* buffer, const char* str)
+{
+    writeBlob(buffer, str ? str : "", str ? strlen(str) : 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t readU32(SICOReadBuffer* buffer)
+{
+    const uint8_t* p;
+
+    if (buffer->error || buffer->offset + 4 > buffer->size)
+    {
+        buffer->error = 1;
+        return 0;
+    }
+
+    p = buffer->data + buffer->offset;
+    buffer->offset += 4;
+
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Returns a pointer into the buffer (not null terminated) and the size of the blob
+
+static const uint8_t* readBlob(SICOReadBuffer* buffer, size_t* size)
+{
+    const uint8_t* p;
+    uint32_t blobSize = readU32(buffer);
+
+    if (buffer->error || buffer->offset + blobSize > buffer->size)
+    {
+        buffer->error = 1;
+        *size = 0;
+        return 0;
+    }
+
+    p = buffer->data + buffer->offset;
+    buffer->offset += blobSize;
+    *size = blobSize;
+
+    return p;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int blobEquals(const uint8_t* blob, size_t size, const char* str)
+{
+    return blob && strlen(str) == size && memcmp(blob, str, size) == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int writeKernelInfo(SICOWriteBuffer* buffer, cl_program program)
+{
+    char* names;
+    char* name;
+    char* next;
+    size_t namesSize = 0;
+    cl_uint kernelCount = 0;
+    cl_int error;
+
+    // the name list has no upper size so ask for it first
+
+    if ((error = clGetProgramInfo(program, CL_PROGRAM_KERNEL_NAMES, 0, 0, &namesSize)) != CL_SUCCESS)
+    {
+        sico_log("Unable to get kernel names, error %s\n", getErrorString(error));
+        return 0;
+    }
+
+    names = mallocZero(namesSize + 1);
+
+    if ((error = clGetProgramInfo(program, CL_PROGRAM_KERNEL_NAMES, namesSize, names, 0)) != CL_SUCCESS)
+    {
+        sico_log("Unable to get kernel names, error %s\n", getErrorString(error));
+        free(names);
+        return 0;
+    }
+
+    // names are separated with ';'
+
+    for (name = names; *name; ++name)
+    {
+        if (*name == ';')
+            kernelCount++;
+    }
+
+    if (names[0])
+        kernelCount++;
+
+    writeU32(buffer, kernelCount);
+
+    for (name = names; name && *name; name = next)
+    {
+        cl_kernel kern;
+        cl_uint argCount = 0;
+
+        if ((next = strchr(name, ';')))
+            *next++ = 0;
+
+        writeString(buffer, name);
+
+        if (!(kern = clCreateKernel(program, name, 0)))
+        {
+            writeU32(buffer, 0);
+            continue;
+        }
+
+        clGetKernelInfo(kern, CL_KERNEL_NUM_ARGS, sizeof(cl_uint), &argCount, 0);
+        writeU32(buffer, argCount);
+
+        for (cl_uint i = 0; i < argCount; ++i)
+        {
+            char typeName[256];
+            char argName[256];
+            cl_kernel_arg_address_qualifier address = 0;
+            cl_kernel_arg_access_qualifier access = 0;
+
+            typeName[0] = 0;
+            argName[0] = 0;
+
+            // Arg info is optional (needs -cl-kernel-arg-info on some implementations) so just store empty data
+            // if it isn't available
+
+            clGetKernelArgInfo(kern, i, CL_KERNEL_ARG_ADDRESS_QUALIFIER, sizeof(address), &address, 0);
+            clGetKernelArgInfo(kern, i, CL_KERNEL_ARG_ACCESS_QUALIFIER, sizeof(access), &access, 0);
+
+            if (clGetKernelArgInfo(kern, i, CL_KERNEL_ARG_TYPE_NAME, sizeof(typeName), typeName, 0) != CL_SUCCESS)
+                typeName[0] = 0;
+
+            if (clGetKernelArgInfo(kern, i, CL_KERNEL_ARG_NAME, sizeof(argName), argName, 0) != CL_SUCCESS)
+                argName[0] = 0;
+
+            writeU32(buffer, (uint32_t)address);
+            writeU32(buffer, (uint32_t)access);
+            writeString(buffer, typeName);
+            writeString(buffer, argName);
+        }
+
+        clReleaseKernel(kern);
+    }
+
+    free(names);
+
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scCompileToBinaryFile(SICODevice* devices, int deviceCount, const char* filename, const char* outputFilename, const char* buildOpts)
+{
+    SICOWriteBuffer buffer = { 0 };
+    cl_program firstProgram = 0;
+    char options[2048];
+    const char* data;
+    size_t fileSize;
+    FILE* f;
+    int ok;
+
+    if (!devices || deviceCount <= 0)
+        return SICO_NoDevice;
+
+    if (!(data = readFileFromDisk(filename, &fileSize)))
+        return SICO_GeneralFail;
+
+    snprintf(options, sizeof(options), "%s -cl-kernel-arg-info", buildOpts ? buildOpts : "");
+
+    writeU32(&buffer, SICO_CONTAINER_MAGIC);
+    writeU32(&buffer, SICO_CONTAINER_VERSION);
+    writeString(&buffer, buildOpts);
+    writeU32(&buffer, (uint32_t)deviceCount);
+
+    for (int i = 0; i < deviceCount; ++i)
+    {
+        char identity[1024];
+        unsigned char* binary;
+        size_t binarySize = 0;
+        cl_program program;
+
+        if (!(program = buildProgramFromSource(devices[i], filename, data, fileSize, options)))
+        {
+            free((void*)data);
+            free(buffer.data);
+
+            if (firstProgram)
+                clReleaseProgram(firstProgram);
+
+            return SICO_UnableToBuildKernel;
+        }
+
+        clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &binarySize, 0);
+        binary = malloc(binarySize);
+        clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char*), &binary, 0);
+
+        getDeviceIdentity(devices[i]->deviceId, identity, sizeof(identity));
+        writeString(&buffer, identity);
+        writeBlob(&buffer, binary, binarySize);
+
+        free(binary);
+
+        if (!firstProgram)
+            firstProgram = program;
+        else
+            clReleaseProgram(program);
+    }
+
+    free((void*)data);
+
+    // All devices has been built from the same source so the kernel names are the same for all of them
+
+    ok = writeKernelInfo(&buffer, firstProgram);
+    clReleaseProgram(firstProgram);
+
+    if (!ok)
+    {
+        free(buffer.data);
+        return SICO_GeneralFail;
+    }
+
+    remove(outputFilename);
+
+    if (!(f = fopen(outputFilename, "wb")))
+    {
+        sico_log("Unable to open %s for write\n", outputFilename);
+        free(buffer.data);
+        return SICO_GeneralFail;
+    }
+
+    ok = fwrite(buffer.data, 1, buffer.size, f) == buffer.size;
+    ok = (fclose(f) == 0) && ok;
+
+    free(buffer.data);
+
+    if (!ok)
+    {
+        sico_log("Unable to write %s\n", outputFilename);
+        remove(outputFilename);
+        return SICO_GeneralFail;
+    }
+
+    return SICO_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct SICOKernel* scLoadProgramFromBinary(struct SICODevice* device, const void* data, size_t size, const char* kernelName)
+{
+    SICOReadBuffer reader;
+    char identity[1024];
+    const uint8_t* binary = 0;
+    size_t binarySize = 0;
+    uint32_t deviceCount, kernelCount;
+    int foundKernel = 0;
+    SICOKernel kernel;
+    cl_program program;
+    cl_kernel kern;
+    cl_int binaryStatus, error;
+    size_t blobSize;
+
+    reader.data = (const uint8_t*)data;
+    reader.size = size;
+    reader.offset = 0;
+    reader.error = 0;
+
+    if (readU32(&reader) != SICO_CONTAINER_MAGIC || readU32(&reader) != SICO_CONTAINER_VERSION)
+    {
+        sico_log("%s", "Not a SICO program binary (or version mismatch)\n");
+        return 0;
+    }
+
+    if (!createDeviceContext(device))
+        return 0;
+
+    readBlob(&reader, &blobSize); // build options
+    deviceCount = readU32(&reader);
+
+    getDeviceIdentity(device->deviceId, identity, sizeof(identity));
+
+    for (uint32_t i = 0; i < deviceCount && !reader.error; ++i)
+    {
+        const uint8_t* id = readBlob(&reader, &blobSize);
+        size_t currentSize;
+        const uint8_t* current = readBlob(&reader, &currentSize);
+
+        if (!binary && blobEquals(id, blobSize, identity))
+        {
+            binary = current;
+            binarySize = currentSize;
+        }
+    }
+
+    kernelCount = readU32(&reader);
+
+    for (uint32_t i = 0; i < kernelCount && !reader.error && !foundKernel; ++i)
+    {
+        const uint8_t* name = readBlob(&reader, &blobSize);
+        uint32_t argCount;
+
+        foundKernel = blobEquals(name, blobSize, kernelName);
+        argCount = readU32(&reader);
+
+        for (uint32_t a = 0; a < argCount && !reader.error; ++a)
+        {
+            readU32(&reader);
+            readU32(&reader);
+            readBlob(&reader, &blobSize);
+            readBlob(&reader, &blobSize);
+        }
+    }
+
+    if (reader.error)
+    {
+        sico_log("%s", "Program binary is truncated or corrupt\n");
+        return 0;
+    }
+
+    if (!binary)
+    {
+        sico_log("No program binary for device %s\n", identity);
+        return 0;
+    }
+
+    if (!foundKernel)
+    {
+        sico_log("Kernel %s not found in program binary\n", kernelName);
+        return 0;
+    }
+
+    program = clCreateProgramWithBinary(device->context, 1, &device->deviceId, &binarySize, &binary, &binaryStatus, &error);
+
+    if (!program || error != CL_SUCCESS || binaryStatus != CL_SUCCESS)
+    {
+        sico_log("clCreateProgramWithBinary failed, error %s\n", getErrorString(error != CL_SUCCESS ? error : binaryStatus));
+
+        if (program)
+            clReleaseProgram(program);
+
+        return 0;
+    }
+
+    if ((error = clBuildProgram(program, 1, &device->deviceId, 0, 0, 0)) != CL_SUCCESS)
+    {
+        logBuildError(device, program, kernelName, error);
+        clReleaseProgram(program);
+        return 0;
+    }
+
+    if (!(kern = clCreateKernel(program, kernelName, &error)))
+    {
+        sico_log("Unable to create kernel %s, error %s\n", kernelName, getErrorString(error));
+        clReleaseProgram(program);
+        return 0;
+    }
+
+    // the container includes the build options
+
+    kernel = createKernelObject(program, kern);
+    kernel->programHash = getProgramHash(data, size, "");
+
+    return kernel;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct SICOKernel* scLoadProgramFromBinaryFile(struct SICODevice* device, const char* filename, const char* kernelName)
+{
+    SICOKernel kernel;
+    size_t size;
+    void* data;
+
+    if (!(data = readFileFromDisk(filename, &size)))
+        return 0;
+
+    kernel = scLoadProgramFromBinary(device, data, size, kernelName);
+
+    free(data);
+
+    return kernel;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scReleaseKernel(struct SICOKernel* kernel)
+{
+    if (!kernel)
+        return;
+
+    if (kernel->kern)
+        clReleaseKernel(kernel->kern);
+
+    if (kernel->program)
+        clReleaseProgram(kernel->program);
+
+    mutexDestroy(&kernel->argLock);
+    free(kernel);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static char* copyString(const char* text, size_t size)
+{
+    char* copy = malloc(size + 1);
+    memcpy(copy, text, size);
+    copy[size] = 0;
+    return copy;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint64_t getKernelKey(SICODevice device, const SICOKernelId* id)
+{
+    uint64_t key = SICO_HASH_INIT;
+
+    key = hashData(key, &device, sizeof(device));
+    key = hashString(key, id->filename);
+    key = hashData(key, id->source ? id->source : "", id->sourceSize);
+    key = hashString(key, id->kernelName);
+    key = hashString(key, id->buildOpts);
+    key = hashData(key, &id->modified, sizeof(id->modified));
+    key = hashData(key, &id->fileSize, sizeof(id->fileSize));
+
+    return key;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// null strings are the same as empty ones (as in the key)
+
+static int isSameString(const char* a, const char* b)
+{
+    return strcmp(a ? a : "", b ? b : "") == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int isSameKernelId(const SICOKernelId* a, const SICOKernelId* b)
+{
+    if (!a->filename != !b->filename || a->sourceSize != b->sourceSize)
+        return 0;
+
+    if (a->modified != b->modified || a->fileSize != b->fileSize)
+        return 0;
+
+    if (a->source && memcmp(a->source, b->source, a->sourceSize) != 0)
+        return 0;
+
+    return isSameString(a->filename, b->filename) && isSameString(a->kernelName, b->kernelName) &&
+           isSameString(a->buildOpts, b->buildOpts);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static SICOKernel findKernel(SICODevice device, uint64_t key, const SICOKernelId* id)
+{
+    SICOKernelEntry* entry;
+
+    for (entry = s_kernelRegistry[key % SICO_KERNEL_REGISTRY_SIZE]; entry; entry = entry->next)
+    {
+        if (entry->key == key && entry->device == device && isSameKernelId(&entry->id, id))
+            return entry->kernel;
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static SICOKernel lookupKernel(SICODevice device, uint64_t key, const SICOKernelId* id)
+{
+    SICOKernel kernel;
+
+    mutexLock(&s_registryMutex);
+    kernel = findKernel(device, key, id);
+    mutexUnlock(&s_registryMutex);
+
+    return kernel;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void freeKernelEntry(SICOKernelEntry* entry)
+{
+    free((void*)entry->id.filename);
+    free((void*)entry->id.source);
+    free((void*)entry->id.kernelName);
+    free((void*)entry->id.buildOpts);
+    free(entry);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Kernels are built without holding the lock so other kernels can be looked up while we compile. If another thread
+// managed to build the same kernel in the meantime we drop ours and use that one instead.
+
+static SICOKernel registerKernel(SICODevice device, uint64_t key, const SICOKernelId* id, SICOKernel kernel)
+{
+    SICOKernelEntry* entry;
+    SICOKernel existing;
+
+    mutexLock(&s_registryMutex);
+
+    if ((existing = findKernel(device, key, id)))
+    {
+        mutexUnlock(&s_registryMutex);
+        scReleaseKernel(kernel);
+        return existing;
+    }
+
+    entry = mallocZero(sizeof(SICOKernelEntry));
+    entry->key = key;
+    entry->device = device;
+    entry->kernel = kernel;
+    entry->id = *id;
+    entry->id.filename = id->filename ? copyString(id->filename, strlen(id->filename)) : 0;
+    entry->id.source = id->source ? copyString(id->source, id->sourceSize) : 0;
+    entry->id.kernelName = copyString(id->kernelName ? id->kernelName : "", id->kernelName ? strlen(id->kernelName) : 0);
+    entry->id.buildOpts = copyString(id->buildOpts ? id->buildOpts : "", id->buildOpts ? strlen(id->buildOpts) : 0);
+    entry->next = s_kernelRegistry[key % SICO_KERNEL_REGISTRY_SIZE];
+    s_kernelRegistry[key % SICO_KERNEL_REGISTRY_SIZE] = entry;
+
+    mutexUnlock(&s_registryMutex);
+
+    return kernel;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// The file is checked with stat on every lookup. When it has changed since the kernel was built a new kernel is built
+// and registered next to the old one (which may still be used by other threads, it's released by scReleaseKernels).
+
+struct SICOKernel* scGetKernel(struct SICODevice* device, const char* filename, const char* kernelName, const char* buildOpts)
+{
+    SICOKernelId id = { 0 };
+    struct stat st;
+    SICOKernel kernel;
+    uint64_t key;
+
+    id.filename = filename ? filename : "";
+    id.kernelName = kernelName;
+    id.buildOpts = buildOpts;
+
+    if (filename && stat(filename, &st) == 0)
+    {
+        id.modified = (int64_t)st.st_mtime;
+        id.fileSize = (int64_t)st.st_size;
+    }
+
+    key = getKernelKey(device, &id);
+
+    if ((kernel = lookupKernel(device, key, &id)))
+        return kernel;
+
+    if (!(kernel = scCompileKernelFromSourceFile(device, filename, kernelName, buildOpts)))
+        return 0;
+
+    return registerKernel(device, key, &id, kernel);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Same as getKernelFromSource but with the registry key already computed (with getSourceKernelKey)
+
+static SICOKernel getKernelFromSourceKey(SICODevice device, uint64_t key, const char* name, const char* source,
+                                         size_t size, const char* kernelName, const char* buildOpts)
+{
+    SICOKernelId id = { 0 };
+    SICOKernel kernel;
+
+    id.source = source;
+    id.sourceSize = size;
+    id.kernelName = kernelName;
+    id.buildOpts = buildOpts;
+
+    if ((kernel = lookupKernel(device, key, &id)))
+        return kernel;
+
+    if (!(kernel = compileKernelFromSource(device, name, source, size, kernelName, buildOpts)))
+        return 0;
+
+    return registerKernel(device, key, &id, kernel);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint64_t getSourceKernelKey(SICODevice device, const char* source, size_t size, const char* kernelName,
+                                   const char* buildOpts)
+{
+    SICOKernelId id = { 0 };
+
+    id.source = source;
+    id.sourceSize = size;
+    id.kernelName = kernelName;
+    id.buildOpts = buildOpts;
+
+    return getKernelKey(device, &id);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Same as scGetKernel but for source in memory, the registry key is based on the source itself
+
+static SICOKernel getKernelFromSource(SICODevice device, const char* name, const char* source, size_t size,
+                                      const char* kernelName, const char* buildOpts)
+{
+    uint64_t key = getSourceKernelKey(device, source, size, kernelName, buildOpts);
+    return getKernelFromSourceKey(device, key, name, source, size, kernelName, buildOpts);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct SICOKernel* scGetKernelFromSource(struct SICODevice* device, const char* source, size_t size, const char* kernelName, const char* buildOpts)
+{
+    if (!device || !source)
+        return 0;
+
+    return getKernelFromSource(device, kernelName, source, size ? size : strlen(source), kernelName, buildOpts);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int compareDefines(const void* a, const void* b)
+{
+    return strcmp(((const SICODefine*)a)->name, ((const SICODefine*)b)->name);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int isValidDefine(const char* text, int allowEmpty)
+{
+    if (!text || (!allowEmpty && !text[0]))
+        return 0;
+
+    for (; *text; ++text)
+    {
+        if (*text == ' ' || *text == '\t' || *text == '\n' || *text == '\r' || *text == '"')
+            return 0;
+    }
+
+    return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Defines are sorted by name so the same set gives the same options (and thus the same registry/cache entry)
+// regardless of the order they were given in
+
+SICOState scSpecializeOptions(char* output, size_t size, const char* buildOpts, const SICODefine* defines, int count)
+{
+    SICODefine* sorted;
+    size_t len;
+
+    if (!output || size == 0 || count < 0 || (count > 0 && !defines))
+        return SICO_GeneralFail;
+
+    len = (size_t)snprintf(output, size, "%s", buildOpts ? buildOpts : "");
+
+    if (len >= size)
+        return SICO_GeneralFail;
+
+    if (count == 0)
+        return SICO_Ok;
+
+    sorted = malloc(sizeof(SICODefine) * (size_t)count);
+    memcpy(sorted, defines, sizeof(SICODefine) * (size_t)count);
+    qsort(sorted, (size_t)count, sizeof(SICODefine), compareDefines);
+
+    for (int i = 0; i < count; ++i)
+    {
+        const char* value = sorted[i].value ? sorted[i].value : "";
+
+        if (!isValidDefine(sorted[i].name, 0) || !isValidDefine(value, 1))
+        {
+            sico_log("Invalid define %s=%s (whitespace and quotes are not allowed)\n", sorted[i].name ? sorted[i].name : "", value);
+            free(sorted);
+            return SICO_GeneralFail;
+        }
+
+        if (value[0])
+            len += (size_t)snprintf(output + len, size - len, "%s-D %s=%s", len ? " " : "", sorted[i].name, value);
+        else
+            len += (size_t)snprintf(output + len, size - len, "%s-D %s", len ? " " : "", sorted[i].name);
+
+        if (len >= size)
+        {
+            sico_log("Build options for %d defines doesn't fit in %d bytes\n", count, (int)size);
+            free(sorted);
+            return SICO_GeneralFail;
+        }
+    }
+
+    free(sorted);
+
+    return SICO_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct SICOKernel* scGetKernelSpecialized(struct SICODevice* device, const char* filename, const char* kernelName,
+                                          const char* buildOpts, const SICODefine* defines, int count)
+{
+    char options[2048];
+
+    if (scSpecializeOptions(options, sizeof(options), buildOpts, defines, count) != SICO_Ok)
+        return 0;
+
+    return scGetKernel(device, filename, kernelName, options);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scEvictKernel(struct SICOKernel* kernel)
+{
+    SICOKernelEntry* found = 0;
+
+    mutexLock(&s_registryMutex);
+
+    for (int i = 0; i < SICO_KERNEL_REGISTRY_SIZE && !found; ++i)
+    {
+        SICOKernelEntry** link;
+
+        for (link = &s_kernelRegistry[i]; *link; link = &(*link)->next)
+        {
+            if ((*link)->kernel == kernel)
+            {
+                found = *link;
+                *link = found->next;
+                break;
+            }
+        }
+    }
+
+    mutexUnlock(&s_registryMutex);
+
+    if (!found)
+        return;
+
+    scReleaseKernel(found->kernel);
+    freeKernelEntry(found);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scReleaseKernels()
+{
+    mutexLock(&s_registryMutex);
+
+    for (int i = 0; i < SICO_KERNEL_REGISTRY_SIZE; ++i)
+    {
+        SICOKernelEntry* entry = s_kernelRegistry[i];
+
+        while (entry)
+        {
+            SICOKernelEntry* next = entry->next;
+            scReleaseKernel(entry->kernel);
+            freeKernelEntry(entry);
+            entry = next;
+        }
+
+        s_kernelRegistry[i] = 0;
+    }
+
+    mutexUnlock(&s_registryMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Async compiles. Jobs are put in a FIFO that a pool of worker threads (started on the first async compile) takes
+// jobs from. The workers go through the kernel registry so the result is the same kernel scGetKernel would return.
+// Waiting on a job that hasn't been picked up yet builds it on the waiting thread instead of waiting behind other
+// jobs.
+
+#define SICO_MAX_COMPILE_THREADS 32
+
+#if defined(_WIN32)
+typedef HANDLE SICOThread;
+#else
+typedef pthread_t SICOThread;
+#endif
+
+struct SICOCompileJob
+{
+    SICODevice device;
+    char* filename;         // set for file jobs
+    char* source;           // copy of the source for in memory jobs
+    size_t size;
+    char* kernelName;
+    char* buildOpts;
+    SICOKernel kernel;
+    int started;
+    int done;
+    struct SICOCompileJob* next;
+};
+
+static SICOMutex s_compileMutex = SICO_MUTEX_INIT;
+static SICOCondition s_compileWork = SICO_CONDITION_INIT;
+static SICOCondition s_compileDone = SICO_CONDITION_INIT;
+static struct SICOCompileJob* s_compileHead = 0;
+static struct SICOCompileJob* s_compileTail = 0;
+static SICOThread s_compileThreads[SICO_MAX_COMPILE_THREADS];
+static int s_compileThreadCount = 0;
+static int s_compileThreadLimit = 0;
+static int s_compileShutdown = 0;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void runCompileJob(struct SICOCompileJob* job)
+{
+    SICOKernel kernel;
+
+    if (job->filename)
+        kernel = scGetKernel(job->device, job->filename, job->kernelName, job->buildOpts);
+    else
+        kernel = getKernelFromSource(job->device, job->kernelName, job->source, job->size, job->kernelName, job->buildOpts);
+
+    mutexLock(&s_compileMutex);
+    job->kernel = kernel;
+    job->done = 1;
+    conditionBroadcast(&s_compileDone);
+    mutexUnlock(&s_compileMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void compileWorker()
+{
+    mutexLock(&s_compileMutex);
+
+    for (;;)
+    {
+        struct SICOCompileJob* job;
+
+        while (!s_compileHead && !s_compileShutdown)
+            conditionWait(&s_compileWork, &s_compileMutex);
+
+        // on shutdown all queued jobs are still built so nobody is left waiting
+
+        if (!(job = s_compileHead))
+            break;
+
+        if (!(s_compileHead = job->next))
+            s_compileTail = 0;
+
+        job->started = 1;
+
+        mutexUnlock(&s_compileMutex);
+        runCompileJob(job);
+        mutexLock(&s_compileMutex);
+    }
+
+    mutexUnlock(&s_compileMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#if defined(_WIN32)
+static DWORD WINAPI compileThreadEntry(LPVOID arg)
+#else
+static void* compileThreadEntry(void* arg)
+#endif
+{
+    (void)arg;
+    compileWorker();
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Called with s_compileMutex held
+
+static void startCompileThreads()
+{
+    int count = s_compileThreadLimit > 0 ? s_compileThreadLimit : getCpuCount();
+
+    if (count > SICO_MAX_COMPILE_THREADS)
+        count = SICO_MAX_COMPILE_THREADS;
+
+    while (s_compileThreadCount < count)
+    {
+        SICOThread* thread = &s_compileThreads[s_compileThreadCount];
+
+#if defined(_WIN32)
+        if (!(*thread = CreateThread(0, 0, compileThreadEntry, 0, 0, 0)))
+            break;
+#else
+        if (pthread_create(thread, 0, compileThreadEntry, 0) != 0)
+            break;
+#endif
+
+        s_compileThreadCount++;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void stopCompileThreads()
+{
+    mutexLock(&s_compileMutex);
+    s_compileShutdown = 1;
+    conditionBroadcast(&s_compileWork);
+    mutexUnlock(&s_compileMutex);
+
+    for (int i = 0; i < s_compileThreadCount; ++i)
+    {
+#if defined(_WIN32)
+        WaitForSingleObject(s_compileThreads[i], INFINITE);
+        CloseHandle(s_compileThreads[i]);
+#else
+        pthread_join(s_compileThreads[i], 0);
+#endif
+    }
+
+    mutexLock(&s_compileMutex);
+    s_compileThreadCount = 0;
+    s_compileShutdown = 0;
+    mutexUnlock(&s_compileMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static SICOCompileJob queueCompileJob(struct SICOCompileJob* job)
+{
+    mutexLock(&s_compileMutex);
+
+    if (s_compileThreadCount == 0)
+        startCompileThreads();
+
+    // no threads available so build it right away (the job is still returned as a finished job)
+
+    if (s_compileThreadCount == 0)
+    {
+        job->started = 1;
+        mutexUnlock(&s_compileMutex);
+        runCompileJob(job);
+        return job;
+    }
+
+    if (s_compileTail)
+        s_compileTail->next = job;
+    else
+        s_compileHead = job;
+
+    s_compileTail = job;
+
+    conditionBroadcast(&s_compileWork);
+    mutexUnlock(&s_compileMutex);
+
+    return job;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scSetCompileThreads(int count)
+{
+    mutexLock(&s_compileMutex);
+    s_compileThreadLimit = count;
+    mutexUnlock(&s_compileMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOCompileJob scCompileKernelAsync(struct SICODevice* device, const char* filename, const char* kernelName, const char* buildOpts)
+{
+    struct SICOCompileJob* job;
+
+    if (!device || !filename || !kernelName)
+        return 0;
+
+    job = mallocZero(sizeof(struct SICOCompileJob));
+    job->device = device;
+    job->filename = copyString(filename, strlen(filename));
+    job->kernelName = copyString(kernelName, strlen(kernelName));
+    job->buildOpts = buildOpts ? copyString(buildOpts, strlen(buildOpts)) : 0;
+
+    return queueCompileJob(job);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOCompileJob scCompileKernelFromSourceAsync(struct SICODevice* device, const char* source, size_t size, const char* kernelName, const char* buildOpts)
+{
+    struct SICOCompileJob* job;
+
+    if (!device || !source || !kernelName)
+        return 0;
+
+    job = mallocZero(sizeof(struct SICOCompileJob));
+    job->device = device;
+    job->size = size ? size : strlen(source);
+    job->source = copyString(source, job->size);
+    job->kernelName = copyString(kernelName, strlen(kernelName));
+    job->buildOpts = buildOpts ? copyString(buildOpts, strlen(buildOpts)) : 0;
+
+    return queueCompileJob(job);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int scCompileJobDone(SICOCompileJob job)
+{
+    int done;
+
+    if (!job)
+        return 1;
+
+    mutexLock(&s_compileMutex);
+    done = job->done;
+    mutexUnlock(&s_compileMutex);
+
+    return done;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct SICOKernel* scCompileJobWait(SICOCompileJob job)
+{
+    struct SICOCompileJob** link;
+    SICOKernel kernel;
+
+    if (!job)
+        return 0;
+
+    mutexLock(&s_compileMutex);
+
+    // still in the queue, take it out and build it here
+
+    if (!job->started)
+    {
+        struct SICOCompileJob* prev = 0;
+
+        for (link = &s_compileHead; *link; prev = *link, link = &(*link)->next)
+        {
+            if (*link == job)
+            {
+                *link = job->next;
+
+                if (s_compileTail == job)
+                    s_compileTail = prev;
+
+                break;
+            }
+        }
+
+        job->started = 1;
+
+        mutexUnlock(&s_compileMutex);
+        runCompileJob(job);
+        mutexLock(&s_compileMutex);
+    }
+
+    while (!job->done)
+        conditionWait(&s_compileDone, &s_compileMutex);
+
+    kernel = job->kernel;
+
+    mutexUnlock(&s_compileMutex);
+
+    return kernel;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scReleaseCompileJob(SICOCompileJob job)
+{
+    if (!job)
+        return;
+
+    scCompileJobWait(job);
+
+    free(job->filename);
+    free(job->source);
+    free(job->kernelName);
+    free(job->buildOpts);
+    free(job);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOHandle scAlloc(struct SICODevice* device, int flags, size_t size, void* hostPtr)
+{
+    cl_int errorCode;
+
+    cl_mem mem = clCreateBuffer(device->context, (cl_mem_flags)flags, size, hostPtr, &errorCode);
+
+    if (errorCode != CL_SUCCESS)
+    {
+        sico_log("%s\n", getErrorString(errorCode));
+        mem = 0;
+    }
+
+    return (SICOHandle)mem;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool scFree(SICOHandle handle)
+{
+    int errorCode = clReleaseMemObject((cl_mem)handle);
+
+    if (errorCode == CL_SUCCESS)
+        return true;
+
+    sico_log("%s\n", getErrorString(errorCode));
+
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOCommanQueue scCreateCommandQueue(struct SICODevice* device)
+{
+    cl_int error;
+    cl_command_queue queue;
+
+    queue = clCreateCommandQueue(device->context, device->deviceId, s_profiling ? CL_QUEUE_PROFILING_ENABLE : 0, &error);
+
+    if (error == CL_SUCCESS)
+        return (SICOCommanQueue)queue;
+
+    sico_log("%s", getErrorString(error));
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOCommanQueue scGetDeviceQueue(struct SICODevice* device)
+{
+    SICOCommanQueue queue;
+
+    mutexLock(&s_registryMutex);
+
+    if (!device->queue)
+        device->queue = (cl_command_queue)scCreateCommandQueue(device);
+
+    queue = (SICOCommanQueue)device->queue;
+
+    mutexUnlock(&s_registryMutex);
+
+    return queue;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Per-thread queues. Each thread gets a small table (stored in thread local storage) of queues per device. All
+// tables are also linked together so scClose can release the queues.
+
+#define SICO_MAX_THREAD_QUEUES 16
+
+typedef struct SICOThreadQueues
+{
+    struct SICODevice* devices[SICO_MAX_THREAD_QUEUES];
+    cl_command_queue queues[SICO_MAX_THREAD_QUEUES];
+    int count;
+    struct SICOThreadQueues* next;
+} SICOThreadQueues;
+
+static SICOMutex s_threadQueuesMutex = SICO_MUTEX_INIT;
+static SICOThreadQueues* s_threadQueues = 0;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOCommanQueue scGetThreadQueue(struct SICODevice* device)
+{
+    SICOThreadQueues* threadQueues;
+    cl_command_queue queue;
+    int i;
+
+    if (!s_threadKeyValid)
+        return scGetDeviceQueue(device);
+
+    if (!(threadQueues = (SICOThreadQueues*)getThreadValue()))
+    {
+        threadQueues = mallocZero(sizeof(SICOThreadQueues));
+        setThreadValue(threadQueues);
+
+        mutexLock(&s_threadQueuesMutex);
+        threadQueues->next = s_threadQueues;
+        s_threadQueues = threadQueues;
+        mutexUnlock(&s_threadQueuesMutex);
+    }
+
+    for (i = 0; i < threadQueues->count; ++i)
+    {
+        if (threadQueues->devices[i] == device)
+            return (SICOCommanQueue)threadQueues->queues[i];
+    }
+
+    if (threadQueues->count == SICO_MAX_THREAD_QUEUES)
+    {
+        sico_log("Too many per-thread queues (max %d), using the shared device queue\n", SICO_MAX_THREAD_QUEUES);
+        return scGetDeviceQueue(device);
+    }
+
+    if (!(queue = (cl_command_queue)scCreateCommandQueue(device)))
+        return 0;
+
+    mutexLock(&s_threadQueuesMutex);
+    threadQueues->devices[threadQueues->count] = device;
+    threadQueues->queues[threadQueues->count] = queue;
+    threadQueues->count++;
+    mutexUnlock(&s_threadQueuesMutex);
+
+    return (SICOCommanQueue)queue;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void releaseThreadQueues(SICOThreadQueues* threadQueues)
+{
+    int i;
+
+    for (i = 0; i < threadQueues->count; ++i)
+    {
+        clFinish(threadQueues->queues[i]);
+        clReleaseCommandQueue(threadQueues->queues[i]);
+    }
+
+    threadQueues->count = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Unlinks the table of a thread and releases it together with its queues
+
+static void freeThreadQueues(SICOThreadQueues* threadQueues)
+{
+    SICOThreadQueues** iter;
+
+    mutexLock(&s_threadQueuesMutex);
+
+    for (iter = &s_threadQueues; *iter; iter = &(*iter)->next)
+    {
+        if (*iter == threadQueues)
+        {
+            *iter = threadQueues->next;
+            break;
+        }
+    }
+
+    releaseThreadQueues(threadQueues);
+
+    mutexUnlock(&s_threadQueuesMutex);
+
+    free(threadQueues);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scReleaseThreadQueues()
+{
+    SICOThreadQueues* threadQueues;
+
+    if (!s_threadKeyValid || !(threadQueues = (SICOThreadQueues*)getThreadValue()))
+        return;
+
+    setThreadValue(0);
+    freeThreadQueues(threadQueues);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Called by the thread local storage when a thread that never called scReleaseThreadQueues exits, so thread pools
+// that replaces their threads doesn't leave tables (and queues) behind
+
+static void threadExit(void* value)
+{
+    freeThreadQueues((SICOThreadQueues*)value);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// The tables are owned by their threads so only the queues are released here
+
+static void releaseAllThreadQueues()
+{
+    SICOThreadQueues* threadQueues;
+
+    mutexLock(&s_threadQueuesMutex);
+
+    for (threadQueues = s_threadQueues; threadQueues; threadQueues = threadQueues->next)
+        releaseThreadQueues(threadQueues);
+
+    mutexUnlock(&s_threadQueuesMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scAddKernel(SICOCommanQueue queue, SICOKernel kernel, int workDim,
+                      const size_t* globalWorkOffset, const size_t* globalWorkSize, const size_t* localWorkSize,
+                      int eventListCount, const SICOEvent* waitEventList, SICOEvent* event)
+{
+    cl_int error = enqueueKernel((cl_command_queue)queue, kernel, (cl_uint)workDim, globalWorkOffset, globalWorkSize, localWorkSize,
+                                 (cl_uint)eventListCount, (const cl_event*)waitEventList, (cl_event*)event);
+
+    if (error == CL_SUCCESS)
+        return SICO_Ok;
+
+    switch (error)
+    {
+        case CL_INVALID_PROGRAM_EXECUTABLE:
+            sico_log("%s ", "CL_INVALID_PROGRAM_EXECUTABLE if there is no successfully built program executable available for device associated with command_queue.\n"); break;
+        case CL_INVALID_COMMAND_QUEUE:
+            sico_log("%s ", " CL_INVALID_COMMAND_QUEUE : if command_queue is not a valid host command-queue.\n"); break;
+        case CL_INVALID_KERNEL:
+            sico_log("%s ", " CL_INVALID_KERNEL : if kernel is not a valid kernel object.\n"); break;
+        case CL_INVALID_CONTEXT:
+            sico_log("%s ", " CL_INVALID_CONTEXT : if context associated with command_queue and kernel is not the same or if the context associated with command_queue and events in event_wait_list are not the same.\n"); break;
+        case CL_INVALID_KERNEL_ARGS:
+            sico_log("%s ", " CL_INVALID_KERNEL_ARGS : if the kernel argument values have not been specified or if a kernel argument declared to be a pointer to a type does not point to a named address space.\n"); break;
+        case CL_INVALID_WORK_DIMENSION:
+            sico_log("%s ", " CL_INVALID_WORK_DIMENSION : if work_dim is not a valid value (i.e. a value between 1 and 3).\n"); break;
+        case CL_INVALID_GLOBAL_WORK_SIZE:
+            sico_log("%s ", " CL_INVALID_GLOBAL_WORK_SIZE : if global_work_size is NULL, or if any of the values specified in global_work_size[0], ...global_work_size [work_dim - 1] are 0 or exceed the range given by the sizeof(size_t) for the device on which the kernel execution will be enqueued.\n"); break;
+        case CL_INVALID_GLOBAL_OFFSET:
+            sico_log("%s ", " CL_INVALID_GLOBAL_OFFSET : if the value specified in global_work_size + the corresponding values in global_work_offset for any dimensions is greater than the sizeof(size_t) for the device on which the kernel execution will be enqueued.\n"); break;
+        case CL_MISALIGNED_SUB_BUFFER_OFFSET:
+            sico_log("%s ", " CL_MISALIGNED_SUB_BUFFER_OFFSET : if a sub-buffer object is specified as the value for an argument that is a buffer object and the offset specified when the sub-buffer object is created is not aligned to CL_DEVICE_MEM_BASE_ADDR_ALIGN value for device associated with queue.\n"); break;
+        case CL_INVALID_IMAGE_SIZE:
+            sico_log("%s ", " CL_INVALID_IMAGE_SIZE : if an image object is specified as an argument value and the image dimensions (image width, height, specified or compute row and/or slice pitch) are not supported by device associated with queue.\n"); break;
+        case CL_IMAGE_FORMAT_NOT_SUPPORTED:
+            sico_log("%s ", " CL_IMAGE_FORMAT_NOT_SUPPORTED : if an image object is specified as an argument value and the image format (image channel order and data type) is not supported by device associated with queue.\n"); break;
+        case CL_MEM_OBJECT_ALLOCATION_FAILURE:
+            sico_log("%s ", " CL_MEM_OBJECT_ALLOCATION_FAILURE : if there is a failure to allocate memory for data store associated with image or buffer objects specified as arguments to kernel.\n"); break;
+        case CL_INVALID_EVENT_WAIT_LIST:
+            sico_log("%s ", " CL_INVALID_EVENT_WAIT_LIST : if event_wait_list is NULL and num_events_in_wait_list > 0, or event_wait_list is not NULL and num_events_in_wait_list is 0, or if event objects in event_wait_list are not valid events.\n"); break;
+        case CL_INVALID_OPERATION:
+            sico_log("%s ", " CL_INVALID_OPERATION : if SVM pointers are passed as arguments to a kernel and the device does not support SVM or if system pointers are passed as arguments to a kernel and/or stored inside SVM allocations passed as kernel arguments and the device does not support fine grain system SVM allocations.\n"); break;
+        case CL_OUT_OF_HOST_MEMORY:
+            sico_log("%s ", " CL_OUT_OF_HOST_MEMORY : if there is a failure to allocate resources required by the OpenCL implementation on the host.\n"); break;
+        case CL_OUT_OF_RESOURCES:
+        {
+            sico_log("%s ", " CL_OUT_OF_RESOURCES : if there is a failure to queue the execution instance of kernel on the command-queue because of insufficient resources needed to execute the kernel. For example, the explicitly specified local_work_size causes a failure to execute the kernel because of insufficient resources such as registers or local memory. Another example would be the number of read-only image args used in kernel exceed the CL_DEVICE_MAX_READ_IMAGE_ARGS value for device or the number of write-only image args used in kernel exceed the CL_DEVICE_MAX_READ_WRITE_IMAGE_ARGS value for device or the number of samplers used in kernel exceed CL_DEVICE_MAX_SAMPLERS for device.\n");
+            sico_log("%s ", " CL_OUT_OF_RESOURCES : if there is a failure to allocate resources required by the OpenCL implementation on the device.\n");
+            break;
+        }
+        case CL_INVALID_WORK_ITEM_SIZE:
+        {
+            sico_log("%s ", " CL_INVALID_WORK_ITEM_SIZE : if the number of work-items specified in any of local_work_size[0], ... local_work_size[work_dim - 1] is greater than the corresponding values specified by CL_DEVICE_MAX_WORK_ITEM_SIZES[0], .... CL_DEVICE_MAX_WORK_ITEM_SIZES[work_dim - 1].\n");
+            sico_log("%s ", " CL_INVALID_WORK_ITEM_SIZE : if the number of work-items specified in any of local_work_size[0], ... local_work_size[work_dim – 1] is greater than the corresponding values specified by CL_DEVICE_MAX_WORK_ITEM_SIZES[0], ... CL_DEVICE_MAX_WORK_ITEM_SIZES[work_dim – 1].\n");
+            break;
+        }
+        case CL_INVALID_WORK_GROUP_SIZE:
+        {
+            sico_log("%s ", " CL_INVALID_WORK_GROUP_SIZE : if local_work_size is specified and does not match the work-group size for kernel in the program source given by the __attribute__ ((reqd_work_group_size(X, Y, Z))) qualifier.\n"); break;
+            sico_log("%s ", " CL_INVALID_WORK_GROUP_SIZE : if local_work_size is specified and the total number of work-items in the work-group computed as local_work_size[0] * … local_work_size[work_dim – 1] is greater than the value specified by CL_DEVICE_MAX_WORK_GROUP_SIZE in the table of OpenCL Device Queries for clGetDeviceInfo.\n");
+            sico_log("%s ", " CL_INVALID_WORK_GROUP_SIZE : if local_work_size is NULL and the __attribute__ ((reqd_work_group_size(X, Y, Z))) qualifier is used to declare the work-group size for kernel in the program source.\n");
+            sico_log("%s ", " CL_INVALID_WORK_GROUP_SIZE : if the program was compiled with –cl-uniform-work-group-size and the number of work-items specified by global_work_size is not evenly divisible by size of work-group given by local_work_size.\n");
+            break;
+        }
+    }
+
+    return SICO_GeneralFail;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Local work size autotuning. Results are stored per (device, kernel, work dim, global size class) where the size
+// class is log2 of each dimension. The table is kept in memory and persisted to a text file if one is set (or
+// autotune.txt in the program cache dir).
+
+#define SICO_TUNE_MAX_CANDIDATES 64
+#define SICO_TUNE_DEFAULT_ITERATIONS 5
+
+typedef struct SICOTuneEntry
+{
+    uint64_t key;
+    int workDim;
+    int sizeClass[3];
+    size_t localSize[3];    // all 0 if the driver default was fastest
+} SICOTuneEntry;
+
+static SICOMutex s_tuneMutex = SICO_MUTEX_INIT;
+static SICOTuneEntry* s_tuneEntries = 0;
+static int s_tuneCount = 0;
+static int s_tuneCapacity = 0;
+static int s_tuneLoaded = 0;
+static char s_tuneFilename[1024];
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int getSizeClass(size_t size)
+{
+    int sizeClass = 0;
+
+    while (size > 1)
+    {
+        size >>= 1;
+        sizeClass++;
+    }
+
+    return sizeClass;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int getTuneFilename(char* output, size_t size)
+{
+    if (s_tuneFilename[0])
+        return snprintf(output, size, "%s", s_tuneFilename) > 0;
+
+    if (s_programCacheDir[0])
+        return snprintf(output, size, "%s/autotune.txt", s_programCacheDir) > 0;
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static SICOTuneEntry* findTuneEntry(uint64_t key, int workDim, const int* sizeClass)
+{
+    for (int i = 0; i < s_tuneCount; ++i)
+    {
+        SICOTuneEntry* entry = &s_tuneEntries[i];
+
+        if (entry->key == key && entry->workDim == workDim && !memcmp(entry->sizeClass, sizeClass, sizeof(int) * 3))
+            return entry;
+    }
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void addTuneEntry(const SICOTuneEntry* newEntry)
+{
+    SICOTuneEntry* entry;
+
+    if ((entry = findTuneEntry(newEntry->key, newEntry->workDim, newEntry->sizeClass)))
+    {
+        *entry = *newEntry;
+        return;
+    }
+
+    if (s_tuneCount == s_tuneCapacity)
+    {
+        s_tuneCapacity = s_tuneCapacity ? s_tuneCapacity * 2 : 64;
+        s_tuneEntries = realloc(s_tuneEntries, sizeof(SICOTuneEntry) * (size_t)s_tuneCapacity);
+    }
+
+    s_tuneEntries[s_tuneCount++] = *newEntry;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Has to be called with s_tuneMutex held
+
+static void loadTuneTable()
+{
+    char filename[1100];
+    unsigned long long key, local[3];
+    SICOTuneEntry entry;
+    FILE* f;
+
+    if (s_tuneLoaded)
+        return;
+
+    s_tuneLoaded = 1;
+
+    if (!getTuneFilename(filename, sizeof(filename)) || !(f = fopen(filename, "r")))
+        return;
+
+    while (fscanf(f, "%llx %d %d %d %d %llu %llu %llu", &key, &entry.workDim,
+                  &entry.sizeClass[0], &entry.sizeClass[1], &entry.sizeClass[2],
+                  &local[0], &local[1], &local[2]) == 8)
+    {
+        entry.key = (uint64_t)key;
+        entry.localSize[0] = (size_t)local[0];
+        entry.localSize[1] = (size_t)local[1];
+        entry.localSize[2] = (size_t)local[2];
+
+        addTuneEntry(&entry);
+    }
+
+    fclose(f);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Has to be called with s_tuneMutex held. Written to a temporary file and renamed in place (same as the program cache)
+
+static void saveTuneTable()
+{
+    char filename[1100];
+    char tempFilename[1200];
+    int ok = 1;
+    FILE* f;
+
+    if (!getTuneFilename(filename, sizeof(filename)))
+        return;
+
+    snprintf(tempFilename, sizeof(tempFilename), "%s.%x.tmp", filename, (uint32_t)time(0) ^ (uint32_t)(uintptr_t)&ok);
+
+    if (!(f = fopen(tempFilename, "w")))
+    {
+        sico_log("Unable to write autotune table %s\n", tempFilename);
+        return;
+    }
+
+    for (int i = 0; i < s_tuneCount; ++i)
+    {
+        const SICOTuneEntry* entry = &s_tuneEntries[i];
+
+        ok = ok && fprintf(f, "%016llx %d %d %d %d %llu %llu %llu\n", (unsigned long long)entry->key, entry->workDim,
+                           entry->sizeClass[0], entry->sizeClass[1], entry->sizeClass[2],
+                           (unsigned long long)entry->localSize[0], (unsigned long long)entry->localSize[1],
+                           (unsigned long long)entry->localSize[2]) > 0;
+    }
+
+    ok = (fclose(f) == 0) && ok;
+
+    if (ok)
+    {
+#if defined(_WIN32)
+        remove(filename);
+#endif
+        ok = rename(tempFilename, filename) == 0;
+    }
+
+    if (!ok)
+        remove(tempFilename);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scSetAutotuneFile(const char* filename)
+{
+    mutexLock(&s_tuneMutex);
+
+    if (!filename || strlen(filename) >= sizeof(s_tuneFilename))
+        s_tuneFilename[0] = 0;
+    else
+        strcpy(s_tuneFilename, filename);
+
+    // entries from the new file are merged in on next use
+
+    s_tuneLoaded = 0;
+
+    mutexUnlock(&s_tuneMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Identifies the kernel across runs: device identity, function name and what the program was built from. The
+// program hash is the same whether the program was compiled or loaded from the cache.
+
+static uint64_t getTuneKey(SICOKernel kernel)
+{
+    char identity[1024];
+    uint64_t key = SICO_HASH_INIT;
+
+    if (kernel->tuneKey)
+        return kernel->tuneKey;
+
+    getDeviceIdentity(kernel->deviceId, identity, sizeof(identity));
+
+    key = hashString(key, identity);
+    key = hashString(key, kernel->name);
+    key = hashData(key, &kernel->programHash, sizeof(kernel->programHash));
+
+    kernel->tuneKey = key ? key : 1;
+
+    return kernel->tuneKey;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void getTuneSizeClass(int workDim, const size_t* globalSize, int* sizeClass)
+{
+    for (int i = 0; i < 3; ++i)
+        sizeClass[i] = i < workDim ? getSizeClass(globalSize[i]) : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Returns the local size set with reqd_work_group_size in the kernel source (all zero if there is none)
+
+static int getRequiredLocalSize(SICOKernel kernel, size_t* output)
+{
+    memset(output, 0, sizeof(size_t) * 3);
+
+    if (clGetKernelWorkGroupInfo(kernel->kern, kernel->deviceId, CL_KERNEL_COMPILE_WORK_GROUP_SIZE,
+                                 sizeof(size_t) * 3, output, 0) != CL_SUCCESS)
+        return 0;
+
+    return output[0] != 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Collects local sizes to try. All dimensions are powers of two, the total has to fit the work group size of the
+// kernel and be a multiple of the preferred size (unless the global size is too small) and divide the global size.
+// An all zero entry (driver default) is always the first candidate.
+
+static int getTuneCandidates(SICOKernel kernel, int workDim, const size_t* globalSize, size_t candidates[][3])
+{
+    size_t maxSize = 0, multiple = 1, maxItems[3] = { 1, 1, 1 }, local[3];
+    size_t x, y, z;
+    int count = 1;
+
+    clGetKernelWorkGroupInfo(kernel->kern, kernel->deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &maxSize, 0);
+    clGetKernelWorkGroupInfo(kernel->kern, kernel->deviceId, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &multiple, 0);
+    clGetDeviceInfo(kernel->deviceId, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(maxItems), maxItems, 0);
+
+    memset(candidates[0], 0, sizeof(size_t) * 3);
+
+    if (maxSize == 0 || multiple == 0 || getRequiredLocalSize(kernel, local))
+        return count;
+
+    for (x = 1; x <= maxSize && x <= maxItems[0]; x *= 2)
+    {
+        for (y = 1; y <= (workDim > 1 ? maxSize : 1) && y <= maxItems[1]; y *= 2)
+        {
+            for (z = 1; z <= (workDim > 2 ? maxSize : 1) && z <= maxItems[2]; z *= 2)
+            {
+                size_t items = x * y * z;
+                size_t local[3] = { x, y, z };
+                int valid = items <= maxSize && (items % multiple == 0 || items * 2 > maxSize);
+
+                for (int i = 0; i < workDim && valid; ++i)
+                    valid = globalSize[i] % local[i] == 0;
+
+                if (!valid || count == SICO_TUNE_MAX_CANDIDATES)
+                    continue;
+
+                memcpy(candidates[count++], local, sizeof(local));
+            }
+        }
+    }
+
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Returns the fastest device time in seconds of a number of runs (or a negative value on failure)
+
+static double timeLocalSize(cl_command_queue queue, SICOKernel kernel, int workDim, const size_t* globalSize,
+                            const size_t* localSize, int iterations)
+{
+    double best = -1.0;
+
+    // first run is warmup
+
+    for (int i = 0; i < iterations + 1; ++i)
+    {
+        cl_ulong start, end;
+        cl_event event;
+
+        if (clEnqueueNDRangeKernel(queue, kernel->kern, (cl_uint)workDim, 0, globalSize, localSize, 0, 0, &event) != CL_SUCCESS)
+            return -1.0;
+
+        clWaitForEvents(1, &event);
+
+        if (i > 0 &&
+            clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, 0) == CL_SUCCESS &&
+            clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, 0) == CL_SUCCESS)
+        {
+            double time = (double)(end - start) * 1e-9;
+
+            if (best < 0.0 || time < best)
+                best = time;
+        }
+
+        clReleaseEvent(event);
+    }
+
+    return best;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scAutotuneKernel(SICOCommanQueue queue, SICOKernel kernel, int workDim, const size_t* globalSize, int iterations)
+{
+    size_t candidates[SICO_TUNE_MAX_CANDIDATES][3];
+    SICOTuneEntry entry;
+    cl_command_queue tuneQueue;
+    cl_context context;
+    double bestTime = -1.0;
+    int best = 0, count;
+    cl_int error;
+
+    if (!kernel || workDim < 1 || workDim > 3 || !globalSize)
+        return SICO_GeneralFail;
+
+    if (iterations <= 0)
+        iterations = SICO_TUNE_DEFAULT_ITERATIONS;
+
+    // timing is done on a separate profiling queue so it works regardless of how the users queues were created
+
+    if (clGetKernelInfo(kernel->kern, CL_KERNEL_CONTEXT, sizeof(cl_context), &context, 0) != CL_SUCCESS)
+        return SICO_GeneralFail;
+
+    if (!(tuneQueue = clCreateCommandQueue(context, kernel->deviceId, CL_QUEUE_PROFILING_ENABLE, &error)))
+    {
+        sico_log("Unable to create profiling queue for autotuning, error %s\n", getErrorString(error));
+        return SICO_GeneralFail;
+    }
+
+    // the profiling queue isn't ordered with the callers queue so the uploads of the arguments has to be done first.
+    // The arguments are locked while timing so no other thread can change them between the runs.
+
+    if (queue)
+        clFinish(queue);
+
+    count = getTuneCandidates(kernel, workDim, globalSize, candidates);
+
+    mutexLock(&kernel->argLock);
+
+    for (int i = 0; i < count; ++i)
+    {
+        const size_t* local = i == 0 ? 0 : candidates[i];
+        double time = timeLocalSize(tuneQueue, kernel, workDim, globalSize, local, iterations);
+
+        if (time >= 0.0 && (bestTime < 0.0 || time < bestTime))
+        {
+            bestTime = time;
+            best = i;
+        }
+    }
+
+    mutexUnlock(&kernel->argLock);
+
+    clReleaseCommandQueue(tuneQueue);
+
+    if (bestTime < 0.0)
+        return SICO_GeneralFail;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.key = getTuneKey(kernel);
+    entry.workDim = workDim;
+    getTuneSizeClass(workDim, globalSize, entry.sizeClass);
+    memcpy(entry.localSize, candidates[best], sizeof(entry.localSize));
+
+    mutexLock(&s_tuneMutex);
+    loadTuneTable();
+    addTuneEntry(&entry);
+    saveTuneTable();
+    mutexUnlock(&s_tuneMutex);
+
+    return SICO_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Returns the tuned local size for a launch or 0 for the driver default. Kernels are only tuned with an explicit
+// scAutotuneKernel call as tuning runs the kernel many times on the current arguments.
+// With exact set the local size has to divide the global size, otherwise the caller handles the remainder.
+
+static const size_t* getTunedLocalSize(SICOKernel kernel, int workDim, const size_t* globalSize, size_t* output, int exact)
+{
+    SICOTuneEntry* entry;
+    int sizeClass[3];
+    int found = 0;
+
+    if (getRequiredLocalSize(kernel, output))
+        return 0;
+
+    getTuneSizeClass(workDim, globalSize, sizeClass);
+
+    mutexLock(&s_tuneMutex);
+
+    loadTuneTable();
+
+    if ((entry = findTuneEntry(getTuneKey(kernel), workDim, sizeClass)))
+    {
+        memcpy(output, entry->localSize, sizeof(size_t) * 3);
+        found = 1;
+    }
+
+    mutexUnlock(&s_tuneMutex);
+
+    if (!found)
+        return 0;
+
+    // entries are per size class so the exact size may not be divisible
+
+    if (output[0] == 0)
+        return 0;
+
+    for (int i = 0; i < workDim && exact; ++i)
+    {
+        if (globalSize[i] % output[i] != 0)
+            return 0;
+    }
+
+    return output;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Local size used for 1D launches that hasn't been tuned: the largest multiple of the preferred size up to 256
+
+#define SICO_DEFAULT_LOCAL_SIZE 256
+
+static size_t getDefaultLocalSize(SICOKernel kernel)
+{
+    size_t maxSize = 0, multiple = 1, local;
+
+    if (kernel->defaultLocalSize)
+        return kernel->defaultLocalSize;
+
+    clGetKernelWorkGroupInfo(kernel->kern, kernel->deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &maxSize, 0);
+    clGetKernelWorkGroupInfo(kernel->kern, kernel->deviceId, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &multiple, 0);
+
+    if (maxSize == 0)
+        return 0;
+
+    local = maxSize < SICO_DEFAULT_LOCAL_SIZE ? maxSize : SICO_DEFAULT_LOCAL_SIZE;
+
+    if (multiple > 0 && local >= multiple)
+        local -= local % multiple;
+
+    kernel->defaultLocalSize = local;
+
+    return local;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static size_t getLocalSize1D(SICOKernel kernel, size_t count)
+{
+    size_t localSize[3];
+
+    if (getTunedLocalSize(kernel, 1, &count, localSize, 0))
+        return localSize[0];
+
+    return getDefaultLocalSize(kernel);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scAddKernel1DSplit(SICOCommanQueue queue, SICOKernel kernel, size_t count, size_t localSize)
+{
+    size_t mainCount, remainder, required[3];
+
+    // kernels with a reqd_work_group_size can't run with any other local size
+
+    if (getRequiredLocalSize(kernel, required))
+        return scAddKernel(queue, kernel, 1, 0, &count, 0, 0, 0, 0);
+
+    if (localSize == 0)
+        localSize = getLocalSize1D(kernel, count);
+
+    if (localSize == 0 || count < localSize)
+        return scAddKernel(queue, kernel, 1, 0, &count, 0, 0, 0, 0);
+
+    remainder = count % localSize;
+    mainCount = count - remainder;
+
+    if (scAddKernel(queue, kernel, 1, 0, &mainCount, &localSize, 0, 0, 0) != SICO_Ok)
+        return SICO_GeneralFail;
+
+    if (remainder == 0)
+        return SICO_Ok;
+
+    // the tail runs as a small launch with an offset so get_global_id still returns the real index
+
+    return scAddKernel(queue, kernel, 1, &mainCount, &remainder, 0, 0, 0, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scAddKernel1DPadded(SICOCommanQueue queue, SICOKernel kernel, size_t count, size_t localSize, int boundsArgIndex)
+{
+    cl_uint bounds = (cl_uint)count;
+    size_t paddedCount, required[3];
+    SICOState state;
+    cl_int error;
+
+    // the bounds argument is a uint so larger counts can't be passed to the kernel
+
+    if (!kernel || count > 0xffffffff || boundsArgIndex < 0)
+        return SICO_GeneralFail;
+
+    // the global size has to be padded to the required size if the kernel has one
+
+    if (getRequiredLocalSize(kernel, required))
+        localSize = required[0];
+
+    if (localSize == 0)
+        localSize = getLocalSize1D(kernel, count);
+
+    if (localSize == 0)
+        localSize = 1;
+
+    paddedCount = ((count + localSize - 1) / localSize) * localSize;
+
+    mutexLock(&kernel->argLock);
+
+    if ((error = setKernelArg(kernel, (cl_uint)boundsArgIndex, sizeof(cl_uint), &bounds)) != CL_SUCCESS)
+    {
+        mutexUnlock(&kernel->argLock);
+        sico_log("Unable to set bounds argument %d, error %s\n", boundsArgIndex, getErrorString(error));
+        return SICO_GeneralFail;
+    }
+
+    state = scAddKernel(queue, kernel, 1, 0, &paddedCount, &localSize, 0, 0, 0);
+
+    mutexUnlock(&kernel->argLock);
+
+    return state;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Always a single launch over count items so get_global_size and get_group_id works as expected. Splitting or padding
+// awkward sizes is opt-in with scAddKernel1DSplit and scAddKernel1DPadded.
+
+SICOState scAddKernel1D(SICOCommanQueue queue, SICOKernel kernel, size_t count)
+{
+    size_t localSize[3];
+
+    return scAddKernel(queue, kernel, 1, 0, &count, getTunedLocalSize(kernel, 1, &count, localSize, 1), 0, 0, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scAddKernel2D(SICOCommanQueue queue, SICODevice device, SICOKernel kernel, size_t sizeX, size_t sizeY, SICOParam* params, int paramCount)
+{
+    size_t sizes[] = { sizeX, sizeY };
+    size_t localSize[3];
+
+	if (scSetupParameters(device, kernel, queue, params, paramCount) != SICO_Ok)
+		return SICO_GeneralFail;
+
+    if (scAddKernel(queue, kernel, 2, 0, (size_t*)&sizes, getTunedLocalSize(kernel, 2, sizes, localSize, 1), 0, 0, 0) != SICO_Ok)
+    	return SICO_GeneralFail;
+
+    return scWriteMemoryParams(device, queue, params, (uint32_t)paramCount);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scAddKernelImage(SICOCommanQueue queue, SICODevice device, SICOKernel kernel, SICOImage image, SICOParam* params, int paramCount)
+{
+    int workDim;
+    size_t localSize[3];
+
+    if (!image)
+        return SICO_GeneralFail;
+
+    workDim = image->size[2] > 1 ? 3 : 2;
+
+    if (scSetupParameters(device, kernel, queue, params, paramCount) != SICO_Ok)
+        return SICO_GeneralFail;
+
+    if (scAddKernel(queue, kernel, workDim, 0, image->size, getTunedLocalSize(kernel, workDim, image->size, localSize, 1), 0, 0, 0) != SICO_Ok)
+        return SICO_GeneralFail;
+
+    return scWriteMemoryParams(device, queue, params, (uint32_t)paramCount);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Launch objects. Buffers are created once and arguments are only set again when they change. Scalars are compared
+// against the value that was last set so changing the host variable is enough, buffers has to be marked dirty.
+
+typedef struct SICOLaunchArg
+{
+    size_t scalarOffset;    // offset into scalarCache for SICO_PARAMETER args
+    uint8_t argDirty;
+    uint8_t uploadDirty;
+} SICOLaunchArg;
+
+struct SICOLaunch
+{
+    SICODevice device;
+    SICOKernel kernel;
+    SICOParam* params;
+    SICOLaunchArg* args;
+    uint8_t* scalarCache;
+    int paramCount;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOLaunch scCreateLaunch(SICODevice device, SICOKernel kernel, const SICOParam* params, int paramCount)
+{
+    SICOLaunch launch;
+    size_t scalarSize = 0;
+    int i, upload;
+
+    if (!device || !device->context || !kernel || !params)
+        return 0;
+
+    launch = mallocZero(sizeof(struct SICOLaunch));
+    launch->device = device;
+    launch->kernel = kernel;
+    launch->paramCount = paramCount;
+    launch->params = mallocZero(sizeof(SICOParam) * (size_t)paramCount);
+    launch->args = mallocZero(sizeof(SICOLaunchArg) * (size_t)paramCount);
+
+    memcpy(launch->params, params, sizeof(SICOParam) * (size_t)paramCount);
+
+    for (i = 0; i < paramCount; ++i)
+    {
+        SICOParam* param = &launch->params[i];
+
+        launch->args[i].argDirty = 1;
+        param->privData = 0;
+
+        if (param->type == SICO_PARAMETER)
+        {
+            launch->args[i].scalarOffset = scalarSize;
+            scalarSize += param->size;
+            continue;
+        }
+
+        if (param->policy == SICO_UserSuppliedData)
+        {
+            param->privData = (void*)param->data;
+            continue;
+        }
+
+        // resident data is synced on every dispatch (which only uploads what changed)
+
+        if (param->policy == SICO_Resident)
+        {
+            param->privData = (void*)((SICOResident)param->data)->mem;
+            continue;
+        }
+
+        if (param->policy == SICO_Output)
+        {
+            param->privData = (void*)((SICOOutput)param->data)->mem;
+            continue;
+        }
+
+        if (param->policy == SICO_Sampler)
+        {
+            param->privData = (void*)param->data;
+            continue;
+        }
+
+        if (param->policy == SICO_Image)
+        {
+            param->privData = (void*)((SICOImage)param->data)->mem;
+            launch->args[i].uploadDirty = 1;
+            continue;
+        }
+
+        if (!(param->privData = createParamBuffer(device, param, i, &upload)))
+        {
+            scDestroyLaunch(launch);
+            return 0;
+        }
+
+        launch->args[i].uploadDirty = (uint8_t)upload;
+    }
+
+    launch->scalarCache = mallocZero(scalarSize > 0 ? scalarSize : 1);
+
+    return launch;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scLaunchSetBuffer(SICOLaunch launch, int index, void* data, size_t size)
+{
+    SICOParam* param;
+    int upload;
+
+    if (!launch || index < 0 || index >= launch->paramCount)
+        return SICO_GeneralFail;
+
+    param = &launch->params[index];
+
+    if (param->type == SICO_PARAMETER || isExternalParam(param))
+        return SICO_GeneralFail;
+
+    // pooled buffers can be reused as long as the size is the same, zero-copy ones wraps the old host pointer
+
+    if (size != param->size || isHostPtrBuffer((cl_mem)param->privData))
+    {
+        poolRelease((cl_mem)param->privData);
+
+        param->data = (uintptr_t)data;
+        param->size = size;
+
+        if (!(param->privData = createParamBuffer(launch->device, param, index, &upload)))
+            return SICO_GeneralFail;
+
+        launch->args[index].argDirty = 1;
+        launch->args[index].uploadDirty = (uint8_t)upload;
+
+        return SICO_Ok;
+    }
+
+    param->data = (uintptr_t)data;
+    launch->args[index].uploadDirty = 1;
+
+    return SICO_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scLaunchMarkDirty(SICOLaunch launch, int index)
+{
+    if (!launch || index < 0 || index >= launch->paramCount)
+        return;
+
+    // zero-copy buffers already points to the host data
+
+    if (launch->params[index].policy == SICO_Resident)
+        scResidentMarkDirty((SICOResident)launch->params[index].data, 0, 0);
+    else if (!isHostPtrBuffer((cl_mem)launch->params[index].privData))
+        launch->args[index].uploadDirty = 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static SICOState updateLaunchArgs(SICOLaunch launch, SICOCommanQueue queue)
+{
+    SICOKernel kernel = launch->kernel;
+    int setAll = kernel->argOwner != launch;
+    cl_int error;
+    int i;
+
+    for (i = 0; i < launch->paramCount; ++i)
+    {
+        SICOParam* param = &launch->params[i];
+        SICOLaunchArg* arg = &launch->args[i];
+
+        if (param->type == SICO_PARAMETER)
+        {
+            uint8_t* cached = launch->scalarCache + arg->scalarOffset;
+
+            if (!setAll && !arg->argDirty && !memcmp(cached, (void*)param->data, param->size))
+                continue;
+
+            memcpy(cached, (void*)param->data, param->size);
+            error = clSetKernelArg(kernel->kern, (cl_uint)i, param->size, cached);
+        }
+        else
+        {
+            if (param->policy == SICO_Resident && scResidentSync(queue, (SICOResident)param->data) != SICO_Ok)
+                return SICO_GeneralFail;
+
+            if (param->policy == SICO_Output &&
+                prepareOutput((cl_command_queue)queue, (SICOOutput)param->data, param->type != SICO_MEM_READ_ONLY) != SICO_Ok)
+            {
+                return SICO_GeneralFail;
+            }
+
+            if (!isExternalParam(param))
+                poolUse(launch->device, (cl_mem)param->privData, (cl_command_queue)queue);
+
+            if (arg->uploadDirty && param->policy == SICO_Image)
+            {
+                if (param->type != SICO_MEM_WRITE_ONLY && scWriteImage(queue, (SICOImage)param->data, 0, 0) != SICO_Ok)
+                    return SICO_GeneralFail;
+
+                arg->uploadDirty = 0;
+            }
+
+            if (arg->uploadDirty && param->privData && !skipsUpload(param) && !isExternalParam(param))
+            {
+                if ((error = enqueueWrite((cl_command_queue)queue, (cl_mem)param->privData, CL_FALSE, 0, param->size,
+                                          (void*)param->data, 0, NULL, NULL)) != CL_SUCCESS)
+                {
+                    sico_log("clEnqueueWriteBuffer failed (param %d), error %s\n", i, getErrorString(error));
+                    return SICO_GeneralFail;
+                }
+
+                arg->uploadDirty = 0;
+            }
+
+            if (!setAll && !arg->argDirty)
+                continue;
+
+            error = clSetKernelArg(kernel->kern, (cl_uint)i, sizeof(cl_mem), &param->privData);
+        }
+
+        if (error != CL_SUCCESS)
+        {
+            sico_log("Unable to clSetKernelArg (param %d), error %s\n", i, getErrorString(error));
+            return SICO_GeneralFail;
+        }
+
+        arg->argDirty = 0;
+    }
+
+    kernel->argOwner = launch;
+
+    return SICO_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scLaunchDispatch(SICOLaunch launch, SICOCommanQueue queue, int workDim, const size_t* globalSize, const size_t* localSize)
+{
+    SICOState state;
+
+    if (!launch || !queue)
+        return SICO_GeneralFail;
+
+    mutexLock(&launch->kernel->argLock);
+
+    if ((state = updateLaunchArgs(launch, queue)) == SICO_Ok)
+        state = scAddKernel(queue, launch->kernel, workDim, 0, globalSize, localSize, 0, 0, 0);
+
+    mutexUnlock(&launch->kernel->argLock);
+
+    return state;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scLaunchReadBack(SICOLaunch launch, SICOCommanQueue queue)
+{
+    if (!launch)
+        return SICO_GeneralFail;
+
+    return writeMemoryParams(launch->device, queue, launch->params, (uint32_t)launch->paramCount, CL_TRUE);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scDestroyLaunch(SICOLaunch launch)
+{
+    if (!launch)
+        return;
+
+    mutexLock(&launch->kernel->argLock);
+
+    if (launch->kernel->argOwner == launch)
+        launch->kernel->argOwner = 0;
+
+    mutexUnlock(&launch->kernel->argLock);
+
+    for (int i = 0; i < launch->paramCount; ++i)
+    {
+        if (launch->params[i].privData && !isExternalParam(&launch->params[i]))
+            poolRelease((cl_mem)launch->params[i].privData);
+    }
+
+    free(launch->scalarCache);
+    free(launch->params);
+    free(launch->args);
+    free(launch);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Streaming executor. Each slot has its own queue and set of chunk buffers so upload, compute and download of
+// different chunks can overlap.
+
+#define SICO_STREAM_MAX_DEPTH 8
+#define SICO_STREAM_MAX_PARAMS 64
+#define SICO_STREAM_DEFAULT_CHUNK (1024 * 1024)
+
+typedef struct SICOStreamSlot
+{
+    cl_command_queue queue;
+    cl_mem buffers[SICO_STREAM_MAX_PARAMS];
+    cl_event done;
+} SICOStreamSlot;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static SICOState streamChunk(SICOStreamSlot* slot, SICOKernel kernel, SICOParam* params, int paramCount,
+                             const size_t* elementSizes, size_t start, size_t count)
+{
+    cl_int error = CL_SUCCESS;
+
+    for (int i = 0; i < paramCount && error == CL_SUCCESS; ++i)
+    {
+        SICOParam* param = &params[i];
+
+        if (param->type == SICO_PARAMETER)
+        {
+            error = setKernelArg(kernel, (cl_uint)i, param->size, (void*)param->data);
+            continue;
+        }
+
+        if (!skipsUpload(param))
+        {
+            error = enqueueWrite(slot->queue, slot->buffers[i], CL_FALSE, 0, count * elementSizes[i],
+                                         (uint8_t*)param->data + start * elementSizes[i], 0, 0, 0);
+        }
+
+        if (error == CL_SUCCESS)
+            error = setKernelArg(kernel, (cl_uint)i, sizeof(cl_mem), &slot->buffers[i]);
+    }
+
+    if (error != CL_SUCCESS)
+    {
+        sico_log("Unable to setup chunk at %d, error %s\n", (int)start, getErrorString(error));
+        return SICO_GeneralFail;
+    }
+
+    if (scAddKernel((SICOCommanQueue)slot->queue, kernel, 1, 0, &count, 0, 0, 0, 0) != SICO_Ok)
+        return SICO_UnableToExecuteKernel;
+
+    for (int i = 0; i < paramCount && error == CL_SUCCESS; ++i)
+    {
+        SICOParam* param = &params[i];
+
+        if (param->type == SICO_PARAMETER || param->type == SICO_MEM_READ_ONLY)
+            continue;
+
+        error = enqueueRead(slot->queue, slot->buffers[i], CL_FALSE, 0, count * elementSizes[i],
+                                    (uint8_t*)param->data + start * elementSizes[i], 0, 0, 0);
+    }
+
+    if (error == CL_SUCCESS)
+        error = clEnqueueMarkerWithWaitList(slot->queue, 0, 0, &slot->done);
+
+    if (error == CL_SUCCESS)
+        error = clFlush(slot->queue);
+
+    if (error != CL_SUCCESS)
+    {
+        sico_log("Unable to read back chunk at %d, error %s\n", (int)start, getErrorString(error));
+        return SICO_GeneralFail;
+    }
+
+    return SICO_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scStreamKernel1D(SICODevice device, SICOKernel kernel, SICOParam* params, int paramCount, size_t elementCount,
+                           const SICOStreamConfig* config)
+{
+    SICOStreamSlot slots[SICO_STREAM_MAX_DEPTH];
+    size_t elementSizes[SICO_STREAM_MAX_PARAMS];
+    size_t chunkElements = config ? config->chunkElements : 0;
+    size_t maxElementSize = 0;
+    cl_ulong maxAlloc = 0;
+    SICOState state = SICO_Ok;
+    int depth = config ? config->depth : 0;
+    int slotCount = 0;
+    cl_int error;
+
+    if (!device)
+        return SICO_NoDevice;
+
+    if (!kernel || !params || paramCount > SICO_STREAM_MAX_PARAMS || elementCount == 0)
+        return SICO_GeneralFail;
+
+    // All buffer parameters are treated as arrays of elementCount items
+
+    for (int i = 0; i < paramCount; ++i)
+    {
+        elementSizes[i] = 0;
+
+        if (params[i].type == SICO_PARAMETER)
+            continue;
+
+        if (params[i].size % elementCount != 0)
+        {
+            sico_log("Size of param %d (%d) isn't a multiple of the element count\n", i, (int)params[i].size);
+            return SICO_GeneralFail;
+        }
+
+        elementSizes[i] = params[i].size / elementCount;
+
+        if (elementSizes[i] > maxElementSize)
+            maxElementSize = elementSizes[i];
+    }
+
+    if (maxElementSize == 0)
+        return SICO_GeneralFail;
+
+    clGetDeviceInfo(device->deviceId, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAlloc), &maxAlloc, 0);
+
+    if (depth <= 0)
+        depth = 2;
+
+    if (depth > SICO_STREAM_MAX_DEPTH)
+        depth = SICO_STREAM_MAX_DEPTH;
+
+    if (chunkElements == 0)
+        chunkElements = SICO_STREAM_DEFAULT_CHUNK;
+
+    // Pool size classes can round up by 25% so keep a margin to the max allocation size
+
+    if (maxAlloc > 0 && chunkElements * maxElementSize > (size_t)(maxAlloc / 5 * 4))
+        chunkElements = (size_t)(maxAlloc / 5 * 4) / maxElementSize;
+
+    if (chunkElements > elementCount)
+        chunkElements = elementCount;
+
+    if (chunkElements == 0)
+        return SICO_GeneralFail;
+
+    memset(slots, 0, sizeof(slots));
+
+    for (slotCount = 0; slotCount < depth && state == SICO_Ok; ++slotCount)
+    {
+        SICOStreamSlot* slot = &slots[slotCount];
+
+        if (!(slot->queue = (cl_command_queue)scCreateCommandQueue(device)))
+            state = SICO_GeneralFail;
+
+        for (int i = 0; i < paramCount && state == SICO_Ok; ++i)
+        {
+            if (params[i].type == SICO_PARAMETER)
+                continue;
+
+            if (!(slot->buffers[i] = poolAcquire(device, chunkElements * elementSizes[i], &error)))
+            {
+                sico_log("Unable to allocate chunk buffer (param %d), error %s\n", i, getErrorString(error));
+                state = SICO_GeneralFail;
+            }
+        }
+    }
+
+    mutexLock(&kernel->argLock);
+
+    for (size_t start = 0, chunk = 0; start < elementCount && state == SICO_Ok; start += chunkElements, ++chunk)
+    {
+        SICOStreamSlot* slot = &slots[chunk % (size_t)depth];
+        size_t count = elementCount - start < chunkElements ? elementCount - start : chunkElements;
+
+        // Wait for the slot to be done with its previous chunk before reusing the buffers
+
+        if (slot->done)
+        {
+            clWaitForEvents(1, &slot->done);
+            clReleaseEvent(slot->done);
+            slot->done = 0;
+        }
+
+        state = streamChunk(slot, kernel, params, paramCount, elementSizes, start, count);
+    }
+
+    mutexUnlock(&kernel->argLock);
+
+    for (int s = 0; s < slotCount; ++s)
+    {
+        SICOStreamSlot* slot = &slots[s];
+
+        if (slot->queue)
+            clFinish(slot->queue);
+
+        if (slot->done)
+            clReleaseEvent(slot->done);
+
+        for (int i = 0; i < paramCount; ++i)
+        {
+            if (slot->buffers[i])
+                poolRelease(slot->buffers[i]);
+        }
+
+        if (slot->queue)
+            clReleaseCommandQueue(slot->queue);
+    }
+
+    return state;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Multi-device runs. The work is split along the last dimension (rows for 2D) and each device gets a full copy of
+// the inputs but only reads back its own rows of the outputs.
+
+#define SICO_MULTI_MAX_DEVICES 16
+#define SICO_MULTI_MAX_PARAMS 64
+
+struct SICOMultiKernel
+{
+    SICODevice devices[SICO_MULTI_MAX_DEVICES];
+    SICOKernel kernels[SICO_MULTI_MAX_DEVICES];
+    double weights[SICO_MULTI_MAX_DEVICES];
+    int deviceCount;
+    SICOSplitMode mode;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void normalizeWeights(double* weights, int count)
+{
+    double total = 0.0;
+
+    for (int i = 0; i < count; ++i)
+        total += weights[i];
+
+    for (int i = 0; i < count; ++i)
+        weights[i] = total > 0.0 ? weights[i] / total : 1.0 / (double)count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct SICOMultiKernel* scCreateMultiKernel(SICODevice* devices, int deviceCount, const char* filename, const char* kernelName,
+                                            const char* buildOpts, SICOSplitMode mode)
+{
+    struct SICOMultiKernel* multi;
+
+    if (!devices || deviceCount <= 0)
+        return 0;
+
+    if (deviceCount > SICO_MULTI_MAX_DEVICES)
+        deviceCount = SICO_MULTI_MAX_DEVICES;
+
+    multi = mallocZero(sizeof(struct SICOMultiKernel));
+    multi->mode = mode;
+
+    for (int i = 0; i < deviceCount; ++i)
+    {
+        SICOKernel kernel;
+
+        // Devices where the kernel doesn't build are skipped so the rest can still be used
+
+        if (!(kernel = scGetKernel(devices[i], filename, kernelName, buildOpts)))
+            continue;
+
+        multi->devices[multi->deviceCount] = devices[i];
+        multi->kernels[multi->deviceCount] = kernel;
+        multi->weights[multi->deviceCount] = getDeviceThroughputEstimate(devices[i]);
+        multi->deviceCount++;
+    }
+
+    if (multi->deviceCount == 0)
+    {
+        free(multi);
+        return 0;
+    }
+
+    normalizeWeights(multi->weights, multi->deviceCount);
+
+    return multi;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scDestroyMultiKernel(struct SICOMultiKernel* multi)
+{
+    free(multi);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int scGetMultiKernelWeights(struct SICOMultiKernel* multi, float* weights)
+{
+    for (int i = 0; i < multi->deviceCount; ++i)
+        weights[i] = (float)multi->weights[i];
+
+    return multi->deviceCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Completion of the parts is recorded from event callbacks so the host thread can sleep while the devices work (a
+// spinning thread would take a core from a CPU device and skew the measured throughput)
+
+typedef struct SICOMultiPart
+{
+    double doneTime;
+    cl_int status;
+    int* remaining;
+} SICOMultiPart;
+
+static SICOMutex s_multiMutex = SICO_MUTEX_INIT;
+static SICOCondition s_multiDone = SICO_CONDITION_INIT;
+
+static void CL_CALLBACK multiPartCallback(cl_event event, cl_int status, void* userData)
+{
+    SICOMultiPart* part = (SICOMultiPart*)userData;
+    double time = getTime();
+
+    (void)event;
+
+    mutexLock(&s_multiMutex);
+    part->doneTime = time;
+    part->status = status;
+    (*part->remaining)--;
+    conditionBroadcast(&s_multiDone);
+    mutexUnlock(&s_multiMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static SICOState enqueueMultiPart(SICODevice device, SICOKernel kernel, int workDim, const size_t* globalSize,
+                                  size_t rowStart, size_t rowCount, size_t rows, SICOParam* params, int paramCount,
+                                  cl_mem* buffers, cl_event* done)
+{
+    cl_command_queue queue = (cl_command_queue)scGetDeviceQueue(device);
+    size_t offset[3] = { 0, 0, 0 };
+    size_t size[3] = { 0, 0, 0 };
+    cl_int error = CL_SUCCESS;
+    SICOState state = SICO_Ok;
+
+    if (!queue)
+        return SICO_GeneralFail;
+
+    for (int d = 0; d < workDim; ++d)
+        size[d] = globalSize[d];
+
+    offset[workDim - 1] = rowStart;
+    size[workDim - 1] = rowCount;
+
+    mutexLock(&kernel->argLock);
+
+    for (int i = 0; i < paramCount && error == CL_SUCCESS; ++i)
+    {
+        SICOParam* param = &params[i];
+
+        if (param->type == SICO_PARAMETER)
+        {
+            error = setKernelArg(kernel, (cl_uint)i, param->size, (void*)param->data);
+            continue;
+        }
+
+        if (!(buffers[i] = poolAcquire(device, param->size, &error)))
+            break;
+
+        if (!skipsUpload(param))
+            error = enqueueWrite(queue, buffers[i], CL_FALSE, 0, param->size, (void*)param->data, 0, 0, 0);
+
+        if (error == CL_SUCCESS)
+            error = setKernelArg(kernel, (cl_uint)i, sizeof(cl_mem), &buffers[i]);
+    }
+
+    if (error == CL_SUCCESS)
+        error = enqueueKernel(queue, kernel, (cl_uint)workDim, offset, size, 0, 0, 0, 0);
+
+    mutexUnlock(&kernel->argLock);
+
+    // Only read back the rows this device has been working on
+
+    for (int i = 0; i < paramCount && error == CL_SUCCESS; ++i)
+    {
+        SICOParam* param = &params[i];
+        size_t rowSize = param->size / rows;
+
+        if (param->type == SICO_PARAMETER || param->type == SICO_MEM_READ_ONLY)
+            continue;
+
+        error = enqueueRead(queue, buffers[i], CL_FALSE, rowStart * rowSize, rowCount * rowSize,
+                                    (uint8_t*)param->data + rowStart * rowSize, 0, 0, 0);
+    }
+
+    if (error == CL_SUCCESS)
+        error = clEnqueueMarkerWithWaitList(queue, 0, 0, done);
+
+    if (error == CL_SUCCESS)
+        error = clFlush(queue);
+
+    if (error != CL_SUCCESS)
+    {
+        sico_log("Unable to run multi-device part, error %s\n", getErrorString(error));
+        state = SICO_GeneralFail;
+    }
+
+    return state;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scRunMultiKernel(struct SICOMultiKernel* multi, int workDim, const size_t* globalSize, SICOParam* params, int paramCount)
+{
+    cl_mem buffers[SICO_MULTI_MAX_DEVICES][SICO_MULTI_MAX_PARAMS];
+    cl_event done[SICO_MULTI_MAX_DEVICES];
+    size_t rowCounts[SICO_MULTI_MAX_DEVICES];
+    SICOMultiPart parts[SICO_MULTI_MAX_DEVICES];
+    SICOState state = SICO_Ok;
+    size_t rows, rowStart = 0;
+    int remaining = 0;
+    double startTime;
+
+    if (!multi || workDim < 1 || workDim > 3 || !globalSize || paramCount > SICO_MULTI_MAX_PARAMS)
+        return SICO_GeneralFail;
+
+    rows = globalSize[workDim - 1];
+
+    if (rows == 0)
+        return SICO_GeneralFail;
+
+    for (int i = 0; i < paramCount; ++i)
+    {
+        if (params[i].type != SICO_PARAMETER && params[i].type != SICO_MEM_READ_ONLY && params[i].size % rows != 0)
+        {
+            sico_log("Size of output param %d isn't a multiple of the number of rows\n", i);
+            return SICO_GeneralFail;
+        }
+    }
+
+    // Split the rows according to the weights, the last device with work gets what's left due to rounding
+
+    for (int d = 0; d < multi->deviceCount; ++d)
+    {
+        rowCounts[d] = (size_t)((double)rows * multi->weights[d]);
+
+        if (rowStart + rowCounts[d] > rows)
+            rowCounts[d] = rows - rowStart;
+
+        rowStart += rowCounts[d];
+    }
+
+    for (int d = multi->deviceCount - 1; d >= 0 && rowStart < rows; --d)
+    {
+        if (rowCounts[d] > 0 || d == 0)
+        {
+            rowCounts[d] += rows - rowStart;
+            rowStart = rows;
+        }
+    }
+
+    memset(buffers, 0, sizeof(buffers));
+    memset(done, 0, sizeof(done));
+
+    startTime = getTime();
+    rowStart = 0;
+
+    for (int d = 0; d < multi->deviceCount; ++d)
+    {
+        parts[d].doneTime = startTime;
+        parts[d].status = CL_COMPLETE;
+        parts[d].remaining = &remaining;
+
+        if (rowCounts[d] == 0)
+            continue;
+
+        if (state == SICO_Ok)
+        {
+            state = enqueueMultiPart(multi->devices[d], multi->kernels[d], workDim, globalSize, rowStart, rowCounts[d],
+                                     rows, params, paramCount, buffers[d], &done[d]);
+        }
+
+        rowStart += rowCounts[d];
+
+        if (!done[d])
+            continue;
+
+        // the count is increased first as the callback can run right away
+
+        mutexLock(&s_multiMutex);
+        remaining++;
+        mutexUnlock(&s_multiMutex);
+
+        if (clSetEventCallback(done[d], CL_COMPLETE, multiPartCallback, &parts[d]) != CL_SUCCESS)
+        {
+            clWaitForEvents(1, &done[d]);
+            clGetEventInfo(done[d], CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &parts[d].status, 0);
+            parts[d].doneTime = getTime();
+
+            mutexLock(&s_multiMutex);
+            remaining--;
+            mutexUnlock(&s_multiMutex);
+        }
+    }
+
+    // Wait for all callbacks so we get a per-device finish time to rebalance from
+
+    mutexLock(&s_multiMutex);
+
+    while (remaining > 0)
+        conditionWait(&s_multiDone, &s_multiMutex);
+
+    mutexUnlock(&s_multiMutex);
+
+    for (int d = 0; d < multi->deviceCount; ++d)
+    {
+        if (done[d] && parts[d].status < 0)
+            state = SICO_UnableToExecuteKernel;
+    }
+
+    for (int d = 0; d < multi->deviceCount; ++d)
+    {
+        if (done[d])
+            clReleaseEvent(done[d]);
+
+        for (int i = 0; i < paramCount; ++i)
+        {
+            if (buffers[d][i])
+                poolRelease(buffers[d][i]);
+        }
+    }
+
+    if (state != SICO_Ok || multi->mode != SICO_SplitAdaptive)
+        return state;
+
+    // Move the weights towards the measured throughput (rows per second). Devices that didn't get any work keeps
+    // their old weight so they can get work again.
+
+    {
+        double measured[SICO_MULTI_MAX_DEVICES];
+
+        for (int d = 0; d < multi->deviceCount; ++d)
+        {
+            double time = parts[d].doneTime - startTime;
+
+            if (rowCounts[d] == 0 || time <= 0.0)
+                measured[d] = multi->weights[d];
+            else
+                measured[d] = (double)rowCounts[d] / time;
+        }
+
+        normalizeWeights(measured, multi->deviceCount);
+
+        for (int d = 0; d < multi->deviceCount; ++d)
+            multi->weights[d] = multi->weights[d] * 0.5 + measured[d] * 0.5;
+
+        normalizeWeights(multi->weights, multi->deviceCount);
+    }
+
+    return SICO_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scAddKernel1DAsync(SICOCommanQueue queue, SICOKernel kernel, size_t count,
+                             int waitCount, const SICOEvent* waitList, SICOEvent* event)
+{
+    return scAddKernel(queue, kernel, 1, 0, &count, 0, waitCount, waitList, event);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOHandle scAllocSyncCopy(struct SICODevice* device, const void* memory, size_t size)
+{
+    cl_int error;
+    cl_mem mem;
+
+    if (!(mem = clCreateBuffer(device->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, size, (void*)memory, &error)))
+    {
+        sico_log("clCreateBuffer failed, error %s\n", getErrorString(error));
+        return 0;
+    }
+
+    return (SICOHandle)mem;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOEvent scAsyncCopyToDevice(SICOCommanQueue queue, SICOHandle handle, size_t offset, const void* memory, size_t size,
+                              int waitCount, const SICOEvent* waitList)
+{
+    cl_event event = 0;
+    cl_int error = enqueueWrite((cl_command_queue)queue, (cl_mem)handle, CL_FALSE, offset, size, memory,
+                                (cl_uint)waitCount, (const cl_event*)waitList, &event);
+
+    if (error == CL_SUCCESS)
+        return (SICOEvent)event;
+
+    sico_log("clEnqueueWriteBuffer failed, error %s\n", getErrorString(error));
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOEvent scAsyncCopyFromDevice(SICOCommanQueue queue, void* dest, SICOHandle handle, size_t offset, size_t size,
+                                int waitCount, const SICOEvent* waitList)
+{
+    cl_event event = 0;
+    cl_int error = enqueueRead((cl_command_queue)queue, (cl_mem)handle, CL_FALSE, offset, size, dest,
+                               (cl_uint)waitCount, (const cl_event*)waitList, &event);
+
+    if (error == CL_SUCCESS)
+        return (SICOEvent)event;
+
+    sico_log("clEnqueueReadBuffer failed, error %s\n", getErrorString(error));
+
+    return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scWaitEvents(const SICOEvent* events, int count)
+{
+    cl_int error;
+
+    if (count <= 0)
+        return SICO_Ok;
+
+    if ((error = clWaitForEvents((cl_uint)count, (const cl_event*)events)) == CL_SUCCESS)
+        return SICO_Ok;
+
+    sico_log("%s\n", getErrorString(error));
+
+    return SICO_GeneralFail;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int scIsEventComplete(SICOEvent event)
+{
+    cl_int status = CL_COMPLETE;
+
+    clGetEventInfo((cl_event)event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, 0);
+
+    // negative values are errors which also means the command is done
+
+    return status <= CL_COMPLETE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scReleaseEvent(SICOEvent event)
+{
+    if (event)
+        clReleaseEvent((cl_event)event);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct SICOEventCallbackData
+{
+    SICOEventCallback callback;
+    void* userData;
+} SICOEventCallbackData;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void CL_CALLBACK eventCallback(cl_event event, cl_int status, void* userData)
+{
+    SICOEventCallbackData* data = (SICOEventCallbackData*)userData;
+
+    data->callback((SICOEvent)event, status == CL_COMPLETE ? SICO_Ok : SICO_GeneralFail, data->userData);
+
+    free(data);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scSetEventCallback(SICOEvent event, SICOEventCallback callback, void* userData)
+{
+    cl_int error;
+    SICOEventCallbackData* data = malloc(sizeof(SICOEventCallbackData));
 
-    clGetPlatformIDs(0, 0, &platformCount);
-    platforms = (cl_platform_id*)malloc(sizeof(cl_platform_id) * platformCount);
-    clGetPlatformIDs(platformCount, platforms, 0);
+    data->callback = callback;
+    data->userData = userData;
+
+    if ((error = clSetEventCallback((cl_event)event, CL_COMPLETE, eventCallback, data)) == CL_SUCCESS)
+        return SICO_Ok;
+
+    free(data);
+
+    sico_log("clSetEventCallback failed, error %s\n", getErrorString(error));
+
+    return SICO_GeneralFail;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scFreeParams(SICOParam* params, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        if (params[i].privData && !isExternalParam(&params[i]))
+            poolRelease((cl_mem)params[i].privData);
+
+        params[i].privData = 0;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOHandle scGetParamHandle(const SICOParam* param)
+{
+    if (!param || param->type == SICO_PARAMETER)
+        return 0;
+
+    return (SICOHandle)param->privData;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static SICODevice getQueueDevice(cl_command_queue queue);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reads part of a buffer back to the same place in the host array. Rows/slices are read with clEnqueueReadBufferRect
+// so only the region is transferred.
+
+SICOState scReadParamRegion(SICOCommanQueue queue, const SICOParam* param, const SICORegion* region, int blocking)
+{
+    size_t origin[3], size[3];
+    size_t rowPitch, slicePitch;
+    cl_event temp;
+    cl_event* event;
+    cl_int error;
+
+    if (!queue || !param || !region || !param->privData || param->type == SICO_PARAMETER || isExternalParam(param))
+    {
+        return SICO_GeneralFail;
+    }
+
+    poolUse(getQueueDevice((cl_command_queue)queue), (cl_mem)param->privData, (cl_command_queue)queue);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        origin[i] = region->origin[i];
+        size[i] = region->size[i] ? region->size[i] : 1;
+    }
+
+    // plain byte range
+
+    if (region->rowPitch == 0)
+    {
+        if (origin[0] + size[0] > param->size)
+            return SICO_GeneralFail;
+
+        error = enqueueRead((cl_command_queue)queue, (cl_mem)param->privData, blocking ? CL_TRUE : CL_FALSE, origin[0], size[0],
+                            (uint8_t*)param->data + origin[0], 0, NULL, NULL);
+    }
+    else
+    {
+        rowPitch = region->rowPitch;
+        slicePitch = region->slicePitch;
+
+        // slicePitch is only needed for 3D regions (OpenCL computes it for 2D ones)
+
+        if (slicePitch == 0 && (origin[2] != 0 || size[2] != 1))
+            return SICO_GeneralFail;
+
+        if (origin[0] + size[0] > rowPitch || (origin[2] + size[2] - 1) * slicePitch + (origin[1] + size[1]) * rowPitch > param->size)
+            return SICO_GeneralFail;
+
+        event = getProfileEvent(0, &temp);
+
+        error = clEnqueueReadBufferRect((cl_command_queue)queue, (cl_mem)param->privData, blocking ? CL_TRUE : CL_FALSE,
+                                        origin, origin, size, rowPitch, slicePitch, rowPitch, slicePitch,
+                                        (void*)param->data, 0, NULL, event);
+
+        if (error == CL_SUCCESS)
+            profileEvent("read_rect", SICO_ProfileRead, size[0] * size[1] * size[2], event, 0);
+    }
+
+    if (error != CL_SUCCESS)
+    {
+        sico_log("Unable to read back region, error %s\n", getErrorString(error));
+        return SICO_GeneralFail;
+    }
+
+    return SICO_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scCommandQueueFinish(SICOCommanQueue queue)
+{
+    cl_int errorCode = clFinish(queue);
+
+    if (errorCode == CL_SUCCESS)
+        return SICO_Ok;
+
+    sico_log("%s ", getErrorString(errorCode));
+
+    return SICO_GeneralFail;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scDestroyCommandQueue(SICOCommanQueue queue)
+{
+    cl_int errorCode = clReleaseCommandQueue(queue);
+
+    if (errorCode == CL_SUCCESS)
+        return SICO_Ok;
+
+    sico_log("%s ", getErrorString(errorCode));
+
+    return SICO_GeneralFail;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scRunKernel1DArraySimple(void* dest, void* sourceA, void* sourceB, const char* filename, size_t elementCount, size_t sizeInBytes)
+{
+    SICODevice device;
+    SICOKernel kernel;
+    SICOCommanQueue queue;
+    SICOState state = SICO_Ok;
+
+    SICOParam params[] =
+    {
+        { (uintptr_t)dest, SICO_MEM_READ_WRITE, SICO_AutoAllocate, sizeInBytes, 0 },
+        { (uintptr_t)sourceA, SICO_MEM_READ_ONLY, SICO_AutoAllocate, sizeInBytes, 0 },
+        { (uintptr_t)sourceB, SICO_MEM_READ_ONLY, SICO_AutoAllocate, sizeInBytes, 0 },
+    };
+
+    if (!scInitialize())
+        return SICO_NoDevice;
+
+    if (!(device = scGetBestDevice()))
+    {
+        sico_log("%s ", "Unable to find OpenCL device\n");
+        return SICO_NoDevice;
+    }
+
+    // Kernel and queue are owned by SICO and reused between calls (released in scClose). The queue is per thread so
+    // several threads can run this at the same time, only the argument setup of the shared kernel is serialized
+
+    if (!(kernel = scGetKernel(device, filename, "kern", "")))
+        return SICO_UnableToBuildKernel;
+
+    if (!(queue = scGetThreadQueue(device)))
+        return SICO_GeneralFail;
+
+    mutexLock(&kernel->argLock);
+
+    if ((scSetupParameters(device, kernel, queue, params, SICO_SIZEOF_ARRAY(params))) != SICO_Ok)
+        state = SICO_GeneralFail;
+    else if ((scAddKernel1D(queue, kernel, elementCount)) != SICO_Ok)
+        state = SICO_GeneralFail;
+
+    mutexUnlock(&kernel->argLock);
+
+    if (state == SICO_Ok && (scWriteMemoryParams(device, queue, params, SICO_SIZEOF_ARRAY(params))) != SICO_Ok)
+        state = SICO_GeneralFail;
+
+    scCommandQueueFinish(queue);
+
+    scFreeParams(params, SICO_SIZEOF_ARRAY(params));
+
+    return state;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Profiling results
+
+static SICOProfileStats* s_profileStats = 0;
+static int s_profileStatsCount = 0;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Callbacks are fired by the driver threads so give them a moment to finish after the queues has been drained
+
+static void waitProfilePending()
+{
+    double endTime = getTime() + 1.0;
+
+    for (;;)
+    {
+        int pending;
+
+        mutexLock(&s_profileMutex);
+        pending = s_profilePending;
+        mutexUnlock(&s_profileMutex);
+
+        if (pending <= 0 || getTime() > endTime)
+            return;
+
+        threadYield();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int compareDouble(const void* a, const void* b)
+{
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static double getPercentile(const double* sorted, int count, double percentile)
+{
+    int index = (int)(percentile * (double)(count - 1) + 0.5);
+    return sorted[index];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void buildProfileStats()
+{
+    int i, j;
+    double* durations;
+
+    for (i = 0; i < s_profileStatsCount; ++i)
+        free((void*)s_profileStats[i].name);
+
+    free(s_profileStats);
+    s_profileStats = 0;
+    s_profileStatsCount = 0;
+
+    if (s_profileRecordCount == 0)
+        return;
+
+    s_profileStats = mallocZero(sizeof(SICOProfileStats) * (size_t)s_profileRecordCount);
+    durations = malloc(sizeof(double) * (size_t)s_profileRecordCount);
+
+    for (i = 0; i < s_profileRecordCount; ++i)
+    {
+        const SICOProfileRecord* record = &s_profileRecords[i];
+        SICOProfileStats* stats;
+        double queueTime = 0.0;
+        int count = 0;
+        char* name;
+
+        // skip if this name/type has already been aggregated
+
+        for (j = 0; j < s_profileStatsCount; ++j)
+        {
+            if (s_profileStats[j].type == record->type && !strcmp(s_profileStats[j].name, record->name))
+                break;
+        }
+
+        if (j != s_profileStatsCount)
+            continue;
+
+        stats = &s_profileStats[s_profileStatsCount++];
+        name = malloc(strlen(record->name) + 1);
+        strcpy(name, record->name);
+        stats->name = name;
+        stats->type = record->type;
+
+        for (j = i; j < s_profileRecordCount; ++j)
+        {
+            const SICOProfileRecord* other = &s_profileRecords[j];
+
+            if (other->type != record->type || strcmp(other->name, record->name))
+                continue;
+
+            durations[count++] = (double)(other->end - other->start) / 1e6;
+            queueTime += (double)(other->start - other->queued) / 1e6;
+            stats->bytes += other->bytes;
+        }
+
+        qsort(durations, (size_t)count, sizeof(double), compareDouble);
+
+        stats->count = count;
+        stats->minMs = durations[0];
+        stats->maxMs = durations[count - 1];
+        stats->p50Ms = getPercentile(durations, count, 0.50);
+        stats->p99Ms = getPercentile(durations, count, 0.99);
+        stats->queueMs = queueTime / count;
+
+        for (j = 0; j < count; ++j)
+            stats->totalMs += durations[j];
+
+        if (stats->totalMs > 0.0)
+            stats->gbPerSec = ((double)stats->bytes / 1e9) / (stats->totalMs / 1e3);
+    }
+
+    free(durations);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int scGetProfileStats(SICOProfileStats* stats, int maxCount)
+{
+    int count;
+
+    waitProfilePending();
+
+    mutexLock(&s_profileMutex);
+
+    buildProfileStats();
+
+    count = s_profileStatsCount;
+
+    if (stats)
+        memcpy(stats, s_profileStats, sizeof(SICOProfileStats) * (size_t)(maxCount < count ? maxCount : count));
+
+    mutexUnlock(&s_profileMutex);
+
+    return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const char* getProfileTypeName(SICOProfileType type)
+{
+    switch (type)
+    {
+        case SICO_ProfileKernel : return "kernel";
+        case SICO_ProfileWrite : return "write";
+        case SICO_ProfileRead : return "read";
+        case SICO_ProfileCompile : return "compile";
+    }
+
+    return "unknown";
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void writeJsonString(FILE* file, const char* text)
+{
+    fputc('"', file);
+
+    for (; *text; ++text)
+    {
+        if (*text == '"' || *text == '\\')
+            fputc('\\', file);
+
+        if ((unsigned char)*text >= 0x20)
+            fputc(*text, file);
+    }
+
+    fputc('"', file);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scProfilingWriteJson(const char* filename)
+{
+    FILE* file;
+    int i, count;
+
+    if (!(file = fopen(filename, "wb")))
+    {
+        sico_log("Unable to open %s for writing\n", filename);
+        return SICO_GeneralFail;
+    }
+
+    count = scGetProfileStats(0, 0);
+
+    mutexLock(&s_profileMutex);
+
+    fprintf(file, "{\n  \"dropped\": %d,\n  \"entries\": [\n", s_profileDropped);
+
+    for (i = 0; i < count && i < s_profileStatsCount; ++i)
+    {
+        const SICOProfileStats* stats = &s_profileStats[i];
+
+        fprintf(file, "    { \"name\": ");
+        writeJsonString(file, stats->name);
+        fprintf(file, ", \"type\": \"%s\", \"count\": %d, \"total_ms\": %f, \"min_ms\": %f, \"max_ms\": %f, "
+                      "\"p50_ms\": %f, \"p99_ms\": %f, \"queue_ms\": %f, \"bytes\": %llu, \"gb_per_s\": %f }%s\n",
+                getProfileTypeName(stats->type), stats->count, stats->totalMs, stats->minMs, stats->maxMs,
+                stats->p50Ms, stats->p99Ms, stats->queueMs, (unsigned long long)stats->bytes, stats->gbPerSec,
+                i + 1 < count ? "," : "");
+    }
+
+    fprintf(file, "  ]\n}\n");
+
+    mutexUnlock(&s_profileMutex);
+
+    fclose(file);
+
+    return SICO_Ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Device and host timestamps use different clocks so they are put on separate tracks, each relative to its
+// own first record.
+
+SICOState scProfilingWriteChromeTrace(const char* filename)
+{
+    FILE* file;
+    int i, pass, first = 1;
+    cl_ulong baseTime[2] = { (cl_ulong)-1, (cl_ulong)-1 };
+
+    if (!(file = fopen(filename, "wb")))
+    {
+        sico_log("Unable to open %s for writing\n", filename);
+        return SICO_GeneralFail;
+    }
+
+    waitProfilePending();
+
+    mutexLock(&s_profileMutex);
+
+    for (i = 0; i < s_profileRecordCount; ++i)
+    {
+        const SICOProfileRecord* record = &s_profileRecords[i];
+        int host = record->type == SICO_ProfileCompile;
+
+        if (record->queued < baseTime[host])
+            baseTime[host] = record->queued;
+    }
 
-    for (i = 0; i < platformCount; ++i)
+    fprintf(file, "{\"traceEvents\":[\n");
+
+    for (pass = 0; pass < 2; ++pass)
     {
-        clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, 0, 0, &deviceCount);
-        totalDeviceCount += deviceCount;
+        for (i = 0; i < s_profileRecordCount; ++i)
+        {
+            const SICOProfileRecord* record = &s_profileRecords[i];
+            int host = record->type == SICO_ProfileCompile;
+
+            if (host != pass)
+                continue;
+
+            fprintf(file, "%s{\"name\":", first ? "" : ",\n");
+            writeJsonString(file, record->name);
+            fprintf(file, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%f,\"dur\":%f,\"args\":{\"bytes\":%llu}}",
+                    getProfileTypeName(record->type), host + 1, (int)record->type,
+                    (double)(record->start - baseTime[host]) / 1e3, (double)(record->end - record->start) / 1e3,
+                    (unsigned long long)record->bytes);
+
+            first = 0;
+        }
     }
 
-    // Allocate space for the devices and then set them up
+    fprintf(file, "\n]}\n");
 
-    s_devices = malloc((sizeof(SICODevice*) * (size_t)totalDeviceCount));
+    mutexUnlock(&s_profileMutex);
 
-    // setup the device ids
+    fclose(file);
 
-    for (i = 0; i < platformCount; ++i)
-    {
-        clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, 0, 0, &deviceCount);
-        devices = (cl_device_id*)malloc(sizeof(cl_device_id) * deviceCount);
-        clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, deviceCount, devices, 0);
+    return SICO_Ok;
+}
 
-        for (j = 0; j < deviceCount; ++j, ++deviceIter)
-        {
-            s_devices[deviceIter] = mallocZero(sizeof(SICODevice));
-            s_devices[deviceIter]->deviceId = devices[j];
-            s_devices[deviceIter]->context = createSingleContext(devices[j]);
-            clGetDeviceInfo(devices[j], CL_DEVICE_TYPE, sizeof(cl_device_type), &s_devices[deviceIter]->deviceType, 0);
-        }
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Primitives. The source in sico_primitives.h is built once per device and data type with the type defines below
+// prepended. All primitives work on device buffers and are only enqueued (nothing is waited on). Temporary buffers
+// are created and released directly (not pooled) as OpenCL keeps them alive until the commands using them are done.
 
-        free(devices);
-    }
+enum SICOPrimitiveKernel
+{
+    SICO_PrimReduce,
+    SICO_PrimScanBlock,
+    SICO_PrimScanAdd,
+    SICO_PrimFill,
+    SICO_PrimRadixHistogram,
+    SICO_PrimRadixScatter,
+    SICO_PrimCompactFlags,
+    SICO_PrimCompactScatter,
+    SICO_PrimHistogramLocal,
+    SICO_PrimHistogramGlobal,
+    SICO_PrimCount,
+};
 
-    free(platforms);
+static const char* s_primitiveKernelNames[SICO_PrimCount] =
+{
+    "sico_reduce",
+    "sico_scan_block",
+    "sico_scan_add",
+    "sico_fill_u32",
+    "sico_radix_histogram",
+    "sico_radix_scatter",
+    "sico_compact_flags",
+    "sico_compact_scatter",
+    "sico_histogram_local",
+    "sico_histogram_global",
+};
 
-    *count = totalDeviceCount;
-    s_deviceCount = totalDeviceCount;
+static const char* s_primitiveTypeDefines[SICO_DataTypeCount] =
+{
+    "#define T int\n#define T_LARGEST INT_MAX\n#define T_SMALLEST INT_MIN\n#define T_MIN(a, b) min(a, b)\n#define T_MAX(a, b) max(a, b)\n",
+    "#define T uint\n#define T_LARGEST UINT_MAX\n#define T_SMALLEST 0\n#define T_MIN(a, b) min(a, b)\n#define T_MAX(a, b) max(a, b)\n",
+    "#define T float\n#define T_LARGEST FLT_MAX\n#define T_SMALLEST (-FLT_MAX)\n#define T_MIN(a, b) fmin(a, b)\n#define T_MAX(a, b) fmax(a, b)\n",
+};
 
-    return s_devices;
+static const char* s_primitiveProgramNames[SICO_DataTypeCount] =
+{
+    "sico_primitives_int",
+    "sico_primitives_uint",
+    "sico_primitives_float",
+};
+
+#define SICO_PRIM_MAX_LOCAL_SIZE 256
+#define SICO_PRIM_MIN_LOCAL_SIZE 16 // radix sort needs at least one item per digit
+#define SICO_PRIM_MAX_GROUPS 256    // for reduce and histogram that loops over the input
+#define SICO_HISTOGRAM_LOCAL_BINS 256
+
+typedef struct SICOPrimitives
+{
+    SICOKernel kernels[SICO_PrimCount];
+    size_t localSize;   // power of two that all kernels can run with
+} SICOPrimitives;
+
+typedef struct SICOPrimArg
+{
+    size_t size;
+    const void* value;  // 0 for local memory
+} SICOPrimArg;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void freePrimitives(SICOPrimitives* primitives)
+{
+    for (int i = 0; i < SICO_PrimCount; ++i)
+        scReleaseKernel(primitives->kernels[i]);
+
+    free(primitives);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-int scSetupParameters(SICODevice device, SICOKernel kernel, SICOCommanQueue queue, SICOParam* params, int paramCount)
+static void releasePrimitives(SICODevice device)
 {
-    uint8_t needsUpload[256] = { 0 };
+    for (int i = 0; i < SICO_DataTypeCount; ++i)
+    {
+        if (device->primitives[i])
+            freePrimitives(device->primitives[i]);
+
+        device->primitives[i] = 0;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static SICOPrimitives* buildPrimitives(SICODevice device, SICODataType type)
+{
+    SICOPrimitives* primitives;
+    cl_program program;
+    size_t size, lineCount = sizeof(s_primitivesSource) / sizeof(s_primitivesSource[0]);
+    size_t maxSize = SICO_PRIM_MAX_LOCAL_SIZE;
+    uint64_t programHash;
+    char* source;
     cl_int error;
-    cl_mem mem;
 
-    if (!device)
-        return SICO_NoDevice;
+    size = strlen(s_primitiveTypeDefines[type]);
 
-    if (!kernel || !queue || !params || params == 0)
-        return SICO_GeneralFail;
+    for (size_t i = 0; i < lineCount; ++i)
+        size += strlen(s_primitivesSource[i]);
 
-    if (!device->context)
-        return SICO_GeneralFail;
+    source = malloc(size + 1);
+    strcpy(source, s_primitiveTypeDefines[type]);
 
-    assert(paramCount < (int)sizeof(needsUpload));
+    for (size_t i = 0; i < lineCount; ++i)
+        strcat(source, s_primitivesSource[i]);
 
-    // Create memory objects
+    program = buildProgramFromSource(device, s_primitiveProgramNames[type], source, size, "");
+    programHash = getProgramHash(source, size, "");
 
-    for (int i = 0; i < paramCount; ++i)
+    free(source);
+
+    if (!program)
+        return 0;
+
+    primitives = mallocZero(sizeof(SICOPrimitives));
+
+    // every kernel object holds a reference to the program
+
+    for (int i = 0; i < SICO_PrimCount; ++i)
     {
-        SICOParam* param = &params[i];
+        size_t kernelMax = 0;
+        cl_kernel kern;
 
-        if (param->type == SICO_PARAMETER || param->policy == SICO_UserSuppliedData)
+        if (!(kern = clCreateKernel(program, s_primitiveKernelNames[i], &error)))
         {
-            param->privData = 0;
-            continue;
+            sico_log("Unable to create primitive kernel %s, error %s\n", s_primitiveKernelNames[i], getErrorString(error));
+            clReleaseProgram(program);
+            freePrimitives(primitives);
+            return 0;
         }
 
-        if (device->deviceType == CL_DEVICE_TYPE_CPU)
-        {
-            if (!(mem = clCreateBuffer(device->context, param->type | CL_MEM_USE_HOST_PTR, param->size, (void*)param->data, &error)))
-            {
-                sico_log("CPU clCreateBuffer failed (param %d), error %s\n", i, getErrorString(error));
-                return SICO_GeneralFail;
-            }
-        }
-        else
-        {
-            if (!(mem = clCreateBuffer(device->context, CL_MEM_READ_WRITE, param->size, NULL, &error)))
-            {
-                sico_log("GPU clCreateBuffer failed (param %d), error %s\n", i, getErrorString(error));
-                return SICO_GeneralFail;
-            }
+        clRetainProgram(program);
+        primitives->kernels[i] = createKernelObject(program, kern);
+        primitives->kernels[i]->programHash = programHash;
 
-            needsUpload[i] = 1;
-        }
+        clGetKernelWorkGroupInfo(kern, device->deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &kernelMax, 0);
 
-        param->privData = (void*)mem;
+        if (kernelMax < maxSize)
+            maxSize = kernelMax;
     }
 
-    // Setup the memory objects that needs to be transfered
+    clReleaseProgram(program);
 
-    for (int i = 0; i < paramCount; ++i)
-    {
-        SICOParam* param = &params[i];
+    primitives->localSize = 1;
 
-        if (needsUpload[i] == 0)
-            continue;
+    while (primitives->localSize * 2 <= maxSize)
+        primitives->localSize *= 2;
 
-        if ((error = clEnqueueWriteBuffer((cl_command_queue)queue, (cl_mem)param->privData, CL_TRUE, 0, param->size, (void*)param->data, 0, NULL, NULL)) != CL_SUCCESS)
-        {
-            sico_log("clEnqueueWriteBuffer failed (param %d), error %s\n", i, getErrorString(error));
-            return SICO_GeneralFail;
-        }
+    if (primitives->localSize < SICO_PRIM_MIN_LOCAL_SIZE)
+    {
+        sico_log("Work group size %d is too small for the primitives\n", (int)primitives->localSize);
+        freePrimitives(primitives);
+        return 0;
     }
 
-    // Setup kernel parameters
+    return primitives;
+}
 
-    for (int i = 0; i < paramCount; ++i)
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Built outside the lock (same as scGetKernel), if another thread won the race we use theirs
+
+static SICOPrimitives* getPrimitives(SICODevice device, SICODataType type)
+{
+    SICOPrimitives* primitives;
+
+    if (!device || (int)type < 0 || type >= SICO_DataTypeCount)
+        return 0;
+
+    mutexLock(&s_registryMutex);
+    primitives = device->primitives[type];
+    mutexUnlock(&s_registryMutex);
+
+    if (primitives)
+        return primitives;
+
+    if (!(primitives = buildPrimitives(device, type)))
+        return 0;
+
+    mutexLock(&s_registryMutex);
+
+    if (device->primitives[type])
     {
-        SICOParam* param = &params[i];
+        freePrimitives(primitives);
+        primitives = device->primitives[type];
+    }
+    else
+    {
+        device->primitives[type] = primitives;
+    }
 
-        if (param->type == SICO_PARAMETER)
-            error = clSetKernelArg(kernel->kern, (cl_uint)i, param->size, (void*)param->data);
-        else
-            error = clSetKernelArg(kernel->kern, (cl_uint)i, sizeof(cl_mem), (cl_mem) & param->privData);
+    mutexUnlock(&s_registryMutex);
 
-        if (error != CL_SUCCESS)
-        {
-            sico_log("Unable to clSetKernelArg (param %d), error %s\n", i, getErrorString(error));
-            return SICO_GeneralFail;
-        }
+    return primitives;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static SICODevice getQueueDevice(cl_command_queue queue)
+{
+    cl_context context;
+
+    if (clGetCommandQueueInfo(queue, CL_QUEUE_CONTEXT, sizeof(cl_context), &context, 0) != CL_SUCCESS)
+        return 0;
+
+    return getDeviceFromContext(context);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Sets the arguments and enqueues with the global size rounded up to the local size
+
+static SICOState runPrimitive(cl_command_queue queue, SICOKernel kernel, size_t globalSize, size_t localSize,
+                              const SICOPrimArg* args, int argCount)
+{
+    cl_int error = CL_SUCCESS;
+
+    globalSize = ((globalSize + localSize - 1) / localSize) * localSize;
+
+    mutexLock(&kernel->argLock);
+
+    for (int i = 0; i < argCount && error == CL_SUCCESS; ++i)
+        error = setKernelArg(kernel, (cl_uint)i, args[i].size, args[i].value);
+
+    if (error == CL_SUCCESS)
+        error = enqueueKernel(queue, kernel, 1, 0, &globalSize, &localSize, 0, 0, 0);
+
+    mutexUnlock(&kernel->argLock);
+
+    if (error != CL_SUCCESS)
+    {
+        sico_log("Unable to run %s, error %s\n", kernel->name, getErrorString(error));
+        return SICO_GeneralFail;
     }
 
     return SICO_Ok;
@@ -454,493 +7629,750 @@ int scSetupParameters(SICODevice device, SICOKernel kernel, SICOCommanQueue queu
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-SICOState scWriteMemoryParams(SICODevice device, SICOCommanQueue queue, SICOParam* params, uint32_t paramCount)
+static cl_mem createTempBuffer(SICODevice device, size_t size)
 {
-    uint32_t i;
     cl_int error;
+    cl_mem mem = clCreateBuffer(device->context, CL_MEM_READ_WRITE, size, 0, &error);
 
-    // If the device is CPU we have nothing that needs to be copied back
+    if (!mem)
+        sico_log("Unable to create temporary buffer of %d bytes, error %s\n", (int)size, getErrorString(error));
 
-    if (device->deviceType == CL_DEVICE_TYPE_CPU)
-        return SICO_Ok;
+    return mem;
+}
 
-    for (i = 0; i < paramCount; ++i)
-    {
-        SICOParam* param = &params[i];
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Scans each block, then scans the block sums (recursively) and adds them back
 
-        if (param->type == SICO_MEM_READ_ONLY || param->type == SICO_PARAMETER)
-            continue;
+static SICOState scanBuffer(SICODevice device, cl_command_queue queue, SICOPrimitives* primitives, cl_mem input,
+                            cl_mem output, cl_uint count, cl_uint inclusive)
+{
+    size_t localSize = primitives->localSize;
+    cl_uint blockCount = (cl_uint)((count + localSize - 1) / localSize);
+    cl_uint exclusive = 0;
+    SICOState state;
+    cl_mem blockSums;
+
+    // all supported types are 4 bytes
 
-        if ((error = clEnqueueReadBuffer((cl_command_queue)queue, (cl_mem)param->privData, CL_TRUE, 0, param->size, (void*)param->data, 0, NULL, NULL)) != CL_SUCCESS)
+    if (!(blockSums = createTempBuffer(device, blockCount * 4)))
+        return SICO_GeneralFail;
+
+    {
+        SICOPrimArg args[] =
         {
-            sico_log("clEnqueueReadBuffer failed (param %d), error %s\n", i, getErrorString(error));
-            return SICO_GeneralFail;
-        }
+            { sizeof(cl_mem), &input },
+            { sizeof(cl_mem), &output },
+            { sizeof(cl_mem), &blockSums },
+            { sizeof(cl_uint), &count },
+            { sizeof(cl_uint), &inclusive },
+            { localSize * 4, 0 },
+        };
+
+        state = runPrimitive(queue, primitives->kernels[SICO_PrimScanBlock], count, localSize, args, SICO_SIZEOF_ARRAY(args));
     }
 
-    return SICO_Ok;
+    if (state == SICO_Ok && blockCount > 1)
+    {
+        SICOPrimArg args[] =
+        {
+            { sizeof(cl_mem), &output },
+            { sizeof(cl_mem), &blockSums },
+            { sizeof(cl_uint), &count },
+        };
+
+        state = scanBuffer(device, queue, primitives, blockSums, blockSums, blockCount, exclusive);
+
+        if (state == SICO_Ok)
+            state = runPrimitive(queue, primitives->kernels[SICO_PrimScanAdd], count, localSize, args, SICO_SIZEOF_ARRAY(args));
+    }
+
+    clReleaseMemObject(blockSums);
+
+    return state;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-int scInitialize()
+SICOState scReduce(SICOCommanQueue queue, SICODataType type, SICOReduceOp op, SICOHandle input, size_t count, SICOHandle result)
 {
-    if (clGetPlatformIDs(1, &s_platformId, 0) != CL_SUCCESS)
+    SICODevice device = getQueueDevice((cl_command_queue)queue);
+    SICOPrimitives* primitives;
+    cl_uint elementCount = (cl_uint)count;
+    cl_uint groupCount, reduceOp = (cl_uint)op;
+    cl_mem partials;
+    SICOState state;
+    size_t localSize;
+
+    if (!(primitives = getPrimitives(device, type)) || count == 0 || count > 0xffffffff)
+        return SICO_GeneralFail;
+
+    localSize = primitives->localSize;
+    groupCount = (cl_uint)((count + localSize - 1) / localSize);
+
+    if (groupCount > SICO_PRIM_MAX_GROUPS)
+        groupCount = SICO_PRIM_MAX_GROUPS;
+
+    if (!(partials = createTempBuffer(device, groupCount * 4)))
+        return SICO_GeneralFail;
+
     {
-        s_platformId = 0;
-        return 0;
+        SICOPrimArg args[] =
+        {
+            { sizeof(cl_mem), &input },
+            { sizeof(cl_mem), &partials },
+            { sizeof(cl_uint), &elementCount },
+            { sizeof(cl_uint), &reduceOp },
+            { localSize * 4, 0 },
+        };
+
+        state = runPrimitive((cl_command_queue)queue, primitives->kernels[SICO_PrimReduce], groupCount * localSize, localSize,
+                             args, SICO_SIZEOF_ARRAY(args));
     }
 
-    return 1;
+    // second pass reduces the partial results with a single group
+
+    if (state == SICO_Ok)
+    {
+        SICOPrimArg args[] =
+        {
+            { sizeof(cl_mem), &partials },
+            { sizeof(cl_mem), &result },
+            { sizeof(cl_uint), &groupCount },
+            { sizeof(cl_uint), &reduceOp },
+            { localSize * 4, 0 },
+        };
+
+        state = runPrimitive((cl_command_queue)queue, primitives->kernels[SICO_PrimReduce], localSize, localSize,
+                             args, SICO_SIZEOF_ARRAY(args));
+    }
+
+    clReleaseMemObject(partials);
+
+    return state;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void scClose()
+SICOState scScan(SICOCommanQueue queue, SICODataType type, SICOHandle input, SICOHandle output, size_t count, int inclusive)
 {
-    for (int i = 0; i < s_deviceCount; ++i)
-    {
-        SICODevice device = s_devices[i];
-
-        if (!device->context)
-            continue;
+    SICODevice device = getQueueDevice((cl_command_queue)queue);
+    SICOPrimitives* primitives;
 
-        int error = clReleaseContext(device->context);
+    if (!(primitives = getPrimitives(device, type)) || count == 0 || count > 0xffffffff)
+        return SICO_GeneralFail;
 
-        if (error != CL_SUCCESS)
-            sico_log("%s ", getErrorString(error));
-    }
+    return scanBuffer(device, (cl_command_queue)queue, primitives, (cl_mem)input, (cl_mem)output, (cl_uint)count, inclusive ? 1 : 0);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// LSD radix sort with 4 bits per pass. Each pass counts digits per block, scans the counts and scatters stable. There
+// is an even number of passes so the result ends up back in the input buffers.
 
-int scListDevices(char* output, size_t size)
+static SICOState radixSort(SICOCommanQueue queue, SICOHandle keys, SICOHandle values, size_t count)
 {
-    int i, count;
-    SICODevice* devices;
+    SICODevice device = getQueueDevice((cl_command_queue)queue);
+    SICOPrimitives* primitives;
+    cl_mem buffers[2][2] = { { (cl_mem)keys, (cl_mem)values }, { 0, 0 } };
+    cl_mem histogram;
+    cl_uint elementCount = (cl_uint)count;
+    cl_uint blockCount, hasValues = values ? 1 : 0;
+    SICOState state = SICO_Ok;
+    size_t localSize;
+    int current = 0;
+
+    if (!(primitives = getPrimitives(device, SICO_UInt32)) || count > 0xffffffff)
+        return SICO_GeneralFail;
 
-    if (s_platformId == 0)
-        return 0;
+    if (count < 2)
+        return SICO_Ok;
 
-    if (!(devices = scGetAllDevices(&count)))
-        return 0;
+    localSize = primitives->localSize;
+    blockCount = (cl_uint)((count + localSize - 1) / localSize);
 
-    for (i = 0; i < count; ++i)
+    if (!(histogram = createTempBuffer(device, (size_t)blockCount * 16 * 4)))
+        return SICO_GeneralFail;
+
+    if (!(buffers[1][0] = createTempBuffer(device, count * 4)) ||
+        (hasValues && !(buffers[1][1] = createTempBuffer(device, count * 4))))
     {
-        cl_device_id id = 0;
+        state = SICO_GeneralFail;
+    }
 
-        if (!devices[i])
-            continue;
+    for (cl_uint shift = 0; shift < 32 && state == SICO_Ok; shift += 4)
+    {
+        cl_mem* src = buffers[current];
+        cl_mem* dst = buffers[current ^ 1];
 
-        id = devices[i]->deviceId;
+        // the kernel ignores the value buffers when there are no values but they still have to be valid
 
-        printOrAppendString(output, id, CL_DEVICE_NAME, i + 1, 0, "%d.%d Device: %s\n", &size);
-        printOrAppendString(output, id, CL_DEVICE_VERSION, i + 1, 1, " %d.%d Hardware version: %s\n", &size);
-        printOrAppendString(output, id, CL_DEVICE_VERSION, i + 1, 2, " %d.%d Software version: %s\n", &size);
-        printOrAppendString(output, id, CL_DEVICE_OPENCL_C_VERSION, i + 1, 3, " %d.%d OpenCL C version: %s\n", &size);
-        printOrAppendInt(output, id, CL_DEVICE_MAX_COMPUTE_UNITS, i + 1, 4, " %d.%d Parallel compute units: %d\n", &size);
+        cl_mem srcValues = hasValues ? src[1] : src[0];
+        cl_mem dstValues = hasValues ? dst[1] : dst[0];
+        cl_uint histogramCount = blockCount * 16;
+
+        SICOPrimArg histogramArgs[] =
+        {
+            { sizeof(cl_mem), &src[0] },
+            { sizeof(cl_mem), &histogram },
+            { sizeof(cl_uint), &elementCount },
+            { sizeof(cl_uint), &shift },
+            { sizeof(cl_uint), &blockCount },
+        };
+
+        SICOPrimArg scatterArgs[] =
+        {
+            { sizeof(cl_mem), &src[0] },
+            { sizeof(cl_mem), &dst[0] },
+            { sizeof(cl_mem), &srcValues },
+            { sizeof(cl_mem), &dstValues },
+            { sizeof(cl_mem), &histogram },
+            { sizeof(cl_uint), &elementCount },
+            { sizeof(cl_uint), &shift },
+            { sizeof(cl_uint), &blockCount },
+            { sizeof(cl_uint), &hasValues },
+            { localSize * 4, 0 },
+        };
+
+        state = runPrimitive((cl_command_queue)queue, primitives->kernels[SICO_PrimRadixHistogram], count, localSize,
+                             histogramArgs, SICO_SIZEOF_ARRAY(histogramArgs));
+
+        if (state == SICO_Ok)
+            state = scanBuffer(device, (cl_command_queue)queue, primitives, histogram, histogram, histogramCount, 0);
+
+        if (state == SICO_Ok)
+        {
+            state = runPrimitive((cl_command_queue)queue, primitives->kernels[SICO_PrimRadixScatter], count, localSize,
+                                 scatterArgs, SICO_SIZEOF_ARRAY(scatterArgs));
+        }
+
+        current ^= 1;
     }
 
-    return count;
+    clReleaseMemObject(histogram);
+
+    if (buffers[1][0])
+        clReleaseMemObject(buffers[1][0]);
+
+    if (buffers[1][1])
+        clReleaseMemObject(buffers[1][1]);
+
+    return state;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-struct SICODevice* scGetBestDevice()
+SICOState scSortKeys(SICOCommanQueue queue, SICOHandle keys, size_t count)
 {
-    int i, count;
-    SICODevice* devices;
+    return radixSort(queue, keys, 0, count);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    // this algorithm can be quite improved. Right now it will just pick the first GPU
+SICOState scSortPairs(SICOCommanQueue queue, SICOHandle keys, SICOHandle values, size_t count)
+{
+    if (!values)
+        return SICO_GeneralFail;
 
-    if (!(devices = scGetAllDevices(&count)))
-    {
-        sico_log("%s", "Unable to find any OpenCL devices in the system\n");
-        return 0;
-    }
+    return radixSort(queue, keys, values, count);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SICOState scCompact(SICOCommanQueue queue, SICOHandle input, SICOHandle flags, SICOHandle output, size_t count, SICOHandle outputCount)
+{
+    SICODevice device = getQueueDevice((cl_command_queue)queue);
+    SICOPrimitives* primitives;
+    cl_uint elementCount = (cl_uint)count;
+    cl_mem positions;
+    SICOState state;
+
+    if (!(primitives = getPrimitives(device, SICO_UInt32)) || count == 0 || count > 0xffffffff)
+        return SICO_GeneralFail;
+
+    if (!(positions = createTempBuffer(device, count * 4)))
+        return SICO_GeneralFail;
 
-    for (i = 0; i < count; ++i)
     {
-        if (!devices[i])
-            continue;
-
-        if (devices[i]->deviceType == CL_DEVICE_TYPE_GPU)
+        SICOPrimArg args[] =
         {
-            if (!createSingleContext(devices[i]->deviceId))
-                return 0;
+            { sizeof(cl_mem), &flags },
+            { sizeof(cl_mem), &positions },
+            { sizeof(cl_uint), &elementCount },
+        };
 
-            return devices[i];
-        }
+        state = runPrimitive((cl_command_queue)queue, primitives->kernels[SICO_PrimCompactFlags], count,
+                             primitives->localSize, args, SICO_SIZEOF_ARRAY(args));
     }
 
-    // if no found at this spot we just use the first one
+    if (state == SICO_Ok)
+        state = scanBuffer(device, (cl_command_queue)queue, primitives, positions, positions, elementCount, 0);
 
-    if (!createSingleContext(devices[0]->deviceId))
-        return 0;
+    if (state == SICO_Ok)
+    {
+        SICOPrimArg args[] =
+        {
+            { sizeof(cl_mem), &input },
+            { sizeof(cl_mem), &flags },
+            { sizeof(cl_mem), &positions },
+            { sizeof(cl_mem), &output },
+            { sizeof(cl_mem), &outputCount },
+            { sizeof(cl_uint), &elementCount },
+        };
+
+        state = runPrimitive((cl_command_queue)queue, primitives->kernels[SICO_PrimCompactScatter], count,
+                             primitives->localSize, args, SICO_SIZEOF_ARRAY(args));
+    }
 
-    return devices[0];
+    clReleaseMemObject(positions);
+
+    return state;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-struct SICOKernel* scCompileKernelFromSourceFile(struct SICODevice* device, const char* filename, const char* kernelName, const char* buildOpts)
+SICOState scHistogram(SICOCommanQueue queue, SICOHandle input, size_t count, SICOHandle bins, int binCount)
 {
-    const char* data;
-    size_t fileSize;
-    cl_kernel kern;
-    cl_int error;
-
-    cl_program program;
-    SICOKernel kernel;
-
-    (void)buildOpts;
+    SICODevice device = getQueueDevice((cl_command_queue)queue);
+    SICOPrimitives* primitives;
+    cl_uint elementCount = (cl_uint)count;
+    cl_uint bucketCount = (cl_uint)binCount;
+    cl_uint zero = 0;
+    size_t localSize, globalSize;
+    int kernel = SICO_PrimHistogramGlobal;
+    SICOState state;
+
+    if (!(primitives = getPrimitives(device, SICO_UInt32)) || binCount <= 0 || count > 0xffffffff)
+        return SICO_GeneralFail;
 
-    // First create a single context if we have none
+    localSize = primitives->localSize;
 
-    if (!device->context)
     {
-        if (!(device->context = createSingleContext(device->deviceId)))
-            return 0;
-    }
-
-    if (!(data = readFileFromDisk(filename, &fileSize)))
-        return 0;
+        SICOPrimArg args[] =
+        {
+            { sizeof(cl_mem), &bins },
+            { sizeof(cl_uint), &zero },
+            { sizeof(cl_uint), &bucketCount },
+        };
 
-    if (!(program = clCreateProgramWithSource(device->context, 1, &data, &fileSize, &error)))
-    {
-        free((void*)data);
-        sico_log("clCreateProgramWithSource failed, error: %s\n", getErrorString(error));
-        return 0;
+        if ((state = runPrimitive((cl_command_queue)queue, primitives->kernels[SICO_PrimFill], (size_t)binCount, localSize,
+                                  args, SICO_SIZEOF_ARRAY(args))) != SICO_Ok)
+        {
+            return state;
+        }
     }
 
-    free((void*)data);
-
-    if ((error = clBuildProgram(program, 0, 0, 0, 0, 0)) != CL_SUCCESS)
-    {
-        char* errorBuffer;
-        size_t size;
+    if (count == 0)
+        return SICO_Ok;
 
-        clGetProgramBuildInfo(program, device->deviceId, CL_PROGRAM_BUILD_LOG, 0, 0, &size);
-        errorBuffer = malloc(size + 1);
-        clGetProgramBuildInfo(program, device->deviceId, CL_PROGRAM_BUILD_LOG, size, errorBuffer, 0);
-        errorBuffer[size] = 0;
+    // few bins are counted in local memory per group and then added to the result
 
-        // TODO: Support writing the error log to a buffer
+    globalSize = ((count + localSize - 1) / localSize) * localSize;
 
-        sico_log("unable to build %s (error %s)\n\n%s\n", filename, getErrorString(error), errorBuffer);
-        free(errorBuffer);
+    if (binCount <= SICO_HISTOGRAM_LOCAL_BINS)
+    {
+        kernel = SICO_PrimHistogramLocal;
 
-        return 0;
+        if (globalSize > localSize * SICO_PRIM_MAX_GROUPS)
+            globalSize = localSize * SICO_PRIM_MAX_GROUPS;
     }
 
-    if (!(kern = clCreateKernel(program, kernelName, &error)))
     {
-        sico_log("Unable to create kernel for %s (%s), error %s\n", filename, kernelName, getErrorString(error));
-        return 0;
+        SICOPrimArg args[] =
+        {
+            { sizeof(cl_mem), &input },
+            { sizeof(cl_mem), &bins },
+            { sizeof(cl_uint), &elementCount },
+            { sizeof(cl_uint), &bucketCount },
+        };
+
+        state = runPrimitive((cl_command_queue)queue, primitives->kernels[kernel], globalSize, localSize,
+                             args, SICO_SIZEOF_ARRAY(args));
     }
 
-    kernel = mallocZero(sizeof(SICOKernel));
-    kernel->program = program;
-    kernel->kern = kern;
-
-    return kernel;
+    return state;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-// TODO: Use this code in the function above
+// Expressions. Nodes are stored in creation order so the arguments of a node always comes before it and the kernel
+// can be generated with one temporary per node. Inputs and constants become kernel arguments so the generated source
+// (and thus the cached kernel) only depends on the shape of the expression. Nodes never change once added so the
+// source generated for a result stays valid for the lifetime of the graph.
 
-int scCompileFromFile(struct SICODevice* device, const char* filename, const char* buildOpts)
+typedef struct SICOExprNode
 {
-    const char* data;
-    size_t fileSize;
-    cl_int error;
-    cl_program program;
+    SICOExprOp op;
+    SICOExpr args[3];
+    int slot;           // input or constant index
+} SICOExprNode;
 
-    (void)buildOpts;
+// Kernel generated for one result. Only the inputs and constants the result depends on are kernel arguments.
 
-    // First create a single context if we have none
+typedef struct SICOExprSource
+{
+    SICOExpr result;
+    SICOWriteBuffer source;
+    int* inputs;        // input slots in argument order
+    int inputCount;
+    int* constants;     // constant slots in argument order
+    int constantCount;
+    SICODevice device;  // device the registry key was computed for
+    uint64_t key;
+} SICOExprSource;
+
+struct SICOExprGraph
+{
+    SICOExprNode* nodes;
+    int nodeCount;
+    int nodeCapacity;
+    cl_mem* inputs;
+    int inputCount;
+    float* constants;
+    int constantCount;
+    SICOExprSource* sources;
+    int sourceCount;
+};
 
-    if (!device->context)
-    {
-        if (!(device->context = createSingleContext(device->deviceId)))
-            return 0;
-    }
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    if (!(data = readFileFromDisk(filename, &fileSize)))
-        return 0;
+SICOExprGraph scExprCreate()
+{
+    return mallocZero(sizeof(struct SICOExprGraph));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void scExprDestroy(SICOExprGraph graph)
+{
+    if (!graph)
+        return;
 
-    if (!(program = clCreateProgramWithSource(device->context, 1, &data, &fileSize, &error)))
+    for (int i = 0; i < graph->sourceCount; ++i)
     {
-        free((void*)data);
-        sico_log("clCreateProgramWithSource failed, error: %s\n", getErrorString(error));
-        return 0;
+        free(graph->sources[i].source.data);
+        free(graph->sources[i].inputs);
+        free(graph->sources[i].constants);
     }
 
-    free((void*)data);
+    free(graph->nodes);
+    free(graph->inputs);
+    free(graph->constants);
+    free(graph->sources);
+    free(graph);
+}
 
-    if ((error = clBuildProgram(program, 0, 0, 0, 0, 0)) != CL_SUCCESS)
-    {
-        char* errorBuffer;
-        size_t size;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-        clGetProgramBuildInfo(program, device->deviceId, CL_PROGRAM_BUILD_LOG, 0, 0, &size);
-        errorBuffer = malloc(size + 1);
-        clGetProgramBuildInfo(program, device->deviceId, CL_PROGRAM_BUILD_LOG, size, errorBuffer, 0);
-        errorBuffer[size] = 0;
+static SICOExpr addExprNode(SICOExprGraph graph, SICOExprOp op, SICOExpr a, SICOExpr b, SICOExpr c, int argCount)
+{
+    SICOExpr args[3] = { a, b, c };
+    SICOExprNode* node;
 
-        // TODO: Support writing the error log to a buffer
+    if (!graph)
+        return -1;
 
-        sico_log("unable to build %s (error %s)\n\n%s\n", filename, getErrorString(error), errorBuffer);
-        free(errorBuffer);
+    for (int i = 0; i < argCount; ++i)
+    {
+        if (args[i] < 0 || args[i] >= graph->nodeCount)
+            return -1;
+    }
 
-        return 0;
+    if (graph->nodeCount == graph->nodeCapacity)
+    {
+        graph->nodeCapacity = graph->nodeCapacity ? graph->nodeCapacity * 2 : 16;
+        graph->nodes = realloc(graph->nodes, sizeof(SICOExprNode) * (size_t)graph->nodeCapacity);
     }
 
-    return 1;
+    node = &graph->nodes[graph->nodeCount];
+    node->op = op;
+    node->args[0] = a;
+    node->args[1] = b;
+    node->args[2] = c;
+    node->slot = 0;
+
+    return graph->nodeCount++;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-SICOHandle scAlloc(struct SICODevice* device, int flags, size_t size, void* hostPtr)
+SICOExpr scExprInput(SICOExprGraph graph, SICOHandle input)
 {
-    cl_int errorCode;
+    SICOExpr expr;
 
-    cl_mem mem = clCreateBuffer(device->context, (cl_mem_flags)flags, size, hostPtr, &errorCode);
+    if (!graph || !input)
+        return -1;
 
-    if (errorCode != CL_SUCCESS)
+    // the same buffer used several times is only read once
+
+    for (int i = 0; i < graph->nodeCount; ++i)
     {
-        sico_log("%s\n", getErrorString(errorCode));
-        mem = 0;
+        if (graph->nodes[i].op == SICO_ExprInput && graph->inputs[graph->nodes[i].slot] == (cl_mem)input)
+            return i;
     }
 
-    return (SICOHandle)mem;
-}
+    if ((expr = addExprNode(graph, SICO_ExprInput, -1, -1, -1, 0)) < 0)
+        return -1;
+
+    graph->inputs = realloc(graph->inputs, sizeof(cl_mem) * (size_t)(graph->inputCount + 1));
+    graph->inputs[graph->inputCount] = (cl_mem)input;
+    graph->nodes[expr].slot = graph->inputCount++;
 
+    return expr;
+}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-bool scFree(SICOHandle handle)
+SICOExpr scExprConst(SICOExprGraph graph, float value)
 {
-    int errorCode = clReleaseMemObject((cl_mem)handle);
+    SICOExpr expr;
 
-    if (errorCode == CL_SUCCESS)
-        return true;
+    if ((expr = addExprNode(graph, SICO_ExprConst, -1, -1, -1, 0)) < 0)
+        return -1;
 
-    sico_log("%s\n", getErrorString(errorCode));
+    graph->constants = realloc(graph->constants, sizeof(float) * (size_t)(graph->constantCount + 1));
+    graph->constants[graph->constantCount] = value;
+    graph->nodes[expr].slot = graph->constantCount++;
 
-    return false;
+    return expr;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-SICOCommanQueue scCreateCommandQueue(struct SICODevice* device)
+SICOExpr scExprUnary(SICOExprGraph graph, SICOExprOp op, SICOExpr a)
 {
-    cl_int error;
-    cl_command_queue queue;
+    if (op < SICO_ExprNeg || op > SICO_ExprCos)
+        return -1;
 
-    queue = clCreateCommandQueue(device->context, device->deviceId, 0, &error);
+    return addExprNode(graph, op, a, -1, -1, 1);
+}
 
-    if (error == CL_SUCCESS)
-        return (SICOCommanQueue)queue;
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    sico_log("%s", getErrorString(error));
+SICOExpr scExprBinary(SICOExprGraph graph, SICOExprOp op, SICOExpr a, SICOExpr b)
+{
+    if (op < SICO_ExprAdd || op > SICO_ExprEqual)
+        return -1;
 
-    return 0;
+    return addExprNode(graph, op, a, b, -1, 2);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-SICOState scAddKernel(SICOCommanQueue queue, SICOKernel kernel, int workDim,
-                      const size_t* globalWorkOffset, const size_t* globalWorkSize, const size_t* localWorkSize,
-                      int eventListCount, void* waitEventList, void* event)
+SICOExpr scExprFma(SICOExprGraph graph, SICOExpr a, SICOExpr b, SICOExpr c)
 {
-    cl_int error = clEnqueueNDRangeKernel((cl_command_queue)queue, kernel->kern,
-                                          (unsigned int)workDim, globalWorkOffset, globalWorkSize, localWorkSize,
-                                          (cl_uint)eventListCount, waitEventList, event);
-
-    if (error == CL_SUCCESS)
-        return SICO_Ok;
+    return addExprNode(graph, SICO_ExprFma, a, b, c, 3);
+}
 
-    switch (error)
-    {
-        case CL_INVALID_PROGRAM_EXECUTABLE:
-            sico_log("%s ", "CL_INVALID_PROGRAM_EXECUTABLE if there is no successfully built program executable available for device associated with command_queue.\n"); break;
-        case CL_INVALID_COMMAND_QUEUE:
-            sico_log("%s ", " CL_INVALID_COMMAND_QUEUE : if command_queue is not a valid host command-queue.\n"); break;
-        case CL_INVALID_KERNEL:
-            sico_log("%s ", " CL_INVALID_KERNEL : if kernel is not a valid kernel object.\n"); break;
-        case CL_INVALID_CONTEXT:
-            sico_log("%s ", " CL_INVALID_CONTEXT : if context associated with command_queue and kernel is not the same or if the context associated with command_queue and events in event_wait_list are not the same.\n"); break;
-        case CL_INVALID_KERNEL_ARGS:
-            sico_log("%s ", " CL_INVALID_KERNEL_ARGS : if the kernel argument values have not been specified or if a kernel argument declared to be a pointer to a type does not point to a named address space.\n"); break;
-        case CL_INVALID_WORK_DIMENSION:
-            sico_log("%s ", " CL_INVALID_WORK_DIMENSION : if work_dim is not a valid value (i.e. a value between 1 and 3).\n"); break;
-        case CL_INVALID_GLOBAL_WORK_SIZE:
-            sico_log("%s ", " CL_INVALID_GLOBAL_WORK_SIZE : if global_work_size is NULL, or if any of the values specified in global_work_size[0], ...global_work_size [work_dim - 1] are 0 or exceed the range given by the sizeof(size_t) for the device on which the kernel execution will be enqueued.\n"); break;
-        case CL_INVALID_GLOBAL_OFFSET:
-            sico_log("%s ", " CL_INVALID_GLOBAL_OFFSET : if the value specified in global_work_size + the corresponding values in global_work_offset for any dimensions is greater than the sizeof(size_t) for the device on which the kernel execution will be enqueued.\n"); break;
-        case CL_MISALIGNED_SUB_BUFFER_OFFSET:
-            sico_log("%s ", " CL_MISALIGNED_SUB_BUFFER_OFFSET : if a sub-buffer object is specified as the value for an argument that is a buffer object and the offset specified when the sub-buffer object is created is not aligned to CL_DEVICE_MEM_BASE_ADDR_ALIGN value for device associated with queue.\n"); break;
-        case CL_INVALID_IMAGE_SIZE:
-            sico_log("%s ", " CL_INVALID_IMAGE_SIZE : if an image object is specified as an argument value and the image dimensions (image width, height, specified or compute row and/or slice pitch) are not supported by device associated with queue.\n"); break;
-        case CL_IMAGE_FORMAT_NOT_SUPPORTED:
-            sico_log("%s ", " CL_IMAGE_FORMAT_NOT_SUPPORTED : if an image object is specified as an argument value and the image format (image channel order and data type) is not supported by device associated with queue.\n"); break;
-        case CL_MEM_OBJECT_ALLOCATION_FAILURE:
-            sico_log("%s ", " CL_MEM_OBJECT_ALLOCATION_FAILURE : if there is a failure to allocate memory for data store associated with image or buffer objects specified as arguments to kernel.\n"); break;
-        case CL_INVALID_EVENT_WAIT_LIST:
-            sico_log("%s ", " CL_INVALID_EVENT_WAIT_LIST : if event_wait_list is NULL and num_events_in_wait_list > 0, or event_wait_list is not NULL and num_events_in_wait_list is 0, or if event objects in event_wait_list are not valid events.\n"); break;
-        case CL_INVALID_OPERATION:
-            sico_log("%s ", " CL_INVALID_OPERATION : if SVM pointers are passed as arguments to a kernel and the device does not support SVM or if system pointers are passed as arguments to a kernel and/or stored inside SVM allocations passed as kernel arguments and the device does not support fine grain system SVM allocations.\n"); break;
-        case CL_OUT_OF_HOST_MEMORY:
-            sico_log("%s ", " CL_OUT_OF_HOST_MEMORY : if there is a failure to allocate resources required by the OpenCL implementation on the host.\n"); break;
-        case CL_OUT_OF_RESOURCES:
-        {
-            sico_log("%s ", " CL_OUT_OF_RESOURCES : if there is a failure to queue the execution instance of kernel on the command-queue because of insufficient resources needed to execute the kernel. For example, the explicitly specified local_work_size causes a failure to execute the kernel because of insufficient resources such as registers or local memory. Another example would be the number of read-only image args used in kernel exceed the CL_DEVICE_MAX_READ_IMAGE_ARGS value for device or the number of write-only image args used in kernel exceed the CL_DEVICE_MAX_READ_WRITE_IMAGE_ARGS value for device or the number of samplers used in kernel exceed CL_DEVICE_MAX_SAMPLERS for device.\n");
-            sico_log("%s ", " CL_OUT_OF_RESOURCES : if there is a failure to allocate resources required by the OpenCL implementation on the device.\n");
-            break;
-        }
-        case CL_INVALID_WORK_ITEM_SIZE:
-        {
-            sico_log("%s ", " CL_INVALID_WORK_ITEM_SIZE : if the number of work-items specified in any of local_work_size[0], ... local_work_size[work_dim - 1] is greater than the corresponding values specified by CL_DEVICE_MAX_WORK_ITEM_SIZES[0], .... CL_DEVICE_MAX_WORK_ITEM_SIZES[work_dim - 1].\n");
-            sico_log("%s ", " CL_INVALID_WORK_ITEM_SIZE : if the number of work-items specified in any of local_work_size[0], ... local_work_size[work_dim – 1] is greater than the corresponding values specified by CL_DEVICE_MAX_WORK_ITEM_SIZES[0], ... CL_DEVICE_MAX_WORK_ITEM_SIZES[work_dim – 1].\n");
-            break;
-        }
-        case CL_INVALID_WORK_GROUP_SIZE:
-        {
-            sico_log("%s ", " CL_INVALID_WORK_GROUP_SIZE : if local_work_size is specified and does not match the work-group size for kernel in the program source given by the __attribute__ ((reqd_work_group_size(X, Y, Z))) qualifier.\n"); break;
-            sico_log("%s ", " CL_INVALID_WORK_GROUP_SIZE : if local_work_size is specified and the total number of work-items in the work-group computed as local_work_size[0] * … local_work_size[work_dim – 1] is greater than the value specified by CL_DEVICE_MAX_WORK_GROUP_SIZE in the table of OpenCL Device Queries for clGetDeviceInfo.\n");
-            sico_log("%s ", " CL_INVALID_WORK_GROUP_SIZE : if local_work_size is NULL and the __attribute__ ((reqd_work_group_size(X, Y, Z))) qualifier is used to declare the work-group size for kernel in the program source.\n");
-            sico_log("%s ", " CL_INVALID_WORK_GROUP_SIZE : if the program was compiled with –cl-uniform-work-group-size and the number of work-items specified by global_work_size is not evenly divisible by size of work-group given by local_work_size.\n");
-            break;
-        }
-    }
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-    return SICO_GeneralFail;
+SICOExpr scExprSelect(SICOExprGraph graph, SICOExpr condition, SICOExpr a, SICOExpr b)
+{
+    return addExprNode(graph, SICO_ExprSelect, condition, a, b, 3);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-SICOState scAddKernel1D(SICOCommanQueue queue, SICOKernel kernel, size_t count)
+static void writeText(SICOWriteBuffer* buffer, const char* text)
 {
-    return scAddKernel(queue, kernel, 1, 0, &count, 0, 0, 0, 0);
+    writeData(buffer, text, strlen(text));
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-SICOState scAddKernel2D(SICOCommanQueue queue, SICODevice device, SICOKernel kernel, size_t sizeX, size_t sizeY, SICOParam* params, int paramCount)
+static void writeExprNode(SICOWriteBuffer* buffer, int index, const SICOExprNode* node)
 {
-    size_t sizes[] = { sizeX, sizeY };
+    static const char* binaryOps[] = { "+", "-", "*", "/" };
+    static const char* compareOps[] = { "<", "<=", ">", ">=", "==" };
+    static const char* functions[] = { "-", "fabs", "sqrt", "rsqrt", "exp", "log", "sin", "cos" };
+    int a = node->args[0], b = node->args[1], c = node->args[2];
+    char line[256];
 
-	if (scSetupParameters(device, kernel, queue, params, paramCount) != SICO_Ok)
-		return SICO_GeneralFail;
+    switch (node->op)
+    {
+        case SICO_ExprInput : snprintf(line, sizeof(line), "    float t%d = in%d[i];\n", index, node->slot); break;
+        case SICO_ExprConst : snprintf(line, sizeof(line), "    float t%d = c%d;\n", index, node->slot); break;
+        case SICO_ExprMin : snprintf(line, sizeof(line), "    float t%d = fmin(t%d, t%d);\n", index, a, b); break;
+        case SICO_ExprMax : snprintf(line, sizeof(line), "    float t%d = fmax(t%d, t%d);\n", index, a, b); break;
+        case SICO_ExprFma : snprintf(line, sizeof(line), "    float t%d = fma(t%d, t%d, t%d);\n", index, a, b, c); break;
+        case SICO_ExprSelect : snprintf(line, sizeof(line), "    float t%d = t%d != 0.0f ? t%d : t%d;\n", index, a, b, c); break;
+
+        case SICO_ExprAdd :
+        case SICO_ExprSub :
+        case SICO_ExprMul :
+        case SICO_ExprDiv :
+            snprintf(line, sizeof(line), "    float t%d = t%d %s t%d;\n", index, a, binaryOps[node->op - SICO_ExprAdd], b);
+            break;
 
-    if (scAddKernel(queue, kernel, 2, 0, (size_t*)&sizes, 0, 0, 0, 0) != SICO_Ok)
-    	return SICO_GeneralFail;
+        case SICO_ExprLess :
+        case SICO_ExprLessEqual :
+        case SICO_ExprGreater :
+        case SICO_ExprGreaterEqual :
+        case SICO_ExprEqual :
+            snprintf(line, sizeof(line), "    float t%d = t%d %s t%d ? 1.0f : 0.0f;\n", index, a, compareOps[node->op - SICO_ExprLess], b);
+            break;
 
-    return scWriteMemoryParams(device, queue, params, SICO_SIZEOF_ARRAY(params));
+        default :
+            snprintf(line, sizeof(line), "    float t%d = %s(t%d);\n", index, functions[node->op - SICO_ExprNeg], a);
+            break;
+    }
+
+    writeText(buffer, line);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Generates the fused kernel for the nodes that the result depends on
 
+static void generateExprSource(SICOExprGraph graph, SICOExprSource* exprSource)
+{
+    SICOWriteBuffer* buffer = &exprSource->source;
+    SICOExpr result = exprSource->result;
+    uint8_t* used = mallocZero((size_t)graph->nodeCount);
+    char line[256];
 
-/*
-
-   SICOHandle scAllocSyncCopy(struct SICODevice* device, const void* memory, int size)
-   {
+    used[result] = 1;
 
-   }
+    for (int i = result; i >= 0; --i)
+    {
+        const SICOExprNode* node = &graph->nodes[i];
 
+        if (!used[i] || node->op == SICO_ExprInput || node->op == SICO_ExprConst)
+            continue;
 
-   SICOHandle scAsycCopyToDevice(SICOHandle handle, const void* memory, int size);
+        for (int a = 0; a < 3; ++a)
+        {
+            if (node->args[a] >= 0)
+                used[node->args[a]] = 1;
+        }
+    }
 
+    exprSource->inputs = malloc(sizeof(int) * (size_t)(graph->inputCount + 1));
+    exprSource->constants = malloc(sizeof(int) * (size_t)(graph->constantCount + 1));
 
-   SICOHandle scAsycCopyFromDevice(void* dest, const SICOHandle handle, int size);
+    writeText(buffer, "__kernel void sico_expr(global float* output, uint count");
 
- */
+    for (int i = 0; i <= result; ++i)
+    {
+        const SICOExprNode* node = &graph->nodes[i];
 
+        if (!used[i] || node->op != SICO_ExprInput)
+            continue;
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+        snprintf(line, sizeof(line), ", global const float* in%d", node->slot);
+        writeText(buffer, line);
+        exprSource->inputs[exprSource->inputCount++] = node->slot;
+    }
 
-void scFreeParams(SICOParam* params, int count)
-{
-    for (int i = 0; i < count; ++i)
+    for (int i = 0; i <= result; ++i)
     {
-        if (params[i].privData)
-            clReleaseMemObject(params[i].privData);
-    }
-}
+        const SICOExprNode* node = &graph->nodes[i];
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+        if (!used[i] || node->op != SICO_ExprConst)
+            continue;
 
-SICOState scCommandQueueFinish(SICOCommanQueue queue)
-{
-    cl_int errorCode = clFinish(queue);
+        snprintf(line, sizeof(line), ", float c%d", node->slot);
+        writeText(buffer, line);
+        exprSource->constants[exprSource->constantCount++] = node->slot;
+    }
 
-    if (errorCode == CL_SUCCESS)
-        return SICO_Ok;
+    writeText(buffer, ")\n{\n    uint i = get_global_id(0);\n\n    if (i >= count)\n        return;\n\n");
 
-    sico_log("%s ", getErrorString(errorCode));
+    for (int i = 0; i <= result; ++i)
+    {
+        if (used[i])
+            writeExprNode(buffer, i, &graph->nodes[i]);
+    }
 
-    return SICO_GeneralFail;
+    snprintf(line, sizeof(line), "\n    output[i] = t%d;\n}\n", result);
+    writeText(buffer, line);
+
+    free(used);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-SICOState scDestroyCommandQueue(SICOCommanQueue queue)
+static SICOExprSource* getExprSource(SICOExprGraph graph, SICOExpr result)
 {
-    cl_int errorCode = clReleaseCommandQueue(queue);
+    SICOExprSource* exprSource;
 
-    if (errorCode == CL_SUCCESS)
-        return SICO_Ok;
+    for (int i = 0; i < graph->sourceCount; ++i)
+    {
+        if (graph->sources[i].result == result)
+            return &graph->sources[i];
+    }
 
-    sico_log("%s ", getErrorString(errorCode));
+    graph->sources = realloc(graph->sources, sizeof(SICOExprSource) * (size_t)(graph->sourceCount + 1));
+    exprSource = &graph->sources[graph->sourceCount++];
+    memset(exprSource, 0, sizeof(SICOExprSource));
+    exprSource->result = result;
 
-    return SICO_GeneralFail;
+    generateExprSource(graph, exprSource);
+
+    return exprSource;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-SICOState scRunKernel1DArraySimple(void* dest, void* sourceA, void* sourceB, const char* filename, size_t elementCount, size_t sizeInBytes)
+SICOState scExprRun(SICOCommanQueue queue, SICOExprGraph graph, SICOExpr result, SICOHandle output, size_t count)
 {
-    SICODevice device;
+    SICODevice device = getQueueDevice((cl_command_queue)queue);
+    cl_uint elementCount = (cl_uint)count;
+    size_t localSize, globalSize;
+    cl_int error = CL_SUCCESS;
+    SICOExprSource* exprSource;
     SICOKernel kernel;
-    SICOCommanQueue queue;
+    cl_uint arg = 0;
 
-    SICOParam params[] =
-    {
-        { (uintptr_t)dest, SICO_MEM_READ_WRITE, SICO_AutoAllocate, sizeInBytes, 0 },
-        { (uintptr_t)sourceA, SICO_MEM_READ_ONLY, SICO_AutoAllocate, sizeInBytes, 0 },
-        { (uintptr_t)sourceB, SICO_MEM_READ_ONLY, SICO_AutoAllocate, sizeInBytes, 0 },
-    };
+    if (!device || !graph || result < 0 || result >= graph->nodeCount || !output || count > 0xffffffff)
+        return SICO_GeneralFail;
 
-    scInitialize();
+    if (count == 0)
+        return SICO_Ok;
 
-    if (!(device = scGetBestDevice()))
+    exprSource = getExprSource(graph, result);
+
+    if (exprSource->device != device)
     {
-        sico_log("%s ", "Unable to find OpenCL device\n");
-        return SICO_NoDevice;
+        exprSource->key = getSourceKernelKey(device, (const char*)exprSource->source.data, exprSource->source.size,
+                                             "sico_expr", "");
+        exprSource->device = device;
     }
 
-    if (!(kernel = scCompileKernelFromSourceFile(device, filename, "kern", "")))
+    if (!(kernel = getKernelFromSourceKey(device, exprSource->key, "sico_expr", (const char*)exprSource->source.data,
+                                          exprSource->source.size, "sico_expr", "")))
         return SICO_UnableToBuildKernel;
 
-    if (!(queue = scCreateCommandQueue(device)))
-        return SICO_GeneralFail;
+    mutexLock(&kernel->argLock);
 
-    if ((scSetupParameters(device, kernel, queue, params, SICO_SIZEOF_ARRAY(params))) != SICO_Ok)
-        return SICO_GeneralFail;
+    error = setKernelArg(kernel, arg++, sizeof(cl_mem), &output);
 
-    if ((scAddKernel1D(queue, kernel, elementCount)) != SICO_Ok)
-        return SICO_GeneralFail;
+    if (error == CL_SUCCESS)
+        error = setKernelArg(kernel, arg++, sizeof(cl_uint), &elementCount);
 
-    if ((scWriteMemoryParams(device, queue, params, SICO_SIZEOF_ARRAY(params))) != SICO_Ok)
-        return SICO_GeneralFail;
+    for (int i = 0; i < exprSource->inputCount && error == CL_SUCCESS; ++i)
+        error = setKernelArg(kernel, arg++, sizeof(cl_mem), &graph->inputs[exprSource->inputs[i]]);
 
-    scCommandQueueFinish(queue);
+    for (int i = 0; i < exprSource->constantCount && error == CL_SUCCESS; ++i)
+        error = setKernelArg(kernel, arg++, sizeof(float), &graph->constants[exprSource->constants[i]]);
 
-    scFreeParams(params, SICO_SIZEOF_ARRAY(params));
+    // the kernel checks the bounds so the global size can be padded to a good local size
+
+    if (error == CL_SUCCESS)
+    {
+        localSize = getLocalSize1D(kernel, count);
 
-    scDestroyCommandQueue(queue);
+        if (localSize == 0)
+            localSize = 1;
+
+        globalSize = ((count + localSize - 1) / localSize) * localSize;
+
+        error = enqueueKernel((cl_command_queue)queue, kernel, 1, 0, &globalSize, &localSize, 0, 0, 0);
+    }
+
+    mutexUnlock(&kernel->argLock);
+
+    if (error != CL_SUCCESS)
+    {
+        sico_log("Unable to run expression, error %s\n", getErrorString(error));
+        return SICO_GeneralFail;
+    }
 
     return SICO_Ok;
 }
@@ -16,9 +16,20 @@ extern "C" {
 
 typedef struct SICODevice* SICODevice;
 typedef struct SICOKernel* SICOKernel;
+typedef struct SICOMultiKernel* SICOMultiKernel;
+typedef struct SICOLaunch* SICOLaunch;
+typedef struct SICOResident* SICOResident;
+typedef struct SICOOutput* SICOOutput;
+typedef struct SICOImage* SICOImage;
+typedef struct SICOArena* SICOArena;
+typedef void* SICOSampler;
+typedef struct SICOCompileJob* SICOCompileJob;
+typedef struct SICOExprGraph* SICOExprGraph;
+typedef int SICOExpr; // node in a SICOExprGraph, negative on error
 //typedef struct SICOQueue* SICOCommanQueue;
 typedef void* SICOCommanQueue;
 typedef void* SICOHandle;
+typedef void* SICOEvent;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -37,17 +48,119 @@ typedef enum SICOMemoryPolicy
 {
     SICO_AutoAllocate,
     SICO_AutoWriteBack,
-    SICO_UserSuppliedData,
+    SICO_UserSuppliedData,  // data is a SICOHandle that is bound as is (never uploaded, read back or freed)
+    SICO_Resident,          // data is a SICOResident (see scCreateResident)
+    SICO_LeaveOnDevice,     // like SICO_AutoAllocate but never read back (see scGetParamHandle and scReadParamRegion)
+    SICO_Output,            // data is a SICOOutput, read back on demand with scAcquireHost (see scCreateOutput)
+    SICO_Image,             // data is a SICOImage, uploaded/read back from its host pixels (see scCreateImage2D)
+    SICO_Sampler,           // data is a SICOSampler (see scCreateSampler)
+    SICO_Uninitialized,     // like SICO_AutoAllocate but SICO_MEM_WRITE_ONLY buffers aren't uploaded first, so their
+                            // contents are undefined and the kernel has to write every byte that is read back
 
 } SICOMemoryPolicy;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+typedef enum SICODevicePolicy
+{
+    SICO_DevicePolicyDefault,   // highest compute score
+    SICO_DevicePolicyPreferCPU, // best CPU device, any device if there are no CPU devices
+    SICO_DevicePolicyPreferGPU, // best GPU device, any device if there are no GPU devices
+    SICO_DevicePolicyBandwidth, // highest measured memory bandwidth
+    SICO_DevicePolicyIndex,     // fixed device index
+
+} SICODevicePolicy;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef enum SICODataType
+{
+    SICO_Int32,
+    SICO_UInt32,
+    SICO_Float32,
+
+    SICO_DataTypeCount,
+
+} SICODataType;
+
+typedef enum SICOReduceOp
+{
+    SICO_ReduceSum,
+    SICO_ReduceMin,
+    SICO_ReduceMax,
+
+} SICOReduceOp;
+
+typedef enum SICOExprOp
+{
+    // binary (scExprBinary). Comparisons gives 1.0f or 0.0f
+
+    SICO_ExprAdd,
+    SICO_ExprSub,
+    SICO_ExprMul,
+    SICO_ExprDiv,
+    SICO_ExprMin,
+    SICO_ExprMax,
+    SICO_ExprLess,
+    SICO_ExprLessEqual,
+    SICO_ExprGreater,
+    SICO_ExprGreaterEqual,
+    SICO_ExprEqual,
+
+    // unary (scExprUnary)
+
+    SICO_ExprNeg,
+    SICO_ExprAbs,
+    SICO_ExprSqrt,
+    SICO_ExprRsqrt,
+    SICO_ExprExp,
+    SICO_ExprLog,
+    SICO_ExprSin,
+    SICO_ExprCos,
+
+    // created with their own functions
+
+    SICO_ExprFma,
+    SICO_ExprSelect,
+    SICO_ExprInput,
+    SICO_ExprConst,
+
+} SICOExprOp;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 #define SICO_MEM_READ_WRITE CL_MEM_READ_WRITE
 #define SICO_MEM_WRITE_ONLY CL_MEM_WRITE_ONLY
 #define SICO_MEM_READ_ONLY CL_MEM_READ_ONLY
 #define SICO_PARAMETER (1 << 20)    // not a real memory type
 
+#define SICO_MAP_READ CL_MAP_READ
+#define SICO_MAP_WRITE CL_MAP_WRITE
+
+#define SICO_CHANNEL_R CL_R
+#define SICO_CHANNEL_RG CL_RG
+#define SICO_CHANNEL_RGBA CL_RGBA
+#define SICO_CHANNEL_BGRA CL_BGRA
+
+#define SICO_CHANNEL_UNORM_INT8 CL_UNORM_INT8
+#define SICO_CHANNEL_UNORM_INT16 CL_UNORM_INT16
+#define SICO_CHANNEL_UNSIGNED_INT8 CL_UNSIGNED_INT8
+#define SICO_CHANNEL_UNSIGNED_INT32 CL_UNSIGNED_INT32
+#define SICO_CHANNEL_SIGNED_INT32 CL_SIGNED_INT32
+#define SICO_CHANNEL_HALF_FLOAT CL_HALF_FLOAT
+#define SICO_CHANNEL_FLOAT CL_FLOAT
+
+#define SICO_ADDRESS_NONE CL_ADDRESS_NONE
+#define SICO_ADDRESS_CLAMP_TO_EDGE CL_ADDRESS_CLAMP_TO_EDGE
+#define SICO_ADDRESS_CLAMP CL_ADDRESS_CLAMP
+#define SICO_ADDRESS_REPEAT CL_ADDRESS_REPEAT
+#define SICO_ADDRESS_MIRRORED_REPEAT CL_ADDRESS_MIRRORED_REPEAT
+
+#define SICO_FILTER_NEAREST CL_FILTER_NEAREST
+#define SICO_FILTER_LINEAR CL_FILTER_LINEAR
+
+#define SICO_HOST_ALIGNMENT 4096 // alignment of scAllocHostAligned, enough for zero-copy on all known drivers
+
 #define SICO_SIZEOF_ARRAY(array) (int)(sizeof(array) / sizeof(array[0]))
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -63,14 +176,16 @@ typedef struct SICOParam
 
 /*
  * Needs to be called before any other function is called. This function won't do that much except make sure that there
- * are some OpenCL capable device on your machine.
+ * are some OpenCL capable device on your machine. It is safe to call from several threads (only the first call
+ * does the work) and after that all functions can be called from any thread.
  * Return non-zero on success otherwise 0
  */
 
 int scInitialize();
 
 /*
- * Closes the devices etc
+ * Closes the devices etc. No other threads may use SICO while this is called. Queued async compiles are finished
+ * before the kernels are released.
  */
 
 void scClose();
@@ -125,19 +240,99 @@ SICODevice* scGetOtherDevices(int* count);
 SICODevice* scGetBestDevices(int* count);
 
 /*
- * Get the "best" device in the system, It will check number of compute units
- * on each device and return the best one in the category
- * Return device(s) pointer
+ * Get the best device in the system according to the device policy (see scSetDevicePolicy). By default devices are
+ * scored on compute units, clock, SIMD width, memory sizes and double support.
+ * Return device or 0 if there are no usable devices
  */
 
 SICODevice scGetBestDevice();
 
+/*
+ * Selects how scGetBestDevice picks a device. Can also be set with the SICO_DEVICE environment variable
+ * (default, cpu, gpu, bandwidth or a device index)
+ * \@param policy Policy to use
+ * \@param index Device index in scGetAllDevices (only used with SICO_DevicePolicyIndex)
+ */
+
+void scSetDevicePolicy(SICODevicePolicy policy, int index);
+
+/*
+ * When enabled devices are scored on a measured compute throughput instead of an estimate. The measurement (and the
+ * bandwidth one done for SICO_DevicePolicyBandwidth) is run once per device and stored in the program cache
+ * directory if one is set. Can also be enabled with the SICO_DEVICE_BENCHMARK environment variable.
+ */
+
+void scSetDeviceBenchmark(int enable);
+
+/*
+ * Score scGetBestDevice uses for a device with the given policy (GFLOP/s for compute, GB/s for bandwidth)
+ */
+
+double scGetDeviceScore(SICODevice device, SICODevicePolicy policy);
+
 /*
  *
  */
 
 int scCompileFromFile(struct SICODevice* device, const char* filename, const char* buildOpts);
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct SICOProgramCacheStats
+{
+    uint32_t hits;          // programs created from a cached binary
+    uint32_t misses;        // programs built from source (no usable cache entry)
+    uint32_t stores;        // binaries written to the cache
+    uint32_t invalidations; // cache entries that were found but rejected (stale driver, corrupt file, etc)
+} SICOProgramCacheStats;
+
+/*
+ * Sets the directory used for the on-disk program binary cache. When set programs built from source are stored as
+ * device binaries and later builds of the same source, build options and device/driver are loaded with
+ * clCreateProgramWithBinary instead. Pass NULL or "" to disable the cache (default unless SICO_PROGRAM_CACHE_DIR is set)
+ * \@param path Directory to store the binaries in. It will be created if it doesn't exist.
+ */
+
+void scSetProgramCacheDir(const char* path);
+
+/*
+ * Get the hit/miss counters for the program binary cache
+ * \@param stats Filled with the current counters
+ */
+
+void scGetProgramCacheStats(SICOProgramCacheStats* stats);
+
+/*
+ * Compiles a source file for a number of devices and writes a program binary container to disk. The container holds
+ * one binary per device, the kernel names, argument metadata and the build options used. This is what the sicoc
+ * tool uses to precompile kernels at build time.
+ * \@param devices Devices to build binaries for
+ * \@param deviceCount Number of devices
+ * \@param filename OpenCL source file to compile
+ * \@param outputFilename File to write the container to
+ * \@param buildOpts Build options passed to the OpenCL compiler (can be NULL)
+ * Return SICO_Ok on success
+ */
+
+SICOState scCompileToBinaryFile(SICODevice* devices, int deviceCount, const char* filename, const char* outputFilename, const char* buildOpts);
+
+/*
+ * Loads a program from a binary container (written by sicoc or scCompileToBinaryFile) and creates a kernel from it.
+ * No runtime compilation from source is done. Fails if the container has no binary matching the device and driver.
+ * \@param device Device to load the program for
+ * \@param filename Container file
+ * \@param kernelName Name of the kernel to create
+ * Return kernel on success otherwise 0
+ */
+
+struct SICOKernel* scLoadProgramFromBinaryFile(struct SICODevice* device, const char* filename, const char* kernelName);
+
+/*
+ * Same as scLoadProgramFromBinaryFile but with the container already in memory
+ */
+
+struct SICOKernel* scLoadProgramFromBinary(struct SICODevice* device, const void* data, size_t size, const char* kernelName);
+
 /*
  * Allocate memory from a device. The memory is uninitialized so user is responsible for filling this memory
  * \@param device Device to allocate the memory from
@@ -161,33 +356,327 @@ bool scFree(SICOHandle handle);
 
 SICOCommanQueue scCreateCommandQueue(struct SICODevice* device);
 
+/*
+ * Get the shared command queue for a device. The queue is created on first use and is owned by SICO (released in
+ * scClose) so it must not be destroyed with scDestroyCommandQueue
+ */
+
+SICOCommanQueue scGetDeviceQueue(struct SICODevice* device);
 
 /*
+ * Get a command queue for a device that is only used by the calling thread, so worker threads can submit work
+ * concurrently without sharing one queue. The queue is created on first use and is owned by SICO (released by
+ * scReleaseThreadQueues or scClose) so it must not be destroyed with scDestroyCommandQueue
+ */
 
-   SICOHandle scAllocSyncCopy(struct SICODevice* device, const void* memory, int size);
+SICOCommanQueue scGetThreadQueue(struct SICODevice* device);
 
+/*
+ * Releases the per-thread queues of the calling thread. This is also done automatically when a thread exits, calling
+ * it is only needed to release the queues of a thread that keeps running.
+ */
 
-   SICOHandle scAsycCopyToDevice(SICOHandle handle, const void* memory, int size);
+void scReleaseThreadQueues();
 
+/*
+ * Allocates host memory aligned (and padded) so that it can be used without copies by CPU and unified memory devices.
+ * On such devices SICO_AutoAllocate parameters using memory from here are used in place instead of being copied
+ * to and from a separate device buffer.
+ * Return memory or NULL if out of memory. Free with scFreeHostAligned
+ */
 
-   SICOHandle scAsycCopyFromDevice(void* dest, const SICOHandle handle, int size);
+void* scAllocHostAligned(size_t size);
 
+/*
+ * Frees memory allocated with scAllocHostAligned
  */
 
+void scFreeHostAligned(void* ptr);
 
 /*
- * TODO Document
+ * Returns non-zero if the device shares memory with the host (CPU devices and CL_DEVICE_HOST_UNIFIED_MEMORY devices)
  */
 
-int scSetupParameters(SICODevice device, SICOKernel kernel, SICOCommanQueue queue, SICOParam* params, int paramCount);
+int scIsUnifiedMemory(struct SICODevice* device);
 
 /*
- * TODO Document
+ * Allocates a buffer in host accessible memory (CL_MEM_ALLOC_HOST_PTR). Access it from the host with
+ * scMapBuffer/scUnmapBuffer, which doesn't copy anything on unified memory devices.
+ */
+
+SICOHandle scAllocHostMapped(struct SICODevice* device, int flags, size_t size);
+
+/*
+ * Maps a buffer for host access and returns a pointer to the mapped range. Blocks until the mapping is done.
+ * \@param mapFlags SICO_MAP_READ and/or SICO_MAP_WRITE
+ * Return pointer to the mapped memory, otherwise 0
+ */
+
+void* scMapBuffer(SICOCommanQueue queue, SICOHandle handle, int mapFlags, size_t offset, size_t size);
+
+/*
+ * Unmaps a pointer returned by scMapBuffer. The buffer must be unmapped before it's used by a kernel again.
+ */
+
+SICOState scUnmapBuffer(SICOCommanQueue queue, SICOHandle handle, void* ptr);
+
+/*
+ * Allocates a read/write buffer on the device and copies memory to it. Returns when the copy is done.
+ * Return handle to memory, otherwise 0
+ */
+
+SICOHandle scAllocSyncCopy(struct SICODevice* device, const void* memory, size_t size);
+
+/*
+ * Starts a non-blocking copy from host memory to a device buffer. memory must stay valid until the returned event
+ * has completed.
+ * \@param waitCount/waitList Events that has to complete before the copy starts (can be 0/NULL)
+ * Return event for the copy (release with scReleaseEvent) or 0 on failure
+ */
+
+SICOEvent scAsyncCopyToDevice(SICOCommanQueue queue, SICOHandle handle, size_t offset, const void* memory, size_t size,
+                              int waitCount, const SICOEvent* waitList);
+
+/*
+ * Starts a non-blocking copy from a device buffer to host memory. The data in dest is valid once the returned
+ * event has completed.
+ * \@param waitCount/waitList Events that has to complete before the copy starts (can be 0/NULL)
+ * Return event for the copy (release with scReleaseEvent) or 0 on failure
+ */
+
+SICOEvent scAsyncCopyFromDevice(SICOCommanQueue queue, void* dest, SICOHandle handle, size_t offset, size_t size,
+                                int waitCount, const SICOEvent* waitList);
+
+/*
+ * Blocks until all events has completed
+ */
+
+SICOState scWaitEvents(const SICOEvent* events, int count);
+
+/*
+ * Returns non-zero if the event has completed (successfully or not)
+ */
+
+int scIsEventComplete(SICOEvent event);
+
+/*
+ * Releases an event returned by any of the async functions
+ */
+
+void scReleaseEvent(SICOEvent event);
+
+/*
+ * Called (from an OpenCL runtime thread) when the event has completed. state is SICO_Ok unless the command failed.
+ * Don't call blocking SICO functions from within the callback.
+ */
+
+typedef void (*SICOEventCallback)(SICOEvent event, SICOState state, void* userData);
+
+SICOState scSetEventCallback(SICOEvent event, SICOEventCallback callback, void* userData);
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct SICOBufferPoolStats
+{
+    uint64_t hits;          // buffers reused from the pool
+    uint64_t misses;        // buffers that had to be created with clCreateBuffer
+    size_t bytesResident;   // bytes held by idle buffers in the pool
+    size_t bytesInUse;      // bytes handed out from the pool that hasn't been returned yet
+    size_t bytesPending;    // bytes returned while queued commands still used them (reused once they are done)
+    size_t peakResident;    // highest bytesResident seen
+    size_t limit;           // high-water mark for bytesResident (see scSetBufferPoolLimit)
+} SICOBufferPoolStats;
+
+/*
+ * Buffers created for SICO_AutoAllocate parameters (on non-CPU devices) comes from a per-device pool and are given
+ * back to it by scFreeParams, so a steady-state loop doesn't do any device allocations. Buffers are rounded up to
+ * size classes so similar sizes can share buffers. Buffers given back while queued commands still use them are only
+ * handed out again once those commands are done.
  *
+ * Sets the max number of bytes idle buffers may hold on the device. Buffers given back when the pool is at the
+ * limit are released instead. Default is 256 MB.
+ */
+
+void scSetBufferPoolLimit(struct SICODevice* device, size_t maxResidentBytes);
+
+/*
+ * Releases idle buffers in the pool until at most maxResidentBytes are held (0 releases all of them)
+ */
+
+void scTrimBufferPool(struct SICODevice* device, size_t maxResidentBytes);
+
+/*
+ * Get the hit rate and memory usage of the device buffer pool
+ */
+
+void scGetBufferPoolStats(struct SICODevice* device, SICOBufferPoolStats* stats);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef enum SICOArenaMode
+{
+    SICO_ArenaBump,         // allocations are only given back by scArenaReset (or when freed from the top)
+    SICO_ArenaFreeList,     // freed ranges can be reused (first fit, neighbours are merged)
+} SICOArenaMode;
+
+typedef struct SICOArenaStats
+{
+    size_t capacity;        // size of the arena buffer
+    size_t used;            // bytes handed out (sizes are rounded up to the device alignment)
+    size_t peak;            // highest used seen
+    size_t largestFree;     // largest allocation that would succeed
+    uint32_t allocations;   // sub-buffers that hasn't been freed
+    uint32_t failures;      // allocations that didn't fit
+    float fragmentation;    // 0 when all free space is in one piece, close to 1 when it's spread out in small holes
+} SICOArenaStats;
+
+/*
+ * Arenas allocate one big device buffer and hand out sub-buffers of it (aligned to CL_DEVICE_MEM_BASE_ADDR_ALIGN), which
+ * is a lot cheaper than a clCreateBuffer per array and doesn't fragment device memory. The handles can be used like
+ * the ones from scAlloc (for example as SICO_UserSuppliedData) but are given back with scArenaFree/scArenaReset.
+ * Memory is reused right away so a reset/free must only be done once no commands are queued that use the old data
+ * on another queue (on the same in-order queue it's fine).
+ *
+ * \@param device Device to allocate the arena on
+ * \@param flags Memory flags for all sub-buffers (SICO_MEM_READ_WRITE etc)
+ * \@param size Size of the arena in bytes
+ * \@param mode SICO_ArenaBump for reset per frame use, SICO_ArenaFreeList for individual frees
+ * Return arena or 0 on failure
+ */
+
+SICOArena scCreateArena(struct SICODevice* device, int flags, size_t size, SICOArenaMode mode);
+
+/*
+ * Return sub-buffer of at least size bytes or 0 if the arena is full
+ */
+
+SICOHandle scArenaAlloc(SICOArena arena, size_t size);
+
+void scArenaFree(SICOArena arena, SICOHandle handle);
+
+/*
+ * Releases all sub-buffers at once (the start of a frame with a bump arena)
+ */
+
+void scArenaReset(SICOArena arena);
+
+void scGetArenaStats(SICOArena arena, SICOArenaStats* stats);
+
+/*
+ * Releases the arena and all sub-buffers that are left
+ */
+
+void scDestroyArena(SICOArena arena);
+
+typedef enum SICOProfileType
+{
+    SICO_ProfileKernel,
+    SICO_ProfileWrite,
+    SICO_ProfileRead,
+    SICO_ProfileCompile,
+} SICOProfileType;
+
+typedef struct SICOProfileStats
+{
+    const char* name;       // kernel function name, "write", "read" or program filename for compiles
+    SICOProfileType type;
+    int count;
+    double totalMs;         // device time (start to end). Compiles are measured on the host
+    double minMs;
+    double maxMs;
+    double p50Ms;
+    double p99Ms;
+    double queueMs;         // average time from queued to start
+    uint64_t bytes;         // bytes transferred (writes and reads)
+    double gbPerSec;        // bytes / total time
+} SICOProfileStats;
+
+/*
+ * Enables or disables profiling. Can also be enabled by setting the SICO_PROFILE environment variable before
+ * scInitialize. Only queues created while profiling is enabled will get timings so this should be called
+ * before any queues are created. All kernel launches, transfers and compiles done through SICO are recorded.
+ */
+
+void scSetProfiling(int enable);
+
+/*
+ * Clears all profile records
+ */
+
+void scProfilingReset();
+
+/*
+ * Aggregates the profile records per name and type. Commands that are still in flight are not included so the
+ * queues should be finished before calling this.
+ *
+ * \@param stats Output array (may be 0 to just get the count)
+ * \@param maxCount Size of the stats array
+ * \@return Number of entries available. Names are valid until the next call or scProfilingReset
+ */
+
+int scGetProfileStats(SICOProfileStats* stats, int maxCount);
+
+/*
+ * Writes the aggregated profile as JSON
+ */
+
+SICOState scProfilingWriteJson(const char* filename);
+
+/*
+ * Writes all profile records in the Chrome trace event format (load in chrome://tracing or Perfetto)
+ */
+
+SICOState scProfilingWriteChromeTrace(const char* filename);
+
+/*
+ * Creates the device memory for the parameters, uploads the data and sets them as kernel arguments. The uploads
+ * are done when it returns so the host data can be changed right away (except for params that are used in place on
+ * CPU and unified memory devices, see scAllocHostAligned).
+ */
+
+int scSetupParameters(SICODevice device, SICOKernel kernel, SICOCommanQueue queue, SICOParam* params, int paramCount);
+
+/*
+ * Same as scSetupParameters but the uploads are only started, so the host can prepare the next request while they
+ * run. The host data must stay unchanged until the kernel has executed (when using the default in-order queues that
+ * is once scWriteMemoryParams/scCommandQueueFinish returns or the kernel event has completed)
+ */
+
+int scSetupParametersAsync(SICODevice device, SICOKernel kernel, SICOCommanQueue queue, SICOParam* params, int paramCount);
+
+/*
+ * Runs a 1D kernel over count items as a single launch. The local size is the tuned one (see scAutotuneKernel) if
+ * it divides count, otherwise it's left to the driver. Use scAddKernel1DSplit or scAddKernel1DPadded for counts that
+ * doesn't have a good divisor.
  */
 
 SICOState scAddKernel1D(SICOCommanQueue queue, SICOKernel kernel, size_t count);
 
+/*
+ * Runs a 1D kernel over count items as one launch with a good local size (tuned, or the largest multiple of the
+ * preferred work group size up to 256) over the largest multiple of it and a second launch (with a global offset)
+ * for the remaining items. get_global_id is the real index but get_global_size and get_group_id are per launch, so
+ * only use this for kernels that doesn't depend on them. Kernels with a reqd_work_group_size runs as a single launch.
+ *
+ * \@param localSize Local size to use (0 to pick one)
+ */
+
+SICOState scAddKernel1DSplit(SICOCommanQueue queue, SICOKernel kernel, size_t count, size_t localSize);
+
+/*
+ * Runs a 1D kernel with the global size rounded up to a multiple of the local size in a single launch (the size from
+ * reqd_work_group_size if the kernel has one). The real count is passed to the kernel as a uint argument at
+ * boundsArgIndex and the kernel must skip items past it, e.g.
+ *
+ * __kernel void kern(global float* output, uint count) { if (get_global_id(0) >= count) return; ... }
+ *
+ * \@param localSize Local size to use (0 to pick one)
+ * \@param boundsArgIndex Index of the uint argument that receives the count
+ */
+
+SICOState scAddKernel1DPadded(SICOCommanQueue queue, SICOKernel kernel, size_t count, size_t localSize, int boundsArgIndex);
+
 /*
  * TODO Document
  *
@@ -196,13 +685,265 @@ SICOState scAddKernel1D(SICOCommanQueue queue, SICOKernel kernel, size_t count);
 SICOState scAddKernel2D(SICOCommanQueue queue, SICODevice device, SICOKernel kernel, size_t sizeX, size_t sizeY, SICOParam* params, int paramCount);
 
 /*
- * TODO Document
+ * Same as scAddKernel2D but runs one work item per pixel of the image (2D or 3D depending on the image). The image
+ * is usually one of the SICO_Image params.
+ */
+
+SICOState scAddKernelImage(SICOCommanQueue queue, SICODevice device, SICOKernel kernel, SICOImage image, SICOParam* params, int paramCount);
+
+/*
+ * Finds the fastest local work size for a kernel by timing all valid power of two local sizes (and the driver
+ * default) over the given global size. The result is stored for the device, kernel and global size class (log2 of
+ * each dimension) and is used by scAddKernel1D and scAddKernel2D from then on. Results are persisted to the file set
+ * with scSetAutotuneFile (or autotune.txt in the program cache dir) so later runs doesn't have to tune again.
+ *
+ * The kernel runs many times on the arguments that are currently set, so it has to be safe to run repeatedly
+ * (outputs doesn't depend on their previous contents). Use scratch buffers for kernels that update data in place.
+ *
+ * \@param queue Queue the arguments were set up on, finished before tuning starts (may be 0)
+ * \@param kernel Kernel to tune
+ * \@param workDim Number of dimensions (1 - 3)
+ * \@param globalSize Global work size per dimension
+ * \@param iterations Timed runs per local size (0 for default)
+ */
+
+SICOState scAutotuneKernel(SICOCommanQueue queue, SICOKernel kernel, int workDim, const size_t* globalSize, int iterations);
+
+/*
+ * Sets the file used to persist autotune results (0 to only keep them in memory)
+ */
+
+void scSetAutotuneFile(const char* filename);
+
+/*
+ * Resident data. A host array registered once gets a device copy that is kept between launches and only the parts
+ * that changed since the last sync are uploaded. Changes are marked with scResidentMarkDirty, or found automatically
+ * by hashing the host data in 64 KB blocks when hashContents is set. Use it in a SICOParam with the SICO_Resident
+ * policy and the SICOResident as data (the size field is ignored), or bind scResidentHandle directly.
+ * The device copy is authoritative, kernels that write to it doesn't update the host data until the parts that are
+ * needed are read with scResidentReadBack (scWriteMemoryParams doesn't read resident params back).
+ */
+
+typedef struct SICOResidentStats
+{
+    uint32_t version;       // number of scResidentMarkDirty calls (including the initial one)
+    uint32_t uploads;       // number of uploads done
+    uint64_t uploadedBytes; // total number of bytes uploaded
+} SICOResidentStats;
+
+/*
+ * \@param device Device to keep the data on
+ * \@param flags Memory flags (SICO_MEM_READ_ONLY etc)
+ * \@param data Host data, must stay valid until scDestroyResident
+ * \@param size Size in bytes
+ * \@param hashContents Non-zero to find changes by hashing the host data on each sync
+ * Return resident object or 0 on failure
+ */
+
+SICOResident scCreateResident(SICODevice device, int flags, void* data, size_t size, int hashContents);
+
+/*
+ * Marks a byte range of the host data as changed, it will be uploaded on the next sync. size 0 means to the end.
+ */
+
+void scResidentMarkDirty(SICOResident resident, size_t offset, size_t size);
+
+/*
+ * Uploads the changed parts (non-blocking, the host data must not be changed until the upload is done). Called
+ * automatically by scSetupParameters and launch objects for SICO_Resident params.
+ */
+
+SICOState scResidentSync(SICOCommanQueue queue, SICOResident resident);
+
+/*
+ * Reads a byte range of the device copy back into the host data (blocking). size 0 means to the end. Ranges marked
+ * with scResidentMarkDirty that overlaps the read are synced first. Unmarked host changes inside the range are
+ * overwritten, with content hashing changes outside it (also in partly read blocks) are still found by the next sync.
+ */
+
+SICOState scResidentReadBack(SICOCommanQueue queue, SICOResident resident, size_t offset, size_t size);
+
+SICOHandle scResidentHandle(SICOResident resident);
+
+void scGetResidentStats(SICOResident resident, SICOResidentStats* stats);
+
+void scDestroyResident(SICOResident resident);
+
+/*
+ * Lazy outputs. Results stay on the device until the host asks for them with scAcquireHost, so intermediate buffers
+ * in a pipeline are never read back. Use it in a SICOParam with the SICO_Output policy and the SICOOutput as data
+ * (the size field is ignored). The same output can be used as input to the next kernel and is then consumed
+ * directly on the device.
+ */
+
+/*
+ * \@param device Device the buffer is created on
+ * \@param flags Memory flags (SICO_MEM_READ_WRITE outputs come from the buffer pool)
+ * \@param size Size in bytes
+ * \@param hostPtr Host memory the data is read back to (must stay valid), if 0 memory is allocated on first
+ *        acquire or on unified memory devices the buffer is mapped
+ * Return output or 0 on failure
+ */
+
+SICOOutput scCreateOutput(SICODevice device, int flags, size_t size, void* hostPtr);
+
+/*
+ * Device buffer of the output, for binding it directly. Call scOutputInvalidate when a kernel has written to it
+ */
+
+SICOHandle scOutputHandle(SICOOutput output);
+
+/*
+ * Marks the host data as out of date (done automatically for SICO_Output params that aren't read only)
+ */
+
+void scOutputInvalidate(SICOCommanQueue queue, SICOOutput output);
+
+/*
+ * Non-zero if the device has data that hasn't been acquired by the host yet
+ */
+
+int scOutputIsStale(SICOOutput output);
+
+/*
+ * Gets the data to the host (waiting for the kernels writing it) the first time it's called after the output has been
+ * written, later calls only return the pointer. The pointer is valid until the output is used by a kernel again.
+ * Return host pointer or 0 on failure
+ */
+
+void* scAcquireHost(SICOCommanQueue queue, SICOOutput output);
+
+/*
+ * \@param queue Queue used for unmapping the buffer if it's mapped (can be 0 if it isn't)
+ */
+
+void scDestroyOutput(SICOCommanQueue queue, SICOOutput output);
+
+/*
+ * Creates a launch object that keeps the device buffers for the params alive between dispatches so repeated
+ * launches of the same kernel only needs to set the arguments that changed. The params are copied (the data
+ * pointers must stay valid while the launch is used).
  *
+ * \@param device Device the kernel was built for
+ * \@param kernel Kernel to launch
+ * \@param params Kernel arguments
+ * \@param paramCount Number of arguments
+ * \@return Launch object or 0 on failure
+ */
+
+SICOLaunch scCreateLaunch(SICODevice device, SICOKernel kernel, const SICOParam* params, int paramCount);
+
+/*
+ * Points a buffer argument to new host memory. The buffer is reused if the size is unchanged and is uploaded
+ * again on the next dispatch
+ */
+
+SICOState scLaunchSetBuffer(SICOLaunch launch, int index, void* data, size_t size);
+
+/*
+ * Tells the launch that the host data of a buffer argument has changed so it gets uploaded on the next dispatch.
+ * Scalars (SICO_PARAMETER) don't need this as their values are compared on each dispatch.
+ */
+
+void scLaunchMarkDirty(SICOLaunch launch, int index);
+
+/*
+ * Uploads dirty buffers, sets changed arguments and enqueues the kernel (nothing is waited on)
+ *
+ * \@param launch Launch object
+ * \@param queue Queue to enqueue on
+ * \@param workDim Number of dimensions (1 - 3)
+ * \@param globalSize Global work size per dimension
+ * \@param localSize Local work size per dimension (may be 0)
+ */
+
+SICOState scLaunchDispatch(SICOLaunch launch, SICOCommanQueue queue, int workDim, const size_t* globalSize, const size_t* localSize);
+
+/*
+ * Reads back the writable buffers of the launch into their host memory (blocking)
+ */
+
+SICOState scLaunchReadBack(SICOLaunch launch, SICOCommanQueue queue);
+
+/*
+ * Releases the buffers of the launch. The kernel is not released.
+ */
+
+void scDestroyLaunch(SICOLaunch launch);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct SICOStreamConfig
+{
+    size_t chunkElements; // elements per chunk (0 = default, clamped to what the device can allocate)
+    int depth;            // number of chunks in flight (0 = 2, max 8)
+} SICOStreamConfig;
+
+/*
+ * Runs a 1D kernel over arrays that can be larger than device memory by splitting them in chunks. Each chunk is
+ * uploaded, run and downloaded on its own queue/buffer set so transfers of one chunk overlaps compute of another.
+ * All buffer params are treated as arrays of elementCount items (param size must be a multiple of elementCount).
+ * SICO_MEM_READ_ONLY params are only uploaded, SICO_MEM_WRITE_ONLY with SICO_Uninitialized only downloaded. The kernel
+ * sees indices local to the chunk (get_global_id(0) goes from 0 to the chunk size) so it must not depend on the global
+ * position.
+ * Returns when all results are back in host memory.
+ * \@param config Chunking setup, can be NULL for defaults
+ */
+
+SICOState scStreamKernel1D(SICODevice device, SICOKernel kernel, SICOParam* params, int paramCount, size_t elementCount,
+                           const SICOStreamConfig* config);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef enum SICOSplitMode
+{
+    SICO_SplitStatic,   // split work by the compute units * clock of each device
+    SICO_SplitAdaptive, // start like static and then rebalance after each run from the measured throughput
+} SICOSplitMode;
+
+/*
+ * Creates a kernel that runs across several devices (for example the devices from scGetBestDevices or
+ * scGetAllDevices). The kernel is built for each device, devices it fails to build on are skipped.
+ * Return multi-device kernel or 0 if it couldn't be built for any device
+ */
+
+SICOMultiKernel scCreateMultiKernel(SICODevice* devices, int deviceCount, const char* filename, const char* kernelName,
+                                    const char* buildOpts, SICOSplitMode mode);
+
+/*
+ * Runs the kernel with the global range split along the last dimension (rows in 2D) between the devices. Work-items
+ * get their real global ids (the split is done with global offsets). Each device gets its own copy of the buffer
+ * params and only its rows of the non read only params are copied back, so output sizes must be a multiple of
+ * the number of rows. Returns when all results are back in host memory.
+ */
+
+SICOState scRunMultiKernel(SICOMultiKernel multi, int workDim, const size_t* globalSize, SICOParam* params, int paramCount);
+
+/*
+ * Get the current share of work (0 - 1) of each device the kernel runs on.
+ * Return number of devices written to weights
+ */
+
+int scGetMultiKernelWeights(SICOMultiKernel multi, float* weights);
+
+void scDestroyMultiKernel(SICOMultiKernel multi);
+
+/*
+ * Enqueues a kernel for execution. This is the raw version of scAddKernel1D/2D
+ * \@param eventListCount/waitEventList Events that has to complete before the kernel starts (can be 0/NULL)
+ * \@param event If non-NULL receives an event for the kernel (release with scReleaseEvent)
  */
 
 SICOState scAddKernel(SICOCommanQueue queue, SICOKernel kernel, int workDim,
                       const size_t* globalWorkOffset, const size_t* globalWorkSize, const size_t* localWorkSize,
-                      int eventListCount, void* waitEventList, void* event);
+                      int eventListCount, const SICOEvent* waitEventList, SICOEvent* event);
+
+/*
+ * Non-blocking 1D kernel enqueue that waits for waitList and returns an event for the kernel
+ */
+
+SICOState scAddKernel1DAsync(SICOCommanQueue queue, SICOKernel kernel, size_t count,
+                             int waitCount, const SICOEvent* waitList, SICOEvent* event);
 
 
 /*
@@ -220,11 +961,110 @@ SICOState scFlushMemory(SICOCommanQueue* queue, SICOKernel kernel, size_t sizeX,
 void scFreeParams(SICOParam* paramaters, int count);
 
 /*
- * TODO Document
+ * Region of a buffer. With rowPitch 0 it's a byte range (origin[0], size[0]), otherwise a 2D/3D rectangle where
+ * origin[0]/size[0] are in bytes and the others in rows/slices. slicePitch is only needed for 3D regions.
+ */
+
+typedef struct SICORegion
+{
+    size_t origin[3];
+    size_t size[3];     // 0 is treated as 1
+    size_t rowPitch;
+    size_t slicePitch;
+} SICORegion;
+
+/*
+ * Device buffer used for a parameter after scSetupParameters, for example to pass a SICO_LeaveOnDevice output to
+ * the next kernel as SICO_UserSuppliedData. Valid until scFreeParams.
+ */
+
+SICOHandle scGetParamHandle(const SICOParam* param);
+
+/*
+ * Reads a region of a parameter buffer back to the same place in the host memory (the host data has the same layout
+ * as the buffer). Only the region is transferred which is useful for getting a region of interest out of a frame.
+ * \@param blocking Non-zero to wait until the data is there
+ */
+
+SICOState scReadParamRegion(SICOCommanQueue queue, const SICOParam* param, const SICORegion* region, int blocking);
+
+/*
+ * Images. A SICOImage is a device image together with the host pixels it's uploaded from and read back to. Use it in
+ * a SICOParam with the SICO_Image policy and the SICOImage as data (the size field is ignored), the type decides
+ * the transfers like for buffers: read only images are only uploaded and write only images only read back.
+ * Return non-zero if the device supports images
+ */
+
+int scHasImageSupport(SICODevice device);
+
+/*
+ * \@param device Device the image is created on
+ * \@param flags Memory flags (SICO_MEM_READ_ONLY etc)
+ * \@param channelOrder Channel order (SICO_CHANNEL_RGBA etc)
+ * \@param channelType Channel data type (SICO_CHANNEL_FLOAT etc)
+ * \@param width Width in pixels
+ * \@param height Height in pixels
+ * \@param rowPitch Bytes between rows in the host data, 0 for tightly packed
+ * \@param hostPtr Host pixels (must stay valid while the image is used), can be 0 if only scGetImageHandle is used
+ * Return image or 0 on failure (for example if the format isn't supported)
+ */
+
+SICOImage scCreateImage2D(SICODevice device, int flags, int channelOrder, int channelType, size_t width, size_t height,
+                          size_t rowPitch, void* hostPtr);
+
+/*
+ * Same as scCreateImage2D but for 3D images.
+ * \@param slicePitch Bytes between slices in the host data, 0 for tightly packed
+ */
+
+SICOImage scCreateImage3D(SICODevice device, int flags, int channelOrder, int channelType, size_t width, size_t height,
+                          size_t depth, size_t rowPitch, size_t slicePitch, void* hostPtr);
+
+/*
+ * Device image, for binding it directly with SICO_UserSuppliedData
+ */
+
+SICOHandle scGetImageHandle(SICOImage image);
+
+/*
+ * Copies a region of the host pixels to the image (or the other way around for scReadImage). Here the region is in
+ * pixels and the pitches are ignored (the ones of the image are used), 0 means the whole image.
+ * \@param blocking Non-zero to wait until the copy is done
+ */
+
+SICOState scWriteImage(SICOCommanQueue queue, SICOImage image, const SICORegion* region, int blocking);
+
+SICOState scReadImage(SICOCommanQueue queue, SICOImage image, const SICORegion* region, int blocking);
+
+void scDestroyImage(SICOImage image);
+
+/*
+ * Creates a sampler for reading images in kernels. Pass it in a SICOParam with the SICO_Sampler policy.
+ * \@param normalizedCoords Non-zero if the kernel uses coordinates in the [0, 1] range
+ * \@param addressMode How coordinates outside the image are handled (SICO_ADDRESS_CLAMP_TO_EDGE etc)
+ * \@param filterMode SICO_FILTER_NEAREST or SICO_FILTER_LINEAR
+ * Return sampler or 0 on failure
+ */
+
+SICOSampler scCreateSampler(SICODevice device, int normalizedCoords, int addressMode, int filterMode);
+
+void scReleaseSampler(SICOSampler sampler);
+
+/*
+ * Copies the results of all parameters that aren't read only back to the host memory. Returns once the data is there.
+ * SICO_LeaveOnDevice and SICO_UserSuppliedData parameters are skipped.
  */
 
 SICOState scWriteMemoryParams(struct SICODevice* device, SICOCommanQueue queue, SICOParam* params, uint32_t paramCount);
 
+/*
+ * Non-blocking version of scWriteMemoryParams. event receives an event that completes when all the data has been
+ * copied back (release with scReleaseEvent). The host arrays must not be used before that, but the params can be
+ * freed right away (pooled buffers aren't handed out again until the reads are done).
+ */
+
+SICOState scWriteMemoryParamsAsync(struct SICODevice* device, SICOCommanQueue queue, SICOParam* params, uint32_t paramCount, SICOEvent* event);
+
 /*
  * TODO Document
  */
@@ -240,13 +1080,229 @@ SICOState scDestroyCommandQueue(SICOCommanQueue queue);
 
 
 /*
- * TODO Document
+ * Compiles a kernel from a .cl file.
+ * \@param buildOpts Options passed to the OpenCL compiler, such as "-cl-fast-relaxed-math -D SIZE=64" (can be NULL)
+ * Return kernel on success otherwise 0 (release with scReleaseKernel)
  */
 
 struct SICOKernel* scCompileKernelFromSourceFile(struct SICODevice* device, const char* filename, const char* kernelName, const char* buildOpts);
 
 /*
- * TODO Document
+ * Compiles a kernel from source in memory, such as a .cl file embedded in the executable by the OpenCLEmbedSource
+ * build rule, so no file I/O is needed.
+ * \@param source OpenCL source
+ * \@param size Size of the source in bytes, if 0 source is expected to be null terminated
+ * Return kernel on success otherwise 0 (release with scReleaseKernel)
+ */
+
+struct SICOKernel* scCompileKernelFromSource(struct SICODevice* device, const char* source, size_t size, const char* kernelName, const char* buildOpts);
+
+/*
+ * Get a kernel from the process wide kernel registry. The first call for a (device, filename, kernelName, buildOpts)
+ * combination compiles the kernel, later calls returns the same kernel object without touching the disk or the
+ * compiler. Kernels returned from here are owned by the registry and are released by scEvictKernel,
+ * scReleaseKernels or scClose. Safe to call from multiple threads.
+ * Return kernel on success otherwise 0
+ */
+
+struct SICOKernel* scGetKernel(struct SICODevice* device, const char* filename, const char* kernelName, const char* buildOpts);
+
+/*
+ * Same as scGetKernel but for source in memory. Kernels are keyed on the source itself so the same source
+ * embedded in several places only gets compiled once.
+ */
+
+struct SICOKernel* scGetKernelFromSource(struct SICODevice* device, const char* source, size_t size, const char* kernelName, const char* buildOpts);
+
+/*
+ * Specialization constants. Each define is passed to the compiler as -D name=value so the kernel can be built with
+ * sizes, loop counts, etc as compile time constants. Every set of defines gives a separate program (and registry and
+ * program cache entry).
+ */
+
+typedef struct SICODefine
+{
+    const char* name;
+    const char* value;      // NULL or "" for just -D name
+} SICODefine;
+
+/*
+ * Builds the options for a set of defines. The defines are sorted by name so the order they are given in doesn't
+ * matter. Names and values can't contain whitespace or quotes.
+ * \@param output Buffer for the options
+ * \@param size Size of the output buffer
+ * \@param buildOpts Other build options (such as "-cl-fast-relaxed-math") placed before the defines (can be NULL)
+ * \@param defines Array of defines
+ * \@param count Number of defines
+ * Return SICO_Ok on success
+ */
+
+SICOState scSpecializeOptions(char* output, size_t size, const char* buildOpts, const SICODefine* defines, int count);
+
+/*
+ * scGetKernel for a specialization, the kernel is compiled once per set of defines
+ */
+
+struct SICOKernel* scGetKernelSpecialized(struct SICODevice* device, const char* filename, const char* kernelName,
+                                          const char* buildOpts, const SICODefine* defines, int count);
+
+/*
+ * Async compiles. Kernels are built on a pool of worker threads so many kernels can be compiled in parallel at
+ * startup, and the caller only has to wait for a kernel when it's about to be used. The kernel is built through the
+ * registry (same as scGetKernel/scGetKernelFromSource) so it's owned by the registry.
+ *
+ * SICOCompileJob job = scCompileKernelAsync(device, "kernels/blur.cl", "blur", "");
+ * ...
+ * SICOKernel kernel = scCompileJobWait(job);
+ * scReleaseCompileJob(job);
+ */
+
+/*
+ * Sets the number of compile threads. Only affects the pool if it hasn't been started yet (it's started on the first
+ * async compile and stopped in scClose). 0 (default) uses one thread per CPU core.
+ */
+
+void scSetCompileThreads(int count);
+
+/*
+ * Queues a compile of a kernel from a .cl file. All strings are copied.
+ * Return job handle (release with scReleaseCompileJob) or 0 on invalid arguments
+ */
+
+SICOCompileJob scCompileKernelAsync(struct SICODevice* device, const char* filename, const char* kernelName, const char* buildOpts);
+
+/*
+ * Same as scCompileKernelAsync but for source in memory (the source is copied, size 0 means null terminated)
+ */
+
+SICOCompileJob scCompileKernelFromSourceAsync(struct SICODevice* device, const char* source, size_t size, const char* kernelName, const char* buildOpts);
+
+/*
+ * Returns non-zero if the job has finished (without blocking)
+ */
+
+int scCompileJobDone(SICOCompileJob job);
+
+/*
+ * Waits for the job to finish. If no worker has started on the job yet it's built on the calling thread.
+ * Return kernel on success otherwise 0. Can be called several times for the same job.
+ */
+
+struct SICOKernel* scCompileJobWait(SICOCompileJob job);
+
+/*
+ * Waits for the job (if not finished) and frees it. The kernel stays in the registry.
+ */
+
+void scReleaseCompileJob(SICOCompileJob job);
+
+/*
+ * Removes a kernel from the registry and releases it. The kernel must not be in use by any other thread.
+ */
+
+void scEvictKernel(struct SICOKernel* kernel);
+
+/*
+ * Releases all kernels in the registry (called by scClose)
+ */
+
+void scReleaseKernels();
+
+/*
+ * Releases a kernel created by scCompileKernelFromSourceFile or scLoadProgramFromBinaryFile.
+ * Don't use this for kernels returned by scGetKernel (use scEvictKernel instead)
+ */
+
+void scReleaseKernel(struct SICOKernel* kernel);
+
+/*
+ * Built-in primitives. They work on device buffers (SICOHandle) created on the same device as the queue and are
+ * only enqueued so several primitives (and user kernels) can be chained without the data going through the host.
+ * The kernels are built the first time a primitive is used for a device/type. Counts are limited to 2^32 - 1.
+ */
+
+/*
+ * Reduces count elements of input to a single value written to the first element of result
+ */
+
+SICOState scReduce(SICOCommanQueue queue, SICODataType type, SICOReduceOp op, SICOHandle input, size_t count, SICOHandle result);
+
+/*
+ * Prefix sum of count elements. Exclusive unless inclusive is non-zero. input and output may be the same buffer.
+ */
+
+SICOState scScan(SICOCommanQueue queue, SICODataType type, SICOHandle input, SICOHandle output, size_t count, int inclusive);
+
+/*
+ * Sorts count 32-bit unsigned keys in place (stable radix sort)
+ */
+
+SICOState scSortKeys(SICOCommanQueue queue, SICOHandle keys, size_t count);
+
+/*
+ * Sorts count 32-bit unsigned keys in place and moves the 32-bit values along with them (stable radix sort)
+ */
+
+SICOState scSortPairs(SICOCommanQueue queue, SICOHandle keys, SICOHandle values, size_t count);
+
+/*
+ * Copies the 32-bit elements of input where flags (uint) is non-zero to the start of output, keeping their order.
+ * The number of elements written is stored as a uint in outputCount.
+ */
+
+SICOState scCompact(SICOCommanQueue queue, SICOHandle input, SICOHandle flags, SICOHandle output, size_t count, SICOHandle outputCount);
+
+/*
+ * Counts the uint values of input into binCount uint bins (bins are cleared first, values >= binCount are ignored)
+ */
+
+SICOState scHistogram(SICOCommanQueue queue, SICOHandle input, size_t count, SICOHandle bins, int binCount);
+
+/*
+ * Expressions. An expression graph describes an elementwise computation over float buffers which is turned into a
+ * single fused kernel, so a chain of operations reads each input and writes the output once. Kernels are cached by
+ * the shape of the expression (constants are passed as arguments so changing them doesn't cause a rebuild).
+ *
+ * SICOExprGraph graph = scExprCreate();
+ * SICOExpr x = scExprInput(graph, xBuffer);
+ * SICOExpr y = scExprFma(graph, x, scExprConst(graph, 2.0f), scExprInput(graph, yBuffer));
+ * scExprRun(queue, graph, scExprUnary(graph, SICO_ExprSqrt, y), outBuffer, count);
+ */
+
+SICOExprGraph scExprCreate();
+
+/*
+ * Releases the graph (buffers used as inputs are not released)
+ */
+
+void scExprDestroy(SICOExprGraph graph);
+
+SICOExpr scExprInput(SICOExprGraph graph, SICOHandle input);
+SICOExpr scExprConst(SICOExprGraph graph, float value);
+SICOExpr scExprUnary(SICOExprGraph graph, SICOExprOp op, SICOExpr a);
+SICOExpr scExprBinary(SICOExprGraph graph, SICOExprOp op, SICOExpr a, SICOExpr b);
+
+/*
+ * a * b + c
+ */
+
+SICOExpr scExprFma(SICOExprGraph graph, SICOExpr a, SICOExpr b, SICOExpr c);
+
+/*
+ * condition != 0 ? a : b
+ */
+
+SICOExpr scExprSelect(SICOExprGraph graph, SICOExpr condition, SICOExpr a, SICOExpr b);
+
+/*
+ * Enqueues the fused kernel computing result for count elements into output (nothing is waited on)
+ */
+
+SICOState scExprRun(SICOCommanQueue queue, SICOExprGraph graph, SICOExpr result, SICOHandle output, size_t count);
+
+/*
+ * Runs a kernel named "kern" over elementCount items with dest, sourceA and sourceB as buffer parameters using the
+ * best device. The kernel is compiled on first use and reused after that (see scGetKernel)
  */
 
 SICOState scRunKernel1DArraySimple(void* dest, void* sourceA, void* sourceB, const char* filename, size_t elementCount, size_t sizeInBytes);
@@ -0,0 +1,210 @@
+// OpenCL source for the built-in primitives (see the Primitives section in sico.c). Included by sico.c only.
+// Stored as one string per line to stay below the string length limits of C compilers.
+
+static const char* s_primitivesSource[] =
+{
+    "// Built-in parallel primitives. The host prepends defines for T (element type), T_LARGEST, T_SMALLEST,\n",
+    "// T_MIN and T_MAX so the typed kernels are built once per data type.\n",
+    "\n",
+    "#define SICO_REDUCE_SUM 0\n",
+    "#define SICO_REDUCE_MIN 1\n",
+    "#define SICO_REDUCE_MAX 2\n",
+    "\n",
+    "#define SICO_RADIX_DIGITS 16\n",
+    "#define SICO_HISTOGRAM_LOCAL_BINS 256\n",
+    "\n",
+    "T reduceIdentity(uint op)\n",
+    "{\n",
+    "    return op == SICO_REDUCE_SUM ? (T)0 : (op == SICO_REDUCE_MIN ? T_LARGEST : T_SMALLEST);\n",
+    "}\n",
+    "\n",
+    "T reduceOp(uint op, T a, T b)\n",
+    "{\n",
+    "    return op == SICO_REDUCE_SUM ? a + b : (op == SICO_REDUCE_MIN ? T_MIN(a, b) : T_MAX(a, b));\n",
+    "}\n",
+    "\n",
+    "// Each group reduces a strided part of the input and writes one value per group. Local size must be a power of two.\n",
+    "\n",
+    "__kernel void sico_reduce(global const T* input, global T* output, uint count, uint op, local T* scratch)\n",
+    "{\n",
+    "    uint lid = get_local_id(0);\n",
+    "    T value = reduceIdentity(op);\n",
+    "\n",
+    "    for (uint i = get_global_id(0); i < count; i += get_global_size(0))\n",
+    "        value = reduceOp(op, value, input[i]);\n",
+    "\n",
+    "    scratch[lid] = value;\n",
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "\n",
+    "    for (uint s = get_local_size(0) / 2; s > 0; s >>= 1)\n",
+    "    {\n",
+    "        if (lid < s)\n",
+    "            scratch[lid] = reduceOp(op, scratch[lid], scratch[lid + s]);\n",
+    "\n",
+    "        barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "    }\n",
+    "\n",
+    "    if (lid == 0)\n",
+    "        output[get_group_id(0)] = scratch[0];\n",
+    "}\n",
+    "\n",
+    "// Scans one block per group and writes the block total to blockSums\n",
+    "\n",
+    "__kernel void sico_scan_block(global const T* input, global T* output, global T* blockSums, uint count, uint inclusive, local T* scratch)\n",
+    "{\n",
+    "    uint gid = get_global_id(0);\n",
+    "    uint lid = get_local_id(0);\n",
+    "    uint localSize = get_local_size(0);\n",
+    "\n",
+    "    scratch[lid] = gid < count ? input[gid] : (T)0;\n",
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "\n",
+    "    for (uint offset = 1; offset < localSize; offset <<= 1)\n",
+    "    {\n",
+    "        T add = lid >= offset ? scratch[lid - offset] : (T)0;\n",
+    "        barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "        scratch[lid] += add;\n",
+    "        barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "    }\n",
+    "\n",
+    "    if (gid < count)\n",
+    "        output[gid] = inclusive ? scratch[lid] : (lid > 0 ? scratch[lid - 1] : (T)0);\n",
+    "\n",
+    "    if (lid == localSize - 1)\n",
+    "        blockSums[get_group_id(0)] = scratch[lid];\n",
+    "}\n",
+    "\n",
+    "// Adds the scanned block sums to each block (same local size as sico_scan_block)\n",
+    "\n",
+    "__kernel void sico_scan_add(global T* output, global const T* blockOffsets, uint count)\n",
+    "{\n",
+    "    uint gid = get_global_id(0);\n",
+    "\n",
+    "    if (gid < count)\n",
+    "        output[gid] += blockOffsets[get_group_id(0)];\n",
+    "}\n",
+    "\n",
+    "__kernel void sico_fill_u32(global uint* output, uint value, uint count)\n",
+    "{\n",
+    "    uint gid = get_global_id(0);\n",
+    "\n",
+    "    if (gid < count)\n",
+    "        output[gid] = value;\n",
+    "}\n",
+    "\n",
+    "// Radix sort pass: count digits per block, stored digit major so an exclusive scan gives the scatter offsets\n",
+    "\n",
+    "__kernel void sico_radix_histogram(global const uint* keys, global uint* histogram, uint count, uint shift, uint blockCount)\n",
+    "{\n",
+    "    local uint counts[SICO_RADIX_DIGITS];\n",
+    "    uint gid = get_global_id(0);\n",
+    "    uint lid = get_local_id(0);\n",
+    "\n",
+    "    if (lid < SICO_RADIX_DIGITS)\n",
+    "        counts[lid] = 0;\n",
+    "\n",
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "\n",
+    "    if (gid < count)\n",
+    "        atomic_inc(&counts[(keys[gid] >> shift) & (SICO_RADIX_DIGITS - 1)]);\n",
+    "\n",
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "\n",
+    "    if (lid < SICO_RADIX_DIGITS)\n",
+    "        histogram[lid * blockCount + get_group_id(0)] = counts[lid];\n",
+    "}\n",
+    "\n",
+    "// Stable scatter: the rank within the block is the number of earlier items with the same digit\n",
+    "\n",
+    "__kernel void sico_radix_scatter(global const uint* keysIn, global uint* keysOut, global const uint* valuesIn, global uint* valuesOut,\n",
+    "                                 global const uint* offsets, uint count, uint shift, uint blockCount, uint hasValues, local uint* digits)\n",
+    "{\n",
+    "    uint gid = get_global_id(0);\n",
+    "    uint lid = get_local_id(0);\n",
+    "    uint key = gid < count ? keysIn[gid] : 0;\n",
+    "    uint digit = gid < count ? (key >> shift) & (SICO_RADIX_DIGITS - 1) : SICO_RADIX_DIGITS;\n",
+    "    uint rank = 0;\n",
+    "\n",
+    "    digits[lid] = digit;\n",
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "\n",
+    "    if (gid >= count)\n",
+    "        return;\n",
+    "\n",
+    "    for (uint i = 0; i < lid; ++i)\n",
+    "        rank += digits[i] == digit ? 1 : 0;\n",
+    "\n",
+    "    uint pos = offsets[digit * blockCount + get_group_id(0)] + rank;\n",
+    "\n",
+    "    keysOut[pos] = key;\n",
+    "\n",
+    "    if (hasValues)\n",
+    "        valuesOut[pos] = valuesIn[gid];\n",
+    "}\n",
+    "\n",
+    "__kernel void sico_compact_flags(global const uint* flags, global uint* output, uint count)\n",
+    "{\n",
+    "    uint gid = get_global_id(0);\n",
+    "\n",
+    "    if (gid < count)\n",
+    "        output[gid] = flags[gid] != 0 ? 1 : 0;\n",
+    "}\n",
+    "\n",
+    "__kernel void sico_compact_scatter(global const uint* input, global const uint* flags, global const uint* positions,\n",
+    "                                   global uint* output, global uint* outputCount, uint count)\n",
+    "{\n",
+    "    uint gid = get_global_id(0);\n",
+    "\n",
+    "    if (gid >= count)\n",
+    "        return;\n",
+    "\n",
+    "    uint keep = flags[gid] != 0 ? 1 : 0;\n",
+    "\n",
+    "    if (keep)\n",
+    "        output[positions[gid]] = input[gid];\n",
+    "\n",
+    "    if (gid == count - 1)\n",
+    "        outputCount[0] = positions[gid] + keep;\n",
+    "}\n",
+    "\n",
+    "// Histogram with per group bins in local memory (binCount <= SICO_HISTOGRAM_LOCAL_BINS). Values outside the bins are ignored.\n",
+    "\n",
+    "__kernel void sico_histogram_local(global const uint* input, global uint* bins, uint count, uint binCount)\n",
+    "{\n",
+    "    local uint localBins[SICO_HISTOGRAM_LOCAL_BINS];\n",
+    "    uint lid = get_local_id(0);\n",
+    "    uint localSize = get_local_size(0);\n",
+    "\n",
+    "    for (uint i = lid; i < binCount; i += localSize)\n",
+    "        localBins[i] = 0;\n",
+    "\n",
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "\n",
+    "    for (uint i = get_global_id(0); i < count; i += get_global_size(0))\n",
+    "    {\n",
+    "        uint value = input[i];\n",
+    "\n",
+    "        if (value < binCount)\n",
+    "            atomic_inc(&localBins[value]);\n",
+    "    }\n",
+    "\n",
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n",
+    "\n",
+    "    for (uint i = lid; i < binCount; i += localSize)\n",
+    "    {\n",
+    "        if (localBins[i])\n",
+    "            atomic_add(&bins[i], localBins[i]);\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "__kernel void sico_histogram_global(global const uint* input, global uint* bins, uint count, uint binCount)\n",
+    "{\n",
+    "    for (uint i = get_global_id(0); i < count; i += get_global_size(0))\n",
+    "    {\n",
+    "        uint value = input[i];\n",
+    "\n",
+    "        if (value < binCount)\n",
+    "            atomic_inc(&bins[value]);\n",
+    "    }\n",
+    "}\n",
+};
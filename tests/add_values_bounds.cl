@@ -0,0 +1,11 @@
+// Same as add_values.cl but with a bounds argument for padded launches
+
+__kernel void kern(global float* output, global float* inputA, global float* inputB, uint count)
+{
+    size_t i = get_global_id(0);
+
+    if (i >= count)
+        return;
+
+    output[i] = inputA[i] + inputB[i];
+}
@@ -0,0 +1,8 @@
+// Same as add_values.cl but with a fixed work group size
+
+__kernel __attribute__((reqd_work_group_size(64, 1, 1)))
+void kern(global float* output, global float* inputA, global float* inputB)
+{
+    size_t i = get_global_id(0);
+    output[i] = inputA[i] + inputB[i];
+}
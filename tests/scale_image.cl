@@ -0,0 +1,8 @@
+// Scales all pixels of an image (used by the image tests)
+
+__kernel void scale_image(__read_only image2d_t input, __write_only image2d_t output, sampler_t sampler, float scale)
+{
+    int2 pos = (int2)(get_global_id(0), get_global_id(1));
+
+    write_imagef(output, pos, read_imagef(input, sampler, pos) * scale);
+}
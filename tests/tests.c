@@ -29,6 +29,49 @@ static void sico_get_devices(void** state)
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+static void sico_device_policy(void** state)
+{
+    (void)state;
+    int deviceCount, cpuCount, i;
+
+    SICODevice* devices = scGetAllDevices(&deviceCount);
+    SICODevice* cpuDevices = scGetCPUDevices(&cpuCount);
+
+    SICODevice best = scGetBestDevice();
+    assert_non_null(best);
+    assert_true(scGetDeviceScore(best, SICO_DevicePolicyDefault) > 0.0);
+
+    scSetDevicePolicy(SICO_DevicePolicyIndex, deviceCount - 1);
+    assert_true(scGetBestDevice() == devices[deviceCount - 1]);
+
+    // invalid index falls back to the default policy
+
+    scSetDevicePolicy(SICO_DevicePolicyIndex, deviceCount);
+    assert_true(scGetBestDevice() == best);
+
+    scSetDevicePolicy(SICO_DevicePolicyPreferCPU, 0);
+
+    if (cpuCount > 0)
+    {
+        SICODevice device = scGetBestDevice();
+        int found = 0;
+
+        for (i = 0; i < cpuCount; ++i)
+            found |= cpuDevices[i] == device;
+
+        assert_true(found);
+    }
+
+    scSetDevicePolicy(SICO_DevicePolicyBandwidth, 0);
+    assert_non_null(scGetBestDevice());
+    assert_true(scGetDeviceScore(scGetBestDevice(), SICO_DevicePolicyBandwidth) > 0.0);
+
+    scSetDevicePolicy(SICO_DevicePolicyDefault, 0);
+    assert_true(scGetBestDevice() == best);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 static void sico_float_add_default_dev(void** state)
 {
     (void)state;
@@ -81,14 +124,1504 @@ static void sico_alloc_free(void** state)
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+static void sico_kernel_registry(void** state)
+{
+    (void)state;
+
+    SICODevice device = scGetBestDevice();
+    assert_non_null(device);
+
+    SICOKernel kernel = scGetKernel(device, "tests/add_values.cl", "kern", "");
+    assert_non_null(kernel);
+
+    // Second lookup should hit the registry and give back the same object
+
+    assert_true(scGetKernel(device, "tests/add_values.cl", "kern", "") == kernel);
+    assert_true(scGetDeviceQueue(device) == scGetDeviceQueue(device));
+
+    scEvictKernel(kernel);
+
+    kernel = scGetKernel(device, "tests/add_values.cl", "kern", "");
+    assert_non_null(kernel);
+
+    // Editing the file gives a new kernel (the size changes so the mtime resolution doesn't matter)
+
+    FILE* f = fopen("registry_edit_test.cl", "wb");
+    assert_non_null(f);
+    fputs("__kernel void kern(__global float* output) { output[get_global_id(0)] = 1.0f; }\n", f);
+    fclose(f);
+
+    SICOKernel edited = scGetKernel(device, "registry_edit_test.cl", "kern", "");
+    assert_non_null(edited);
+    assert_true(scGetKernel(device, "registry_edit_test.cl", "kern", "") == edited);
+
+    f = fopen("registry_edit_test.cl", "wb");
+    assert_non_null(f);
+    fputs("__kernel void kern(__global float* output) { output[get_global_id(0)] = 2.0f; }\n\n", f);
+    fclose(f);
+
+    kernel = scGetKernel(device, "registry_edit_test.cl", "kern", "");
+    assert_non_null(kernel);
+    assert_true(kernel != edited);
+
+    remove("registry_edit_test.cl");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_kernel_from_source(void** state)
+{
+    (void)state;
+
+    static const char source[] =
+        "__kernel void kern(__global float* output, __global const float* a, __global const float* b)\n"
+        "{\n"
+        "    int i = get_global_id(0);\n"
+        "    output[i] = a[i] + b[i];\n"
+        "}\n";
+
+    SICODevice device = scGetBestDevice();
+    assert_non_null(device);
+
+    SICOKernel kernel = scCompileKernelFromSource(device, source, 0, "kern", "");
+    assert_non_null(kernel);
+    scReleaseKernel(kernel);
+
+    kernel = scGetKernelFromSource(device, source, sizeof(source) - 1, "kern", "");
+    assert_non_null(kernel);
+    assert_true(scGetKernelFromSource(device, source, 0, "kern", "") == kernel);
+
+    assert_null(scCompileKernelFromSource(device, "this is not OpenCL", 0, "kern", ""));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_specialization(void** state)
+{
+    (void)state;
+
+    static const char* filename = "examples/advanced/mandelbrot_fractal/mandelbrot_fractal.cl";
+    SICODefine defines[] = { { "WIDTH", "640" }, { "HEIGHT", "480" } };
+    SICODefine reversed[] = { { "HEIGHT", "480" }, { "WIDTH", "640" } };
+    SICODefine other[] = { { "WIDTH", "320" }, { "HEIGHT", "240" } };
+    SICODefine invalid[] = { { "WIDTH", "1 2" } };
+    char options[256];
+
+    assert_int_equal(scSpecializeOptions(options, sizeof(options), "-cl-mad-enable", defines, 2), SICO_Ok);
+    assert_string_equal(options, "-cl-mad-enable -D HEIGHT=480 -D WIDTH=640");
+    assert_int_equal(scSpecializeOptions(options, sizeof(options), 0, invalid, 1), SICO_GeneralFail);
+    assert_int_equal(scSpecializeOptions(options, 8, 0, defines, 2), SICO_GeneralFail);
+
+    SICODevice device = scGetBestDevice();
+    assert_non_null(device);
+
+    // same set in any order gives the same kernel, another set gives a new one
+
+    SICOKernel kernel = scGetKernelSpecialized(device, filename, "kern", "", defines, 2);
+    assert_non_null(kernel);
+    assert_true(scGetKernelSpecialized(device, filename, "kern", "", reversed, 2) == kernel);
+
+    SICOKernel otherKernel = scGetKernelSpecialized(device, filename, "kern", "", other, 2);
+    assert_non_null(otherKernel);
+    assert_true(otherKernel != kernel);
+
+    // build options are passed to the compiler
+
+    assert_null(scCompileKernelFromSourceFile(device, filename, "kern", "-this-is-not-an-option"));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_async_compile(void** state)
+{
+    (void)state;
+
+    static const char* filename = "examples/advanced/mandelbrot_fractal/mandelbrot_fractal.cl";
+    SICOCompileJob jobs[4];
+    char options[4][64];
+
+    SICODevice device = scGetBestDevice();
+    assert_non_null(device);
+
+    for (int i = 0; i < 4; ++i)
+    {
+        sprintf(options[i], "-D WIDTH=%d -D HEIGHT=100", 100 + i);
+        jobs[i] = scCompileKernelAsync(device, filename, "kern", options[i]);
+        assert_non_null(jobs[i]);
+    }
+
+    SICOCompileJob badJob = scCompileKernelFromSourceAsync(device, "this is not OpenCL", 0, "kern", "");
+    assert_non_null(badJob);
+
+    // wait in reverse order so some jobs are likely still queued (and get built on this thread)
+
+    for (int i = 3; i >= 0; --i)
+    {
+        SICOKernel kernel = scCompileJobWait(jobs[i]);
+        assert_non_null(kernel);
+        assert_true(scCompileJobDone(jobs[i]));
+        assert_true(scGetKernel(device, filename, "kern", options[i]) == kernel);
+        scReleaseCompileJob(jobs[i]);
+    }
+
+    assert_null(scCompileJobWait(badJob));
+    scReleaseCompileJob(badJob);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_buffer_pool(void** state)
+{
+    (void)state;
+
+    float a[1024] = { 0 };
+    float b[1024] = { 0 };
+    float res[1024];
+    SICOBufferPoolStats first, second;
+
+    SICODevice device = scGetBestDevice();
+    assert_non_null(device);
+
+    scRunKernel1DArraySimple(res, a, b, "tests/add_values.cl", 1024, sizeof(a));
+    scCommandQueueFinish(scGetThreadQueue(device));
+    scGetBufferPoolStats(device, &first);
+
+    scRunKernel1DArraySimple(res, a, b, "tests/add_values.cl", 1024, sizeof(a));
+    scGetBufferPoolStats(device, &second);
+
+    // CPU devices uses the host memory directly and doesn't go through the pool. Otherwise
+    // the second run should be served completly from the pool.
+
+    assert_int_equal(second.bytesInUse, 0);
+    assert_true(second.misses == first.misses);
+
+    scTrimBufferPool(device, 0);
+    scGetBufferPoolStats(device, &second);
+    assert_int_equal(second.bytesResident, 0);
+
+    // Pooled buffers can hold data of an earlier user so write-only params still gets the host data uploaded. The
+    // kernel only writes the first half here and the rest has to be what the host had.
+
+    SICOKernel kernel = scGetKernel(device, "tests/add_values.cl", "kern", "");
+    assert_non_null(kernel);
+
+    for (int i = 0; i < 1024; ++i)
+        res[i] = -1.0f;
+
+    SICOParam writeOnly[] =
+    {
+        { (uintptr_t)res, SICO_MEM_WRITE_ONLY, SICO_AutoAllocate, sizeof(res), 0 },
+        { (uintptr_t)a, SICO_MEM_READ_ONLY, SICO_AutoAllocate, sizeof(a), 0 },
+        { (uintptr_t)b, SICO_MEM_READ_ONLY, SICO_AutoAllocate, sizeof(b), 0 },
+    };
+
+    assert_int_equal(scSetupParameters(device, kernel, scGetThreadQueue(device), writeOnly, SICO_SIZEOF_ARRAY(writeOnly)), SICO_Ok);
+    assert_int_equal(scAddKernel1D(scGetThreadQueue(device), kernel, 512), SICO_Ok);
+    assert_int_equal(scWriteMemoryParams(device, scGetThreadQueue(device), writeOnly, SICO_SIZEOF_ARRAY(writeOnly)), SICO_Ok);
+    scFreeParams(writeOnly, SICO_SIZEOF_ARRAY(writeOnly));
+
+    for (int i = 0; i < 1024; ++i)
+        assert_true(res[i] == (i < 512 ? 0.0f : -1.0f));
+
+    // Buffers released while the queue is still busy with them must not be handed out again until it's done. The
+    // queue is held up by a user event so the commands can't complete before we check (the params are
+    // uninitialized so setting them up doesn't wait for uploads on the held up queue).
+
+    cl_int error;
+    cl_context context = 0;
+    SICOCommanQueue queue = scCreateCommandQueue(device);
+    clGetCommandQueueInfo((cl_command_queue)queue, CL_QUEUE_CONTEXT, sizeof(context), &context, 0);
+    cl_event gate = clCreateUserEvent(context, &error);
+    assert_non_null(gate);
+    assert_int_equal(clEnqueueMarkerWithWaitList((cl_command_queue)queue, 1, &gate, 0), CL_SUCCESS);
+
+    SICOParam params[] =
+    {
+        { (uintptr_t)res, SICO_MEM_WRITE_ONLY, SICO_Uninitialized, sizeof(res), 0 },
+        { (uintptr_t)a, SICO_MEM_WRITE_ONLY, SICO_Uninitialized, sizeof(a), 0 },
+        { (uintptr_t)b, SICO_MEM_WRITE_ONLY, SICO_Uninitialized, sizeof(b), 0 },
+    };
+
+    SICOParam params2[SICO_SIZEOF_ARRAY(params)];
+    memcpy(params2, params, sizeof(params));
+
+    scGetBufferPoolStats(device, &first);
+    assert_int_equal(scSetupParameters(device, kernel, queue, params, SICO_SIZEOF_ARRAY(params)), SICO_Ok);
+    SICOHandle inFlight = scGetParamHandle(&params[0]);
+    scFreeParams(params, SICO_SIZEOF_ARRAY(params));
+    scGetBufferPoolStats(device, &second);
+
+    if (second.misses != first.misses || second.hits != first.hits)
+    {
+        assert_true(second.bytesPending > 0);
+        assert_int_equal(scSetupParameters(device, kernel, queue, params2, SICO_SIZEOF_ARRAY(params2)), SICO_Ok);
+
+        for (int i = 0; i < SICO_SIZEOF_ARRAY(params2); ++i)
+            assert_true(scGetParamHandle(&params2[i]) != inFlight);
+
+        scFreeParams(params2, SICO_SIZEOF_ARRAY(params2));
+    }
+
+    clSetUserEventStatus(gate, CL_COMPLETE);
+    scCommandQueueFinish(queue);
+    scGetBufferPoolStats(device, &second);
+    assert_int_equal(second.bytesPending, 0);
+
+    clReleaseEvent(gate);
+    scDestroyCommandQueue(queue);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_async_copy(void** state)
+{
+    (void)state;
+
+    int input[1024];
+    int output[1024];
+    SICOEvent events[2];
+
+    for (int i = 0; i < 1024; ++i)
+    {
+        input[i] = i;
+        output[i] = 0;
+    }
+
+    SICODevice device = scGetBestDevice();
+    SICOCommanQueue queue = scGetDeviceQueue(device);
+
+    SICOHandle handle = scAlloc(device, CL_MEM_READ_WRITE, sizeof(input), 0);
+    assert_non_null(handle);
+
+    events[0] = scAsyncCopyToDevice(queue, handle, 0, input, sizeof(input), 0, 0);
+    assert_non_null(events[0]);
+
+    events[1] = scAsyncCopyFromDevice(queue, output, handle, 0, sizeof(output), 1, &events[0]);
+    assert_non_null(events[1]);
+
+    assert_int_equal(scWaitEvents(events, 2), SICO_Ok);
+    assert_true(scIsEventComplete(events[1]));
+    assert_memory_equal(input, output, sizeof(input));
+
+    scReleaseEvent(events[0]);
+    scReleaseEvent(events[1]);
+    scFree(handle);
+
+    // scSetupParameters has uploaded everything when it returns so the host data can be reused at once, the async
+    // version needs the data until the kernel has run but the params can be freed before the readback is done
+
+    float a[1024], b[1024], res[1024];
+
+    for (int i = 0; i < 1024; ++i)
+    {
+        a[i] = (float)i;
+        b[i] = 1.0f;
+    }
+
+    SICOKernel kernel = scGetKernel(device, "tests/add_values.cl", "kern", "");
+    assert_non_null(kernel);
+
+    SICOParam params[] =
+    {
+        { (uintptr_t)res, SICO_MEM_WRITE_ONLY, SICO_AutoAllocate, sizeof(res), 0 },
+        { (uintptr_t)a, SICO_MEM_READ_ONLY, SICO_AutoAllocate, sizeof(a), 0 },
+        { (uintptr_t)b, SICO_MEM_READ_ONLY, SICO_AutoAllocate, sizeof(b), 0 },
+    };
+
+    cl_mem_flags flags = 0;
+
+    assert_int_equal(scSetupParameters(device, kernel, queue, params, SICO_SIZEOF_ARRAY(params)), SICO_Ok);
+    clGetMemObjectInfo((cl_mem)scGetParamHandle(&params[2]), CL_MEM_FLAGS, sizeof(flags), &flags, 0);
+
+    // buffers used in place (CPU devices) sees the new values
+
+    for (int i = 0; i < 1024; ++i)
+        b[i] = 100.0f;
+
+    assert_int_equal(scAddKernel1D(queue, kernel, 1024), SICO_Ok);
+    assert_int_equal(scWriteMemoryParams(device, queue, params, SICO_SIZEOF_ARRAY(params)), SICO_Ok);
+    scFreeParams(params, SICO_SIZEOF_ARRAY(params));
+
+    for (int i = 0; i < 1024; ++i)
+        assert_true(res[i] == (float)i + ((flags & CL_MEM_USE_HOST_PTR) ? 100.0f : 1.0f));
+
+    assert_int_equal(scSetupParametersAsync(device, kernel, queue, params, SICO_SIZEOF_ARRAY(params)), SICO_Ok);
+    assert_int_equal(scAddKernel1D(queue, kernel, 1024), SICO_Ok);
+    assert_int_equal(scWriteMemoryParamsAsync(device, queue, params, SICO_SIZEOF_ARRAY(params), &events[0]), SICO_Ok);
+    scFreeParams(params, SICO_SIZEOF_ARRAY(params));
+
+    assert_int_equal(scWaitEvents(events, 1), SICO_Ok);
+    scReleaseEvent(events[0]);
+
+    for (int i = 0; i < 1024; ++i)
+        assert_true(res[i] == (float)i + 100.0f);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Shared setup for the tests running tests/add_values.cl: result = a + b with a[i] = i and b[i] = bValue
+
+typedef struct AddFixture
+{
+    size_t count;
+    size_t dataSize;
+    float bValue;
+    float* a;
+    float* b;
+    float* result;
+    SICOParam params[3];
+} AddFixture;
+
+static void createAddFixture(AddFixture* fixture, size_t count, float bValue)
+{
+    fixture->count = count;
+    fixture->dataSize = sizeof(float) * count;
+    fixture->bValue = bValue;
+    fixture->a = (float*)malloc(fixture->dataSize);
+    fixture->b = (float*)malloc(fixture->dataSize);
+    fixture->result = (float*)malloc(fixture->dataSize);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        fixture->a[i] = (float)i;
+        fixture->b[i] = bValue;
+        fixture->result[i] = 0.0f;
+    }
+
+    SICOParam params[] =
+    {
+        { (uintptr_t)fixture->result, SICO_MEM_WRITE_ONLY, SICO_AutoAllocate, fixture->dataSize, 0 },
+        { (uintptr_t)fixture->a, SICO_MEM_READ_ONLY, SICO_AutoAllocate, fixture->dataSize, 0 },
+        { (uintptr_t)fixture->b, SICO_MEM_READ_ONLY, SICO_AutoAllocate, fixture->dataSize, 0 },
+    };
+
+    memcpy(fixture->params, params, sizeof(params));
+}
+
+// checks the first count results
+
+static void checkAddFixture(const AddFixture* fixture, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        assert_true(fabs(fixture->result[i] - ((float)i + fixture->bValue)) < FLT_EPSILON);
+}
+
+static void destroyAddFixture(AddFixture* fixture)
+{
+    free(fixture->a);
+    free(fixture->b);
+    free(fixture->result);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_stream_kernel(void** state)
+{
+    (void)state;
+
+    AddFixture fixture;
+    createAddFixture(&fixture, 100 * 1000 + 7, 10.0f);
+
+    SICODevice device = scGetBestDevice();
+    SICOKernel kernel = scGetKernel(device, "tests/add_values.cl", "kern", "");
+    assert_non_null(kernel);
+
+    // small chunks so we get a partial chunk at the end and all slots gets reused
+
+    SICOStreamConfig config = { 4096, 3 };
+
+    assert_int_equal(scStreamKernel1D(device, kernel, fixture.params, 3, fixture.count, &config), SICO_Ok);
+    checkAddFixture(&fixture, fixture.count);
+
+    destroyAddFixture(&fixture);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_zero_copy(void** state)
+{
+    (void)state;
+
+    int count = 4096;
+    size_t dataSize = sizeof(float) * (size_t)count;
+
+    float* inputData = (float*)scAllocHostAligned(dataSize);
+    float* inputData2 = (float*)scAllocHostAligned(dataSize);
+    float* dataRes = (float*)scAllocHostAligned(dataSize);
+
+    assert_int_equal((uintptr_t)inputData % SICO_HOST_ALIGNMENT, 0);
+
+    for (int i = 0; i < count; ++i)
+    {
+        inputData[i] = (float)i;
+        inputData2[i] = 1.0f;
+        dataRes[i] = 0.0f;
+    }
+
+    assert_int_equal(scRunKernel1DArraySimple(dataRes, inputData, inputData2, "tests/add_values.cl", (size_t)count, dataSize), SICO_Ok);
+
+    for (int i = 0; i < count; ++i)
+        assert_true(fabs(dataRes[i] - ((float)i + 1.0f)) < FLT_EPSILON);
+
+    // Mapped buffer round trip
+
+    SICODevice device = scGetBestDevice();
+    SICOCommanQueue queue = scGetDeviceQueue(device);
+    SICOHandle handle = scAllocHostMapped(device, CL_MEM_READ_WRITE, dataSize);
+    assert_non_null(handle);
+
+    float* mapped = (float*)scMapBuffer(queue, handle, SICO_MAP_WRITE, 0, dataSize);
+    assert_non_null(mapped);
+    memcpy(mapped, inputData, dataSize);
+    assert_int_equal(scUnmapBuffer(queue, handle, mapped), SICO_Ok);
+
+    mapped = (float*)scMapBuffer(queue, handle, SICO_MAP_READ, 0, dataSize);
+    assert_non_null(mapped);
+    assert_memory_equal(mapped, inputData, dataSize);
+    assert_int_equal(scUnmapBuffer(queue, handle, mapped), SICO_Ok);
+
+    scCommandQueueFinish(queue);
+    scFree(handle);
+
+    scFreeHostAligned(inputData);
+    scFreeHostAligned(inputData2);
+    scFreeHostAligned(dataRes);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_multi_device(void** state)
+{
+    (void)state;
+
+    int deviceCount = 0;
+    float weights[16];
+
+    AddFixture fixture;
+    createAddFixture(&fixture, 64 * 1024 + 3, 2.0f);
+
+    SICODevice* devices = scGetAllDevices(&deviceCount);
+    SICOMultiKernel multi = scCreateMultiKernel(devices, deviceCount, "tests/add_values.cl", "kern", "", SICO_SplitAdaptive);
+    assert_non_null(multi);
+
+    // run a few times so the adaptive split gets to rebalance
+
+    for (int run = 0; run < 3; ++run)
+    {
+        memset(fixture.result, 0, fixture.dataSize);
+
+        assert_int_equal(scRunMultiKernel(multi, 1, &fixture.count, fixture.params, 3), SICO_Ok);
+        checkAddFixture(&fixture, fixture.count);
+    }
+
+    float total = 0.0f;
+    int weightCount = scGetMultiKernelWeights(multi, weights);
+
+    for (int i = 0; i < weightCount; ++i)
+        total += weights[i];
+
+    assert_true(fabs(total - 1.0f) < 0.001f);
+
+    scDestroyMultiKernel(multi);
+    destroyAddFixture(&fixture);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_profiling(void** state)
+{
+    (void)state;
+
+    SICOProfileStats stats[16];
+    int foundKernel = 0, foundCompile = 0;
+
+    AddFixture fixture;
+    createAddFixture(&fixture, 4096, 1.0f);
+
+    scSetProfiling(1);
+    scProfilingReset();
+
+    SICODevice device = scGetBestDevice();
+    SICOCommanQueue queue = scCreateCommandQueue(device);
+    SICOKernel kernel = scCompileKernelFromSourceFile(device, "tests/add_values.cl", "kern", "");
+    assert_non_null(kernel);
+
+    assert_int_equal(scSetupParameters(device, kernel, queue, fixture.params, 3), SICO_Ok);
+    assert_int_equal(scAddKernel1D(queue, kernel, fixture.count), SICO_Ok);
+    assert_int_equal(scWriteMemoryParams(device, queue, fixture.params, 3), SICO_Ok);
+    scCommandQueueFinish(queue);
+    checkAddFixture(&fixture, fixture.count);
+
+    int statsCount = scGetProfileStats(stats, 16);
+
+    for (int i = 0; i < statsCount && i < 16; ++i)
+    {
+        assert_true(stats[i].count > 0);
+        assert_true(stats[i].minMs <= stats[i].p50Ms && stats[i].p50Ms <= stats[i].maxMs);
+
+        if (stats[i].type == SICO_ProfileKernel && !strcmp(stats[i].name, "kern"))
+            foundKernel = 1;
+        else if (stats[i].type == SICO_ProfileCompile)
+            foundCompile = 1;
+    }
+
+    assert_true(foundKernel);
+    assert_true(foundCompile);
+
+    scSetProfiling(0);
+    scProfilingReset();
+
+    scFreeParams(fixture.params, 3);
+    scReleaseKernel(kernel);
+    scDestroyCommandQueue(queue);
+
+    destroyAddFixture(&fixture);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_thread_queues(void** state)
+{
+    (void)state;
+
+    SICODevice device = scGetBestDevice();
+
+    // calling scInitialize again is a no-op
+
+    assert_int_equal(scInitialize(), 1);
+
+    SICOCommanQueue queue = scGetThreadQueue(device);
+    assert_non_null(queue);
+    assert_true(scGetThreadQueue(device) == queue);
+    assert_true(scGetDeviceQueue(device) != queue);
+
+    scReleaseThreadQueues();
+
+    // a new queue is created after release
+
+    assert_non_null(scGetThreadQueue(device));
+    scReleaseThreadQueues();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_launch(void** state)
+{
+    (void)state;
+
+    AddFixture fixture;
+    createAddFixture(&fixture, 4096, 1.0f);
+
+    SICODevice device = scGetBestDevice();
+    SICOCommanQueue queue = scGetThreadQueue(device);
+    SICOKernel kernel = scGetKernel(device, "tests/add_values.cl", "kern", "");
+    assert_non_null(kernel);
+
+    SICOLaunch launch = scCreateLaunch(device, kernel, fixture.params, 3);
+    assert_non_null(launch);
+
+    assert_int_equal(scLaunchDispatch(launch, queue, 1, &fixture.count, 0), SICO_Ok);
+    assert_int_equal(scLaunchReadBack(launch, queue), SICO_Ok);
+    checkAddFixture(&fixture, fixture.count);
+
+    // change one input and dispatch again
+
+    fixture.bValue = 3.0f;
+
+    for (size_t i = 0; i < fixture.count; ++i)
+        fixture.b[i] = 3.0f;
+
+    scLaunchMarkDirty(launch, 2);
+
+    assert_int_equal(scLaunchDispatch(launch, queue, 1, &fixture.count, 0), SICO_Ok);
+    assert_int_equal(scLaunchReadBack(launch, queue), SICO_Ok);
+    checkAddFixture(&fixture, fixture.count);
+
+    scDestroyLaunch(launch);
+
+    // When another user sets the arguments of the kernel in between (here the scalar bounds argument) the launch
+    // has to set all of its arguments again even if its own values hasn't changed
+
+    SICOKernel boundsKernel = scGetKernel(device, "tests/add_values_bounds.cl", "kern", "");
+    assert_non_null(boundsKernel);
+
+    cl_uint bounds = (cl_uint)fixture.count / 2;
+
+    for (size_t i = 0; i < fixture.count; ++i)
+        fixture.result[i] = -1.0f;
+
+    SICOParam boundsParams[4];
+    SICOParam boundsParam = { (uintptr_t)&bounds, SICO_PARAMETER, SICO_AutoAllocate, sizeof(cl_uint), 0 };
+    memcpy(boundsParams, fixture.params, sizeof(fixture.params));
+    boundsParams[3] = boundsParam;
+
+    launch = scCreateLaunch(device, boundsKernel, boundsParams, 4);
+    assert_non_null(launch);
+    assert_int_equal(scLaunchDispatch(launch, queue, 1, &fixture.count, 0), SICO_Ok);
+
+    SICOParam otherParams[3];
+    memcpy(otherParams, fixture.params, sizeof(fixture.params));
+    assert_int_equal(scSetupParameters(device, boundsKernel, queue, otherParams, 3), SICO_Ok);
+    assert_int_equal(scAddKernel1DPadded(queue, boundsKernel, fixture.count, 0, 3), SICO_Ok);
+    scCommandQueueFinish(queue);
+    scFreeParams(otherParams, 3);
+
+    // new input values so the result of the first dispatch can't pass
+
+    fixture.bValue = 5.0f;
+
+    for (size_t i = 0; i < fixture.count; ++i)
+    {
+        fixture.b[i] = 5.0f;
+        fixture.result[i] = -1.0f;
+    }
+
+    scLaunchMarkDirty(launch, 2);
+
+    assert_int_equal(scLaunchDispatch(launch, queue, 1, &fixture.count, 0), SICO_Ok);
+    assert_int_equal(scLaunchReadBack(launch, queue), SICO_Ok);
+
+    checkAddFixture(&fixture, bounds);
+
+    for (size_t i = bounds; i < fixture.count; ++i)
+        assert_true(fixture.result[i] == -1.0f);
+
+    scDestroyLaunch(launch);
+    destroyAddFixture(&fixture);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_autotune(void** state)
+{
+    (void)state;
+
+    const char* tuneFile = "sico_autotune_test.txt";
+
+    AddFixture fixture;
+    createAddFixture(&fixture, 64 * 1024, 4.0f);
+
+    scSetAutotuneFile(tuneFile);
+
+    SICODevice device = scGetBestDevice();
+    SICOCommanQueue queue = scGetThreadQueue(device);
+    SICOKernel kernel = scGetKernel(device, "tests/add_values.cl", "kern", "");
+    assert_non_null(kernel);
+
+    assert_int_equal(scSetupParameters(device, kernel, queue, fixture.params, 3), SICO_Ok);
+    assert_int_equal(scAutotuneKernel(queue, kernel, 1, &fixture.count, 2), SICO_Ok);
+
+    // the tuned size is picked up by scAddKernel1D and the result has to be the same
+
+    assert_int_equal(scAddKernel1D(queue, kernel, fixture.count), SICO_Ok);
+    assert_int_equal(scWriteMemoryParams(device, queue, fixture.params, 3), SICO_Ok);
+    checkAddFixture(&fixture, fixture.count);
+
+    FILE* f = fopen(tuneFile, "r");
+    assert_non_null(f);
+    fclose(f);
+    remove(tuneFile);
+
+    scSetAutotuneFile(0);
+    scFreeParams(fixture.params, 3);
+
+    destroyAddFixture(&fixture);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Runs kernel over count items with one of the 1D launch variants and checks the result
+
+static void runAwkwardSize(AddFixture* fixture, SICOKernel kernel, size_t count, int padded)
+{
+    SICODevice device = scGetBestDevice();
+    SICOCommanQueue queue = scGetThreadQueue(device);
+
+    for (int i = 0; i < 3; ++i)
+        fixture->params[i].size = sizeof(float) * count;
+
+    memset(fixture->result, 0, fixture->dataSize);
+    assert_int_equal(scSetupParameters(device, kernel, queue, fixture->params, 3), SICO_Ok);
+
+    if (padded)
+        assert_int_equal(scAddKernel1DPadded(queue, kernel, count, 0, 3), SICO_Ok);
+    else
+        assert_int_equal(scAddKernel1DSplit(queue, kernel, count, 0), SICO_Ok);
+
+    assert_int_equal(scWriteMemoryParams(device, queue, fixture->params, 3), SICO_Ok);
+    scFreeParams(fixture->params, 3);
+
+    checkAddFixture(fixture, count);
+}
+
+static void sico_awkward_sizes(void** state)
+{
+    (void)state;
+
+    AddFixture fixture;
+    createAddFixture(&fixture, 1000003, 1.0f);
+
+    SICODevice device = scGetBestDevice();
+
+    // main + remainder launch
+
+    SICOKernel kernel = scGetKernel(device, "tests/add_values.cl", "kern", "");
+    assert_non_null(kernel);
+    runAwkwardSize(&fixture, kernel, fixture.count, 0);
+
+    // padded launch with bounds argument (the 4th argument is set by scAddKernel1DPadded)
+
+    SICOKernel boundsKernel = scGetKernel(device, "tests/add_values_bounds.cl", "kern", "");
+    assert_non_null(boundsKernel);
+    runAwkwardSize(&fixture, boundsKernel, fixture.count, 1);
+
+    // kernels with reqd_work_group_size runs as a single launch with the required size (1000000 isn't a multiple of
+    // the default local size so any other split would fail)
+
+    SICOKernel reqdKernel = scGetKernel(device, "tests/add_values_reqd.cl", "kern", "");
+    assert_non_null(reqdKernel);
+    runAwkwardSize(&fixture, reqdKernel, 1000000, 0);
+
+    destroyAddFixture(&fixture);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void readBuffer(SICOCommanQueue queue, void* dest, SICOHandle handle, size_t size)
+{
+    SICOEvent event = scAsyncCopyFromDevice(queue, dest, handle, 0, size, 0, 0);
+    assert_non_null(event);
+    assert_int_equal(scWaitEvents(&event, 1), SICO_Ok);
+    scReleaseEvent(event);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int compareUint(const void* a, const void* b)
+{
+    unsigned int ua = *(const unsigned int*)a;
+    unsigned int ub = *(const unsigned int*)b;
+    return (ua > ub) - (ua < ub);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_primitives(void** state)
+{
+    (void)state;
+
+    size_t count = 100003;
+    size_t dataSize = sizeof(unsigned int) * count;
+    unsigned int seed = 1234;
+
+    unsigned int* keys = (unsigned int*)malloc(dataSize);
+    unsigned int* values = (unsigned int*)malloc(dataSize);
+    unsigned int* result = (unsigned int*)malloc(dataSize);
+    unsigned int* result2 = (unsigned int*)malloc(dataSize);
+    int* signedData = (int*)malloc(dataSize);
+    float* floatData = (float*)malloc(dataSize);
+    float* floatResult = (float*)malloc(dataSize);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        keys[i] = seed;
+        values[i] = (unsigned int)i;
+        signedData[i] = (int)(i % 1000) - 500;
+        floatData[i] = 1.0f;
+    }
+
+    SICODevice device = scGetBestDevice();
+    SICOCommanQueue queue = scGetThreadQueue(device);
+
+    // reductions
+
+    SICOHandle signedHandle = scAllocSyncCopy(device, signedData, dataSize);
+    SICOHandle floatHandle = scAllocSyncCopy(device, floatData, dataSize);
+    SICOHandle resultHandle = scAlloc(device, SICO_MEM_READ_WRITE, dataSize, 0);
+    assert_non_null(signedHandle);
+    assert_non_null(floatHandle);
+    assert_non_null(resultHandle);
+
+    int intResult = 0;
+    long long expectedSum = 0;
+
+    for (size_t i = 0; i < count; ++i)
+        expectedSum += signedData[i];
+
+    assert_int_equal(scReduce(queue, SICO_Int32, SICO_ReduceSum, signedHandle, count, resultHandle), SICO_Ok);
+    readBuffer(queue, &intResult, resultHandle, sizeof(int));
+    assert_int_equal(intResult, (int)expectedSum);
+
+    assert_int_equal(scReduce(queue, SICO_Int32, SICO_ReduceMin, signedHandle, count, resultHandle), SICO_Ok);
+    readBuffer(queue, &intResult, resultHandle, sizeof(int));
+    assert_int_equal(intResult, -500);
+
+    assert_int_equal(scReduce(queue, SICO_Int32, SICO_ReduceMax, signedHandle, count, resultHandle), SICO_Ok);
+    readBuffer(queue, &intResult, resultHandle, sizeof(int));
+    assert_int_equal(intResult, 499);
+
+    // scans (1.0f values so the float results are exact)
+
+    assert_int_equal(scScan(queue, SICO_Float32, floatHandle, resultHandle, count, 1), SICO_Ok);
+    readBuffer(queue, floatResult, resultHandle, dataSize);
+
+    for (size_t i = 0; i < count; ++i)
+        assert_true(floatResult[i] == (float)(i + 1));
+
+    assert_int_equal(scScan(queue, SICO_Float32, floatHandle, floatHandle, count, 0), SICO_Ok);
+    readBuffer(queue, floatResult, floatHandle, dataSize);
+
+    for (size_t i = 0; i < count; ++i)
+        assert_true(floatResult[i] == (float)i);
+
+    // sorting
+
+    SICOHandle keysHandle = scAllocSyncCopy(device, keys, dataSize);
+    SICOHandle valuesHandle = scAllocSyncCopy(device, values, dataSize);
+
+    assert_int_equal(scSortPairs(queue, keysHandle, valuesHandle, count), SICO_Ok);
+    readBuffer(queue, result, keysHandle, dataSize);
+    readBuffer(queue, result2, valuesHandle, dataSize);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        assert_int_equal(result[i], keys[result2[i]]);
+
+        if (i > 0)
+            assert_true(result[i - 1] <= result[i]);
+    }
+
+    // keys only, with lots of duplicates
+
+    for (size_t i = 0; i < count; ++i)
+        values[i] = (unsigned int)(count - i) % 17;
+
+    scFree(keysHandle);
+    keysHandle = scAllocSyncCopy(device, values, dataSize);
+
+    assert_int_equal(scSortKeys(queue, keysHandle, count), SICO_Ok);
+    readBuffer(queue, result, keysHandle, dataSize);
+    qsort(values, count, sizeof(unsigned int), compareUint);
+    assert_memory_equal(result, values, dataSize);
+
+    // compaction, keep every third element
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        keys[i] = (unsigned int)i;
+        values[i] = i % 3 == 0 ? 7 : 0;
+    }
+
+    SICOHandle inputHandle = scAllocSyncCopy(device, keys, dataSize);
+    SICOHandle flagsHandle = scAllocSyncCopy(device, values, dataSize);
+    SICOHandle countHandle = scAlloc(device, SICO_MEM_READ_WRITE, sizeof(unsigned int), 0);
+    unsigned int compactCount = 0;
+
+    assert_int_equal(scCompact(queue, inputHandle, flagsHandle, resultHandle, count, countHandle), SICO_Ok);
+    readBuffer(queue, &compactCount, countHandle, sizeof(unsigned int));
+    readBuffer(queue, result, resultHandle, dataSize);
+
+    assert_int_equal(compactCount, (count + 2) / 3);
+
+    for (size_t i = 0; i < compactCount; ++i)
+        assert_int_equal(result[i], i * 3);
+
+    // histograms with few (local memory) and many bins, values outside the bins are ignored
+
+    for (size_t i = 0; i < count; ++i)
+        keys[i] = (unsigned int)(i % 300);
+
+    scFree(inputHandle);
+    inputHandle = scAllocSyncCopy(device, keys, dataSize);
+
+    int binCounts[] = { 256, 1000 };
+
+    for (int b = 0; b < 2; ++b)
+    {
+        int binCount = binCounts[b];
+
+        assert_int_equal(scHistogram(queue, inputHandle, count, resultHandle, binCount), SICO_Ok);
+        readBuffer(queue, result, resultHandle, sizeof(unsigned int) * (size_t)binCount);
+
+        for (int i = 0; i < binCount; ++i)
+        {
+            unsigned int expected = 0;
+
+            if (i < 300)
+                expected = (unsigned int)(count / 300 + ((size_t)i < count % 300 ? 1 : 0));
+
+            assert_int_equal(result[i], expected);
+        }
+    }
+
+    scFree(signedHandle);
+    scFree(floatHandle);
+    scFree(resultHandle);
+    scFree(keysHandle);
+    scFree(valuesHandle);
+    scFree(inputHandle);
+    scFree(flagsHandle);
+    scFree(countHandle);
+
+    free(keys);
+    free(values);
+    free(result);
+    free(result2);
+    free(signedData);
+    free(floatData);
+    free(floatResult);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_expr(void** state)
+{
+    (void)state;
+
+    size_t count = 10007;
+    size_t dataSize = sizeof(float) * count;
+
+    float* a = (float*)malloc(dataSize);
+    float* b = (float*)malloc(dataSize);
+    float* result = (float*)malloc(dataSize);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        a[i] = (float)(i % 100) * 0.25f;
+        b[i] = (float)(i % 7) - 3.0f;
+    }
+
+    SICODevice device = scGetBestDevice();
+    SICOCommanQueue queue = scGetThreadQueue(device);
+
+    SICOHandle aHandle = scAllocSyncCopy(device, a, dataSize);
+    SICOHandle bHandle = scAllocSyncCopy(device, b, dataSize);
+    SICOHandle outHandle = scAlloc(device, SICO_MEM_READ_WRITE, dataSize, 0);
+    assert_non_null(aHandle);
+    assert_non_null(bHandle);
+    assert_non_null(outHandle);
+
+    // sqrt(abs(a * 2 + b)) where b > 0, otherwise max(a, b)
+
+    SICOExprGraph graph = scExprCreate();
+    SICOExpr x = scExprInput(graph, aHandle);
+    SICOExpr y = scExprInput(graph, bHandle);
+    assert_int_equal(scExprInput(graph, aHandle), x);
+
+    SICOExpr t = scExprFma(graph, x, scExprConst(graph, 2.0f), y);
+    t = scExprUnary(graph, SICO_ExprSqrt, scExprUnary(graph, SICO_ExprAbs, t));
+    SICOExpr cond = scExprBinary(graph, SICO_ExprGreater, y, scExprConst(graph, 0.0f));
+    SICOExpr res = scExprSelect(graph, cond, t, scExprBinary(graph, SICO_ExprMax, x, y));
+    assert_true(res >= 0);
+
+    // bad arguments
+
+    assert_true(scExprUnary(graph, SICO_ExprAdd, x) < 0);
+    assert_true(scExprBinary(graph, SICO_ExprAdd, x, 1000) < 0);
+
+    assert_int_equal(scExprRun(queue, graph, res, outHandle, count), SICO_Ok);
+    readBuffer(queue, result, outHandle, dataSize);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        float expected = b[i] > 0.0f ? sqrtf(fabsf(a[i] * 2.0f + b[i])) : fmaxf(a[i], b[i]);
+        assert_true(fabsf(result[i] - expected) <= 1e-4f * (1.0f + fabsf(expected)));
+    }
+
+    // a second result that only uses b, running both again uses the source generated for each of them
+
+    SICOExpr scaled = scExprBinary(graph, SICO_ExprMul, y, scExprConst(graph, 3.0f));
+    assert_int_equal(scExprRun(queue, graph, scaled, outHandle, count), SICO_Ok);
+    assert_int_equal(scExprRun(queue, graph, res, outHandle, count), SICO_Ok);
+    assert_int_equal(scExprRun(queue, graph, scaled, outHandle, count), SICO_Ok);
+    readBuffer(queue, result, outHandle, dataSize);
+
+    for (size_t i = 0; i < count; ++i)
+        assert_true(fabsf(result[i] - b[i] * 3.0f) <= 1e-4f * (1.0f + fabsf(b[i] * 3.0f)));
+
+    scExprDestroy(graph);
+
+    scFree(aHandle);
+    scFree(bHandle);
+    scFree(outHandle);
+
+    free(a);
+    free(b);
+    free(result);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_resident(void** state)
+{
+    (void)state;
+
+    size_t count = 256 * 1024;
+    size_t dataSize = sizeof(float) * count;
+    SICOResidentStats stats;
+
+    float* data = (float*)malloc(dataSize);
+    float* result = (float*)malloc(dataSize);
+
+    for (size_t i = 0; i < count; ++i)
+        data[i] = (float)i;
+
+    SICODevice device = scGetBestDevice();
+    SICOCommanQueue queue = scGetThreadQueue(device);
+
+    for (int hashed = 0; hashed < 2; ++hashed)
+    {
+        SICOResident resident = scCreateResident(device, SICO_MEM_READ_ONLY, data, dataSize, hashed);
+        assert_non_null(resident);
+
+        // first sync uploads everything, the next one nothing
+
+        assert_int_equal(scResidentSync(queue, resident), SICO_Ok);
+        scGetResidentStats(resident, &stats);
+
+        // zero-copy buffers are never uploaded
+
+        if (stats.uploads != 0)
+        {
+            assert_true(stats.uploadedBytes == dataSize);
+
+            assert_int_equal(scResidentSync(queue, resident), SICO_Ok);
+            scGetResidentStats(resident, &stats);
+            assert_true(stats.uploadedBytes == dataSize);
+
+            data[1000] = -1.0f;
+            data[count - 1] = -2.0f;
+
+            // with hashing changes are found in 64 KB blocks, otherwise only the marked bytes are uploaded
+
+            if (!hashed)
+            {
+                scResidentMarkDirty(resident, 1000 * sizeof(float), sizeof(float));
+                scResidentMarkDirty(resident, (count - 1) * sizeof(float), 0);
+            }
+
+            assert_int_equal(scResidentSync(queue, resident), SICO_Ok);
+            scGetResidentStats(resident, &stats);
+            assert_true(stats.uploadedBytes == dataSize + (hashed ? 2 * 64 * 1024 : 2 * sizeof(float)));
+
+            // data written on the device is read back on request and isn't uploaded again on the next sync
+
+            float value = -5.0f;
+            SICOEvent event = scAsyncCopyToDevice(queue, scResidentHandle(resident), 2000 * sizeof(float), &value, sizeof(float), 0, 0);
+            assert_non_null(event);
+            assert_int_equal(scWaitEvents(&event, 1), SICO_Ok);
+            scReleaseEvent(event);
+
+            assert_int_equal(scResidentReadBack(queue, resident, 2000 * sizeof(float), sizeof(float)), SICO_Ok);
+            assert_true(data[2000] == -5.0f);
+
+            assert_int_equal(scResidentSync(queue, resident), SICO_Ok);
+            scGetResidentStats(resident, &stats);
+            assert_true(stats.uploadedBytes == dataSize + (hashed ? 2 * 64 * 1024 : 2 * sizeof(float)));
+
+            // a host change in the same block as the read (unmarked with hashing, marked and inside the read
+            // otherwise) isn't lost and reaches the device on the next sync
+
+            data[10] = -7.0f;
+
+            if (!hashed)
+                scResidentMarkDirty(resident, 10 * sizeof(float), sizeof(float));
+
+            assert_int_equal(scResidentReadBack(queue, resident, hashed ? 2000 * sizeof(float) : 0, 4096 * sizeof(float)), SICO_Ok);
+            assert_true(data[10] == -7.0f);
+            assert_int_equal(scResidentSync(queue, resident), SICO_Ok);
+        }
+
+        readBuffer(queue, result, scResidentHandle(resident), dataSize);
+        assert_memory_equal(result, data, dataSize);
+
+        scDestroyResident(resident);
+
+        data[10] = 10.0f;
+        data[1000] = 1000.0f;
+        data[2000] = 2000.0f;
+        data[count - 1] = (float)(count - 1);
+    }
+
+    free(data);
+    free(result);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_readback_control(void** state)
+{
+    (void)state;
+
+    const size_t width = 256, height = 64;
+    size_t count = width * height;
+    size_t dataSize = sizeof(float) * count;
+
+    float* inputData = (float*)malloc(dataSize);
+    float* dataRes = (float*)malloc(dataSize);
+    float* dataRes2 = (float*)malloc(dataSize);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        inputData[i] = (float)i;
+        dataRes[i] = -1.0f;
+        dataRes2[i] = -1.0f;
+    }
+
+    SICODevice device = scGetBestDevice();
+    SICOCommanQueue queue = scCreateCommandQueue(device);
+    SICOKernel kernel = scGetKernel(device, "tests/add_values.cl", "kern", "");
+    assert_non_null(kernel);
+
+    // output = input + input, left on the device
+
+    SICOParam params[] =
+    {
+        { (uintptr_t)dataRes, SICO_MEM_WRITE_ONLY, SICO_LeaveOnDevice, dataSize, 0 },
+        { (uintptr_t)inputData, SICO_MEM_READ_ONLY, SICO_AutoAllocate, dataSize, 0 },
+        { (uintptr_t)inputData, SICO_MEM_READ_ONLY, SICO_AutoAllocate, dataSize, 0 },
+    };
+
+    assert_int_equal(scSetupParameters(device, kernel, queue, params, SICO_SIZEOF_ARRAY(params)), SICO_Ok);
+    assert_int_equal(scAddKernel1D(queue, kernel, count), SICO_Ok);
+    assert_int_equal(scWriteMemoryParams(device, queue, params, SICO_SIZEOF_ARRAY(params)), SICO_Ok);
+
+    for (size_t i = 0; i < count; ++i)
+        assert_true(dataRes[i] == -1.0f);
+
+    // byte range and a 2D region of interest
+
+    SICORegion range = { { 100 * sizeof(float), 0, 0 }, { 50 * sizeof(float), 0, 0 }, 0, 0 };
+    SICORegion rect = { { 16 * sizeof(float), 10, 0 }, { 32 * sizeof(float), 5, 1 }, width * sizeof(float), 0 };
+
+    assert_int_equal(scReadParamRegion(queue, &params[0], &range, 1), SICO_Ok);
+    assert_int_equal(scReadParamRegion(queue, &params[0], &rect, 1), SICO_Ok);
+
+    for (size_t y = 0; y < height; ++y)
+    {
+        for (size_t x = 0; x < width; ++x)
+        {
+            size_t i = y * width + x;
+            int inRange = i >= 100 && i < 150;
+            int inRect = x >= 16 && x < 48 && y >= 10 && y < 15;
+            assert_true(dataRes[i] == ((inRange || inRect) ? (float)i * 2.0f : -1.0f));
+        }
+    }
+
+    SICORegion outside = { { 0, 60, 0 }, { 4, 10, 1 }, width * sizeof(float), 0 };
+    assert_int_equal(scReadParamRegion(queue, &params[0], &outside, 1), SICO_GeneralFail);
+
+    // feed the output to the next kernel without going through the host
+
+    SICOParam params2[] =
+    {
+        { (uintptr_t)dataRes2, SICO_MEM_WRITE_ONLY, SICO_AutoAllocate, dataSize, 0 },
+        { (uintptr_t)scGetParamHandle(&params[0]), SICO_MEM_READ_ONLY, SICO_UserSuppliedData, dataSize, 0 },
+        { (uintptr_t)inputData, SICO_MEM_READ_ONLY, SICO_AutoAllocate, dataSize, 0 },
+    };
+
+    assert_non_null(scGetParamHandle(&params[0]));
+    assert_int_equal(scSetupParameters(device, kernel, queue, params2, SICO_SIZEOF_ARRAY(params2)), SICO_Ok);
+    assert_int_equal(scAddKernel1D(queue, kernel, count), SICO_Ok);
+    assert_int_equal(scWriteMemoryParams(device, queue, params2, SICO_SIZEOF_ARRAY(params2)), SICO_Ok);
+
+    for (size_t i = 0; i < count; ++i)
+        assert_true(dataRes2[i] == (float)i * 3.0f);
+
+    scFreeParams(params2, SICO_SIZEOF_ARRAY(params2));
+    scFreeParams(params, SICO_SIZEOF_ARRAY(params));
+    scDestroyCommandQueue(queue);
+
+    free(inputData);
+    free(dataRes);
+    free(dataRes2);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_lazy_output(void** state)
+{
+    (void)state;
+
+    size_t count = 64 * 1024;
+    size_t dataSize = sizeof(float) * count;
+
+    float* inputData = (float*)malloc(dataSize);
+
+    for (size_t i = 0; i < count; ++i)
+        inputData[i] = (float)i;
+
+    SICODevice device = scGetBestDevice();
+    SICOCommanQueue queue = scCreateCommandQueue(device);
+    SICOKernel kernel = scGetKernel(device, "tests/add_values.cl", "kern", "");
+    assert_non_null(kernel);
+
+    SICOOutput stage1 = scCreateOutput(device, SICO_MEM_READ_WRITE, dataSize, 0);
+    SICOOutput stage2 = scCreateOutput(device, SICO_MEM_READ_WRITE, dataSize, 0);
+    assert_non_null(stage1);
+    assert_non_null(stage2);
+    assert_false(scOutputIsStale(stage1));
+
+    // stage1 = input + input, stage2 = stage1 + input (stage1 never leaves the device)
+
+    SICOParam params[] =
+    {
+        { (uintptr_t)stage1, SICO_MEM_WRITE_ONLY, SICO_Output, 0, 0 },
+        { (uintptr_t)inputData, SICO_MEM_READ_ONLY, SICO_AutoAllocate, dataSize, 0 },
+        { (uintptr_t)inputData, SICO_MEM_READ_ONLY, SICO_AutoAllocate, dataSize, 0 },
+    };
+
+    SICOParam params2[] =
+    {
+        { (uintptr_t)stage2, SICO_MEM_WRITE_ONLY, SICO_Output, 0, 0 },
+        { (uintptr_t)stage1, SICO_MEM_READ_ONLY, SICO_Output, 0, 0 },
+        { (uintptr_t)inputData, SICO_MEM_READ_ONLY, SICO_AutoAllocate, dataSize, 0 },
+    };
+
+    assert_int_equal(scSetupParameters(device, kernel, queue, params, SICO_SIZEOF_ARRAY(params)), SICO_Ok);
+    assert_int_equal(scAddKernel1D(queue, kernel, count), SICO_Ok);
+    assert_int_equal(scWriteMemoryParams(device, queue, params, SICO_SIZEOF_ARRAY(params)), SICO_Ok);
+    assert_true(scOutputIsStale(stage1));
+
+    assert_int_equal(scSetupParameters(device, kernel, queue, params2, SICO_SIZEOF_ARRAY(params2)), SICO_Ok);
+    assert_int_equal(scAddKernel1D(queue, kernel, count), SICO_Ok);
+    assert_int_equal(scWriteMemoryParams(device, queue, params2, SICO_SIZEOF_ARRAY(params2)), SICO_Ok);
+    assert_true(scOutputIsStale(stage2));
+
+    float* result = (float*)scAcquireHost(queue, stage2);
+    assert_non_null(result);
+    assert_false(scOutputIsStale(stage2));
+    assert_true(scOutputIsStale(stage1));
+    assert_true(scAcquireHost(queue, stage2) == result);
+
+    for (size_t i = 0; i < count; ++i)
+        assert_true(result[i] == (float)i * 3.0f);
+
+    result = (float*)scAcquireHost(queue, stage1);
+    assert_non_null(result);
+
+    for (size_t i = 0; i < count; ++i)
+        assert_true(result[i] == (float)i * 2.0f);
+
+    scFreeParams(params, SICO_SIZEOF_ARRAY(params));
+    scFreeParams(params2, SICO_SIZEOF_ARRAY(params2));
+    scDestroyOutput(queue, stage1);
+    scDestroyOutput(queue, stage2);
+    scDestroyCommandQueue(queue);
+
+    free(inputData);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_image(void** state)
+{
+    (void)state;
+
+    const size_t width = 64;
+    const size_t height = 32;
+    size_t count = width * height * 4;
+
+    SICODevice device = scGetBestDevice();
+
+    if (!scHasImageSupport(device))
+        return;
+
+    float* inputData = (float*)malloc(sizeof(float) * count);
+    float* outputData = (float*)malloc(sizeof(float) * count);
+
+    for (size_t i = 0; i < count; ++i)
+        inputData[i] = (float)(i & 255);
+
+    SICOCommanQueue queue = scCreateCommandQueue(device);
+    SICOKernel kernel = scGetKernel(device, "tests/scale_image.cl", "scale_image", "");
+    assert_non_null(kernel);
+
+    SICOImage input = scCreateImage2D(device, SICO_MEM_READ_ONLY, SICO_CHANNEL_RGBA, SICO_CHANNEL_FLOAT, width, height, 0, inputData);
+    SICOImage output = scCreateImage2D(device, SICO_MEM_WRITE_ONLY, SICO_CHANNEL_RGBA, SICO_CHANNEL_FLOAT, width, height, 0, outputData);
+    SICOSampler sampler = scCreateSampler(device, 0, SICO_ADDRESS_CLAMP_TO_EDGE, SICO_FILTER_NEAREST);
+    assert_non_null(input);
+    assert_non_null(output);
+    assert_non_null(sampler);
+
+    float scale = 2.0f;
+
+    SICOParam params[] =
+    {
+        { (uintptr_t)input, SICO_MEM_READ_ONLY, SICO_Image, 0, 0 },
+        { (uintptr_t)output, SICO_MEM_WRITE_ONLY, SICO_Image, 0, 0 },
+        { (uintptr_t)sampler, SICO_MEM_READ_ONLY, SICO_Sampler, 0, 0 },
+        { (uintptr_t)&scale, SICO_PARAMETER, SICO_AutoAllocate, sizeof(float), 0 },
+    };
+
+    assert_int_equal(scAddKernelImage(queue, device, kernel, output, params, SICO_SIZEOF_ARRAY(params)), SICO_Ok);
+
+    for (size_t i = 0; i < count; ++i)
+        assert_true(outputData[i] == inputData[i] * 2.0f);
+
+    // read back a single row through the region api
+
+    SICORegion region = { { 0, 5, 0 }, { width, 1, 0 }, 0, 0 };
+
+    memset(outputData, 0, sizeof(float) * count);
+    assert_int_equal(scReadImage(queue, output, &region, 1), SICO_Ok);
+
+    for (size_t i = 0; i < count; ++i)
+        assert_true(outputData[i] == (i / (width * 4) == 5 ? inputData[i] * 2.0f : 0.0f));
+
+    scFreeParams(params, SICO_SIZEOF_ARRAY(params));
+    scReleaseSampler(sampler);
+    scDestroyImage(input);
+    scDestroyImage(output);
+    scDestroyCommandQueue(queue);
+
+    free(inputData);
+    free(outputData);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void sico_arena(void** state)
+{
+    (void)state;
+
+    size_t count = 1024;
+    size_t dataSize = sizeof(float) * count;
+    SICOArenaStats stats;
+    SICOHandle handles[4];
+
+    float* inputData = (float*)malloc(dataSize);
+    float* outputData = (float*)malloc(dataSize);
+
+    for (size_t i = 0; i < count; ++i)
+        inputData[i] = (float)i;
+
+    SICODevice device = scGetBestDevice();
+    SICOCommanQueue queue = scCreateCommandQueue(device);
+    SICOKernel kernel = scGetKernel(device, "tests/add_values.cl", "kern", "");
+    assert_non_null(kernel);
+
+    // free list arena, freeing the middle allocations leaves a hole that is merged and reused
+
+    SICOArena arena = scCreateArena(device, SICO_MEM_READ_WRITE, 1024 * 1024, SICO_ArenaFreeList);
+    assert_non_null(arena);
+
+    for (int i = 0; i < 4; ++i)
+    {
+        handles[i] = scArenaAlloc(arena, dataSize);
+        assert_non_null(handles[i]);
+    }
+
+    scGetArenaStats(arena, &stats);
+    assert_int_equal(stats.allocations, 4);
+    assert_true(stats.used >= 4 * dataSize);
+    assert_true(stats.peak == stats.used);
+    assert_true(stats.fragmentation == 0.0f);
+
+    scArenaFree(arena, handles[1]);
+    scArenaFree(arena, handles[2]);
+
+    scGetArenaStats(arena, &stats);
+    assert_int_equal(stats.allocations, 2);
+    assert_true(stats.fragmentation > 0.0f);
+    assert_true(stats.peak > stats.used);
+
+    handles[1] = scArenaAlloc(arena, 2 * dataSize);
+    assert_non_null(handles[1]);
+    assert_null(scArenaAlloc(arena, 2 * 1024 * 1024));
+
+    scGetArenaStats(arena, &stats);
+    assert_int_equal(stats.failures, 1);
+    assert_true(stats.fragmentation == 0.0f);
+
+    // sub-buffers work as kernel arguments
+
+    handles[2] = scArenaAlloc(arena, dataSize);
+    assert_non_null(handles[2]);
+
+    SICOParam params[] =
+    {
+        { (uintptr_t)handles[3], SICO_MEM_WRITE_ONLY, SICO_UserSuppliedData, dataSize, 0 },
+        { (uintptr_t)handles[0], SICO_MEM_READ_ONLY, SICO_UserSuppliedData, dataSize, 0 },
+        { (uintptr_t)handles[2], SICO_MEM_READ_ONLY, SICO_UserSuppliedData, dataSize, 0 },
+    };
+
+    SICOEvent events[3];
+
+    events[0] = scAsyncCopyToDevice(queue, handles[0], 0, inputData, dataSize, 0, 0);
+    events[1] = scAsyncCopyToDevice(queue, handles[2], 0, inputData, dataSize, 0, 0);
+    assert_int_equal(scSetupParameters(device, kernel, queue, params, SICO_SIZEOF_ARRAY(params)), SICO_Ok);
+    assert_int_equal(scAddKernel1D(queue, kernel, count), SICO_Ok);
+    events[2] = scAsyncCopyFromDevice(queue, outputData, handles[3], 0, dataSize, 0, 0);
+    assert_int_equal(scWaitEvents(events, 3), SICO_Ok);
+
+    for (int i = 0; i < 3; ++i)
+        scReleaseEvent(events[i]);
+
+    for (size_t i = 0; i < count; ++i)
+        assert_true(outputData[i] == (float)i * 2.0f);
+
+    scFreeParams(params, SICO_SIZEOF_ARRAY(params));
+    scDestroyArena(arena);
+
+    // bump arena, everything is given back at once
+
+    arena = scCreateArena(device, SICO_MEM_READ_WRITE, 64 * 1024, SICO_ArenaBump);
+    assert_non_null(arena);
+
+    while (scArenaAlloc(arena, 1000))
+        ;
+
+    scGetArenaStats(arena, &stats);
+    assert_true(stats.allocations > 0);
+    assert_int_equal(stats.failures, 1);
+
+    scArenaReset(arena);
+
+    scGetArenaStats(arena, &stats);
+    assert_int_equal(stats.allocations, 0);
+    assert_true(stats.used == 0);
+    assert_true(stats.largestFree == stats.capacity);
+
+    scDestroyArena(arena);
+    scDestroyCommandQueue(queue);
+
+    free(inputData);
+    free(outputData);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
 int main()
 {
     const UnitTest tests[] =
     {
         unit_test(sico_init),
         unit_test(sico_get_devices),
+        unit_test(sico_device_policy),
         unit_test(sico_float_add_default_dev),
         unit_test(sico_alloc_free),
+        unit_test(sico_kernel_registry),
+        unit_test(sico_kernel_from_source),
+        unit_test(sico_specialization),
+        unit_test(sico_async_compile),
+        unit_test(sico_buffer_pool),
+        unit_test(sico_async_copy),
+        unit_test(sico_stream_kernel),
+        unit_test(sico_zero_copy),
+        unit_test(sico_multi_device),
+        unit_test(sico_profiling),
+        unit_test(sico_thread_queues),
+        unit_test(sico_launch),
+        unit_test(sico_autotune),
+        unit_test(sico_awkward_sizes),
+        unit_test(sico_primitives),
+        unit_test(sico_expr),
+        unit_test(sico_resident),
+        unit_test(sico_readback_control),
+        unit_test(sico_lazy_output),
+        unit_test(sico_image),
+        unit_test(sico_arena),
     };
 
     int ret = run_tests(tests);
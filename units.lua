@@ -11,10 +11,51 @@ DefRule {
 		OutName = { Required = false, Type = "string", Help = "Output filename", },
 	},
 
+	-- Output is a program binary container (see scLoadProgramFromBinaryFile)
+
+	Setup = function (env, data)
+		return {
+			InputFiles    = { data.Source },
+			OutputFiles   = { data.OutName or ("$(OBJECTDIR)/_generated/" .. data.Source .. ".scb") },
+		}
+	end,
+}
+
+-- Embeds the source as a C array (const unsigned char <name>_cl[] and const size_t <name>_cl_size) to be used
+-- with scCompileKernelFromSource/scGetKernelFromSource so no kernel files are read at runtime
+
+DefRule {
+	Name = "OpenCLEmbedSource",
+	Command = "$(OPENCL_COMPILER) --embed-source $(<) $(@)",
+
+	Blueprint = {
+		Source = { Required = true, Type = "string", Help = "Input filename", },
+		OutName = { Required = false, Type = "string", Help = "Output filename", },
+	},
+
+	Setup = function (env, data)
+		return {
+			InputFiles    = { data.Source },
+			OutputFiles   = { data.OutName or ("$(OBJECTDIR)/_generated/" .. data.Source .. ".src.c") },
+		}
+	end,
+}
+
+-- Same as OpenCLEmbedSource but embeds the program binary container (use with scLoadProgramFromBinary)
+
+DefRule {
+	Name = "OpenCLEmbedBinary",
+	Command = "$(OPENCL_COMPILER) --embed-binary $(<) $(@)",
+
+	Blueprint = {
+		Source = { Required = true, Type = "string", Help = "Input filename", },
+		OutName = { Required = false, Type = "string", Help = "Output filename", },
+	},
+
 	Setup = function (env, data)
 		return {
 			InputFiles    = { data.Source },
-			OutputFiles   = { "$(OBJECTDIR)/_generated/" .. data.Source .. ".temp" },
+			OutputFiles   = { data.OutName or ("$(OBJECTDIR)/_generated/" .. data.Source .. ".bin.c") },
 		}
 	end,
 }
@@ -31,7 +72,7 @@ StaticLibrary {
     },
 
     Propagate = {
-	Libs = { "OpenCL"; Config = "unix-*" },
+	Libs = { "OpenCL", "pthread"; Config = "unix-*" },
     },
 
     Sources = { "src/sico.c" },
@@ -127,7 +168,7 @@ Program {
     },
     Sources = { 
     	"examples/advanced/mandelbrot_fractal/mandelbrot_fractal.c" ,
-    	OpenCLCompile { Source = "examples/advanced/mandelbrot_fractal/mandelbrot_fractal.cl" },
+    	OpenCLEmbedSource { Source = "examples/advanced/mandelbrot_fractal/mandelbrot_fractal.cl" },
    	},
     Libs = { 
 		{ "OpenCL.lib", "kernel32.lib" ; Config = { "win32-*-*", "win64-*-*" } },
@@ -153,6 +194,17 @@ Program {
     Frameworks = { "OpenCL" },
 }
 
+------------------------------------------------
+
+Program {
+    Name = "sico_bench",
+    Env = { CPPPATH = { "src" }, },
+    Sources = { "bench/sico_bench.c" },
+    Libs = { { "OpenCL.lib", "kernel32.lib" ; Config = { "win32-*-*", "win64-*-*" } } },
+    Depends = { "sico" },
+    Frameworks = { "OpenCL" },
+}
+
 -------------- Programs ------------------------
 
 Program {
@@ -176,4 +228,5 @@ Default "show_devices"
 Default "add_floats"
 Default "mandelbrot_fractal"
 Default "tests"
+Default "sico_bench"
 Default "sicoc"